@@ -0,0 +1,22 @@
+# Compiles the CA certificate of the broker into the client, see MQTT_TLS in CMakeLists.txt.
+#
+# mqtt_tls_ca_header(<target> <pem file>) writes mqtt_tls_ca.h to the build directory, it defines
+# mqttTlsCaCert as the PEM text with its terminating nul, as mbedtls_x509_crt_parse() wants it.
+# The header is written again when the certificate changes.
+function(mqtt_tls_ca_header target pem)
+    if (NOT EXISTS "${pem}")
+        message(FATAL_ERROR "CA certificate ${pem} not found, set MQTT_TLS_CA_FILE")
+    endif ()
+    set_property(DIRECTORY APPEND PROPERTY CMAKE_CONFIGURE_DEPENDS "${pem}")
+
+    file(STRINGS "${pem}" lines)
+    set(body "")
+    foreach (line IN LISTS lines)
+        string(APPEND body "    \"${line}\\n\"\n")
+    endforeach ()
+
+    set(dir ${CMAKE_CURRENT_BINARY_DIR}/mqtt_tls)
+    file(GENERATE OUTPUT ${dir}/mqtt_tls_ca.h CONTENT
+            "// Generated from ${pem} by cmake/mqtt_tls_ca.cmake, do not edit\n#ifndef _MQTT_TLS_CA_H_\n#define _MQTT_TLS_CA_H_\n\nstatic const char mqttTlsCaCert[] =\n${body};\n\n#endif /* _MQTT_TLS_CA_H_ */\n")
+    target_include_directories(${target} PRIVATE ${dir})
+endfunction()
@@ -0,0 +1,30 @@
+#ifndef _ARCH_CC_H_
+#define _ARCH_CC_H_
+/** lwIP compiler and platform settings for the host build */
+/** Includes *************************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+
+/** Defines **************************************************************************************/
+#define LWIP_PLATFORM_DIAG(x) \
+    do                        \
+    {                         \
+        printf x;             \
+    } while (0)
+
+#define LWIP_PLATFORM_ASSERT(x)                                                            \
+    do                                                                                     \
+    {                                                                                      \
+        printf("Assertion \"%s\" failed at line %d in %s\n", x, __LINE__, __FILE__);      \
+        fflush(NULL);                                                                      \
+        abort();                                                                           \
+    } while (0)
+
+#define LWIP_RAND() ((u32_t)rand())
+
+/** Typedefs *************************************************************************************/
+
+/** lwIP only runs on the main loop thread, the protection is a no-op */
+typedef int sys_prot_t;
+
+#endif /* _ARCH_CC_H_ */
@@ -0,0 +1,8 @@
+#ifndef _HARDWARE_SYNC_H_
+#define _HARDWARE_SYNC_H_
+/** Functions ************************************************************************************/
+
+/** Wake a thread sleeping in best_effort_wfe_or_timeout() */
+void __sev(void);
+
+#endif /* _HARDWARE_SYNC_H_ */
@@ -0,0 +1,52 @@
+#ifndef _HOST_PLATFORM_H_
+#define _HOST_PLATFORM_H_
+/** Includes *************************************************************************************/
+#include <stdint.h>
+
+#include "lwip/netif.h"
+
+/** Defines **************************************************************************************/
+
+/** Defaults for the TAP interface, the host side of it is the gateway and runs the broker */
+#ifndef HOST_PLATFORM_TAP_NAME
+#define HOST_PLATFORM_TAP_NAME "tap0"
+#endif
+#ifndef HOST_PLATFORM_IP
+#define HOST_PLATFORM_IP "192.168.7.2"
+#endif
+#ifndef HOST_PLATFORM_NETMASK
+#define HOST_PLATFORM_NETMASK "255.255.255.0"
+#endif
+#ifndef HOST_PLATFORM_GATEWAY
+#define HOST_PLATFORM_GATEWAY "192.168.7.1"
+#endif
+
+/** Typedefs *************************************************************************************/
+
+/** Where the client sits on the TAP interface */
+typedef struct
+{
+    const char *tapName;
+    const char *ip;
+    const char *netmask;
+    const char *gateway;
+} HostPlatformConfig_t;
+
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+/** Functions ************************************************************************************/
+
+/**
+ * @brief Start lwIP on the TAP interface with a static address, stands in for wifi_init()
+ * @param config The interface settings
+ * @return int 0 on success, -1 on failure
+ */
+int host_platform_init(const HostPlatformConfig_t *config);
+
+/**
+ * @brief Get the lwIP interface of the TAP interface
+ * @return struct netif* The interface
+ */
+struct netif *host_platform_netif(void);
+
+#endif /* _HOST_PLATFORM_H_ */
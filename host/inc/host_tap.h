@@ -0,0 +1,36 @@
+#ifndef _HOST_TAP_H_
+#define _HOST_TAP_H_
+/** Includes *************************************************************************************/
+#include "lwip/err.h"
+#include "lwip/netif.h"
+
+/** Defines **************************************************************************************/
+/** Typedefs *************************************************************************************/
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+/** Functions ************************************************************************************/
+
+/**
+ * @brief lwIP init callback of an ethernet interface on a Linux TAP device
+ *
+ * Pass it to netif_add() with the name of the TAP device as the state. The device must exist
+ * and be owned by the user, e.g. ip tuntap add dev tap0 mode tap user $USER.
+ *
+ * @param netif The interface
+ * @return err_t ERR_OK on success, ERR_IF if the device could not be opened
+ */
+err_t host_tap_netif_init(struct netif *netif);
+
+/**
+ * @brief Hand the frames waiting on the device to lwIP, never blocks
+ * @param netif The interface
+ */
+void host_tap_poll(struct netif *netif);
+
+/**
+ * @brief Get the file descriptor of the device, to wait for frames
+ * @return int The descriptor, -1 if the device is not open
+ */
+int host_tap_fd(void);
+
+#endif /* _HOST_TAP_H_ */
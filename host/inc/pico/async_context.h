@@ -0,0 +1,30 @@
+#ifndef _PICO_ASYNC_CONTEXT_H_
+#define _PICO_ASYNC_CONTEXT_H_
+/** Host stand-in for the Pico SDK async context, only the when pending workers */
+/** Includes *************************************************************************************/
+#include <stdbool.h>
+
+/** Defines **************************************************************************************/
+/** Typedefs *************************************************************************************/
+typedef struct async_context async_context_t;
+
+typedef struct async_when_pending_worker
+{
+    struct async_when_pending_worker *next;
+    void (*do_work)(async_context_t *context, struct async_when_pending_worker *worker);
+    bool work_pending;
+    void *user_data;
+} async_when_pending_worker_t;
+
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+/** Functions ************************************************************************************/
+
+bool async_context_add_when_pending_worker(async_context_t *context, async_when_pending_worker_t *worker);
+
+/**
+ * @brief Mark the worker pending and wake the loop, safe from any thread
+ */
+void async_context_set_work_pending(async_context_t *context, async_when_pending_worker_t *worker);
+
+#endif /* _PICO_ASYNC_CONTEXT_H_ */
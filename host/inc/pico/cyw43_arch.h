@@ -0,0 +1,36 @@
+#ifndef _PICO_CYW43_ARCH_H_
+#define _PICO_CYW43_ARCH_H_
+/**
+ * Host stand-in for cyw43_arch in its poll mode. There is no radio, lwIP runs over the TAP
+ * interface set up by host_platform_init().
+ */
+/** Includes *************************************************************************************/
+#include "pico/async_context.h"
+#include "pico/stdlib.h"
+
+#include "lwip/ip_addr.h"
+#include "lwip/netif.h"
+
+/** Defines **************************************************************************************/
+/** Typedefs *************************************************************************************/
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+/** Functions ************************************************************************************/
+
+/**
+ * @brief Read the frames waiting on the TAP interface, run the lwIP timers and the pending workers
+ */
+void cyw43_arch_poll(void);
+
+/**
+ * @brief Sleep until the time, a frame arrives or a worker is marked pending
+ */
+void cyw43_arch_wait_for_work_until(absolute_time_t until);
+
+async_context_t *cyw43_arch_async_context(void);
+
+/** lwIP only ever runs on the thread of the main loop */
+static inline void cyw43_arch_lwip_begin(void) {}
+static inline void cyw43_arch_lwip_end(void) {}
+
+#endif /* _PICO_CYW43_ARCH_H_ */
@@ -0,0 +1,11 @@
+#ifndef _PICO_FLASH_H_
+#define _PICO_FLASH_H_
+/** Includes *************************************************************************************/
+#include <stdbool.h>
+
+/** Functions ************************************************************************************/
+
+/** The host store is in RAM, core 1 never has to be parked */
+static inline bool flash_safe_execute_core_init(void) { return true; }
+
+#endif /* _PICO_FLASH_H_ */
@@ -0,0 +1,8 @@
+#ifndef _PICO_MULTICORE_H_
+#define _PICO_MULTICORE_H_
+/** Functions ************************************************************************************/
+
+/** Core 1 is a thread on the host */
+void multicore_launch_core1(void (*entry)(void));
+
+#endif /* _PICO_MULTICORE_H_ */
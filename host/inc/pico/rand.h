@@ -0,0 +1,11 @@
+#ifndef _PICO_RAND_H_
+#define _PICO_RAND_H_
+/** Includes *************************************************************************************/
+#include <stdint.h>
+
+/** Functions ************************************************************************************/
+
+/** Random number from the kernel, see host_platform.c */
+uint32_t get_rand_32(void);
+
+#endif /* _PICO_RAND_H_ */
@@ -0,0 +1,50 @@
+#ifndef _PICO_STDLIB_H_
+#define _PICO_STDLIB_H_
+/**
+ * Host stand-in for the Pico SDK stdlib, only what the client logic uses.
+ * Time runs from the start of the process, see host_platform.c.
+ */
+/** Includes *************************************************************************************/
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** Defines **************************************************************************************/
+#define PICO_OK 0
+#define PICO_ERROR_GENERIC -1
+
+#ifndef __unused
+#define __unused __attribute__((unused))
+#endif
+
+/** Typedefs *************************************************************************************/
+typedef uint64_t absolute_time_t;
+
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+/** Functions ************************************************************************************/
+
+uint64_t time_us_64(void);
+void sleep_ms(uint32_t ms);
+void sleep_us(uint64_t us);
+void panic(const char *fmt, ...) __attribute__((noreturn, format(printf, 1, 2)));
+
+/**
+ * @brief Sleep until the time or an event sent with __sev(), like the WFE of core 1
+ * @return bool True if the time was reached
+ */
+bool best_effort_wfe_or_timeout(absolute_time_t timeout_timestamp);
+
+static inline uint32_t time_us_32(void) { return (uint32_t)time_us_64(); }
+static inline absolute_time_t get_absolute_time(void) { return time_us_64(); }
+static inline uint32_t to_ms_since_boot(absolute_time_t t) { return (uint32_t)(t / 1000u); }
+static inline uint64_t to_us_since_boot(absolute_time_t t) { return t; }
+static inline absolute_time_t from_us_since_boot(uint64_t us) { return us; }
+static inline absolute_time_t make_timeout_time_ms(uint32_t ms) { return time_us_64() + (uint64_t)ms * 1000u; }
+static inline void tight_loop_contents(void) {}
+static inline bool stdio_init_all(void) { return true; }
+
+#endif /* _PICO_STDLIB_H_ */
@@ -0,0 +1,76 @@
+/** Includes *************************************************************************************/
+#include "adc_sampler.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#include "pico/stdlib.h"
+
+/** Defines **************************************************************************************/
+
+/** Raw reading of the temperature sensor at 27 C, 0.706 V of 3.3 V on 12 bits */
+#define ADC_SAMPLER_HOST_RAW_27C 876
+
+/** Typedefs *************************************************************************************/
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+/** Functions ************************************************************************************/
+
+/**
+ * There is no ADC on the host, the sampler produces a steady 27 C reading every outputPeriodMs
+ * through the same queue so the application core runs unchanged.
+ */
+int adc_sampler_init(AdcSampler_t *sampler, const AdcSamplerConfig_t *config)
+{
+    if (sampler == NULL || config == NULL || config->outputPeriodMs == 0)
+    {
+        return -1;
+    }
+
+    memset(sampler, 0, sizeof(AdcSampler_t));
+    sampler->config = *config;
+    sampler->lastPollUs = time_us_64();
+
+    return ring_buffer_init(&sampler->queue, sampler->queueStorage, sizeof(sampler->queueStorage));
+}
+
+int adc_sampler_poll(AdcSampler_t *sampler)
+{
+    if (sampler == NULL)
+    {
+        return -1;
+    }
+
+    uint64_t periodUs = (uint64_t)sampler->config.outputPeriodMs * 1000u;
+    uint64_t nowUs = time_us_64();
+    while (nowUs - sampler->lastPollUs >= periodUs)
+    {
+        sampler->lastPollUs += periodUs;
+
+        const AdcSample_t sample = {
+            .sequence = sampler->sequence++,
+            .value = (uint32_t)ADC_SAMPLER_HOST_RAW_27C << sampler->config.extraBits,
+        };
+        sampler->stats.outputs++;
+
+        if (ring_buffer_free(&sampler->queue) < sizeof(sample))
+        {
+            sampler->stats.queueFull++;
+            continue;
+        }
+        ring_buffer_write(&sampler->queue, (const uint8_t *)&sample, sizeof(sample));
+    }
+
+    return 0;
+}
+
+bool adc_sampler_read(AdcSampler_t *sampler, AdcSample_t *sample)
+{
+    if (sampler == NULL || sample == NULL || ring_buffer_used(&sampler->queue) < sizeof(AdcSample_t))
+    {
+        return false;
+    }
+
+    ring_buffer_read(&sampler->queue, (uint8_t *)sample, sizeof(AdcSample_t));
+    return true;
+}
@@ -0,0 +1,783 @@
+/** Includes *************************************************************************************/
+#include "app_core.h"
+#include "histogram.h"
+#include "host_platform.h"
+#include "json_writer.h"
+#include "mqtt_client.h"
+#include "pool_stats.h"
+#include "scheduler.h"
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pico/cyw43_arch.h"
+#include "pico/stdlib.h"
+
+#include "lwip/altcp.h"
+
+#if MQTT_TLS
+#include "mqtt_tls_ca.h"
+#endif
+
+/** Defines **************************************************************************************/
+
+/** Send times are kept for this many sequence numbers, a power of two */
+#define BENCH_SEQ_WINDOW 65536
+
+/** The subscriber measuring the end to end latency has its own session on the broker */
+#define BENCH_SUBSCRIBER_ID CLIENT_ID "_bench"
+
+#define BENCH_CONNECT_TIMEOUT_MS 10000
+#define BENCH_DRAIN_TIMEOUT_MS 5000
+#define BENCH_RECONNECT_TIMEOUT_MS 120000
+#define BENCH_RECONNECT_HOLD_MS 1000
+
+/** Samples queued per loop when running flat out, bounds the time between two lwIP polls */
+#define BENCH_MAX_BURST 64
+
+/** Longest sleep of the loop while virtual devices are publishing */
+#define BENCH_DEVICE_TICK_US 10000u
+
+/** Typedefs *************************************************************************************/
+
+typedef struct
+{
+    HostPlatformConfig_t platform;
+    uint32_t durationS;
+    uint32_t ratePerS; /** Samples per second, 0 for as fast as the client takes them */
+    uint32_t reconnects;
+    uint32_t devices;        /** Virtual devices publishing next to the measured client */
+    uint32_t deviceRatePerS; /** Samples per second of each virtual device */
+} BenchConfig_t;
+
+/** A virtual device, a client with its own id and topics driven by the same loop */
+typedef struct
+{
+    MqttClientData_t client;
+    AppCore_t app;
+    uint32_t sent;
+} BenchDevice_t;
+
+/** Second client, subscribed to the topic the client publishes on */
+typedef struct
+{
+    mqtt_client_t *client;
+    mqtt_client_t instance; /** Not from the lwIP pools, like the one of MqttClientData_t */
+    struct mqtt_connect_client_info_t info;
+    bool connected;
+    bool subscribed;
+    char payload[PUBLISH_QUEUE_BATCH_SIZE + 1];
+    uint16_t len;
+    uint32_t received; /** Samples, a batch counts for each sample in it */
+    Histogram_t latencyUs;
+#if MQTT_TLS
+    MqttTls_t tls;
+#endif
+} BenchSubscriber_t;
+
+/** Completions of the QoS 1 publishes of the client, they have to arrive in publish order */
+typedef struct
+{
+    uint32_t acked;
+    uint32_t dropped;
+    uint32_t expired;
+    uint32_t outOfOrder;  /** Completions with an id below the previous one */
+    uint32_t lastId;
+    uint32_t retransmits; /** Attempts beyond the first */
+    Histogram_t doneUs;   /** First send to PUBACK, the retransmissions included */
+} BenchCompletions_t;
+
+typedef struct
+{
+    BenchConfig_t config;
+    MqttClientData_t client;
+    AppCore_t app;
+    BenchSubscriber_t subscriber;
+    BenchCompletions_t completions;
+    BenchDevice_t *devices;
+    uint32_t sent;
+    uint64_t sentUs[BENCH_SEQ_WINDOW];
+} Bench_t;
+
+/** Variables ************************************************************************************/
+static Bench_t Bench = {
+    .config = {
+        .platform = {
+            .tapName = HOST_PLATFORM_TAP_NAME,
+            .ip = HOST_PLATFORM_IP,
+            .netmask = HOST_PLATFORM_NETMASK,
+            .gateway = HOST_PLATFORM_GATEWAY,
+        },
+        .durationS = 10,
+        .ratePerS = 0,
+        .reconnects = 5,
+        .devices = 0,
+        .deviceRatePerS = 1,
+    },
+};
+
+/** Prototypes ***********************************************************************************/
+static int _bench_parse_args(int argc, char **argv);
+static int _bench_init_devices(const AdcSamplerConfig_t *samplerConfig);
+static int _bench_mqtt_task(void *arg);
+static void _bench_poll(uint64_t untilUs);
+static bool _bench_wait(bool (*done)(void), uint32_t timeoutMs);
+static bool _bench_online(void);
+static bool _bench_drained(void);
+static int _bench_produce(uint32_t count);
+static void _bench_produce_devices(uint64_t elapsedUs);
+static uint32_t _bench_device_pubacks(Histogram_t *pubackUs);
+static void _bench_connect_subscriber(void);
+static void _bench_sub_connection_cb(mqtt_client_t *client, void *arg, mqtt_connection_status_t status);
+static void _bench_sub_request_cb(void *arg, err_t err);
+static void _bench_sub_publish_cb(void *arg, const char *topic, u32_t tot_len);
+static void _bench_sub_data_cb(void *arg, const u8_t *data, u16_t len, u8_t flags);
+static void _bench_publish_done(void *arg, const MqttPublishHandle_t *handle);
+static void _bench_print_completions(void);
+static void _bench_print_histogram(const char *name, const Histogram_t *histogram);
+static void _bench_throughput(void);
+static void _bench_reconnects(void);
+
+/** Functions ************************************************************************************/
+
+int main(int argc, char **argv)
+{
+    if (_bench_parse_args(argc, argv) != 0)
+    {
+        return EXIT_FAILURE;
+    }
+
+    if (host_platform_init(&Bench.config.platform) != 0)
+    {
+        printf("Failed to bring up %s\n", Bench.config.platform.tapName);
+        return EXIT_FAILURE;
+    }
+
+    /** The measured client keeps its offline store, the virtual devices run without one */
+    FlashDevice_t storeDevice;
+    const MqttClientConfig_t clientConfig = {
+        .clientId = CLIENT_ID,
+        .serverIp = SERVER_IP,
+        .port = MQTT_PORT,
+        .store = flash_device_pico_init(&storeDevice) == 0 ? &storeDevice : NULL,
+#if MQTT_TLS
+        .caCert = (const uint8_t *)mqttTlsCaCert,
+        .caCertLen = sizeof(mqttTlsCaCert),
+        .serverName = MQTT_TLS_SERVER_NAME,
+#endif
+    };
+    if (mqtt_client_init(&Bench.client, &clientConfig) != 0 || scheduler_init() != 0)
+    {
+        printf("Failed to initialise the client\n");
+        return EXIT_FAILURE;
+    }
+    Bench.client.taskId = scheduler_add_task(_bench_mqtt_task, &Bench.client, MQTT_CLIENT_TASK_TIMEOUT_ms);
+    mqtt_client_set_publish_done(&Bench.client, _bench_publish_done, &Bench.completions);
+
+    /** The bench stands in for core 1 and queues the samples itself, the sampler is not started */
+    const AdcSamplerConfig_t samplerConfig = {
+        .input = ADC_SAMPLER_TEMP_INPUT,
+        .outputPeriodMs = MQTT_SAMPLE_INTERVAL_MS,
+        .extraBits = MQTT_SAMPLE_EXTRA_BITS,
+    };
+    if (app_core_init(&Bench.app, &samplerConfig, Bench.client.taskId) != 0)
+    {
+        printf("Failed to initialise the application queues\n");
+        return EXIT_FAILURE;
+    }
+    Bench.client.app = &Bench.app;
+
+    if (_bench_init_devices(&samplerConfig) != 0)
+    {
+        return EXIT_FAILURE;
+    }
+
+    _bench_connect_subscriber();
+
+    uint64_t startUs = time_us_64();
+    if (!_bench_wait(_bench_online, BENCH_CONNECT_TIMEOUT_MS))
+    {
+        printf("Could not reach the broker at %s:%d\n", SERVER_IP, MQTT_PORT);
+        return EXIT_FAILURE;
+    }
+    printf("Connected and subscribed in %llu ms, CONNECT to CONNACK %lu us\n", (unsigned long long)((time_us_64() - startUs) / 1000u),
+           (unsigned long)Bench.client.stats.lastConnectUs);
+
+    _bench_throughput();
+    _bench_reconnects();
+
+    /** Everything lwIP allocated came from the pools, the high water marks bound the RAM it ever used */
+    uint32_t poolBytes;
+    uint32_t peakBytes;
+    pool_stats_totals(&poolBytes, &peakBytes);
+    printf("lwIP pools %lu bytes, peak use at most %lu bytes\n", (unsigned long)poolBytes, (unsigned long)peakBytes);
+    PoolStats_t pool;
+    for (int i = 0; i < pool_stats_count(); i++)
+    {
+        if (pool_stats_get(i, &pool) == 0 && pool.err != 0)
+        {
+            printf("Pool %s ran out %lu times, max %u of %u\n", pool.name, (unsigned long)pool.err, pool.max, pool.avail);
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Read the command line
+ * @return int 0 on success, -1 on failure
+ */
+static int _bench_parse_args(int argc, char **argv)
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "i:a:d:r:c:n:l:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'i':
+            Bench.config.platform.tapName = optarg;
+            break;
+        case 'a':
+            Bench.config.platform.ip = optarg;
+            break;
+        case 'd':
+            Bench.config.durationS = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'r':
+            Bench.config.ratePerS = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'c':
+            Bench.config.reconnects = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'n':
+            Bench.config.devices = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'l':
+            Bench.config.deviceRatePerS = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        default:
+            printf("Usage: %s [-i tap] [-a address] [-d seconds] [-r samples per second, 0 flat out] [-c reconnects]"
+                   " [-n virtual devices] [-l samples per second of each device]\n",
+                   argv[0]);
+            return -1;
+        }
+    }
+
+    if (Bench.config.devices > BENCH_MAX_DEVICES)
+    {
+        printf("At most %d virtual devices, see BENCH_MAX_DEVICES in host/CMakeLists.txt\n", BENCH_MAX_DEVICES);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Set up the virtual devices, each one is a client of its own named CLIENT_ID "_<n>"
+ * @param samplerConfig Sampler settings of the application queues, the samplers are not started
+ * @return int 0 on success, -1 on failure
+ */
+static int _bench_init_devices(const AdcSamplerConfig_t *samplerConfig)
+{
+    if (Bench.config.devices == 0)
+    {
+        return 0;
+    }
+
+    Bench.devices = calloc(Bench.config.devices, sizeof(BenchDevice_t));
+    if (Bench.devices == NULL)
+    {
+        printf("No memory for %lu virtual devices\n", (unsigned long)Bench.config.devices);
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < Bench.config.devices; i++)
+    {
+        BenchDevice_t *device = &Bench.devices[i];
+
+        char clientId[MQTT_CLIENT_ID_LEN];
+        snprintf(clientId, sizeof(clientId), "%s_%lu", CLIENT_ID, (unsigned long)i);
+        const MqttClientConfig_t config = {
+            .clientId = clientId,
+            .serverIp = SERVER_IP,
+            .port = MQTT_PORT,
+            .store = NULL,
+#if MQTT_TLS
+            .caCert = (const uint8_t *)mqttTlsCaCert,
+            .caCertLen = sizeof(mqttTlsCaCert),
+            .serverName = MQTT_TLS_SERVER_NAME,
+#endif
+        };
+
+        if (mqtt_client_init(&device->client, &config) != 0)
+        {
+            printf("Failed to initialise %s\n", clientId);
+            return -1;
+        }
+        device->client.taskId = scheduler_add_task(_bench_mqtt_task, &device->client, MQTT_CLIENT_TASK_TIMEOUT_ms);
+        if (device->client.taskId == SCHEDULER_INVALID_TASK || app_core_init(&device->app, samplerConfig, device->client.taskId) != 0)
+        {
+            printf("Failed to register %s\n", clientId);
+            return -1;
+        }
+        device->client.app = &device->app;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Scheduler wrapper for the mqtt client task, the link is always up on the host
+ */
+static int _bench_mqtt_task(void *arg)
+{
+    return mqtt_client_task((MqttClientData_t *)arg);
+}
+
+/**
+ * @brief One turn of the main loop of the firmware
+ * @param untilUs Latest time to sleep until, the next task deadline may be earlier
+ */
+static void _bench_poll(uint64_t untilUs)
+{
+    cyw43_arch_poll();
+
+    uint64_t nextDeadlineUs = scheduler_run();
+    scheduler_wait_until(nextDeadlineUs < untilUs ? nextDeadlineUs : untilUs);
+}
+
+/**
+ * @brief Run the loop until the condition is met
+ * @param done The condition
+ * @param timeoutMs Time to give up after
+ * @return bool True if the condition was met
+ */
+static bool _bench_wait(bool (*done)(void), uint32_t timeoutMs)
+{
+    uint64_t deadlineUs = time_us_64() + (uint64_t)timeoutMs * 1000u;
+    while (!done())
+    {
+        if (time_us_64() >= deadlineUs)
+        {
+            return false;
+        }
+        _bench_poll(deadlineUs);
+    }
+
+    return true;
+}
+
+static bool _bench_online(void)
+{
+    for (uint32_t i = 0; i < Bench.config.devices; i++)
+    {
+        if (Bench.devices[i].client.taskState != MQTT_CLIENT_SUBSCRIBED)
+        {
+            return false;
+        }
+    }
+
+    return Bench.client.taskState == MQTT_CLIENT_SUBSCRIBED && Bench.subscriber.subscribed;
+}
+
+static bool _bench_drained(void)
+{
+    return Bench.subscriber.received >= Bench.sent;
+}
+
+/**
+ * @brief Queue samples for the client the way core 1 does, each one carries its sequence number
+ * @param count Samples to queue
+ * @return int Samples queued, fewer than count when the queue is full
+ */
+static int _bench_produce(uint32_t count)
+{
+    uint32_t queued = 0;
+    for (; queued < count; queued++)
+    {
+        uint8_t body[1 + APP_CORE_SAMPLE_LEN];
+        body[0] = (uint8_t)MQTT_FORMAT_JSON;
+
+        JsonWriter_t writer;
+        json_writer_init(&writer, (char *)&body[1], APP_CORE_SAMPLE_LEN);
+        json_writer_begin_object(&writer);
+        json_writer_key(&writer, "s");
+        json_writer_int(&writer, (int32_t)Bench.sent);
+        json_writer_end_object(&writer);
+        int len = json_writer_finish(&writer);
+
+        Bench.sentUs[Bench.sent & (BENCH_SEQ_WINDOW - 1)] = time_us_64();
+        if (len < 0 || msg_queue_push(&Bench.app.samples, APP_CORE_MSG_SAMPLE, MQTT_TOPIC_TEMP, body, (uint16_t)(1 + len)) != 0)
+        {
+            break;
+        }
+        Bench.sent++;
+    }
+
+    if (queued > 0)
+    {
+        scheduler_wake(Bench.client.taskId);
+    }
+
+    return (int)queued;
+}
+
+/**
+ * @brief Queue the samples of the virtual devices that are due
+ * @param elapsedUs Time since the start of the run
+ */
+static void _bench_produce_devices(uint64_t elapsedUs)
+{
+    uint64_t due = elapsedUs * Bench.config.deviceRatePerS / 1000000u + 1;
+
+    for (uint32_t i = 0; i < Bench.config.devices; i++)
+    {
+        BenchDevice_t *device = &Bench.devices[i];
+        if (due <= device->sent)
+        {
+            continue;
+        }
+
+        for (; device->sent < due; device->sent++)
+        {
+            uint8_t body[1 + APP_CORE_SAMPLE_LEN];
+            body[0] = (uint8_t)MQTT_FORMAT_JSON;
+
+            JsonWriter_t writer;
+            json_writer_init(&writer, (char *)&body[1], APP_CORE_SAMPLE_LEN);
+            json_writer_begin_object(&writer);
+            json_writer_key(&writer, "s");
+            json_writer_int(&writer, (int32_t)device->sent);
+            json_writer_end_object(&writer);
+            int len = json_writer_finish(&writer);
+
+            if (len < 0 || msg_queue_push(&device->app.samples, APP_CORE_MSG_SAMPLE, MQTT_TOPIC_TEMP, body, (uint16_t)(1 + len)) != 0)
+            {
+                break;
+            }
+        }
+        scheduler_wake(device->client.taskId);
+    }
+}
+
+/**
+ * @brief Add up the acknowledged publishes and the PUBACK latencies of the virtual devices
+ * @param pubackUs Filled with the latencies of all the devices
+ * @return uint32_t Publishes acknowledged
+ */
+static uint32_t _bench_device_pubacks(Histogram_t *pubackUs)
+{
+    uint32_t pubacks = 0;
+    histogram_reset(pubackUs);
+
+    for (uint32_t i = 0; i < Bench.config.devices; i++)
+    {
+        const MqttClientStats_t *stats = &Bench.devices[i].client.stats;
+        pubacks += stats->pubacks;
+
+        for (uint32_t b = 0; b < HISTOGRAM_BUCKETS; b++)
+        {
+            pubackUs->buckets[b] += stats->pubackUs.buckets[b];
+        }
+        pubackUs->count += stats->pubackUs.count;
+        pubackUs->sum += stats->pubackUs.sum;
+        if (stats->pubackUs.max > pubackUs->max)
+        {
+            pubackUs->max = stats->pubackUs.max;
+        }
+    }
+
+    return pubacks;
+}
+
+/**
+ * @brief Publish flat out or at the set rate and report the throughput and the latencies
+ */
+static void _bench_throughput(void)
+{
+    printf("Publishing for %lu s at %s\n", (unsigned long)Bench.config.durationS,
+           Bench.config.ratePerS == 0 ? "full speed" : "the set rate");
+
+    histogram_reset(&Bench.client.stats.pubackUs);
+    histogram_reset(&Bench.subscriber.latencyUs);
+    Bench.subscriber.received = 0;
+    Bench.sent = 0;
+    uint32_t pubacks = Bench.client.stats.pubacks;
+
+    Histogram_t devicePubackUs;
+    for (uint32_t i = 0; i < Bench.config.devices; i++)
+    {
+        histogram_reset(&Bench.devices[i].client.stats.pubackUs);
+        Bench.devices[i].sent = 0;
+    }
+    uint32_t devicePubacks = _bench_device_pubacks(&devicePubackUs);
+
+    uint64_t startUs = time_us_64();
+    uint64_t endUs = startUs + (uint64_t)Bench.config.durationS * 1000000u;
+    uint64_t nowUs;
+    while ((nowUs = time_us_64()) < endUs)
+    {
+        _bench_produce_devices(nowUs - startUs);
+
+        if (Bench.config.ratePerS == 0)
+        {
+            _bench_produce(BENCH_MAX_BURST);
+            _bench_poll(nowUs);
+        }
+        else
+        {
+            /** Catch up with the schedule, then sleep until the next sample is due */
+            uint64_t due = (nowUs - startUs) * Bench.config.ratePerS / 1000000u + 1;
+            if (due > Bench.sent)
+            {
+                _bench_produce((uint32_t)(due - Bench.sent));
+            }
+            uint64_t untilUs = startUs + (uint64_t)Bench.sent * 1000000u / Bench.config.ratePerS;
+            if (Bench.config.devices != 0 && untilUs > nowUs + BENCH_DEVICE_TICK_US)
+            {
+                untilUs = nowUs + BENCH_DEVICE_TICK_US;
+            }
+            _bench_poll(untilUs);
+        }
+    }
+
+    uint32_t acked = Bench.client.stats.pubacks - pubacks;
+    devicePubacks = _bench_device_pubacks(&devicePubackUs) - devicePubacks;
+    uint64_t elapsedUs = time_us_64() - startUs;
+
+    /** Let the last publishes come back through the broker */
+    _bench_wait(_bench_drained, BENCH_DRAIN_TIMEOUT_MS);
+
+    printf("Samples queued %lu, publishes acknowledged %lu, samples received %lu\n", (unsigned long)Bench.sent,
+           (unsigned long)acked, (unsigned long)Bench.subscriber.received);
+    printf("Publishes/s %.1f\n", (double)acked * 1000000.0 / (double)elapsedUs);
+    _bench_print_histogram("Publish to PUBACK", &Bench.client.stats.pubackUs);
+    _bench_print_histogram("End to end", &Bench.subscriber.latencyUs);
+    printf("Refused by lwIP %lu, timed out %lu, stored %lu\n", (unsigned long)Bench.client.stats.pubRefused,
+           (unsigned long)Bench.client.stats.pubTimeouts, (unsigned long)flash_log_pending(&Bench.client.store));
+
+    /** The samples the outbox held back waited in the queue of the application core */
+    OutboxQueueStats_t outbox;
+    outbox_get_stats(&Bench.client.outbox, OUTBOX_PRIORITY_NORMAL, &outbox);
+    printf("Outbox max depth %u of %u, timed out %lu, waited for lwIP %lu times\n", (unsigned)outbox.maxDepth,
+           (unsigned)MQTT_OUTBOX_NORMAL_DEPTH, (unsigned long)outbox.timeouts, (unsigned long)outbox.retries);
+    _bench_print_completions();
+
+    if (Bench.config.devices != 0)
+    {
+        printf("Virtual devices %lu, publishes acknowledged %lu, publishes/s %.1f\n", (unsigned long)Bench.config.devices,
+               (unsigned long)devicePubacks, (double)devicePubacks * 1000000.0 / (double)elapsedUs);
+        _bench_print_histogram("Virtual devices publish to PUBACK", &devicePubackUs);
+    }
+}
+
+/**
+ * @brief Drop the TCP connection of the client and time how long it takes to be back and subscribed
+ */
+static void _bench_reconnects(void)
+{
+    Histogram_t reconnectUs;
+    histogram_reset(&reconnectUs);
+
+    for (uint32_t i = 0; i < Bench.config.reconnects; i++)
+    {
+        /** Let the connection settle, the client may still be subscribing */
+        uint64_t holdUs = time_us_64() + (uint64_t)BENCH_RECONNECT_HOLD_MS * 1000u;
+        while (time_us_64() < holdUs)
+        {
+            _bench_poll(holdUs);
+        }
+        if (Bench.client.taskState != MQTT_CLIENT_SUBSCRIBED || Bench.client.mqttClientInst == NULL)
+        {
+            break;
+        }
+
+        /** An abort looks like the broker or the access point went away, lwIP reports it through the connection callback */
+        uint64_t startUs = time_us_64();
+        altcp_abort(Bench.client.mqttClientInst->conn);
+
+        if (!_bench_wait(_bench_online, BENCH_RECONNECT_TIMEOUT_MS))
+        {
+            printf("Reconnect %lu timed out\n", (unsigned long)i + 1);
+            break;
+        }
+
+        uint32_t totalUs = (uint32_t)(time_us_64() - startUs);
+        histogram_add(&reconnectUs, totalUs);
+#if MQTT_TLS
+        const char *handshake = Bench.client.tls.stats.lastResumed ? ", TLS resumed" : ", TLS full handshake";
+#else
+        const char *handshake = "";
+#endif
+        printf("Reconnect %lu: %lu ms, of which backoff %lu ms and CONNECT to CONNACK %lu us, session %s%s\n", (unsigned long)i + 1,
+               (unsigned long)(totalUs / 1000u), (unsigned long)Bench.client.backoff.delayMs, (unsigned long)Bench.client.stats.lastConnectUs,
+               Bench.client.sessionPresent ? "resumed" : "new", handshake);
+    }
+
+    _bench_print_histogram("Reconnect", &reconnectUs);
+#if MQTT_TLS
+    /** The first connect of the client is a full handshake, the reconnects resume its session when the broker kept it */
+    _bench_print_histogram("TLS full handshake, CONNECT to CONNACK", &Bench.client.tls.stats.fullUs);
+    _bench_print_histogram("TLS resumed session, CONNECT to CONNACK", &Bench.client.tls.stats.resumedUs);
+#endif
+    _bench_print_completions();
+}
+
+/**
+ * @brief Count the completion of a QoS 1 publish of the client and check its order
+ * @param arg The BenchCompletions_t
+ * @param handle The publish
+ */
+static void _bench_publish_done(void *arg, const MqttPublishHandle_t *handle)
+{
+    BenchCompletions_t *completions = (BenchCompletions_t *)arg;
+
+    if (handle->id <= completions->lastId)
+    {
+        completions->outOfOrder++;
+    }
+    completions->lastId = handle->id;
+
+    switch (handle->result)
+    {
+    case MQTT_PUBLISH_ACKED:
+        completions->acked++;
+        histogram_add(&completions->doneUs, (uint32_t)(handle->doneUs - handle->firstSentUs));
+        break;
+    case MQTT_PUBLISH_DROPPED:
+        completions->dropped++;
+        break;
+    default:
+        completions->expired++;
+        break;
+    }
+    if (handle->attempts > 1)
+    {
+        completions->retransmits += handle->attempts - 1u;
+    }
+}
+
+/**
+ * @brief Print the completions of the QoS 1 publishes since the start
+ */
+static void _bench_print_completions(void)
+{
+    const BenchCompletions_t *completions = &Bench.completions;
+    printf("Completions acknowledged %lu, dropped %lu, expired %lu, out of order %lu, retransmitted %lu\n",
+           (unsigned long)completions->acked, (unsigned long)completions->dropped, (unsigned long)completions->expired,
+           (unsigned long)completions->outOfOrder, (unsigned long)completions->retransmits);
+    _bench_print_histogram("First send to completion", &completions->doneUs);
+}
+
+/**
+ * @brief Print the count and the percentiles of a latency histogram
+ */
+static void _bench_print_histogram(const char *name, const Histogram_t *histogram)
+{
+    printf("%s: n %lu, p50 %lu us, p90 %lu us, p99 %lu us, max %lu us, mean %llu us\n", name, (unsigned long)histogram->count,
+           (unsigned long)histogram_percentile(histogram, 50), (unsigned long)histogram_percentile(histogram, 90),
+           (unsigned long)histogram_percentile(histogram, 99), (unsigned long)histogram->max,
+           histogram->count != 0 ? (unsigned long long)(histogram->sum / histogram->count) : 0ull);
+}
+
+/**
+ * @brief Connect the subscriber, it subscribes once the broker accepted it
+ */
+static void _bench_connect_subscriber(void)
+{
+    BenchSubscriber_t *subscriber = &Bench.subscriber;
+
+    subscriber->info.client_id = BENCH_SUBSCRIBER_ID;
+    subscriber->info.keep_alive = MQTT_KEEP_ALIVE_S;
+
+    ip_addr_t server;
+    if (!ipaddr_aton(SERVER_IP, &server))
+    {
+        panic("Failed to convert IP address %s", SERVER_IP);
+    }
+
+#if MQTT_TLS
+    if (mqtt_tls_init(&subscriber->tls, (const uint8_t *)mqttTlsCaCert, sizeof(mqttTlsCaCert), MQTT_TLS_SERVER_NAME) != 0)
+    {
+        panic("Failed to set up TLS for the subscriber");
+    }
+    subscriber->info.tls_config = subscriber->tls.config;
+#endif
+
+    subscriber->client = &subscriber->instance;
+    if (mqtt_client_connect(subscriber->client, &server, MQTT_PORT, _bench_sub_connection_cb, subscriber, &subscriber->info) != ERR_OK)
+    {
+        panic("MQTT broker connection error");
+    }
+#if MQTT_TLS
+    mqtt_tls_start(&subscriber->tls, subscriber->client->conn);
+#endif
+
+    /** The connect wipes the client, the callbacks go in afterwards */
+    mqtt_set_inpub_callback(subscriber->client, _bench_sub_publish_cb, _bench_sub_data_cb, subscriber);
+}
+
+static void _bench_sub_connection_cb(mqtt_client_t *client, void *arg, mqtt_connection_status_t status)
+{
+    BenchSubscriber_t *subscriber = (BenchSubscriber_t *)arg;
+
+    subscriber->connected = status == MQTT_CONNECT_ACCEPTED;
+    if (!subscriber->connected)
+    {
+        panic("Subscriber lost the broker, status %d", status);
+    }
+
+    mqtt_subscribe(client, MQTT_TEMPERATURE_TOPIC, MQTT_SUBSCRIBE_QOS, _bench_sub_request_cb, subscriber);
+}
+
+static void _bench_sub_request_cb(void *arg, err_t err)
+{
+    BenchSubscriber_t *subscriber = (BenchSubscriber_t *)arg;
+
+    if (err != ERR_OK)
+    {
+        panic("Subscriber failed to subscribe, err %d", err);
+    }
+    subscriber->subscribed = true;
+}
+
+static void _bench_sub_publish_cb(void *arg, const char *topic, u32_t tot_len)
+{
+    (void)topic;
+    (void)tot_len;
+
+    BenchSubscriber_t *subscriber = (BenchSubscriber_t *)arg;
+    subscriber->len = 0;
+}
+
+/**
+ * @brief Reassemble the publish and time every sample in it, a batch is an array of samples
+ */
+static void _bench_sub_data_cb(void *arg, const u8_t *data, u16_t len, u8_t flags)
+{
+    BenchSubscriber_t *subscriber = (BenchSubscriber_t *)arg;
+
+    uint16_t room = (uint16_t)(sizeof(subscriber->payload) - 1 - subscriber->len);
+    uint16_t copy = len < room ? len : room;
+    memcpy(&subscriber->payload[subscriber->len], data, copy);
+    subscriber->len += copy;
+
+    if ((flags & MQTT_DATA_FLAG_LAST) == 0)
+    {
+        return;
+    }
+
+    uint64_t nowUs = time_us_64();
+    subscriber->payload[subscriber->len] = '\0';
+    for (const char *sample = strstr(subscriber->payload, "\"s\":"); sample != NULL; sample = strstr(sample + 1, "\"s\":"))
+    {
+        uint32_t sequence = (uint32_t)strtoul(sample + 4, NULL, 10);
+        if (sequence < Bench.sent && Bench.sent - sequence <= BENCH_SEQ_WINDOW)
+        {
+            histogram_add(&subscriber->latencyUs, (uint32_t)(nowUs - Bench.sentUs[sequence & (BENCH_SEQ_WINDOW - 1)]));
+            subscriber->received++;
+        }
+    }
+}
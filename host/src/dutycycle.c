@@ -0,0 +1,336 @@
+/** Includes *************************************************************************************/
+#include "histogram.h"
+#include "mqtt_client.h"
+#include "power.h"
+#include "scheduler.h"
+
+#include <getopt.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pico/cyw43_arch.h"
+#include "pico/stdlib.h"
+
+/**
+ * Runs the scheduler and the duty cycle accounting of the firmware main loop against a
+ * simulated clock. Sleeping jumps the clock to the next deadline, so hours of operation take
+ * milliseconds. The wake-up sources are modelled on the firmware: the tasks of main.c with
+ * their periods, core 1 waking the client for every sample, and the lwIP timers, which run in
+ * the async context and are not rounded up to the slack.
+ */
+
+/** Defines **************************************************************************************/
+
+/** Periods of the firmware, see main.c and wifi.c */
+#define DUTYCYCLE_LED_MS 250
+#define DUTYCYCLE_WIFI_MS 500
+#define DUTYCYCLE_WIFI_POWER_SAVE_MS 5000
+
+/** lwIP timers while connected: TCP, DHCP fine, ARP and the MQTT cyclic timer */
+#define DUTYCYCLE_LWIP_TIMERS 4
+
+/** Typedefs *************************************************************************************/
+
+/** Index of the configurations in DutyCycleProfiles */
+typedef enum
+{
+    DUTYCYCLE_PROFILE_DEFAULT,
+    DUTYCYCLE_PROFILE_POWER_SAVE,
+    DUTYCYCLE_PROFILES
+} DutyCycleProfileId_t;
+
+/** A firmware configuration to compare */
+typedef struct
+{
+    const char *name;
+    uint32_t slackMs;
+    uint32_t ledMs; /** 0 when the LED task only runs once per cycle */
+    uint32_t wifiMs;
+    uint32_t maxIdleMs;
+} DutyCycleProfile_t;
+
+typedef struct
+{
+    uint32_t durationS;
+    uint32_t wakeUs;    /** CPU time of a wake-up with nothing to send */
+    uint32_t publishMs; /** Awake time of a publish, radio up until the PUBACK */
+    bool lwipTimers;    /** Model the lwIP timers, without them only the tasks wake the loop */
+} DutyCycleConfig_t;
+
+/** The simulated platform */
+typedef struct
+{
+    uint64_t nowUs;
+    bool wakePending;
+    int mqttTask;
+    uint64_t nextSampleUs;
+    uint64_t nextPublishUs;
+    uint64_t lwipDueUs[DUTYCYCLE_LWIP_TIMERS];
+    uint32_t publishes;
+    char context; /** Only its address is used */
+} DutyCycleSim_t;
+
+/** Variables ************************************************************************************/
+static const uint32_t DutyCycleLwipPeriodsMs[DUTYCYCLE_LWIP_TIMERS] = {250, 500, 1000, 5000};
+
+static const DutyCycleProfile_t DutyCycleProfiles[DUTYCYCLE_PROFILES] = {
+    [DUTYCYCLE_PROFILE_DEFAULT] = {"default", 0, DUTYCYCLE_LED_MS, DUTYCYCLE_WIFI_MS, SCHEDULER_MAX_IDLE_MS},
+    [DUTYCYCLE_PROFILE_POWER_SAVE] = {"power save", 100, 0, DUTYCYCLE_WIFI_POWER_SAVE_MS, 60000},
+};
+
+static DutyCycleConfig_t DutyCycle = {
+    .durationS = 3600,
+    .wakeUs = 50,
+    .publishMs = 30,
+    .lwipTimers = true,
+};
+
+static DutyCycleSim_t Sim;
+
+/** Prototypes ***********************************************************************************/
+static void _dutycycle_run(const DutyCycleProfile_t *profile, PowerStats_t *stats);
+static double _dutycycle_wakeups_per_cycle(const PowerStats_t *stats);
+static int _dutycycle_mqtt_task(void *arg);
+static int _dutycycle_periodic_task(void *arg);
+static void _dutycycle_external_events(void);
+
+/** Functions ************************************************************************************/
+
+int main(int argc, char **argv)
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "t:w:p:l:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 't':
+            DutyCycle.durationS = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'w':
+            DutyCycle.wakeUs = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'p':
+            DutyCycle.publishMs = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'l':
+            DutyCycle.lwipTimers = strtoul(optarg, NULL, 0) != 0;
+            break;
+        default:
+            printf("Usage: %s [-t simulated seconds] [-w us awake per wake-up] [-p ms awake per publish] [-l 0|1 lwIP timers]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    printf("Publish cycle %lu ms, sample every %lu ms, keep alive %u s, listen interval %u beacons\n",
+           (unsigned long)MQTT_PUBLISH_CYCLE_MS, (unsigned long)MQTT_SAMPLE_INTERVAL_MS,
+           power_keep_alive_s(MQTT_PUBLISH_CYCLE_MS, MQTT_KEEP_ALIVE_S), power_listen_interval(MQTT_PUBLISH_CYCLE_MS));
+
+    PowerStats_t stats[DUTYCYCLE_PROFILES];
+    for (int i = 0; i < DUTYCYCLE_PROFILES; i++)
+    {
+        _dutycycle_run(&DutyCycleProfiles[i], &stats[i]);
+    }
+
+    /**
+     * The point of the power save profile, checked by ctest. The TCP timer of lwIP wakes both
+     * profiles every 250 ms while connected and the task wake-ups land on it, so power save only
+     * has strictly fewer wake-ups without the lwIP timers.
+     */
+    const PowerStats_t *normal = &stats[DUTYCYCLE_PROFILE_DEFAULT];
+    const PowerStats_t *powerSave = &stats[DUTYCYCLE_PROFILE_POWER_SAVE];
+    double normalWakeups = _dutycycle_wakeups_per_cycle(normal);
+    double powerSaveWakeups = _dutycycle_wakeups_per_cycle(powerSave);
+    if (powerSave->cycles == 0 || powerSaveWakeups > normalWakeups || (!DutyCycle.lwipTimers && powerSaveWakeups >= normalWakeups))
+    {
+        printf("FAIL: power save wakes up %.1f times per cycle, the default %.1f\n", powerSaveWakeups, normalWakeups);
+        return EXIT_FAILURE;
+    }
+    if ((double)powerSave->awakeUs / (double)powerSave->elapsedUs >= (double)normal->awakeUs / (double)normal->elapsedUs)
+    {
+        printf("FAIL: power save is awake as much of the time as the default\n");
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ * @brief Run the main loop of the firmware for the set time and print the duty cycle
+ * @param profile The configuration to run
+ * @param stats Filled with the accounting of the run
+ */
+static void _dutycycle_run(const DutyCycleProfile_t *profile, PowerStats_t *stats)
+{
+    memset(&Sim, 0, sizeof(Sim));
+    Sim.nextSampleUs = (uint64_t)MQTT_SAMPLE_INTERVAL_MS * 1000u;
+    Sim.nextPublishUs = (uint64_t)MQTT_PUBLISH_CYCLE_MS * 1000u;
+    for (int i = 0; i < DUTYCYCLE_LWIP_TIMERS; i++)
+    {
+        Sim.lwipDueUs[i] = DutyCycle.lwipTimers ? (uint64_t)DutyCycleLwipPeriodsMs[i] * 1000u : UINT64_MAX;
+    }
+
+    scheduler_init();
+    scheduler_add_task(_dutycycle_periodic_task, NULL, profile->wifiMs);
+    scheduler_add_task(_dutycycle_periodic_task, NULL, profile->ledMs != 0 ? profile->ledMs : MQTT_PUBLISH_CYCLE_MS);
+    Sim.mqttTask = scheduler_add_task(_dutycycle_mqtt_task, NULL, profile->maxIdleMs);
+
+    Power_t power;
+    const PowerConfig_t powerConfig = {
+        .cycleMs = MQTT_PUBLISH_CYCLE_MS,
+        .slackMs = profile->slackMs,
+    };
+    power_init(&power, &powerConfig, time_us_64());
+
+    /** The loop of main.c */
+    uint64_t endUs = (uint64_t)DutyCycle.durationS * 1000000u;
+    while (time_us_64() < endUs)
+    {
+        cyw43_arch_poll();
+        uint64_t nextDeadlineUs = scheduler_run();
+        uint64_t wakeUs = power_sleep(&power, time_us_64(), nextDeadlineUs);
+        bool slept = scheduler_wait_until(wakeUs);
+        power_wake(&power, time_us_64(), slept);
+    }
+
+    power_get_stats(&power, stats);
+    printf("%s: %lu cycles, %lu publishes, %.1f wake-ups per cycle, awake per cycle p50 %lu us p99 %lu us max %lu ms, duty cycle %.3f %%\n",
+           profile->name, (unsigned long)stats->cycles, (unsigned long)Sim.publishes, _dutycycle_wakeups_per_cycle(stats),
+           (unsigned long)histogram_percentile(&stats->cycleAwakeUs, 50), (unsigned long)histogram_percentile(&stats->cycleAwakeUs, 99),
+           (unsigned long)stats->maxAwakeMs, stats->elapsedUs != 0 ? (double)stats->awakeUs * 100.0 / (double)stats->elapsedUs : 0.0);
+}
+
+/**
+ * @brief Average wake-ups of the main loop per publish cycle
+ * @param stats The accounting of a run
+ * @return double The wake-ups per cycle, 0 without a complete cycle
+ */
+static double _dutycycle_wakeups_per_cycle(const PowerStats_t *stats)
+{
+    return stats->cycles != 0 ? (double)stats->wakeups / stats->cycles : 0.0;
+}
+
+/**
+ * @brief The client, publishes once per cycle and otherwise only takes the sample
+ */
+static int _dutycycle_mqtt_task(void *arg)
+{
+    (void)arg;
+
+    if (Sim.nowUs >= Sim.nextPublishUs)
+    {
+        Sim.nowUs += (uint64_t)DutyCycle.publishMs * 1000u;
+        Sim.nextPublishUs += (uint64_t)MQTT_PUBLISH_CYCLE_MS * 1000u;
+        Sim.publishes++;
+    }
+    else
+    {
+        Sim.nowUs += DutyCycle.wakeUs;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief The Wi-Fi link check and the LED, nothing to do but the wake-up
+ */
+static int _dutycycle_periodic_task(void *arg)
+{
+    (void)arg;
+    Sim.nowUs += DutyCycle.wakeUs;
+
+    return 0;
+}
+
+/**
+ * @brief Run what is due outside of the scheduler: the lwIP timers and the samples of core 1
+ */
+static void _dutycycle_external_events(void)
+{
+    for (int i = 0; i < DUTYCYCLE_LWIP_TIMERS; i++)
+    {
+        while (Sim.lwipDueUs[i] != UINT64_MAX && Sim.lwipDueUs[i] <= Sim.nowUs)
+        {
+            Sim.lwipDueUs[i] += (uint64_t)DutyCycleLwipPeriodsMs[i] * 1000u;
+        }
+    }
+
+    while (Sim.nextSampleUs <= Sim.nowUs)
+    {
+        Sim.nextSampleUs += (uint64_t)MQTT_SAMPLE_INTERVAL_MS * 1000u;
+        scheduler_wake(Sim.mqttTask);
+    }
+}
+
+/** Simulated platform ***************************************************************************/
+
+uint64_t time_us_64(void)
+{
+    return Sim.nowUs;
+}
+
+void panic(const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    vprintf(fmt, args);
+    va_end(args);
+    exit(EXIT_FAILURE);
+}
+
+void cyw43_arch_poll(void)
+{
+    Sim.wakePending = false;
+    _dutycycle_external_events();
+}
+
+/**
+ * @brief Jump to the deadline or to the first event before it, the lwIP timers wake the loop too
+ */
+void cyw43_arch_wait_for_work_until(absolute_time_t until)
+{
+    if (Sim.wakePending)
+    {
+        return;
+    }
+
+    uint64_t wakeUs = until;
+    if (Sim.nextSampleUs < wakeUs)
+    {
+        wakeUs = Sim.nextSampleUs;
+    }
+    for (int i = 0; i < DUTYCYCLE_LWIP_TIMERS; i++)
+    {
+        if (Sim.lwipDueUs[i] < wakeUs)
+        {
+            wakeUs = Sim.lwipDueUs[i];
+        }
+    }
+
+    if (wakeUs > Sim.nowUs)
+    {
+        Sim.nowUs = wakeUs;
+    }
+
+    /** Running the lwIP timers is a wake-up of its own */
+    Sim.nowUs += DutyCycle.wakeUs;
+}
+
+async_context_t *cyw43_arch_async_context(void)
+{
+    return (async_context_t *)&Sim.context;
+}
+
+bool async_context_add_when_pending_worker(async_context_t *context, async_when_pending_worker_t *worker)
+{
+    (void)context;
+    (void)worker;
+    return true;
+}
+
+void async_context_set_work_pending(async_context_t *context, async_when_pending_worker_t *worker)
+{
+    (void)context;
+    (void)worker;
+    Sim.wakePending = true;
+}
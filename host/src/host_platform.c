@@ -0,0 +1,339 @@
+/** Includes *************************************************************************************/
+#include "host_platform.h"
+#include "host_tap.h"
+#include "flash_device.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/random.h>
+
+#include "pico/cyw43_arch.h"
+#include "pico/multicore.h"
+#include "pico/rand.h"
+#include "pico/stdlib.h"
+#include "hardware/sync.h"
+
+#include "lwip/init.h"
+#include "lwip/sys.h"
+#include "lwip/timeouts.h"
+#include "netif/ethernet.h"
+
+/** Defines **************************************************************************************/
+/** Typedefs *************************************************************************************/
+
+/** The single async context, the loop waits on the TAP device and on a pipe written by the workers */
+struct async_context
+{
+    async_when_pending_worker_t *workers;
+    int wakeFds[2]; /** Read end, write end */
+    volatile bool wakePending;
+};
+
+typedef struct
+{
+    struct netif netif;
+    struct async_context context;
+    uint64_t startUs; /** Boot time, time_us_64() counts from it */
+    pthread_mutex_t eventLock;
+    pthread_cond_t event; /** __sev() */
+    bool eventPending;
+    uint8_t store[FLASH_DEVICE_STORE_SIZE];
+    uint8_t settings[FLASH_DEVICE_SETTINGS_SIZE];
+} HostPlatform_t;
+
+/** Variables ************************************************************************************/
+static HostPlatform_t HostPlatform = {
+    .context = {.wakeFds = {-1, -1}},
+    .eventLock = PTHREAD_MUTEX_INITIALIZER,
+    .event = PTHREAD_COND_INITIALIZER,
+};
+
+/** Prototypes ***********************************************************************************/
+static uint64_t _host_platform_monotonic_us(void);
+static void *_host_platform_core1(void *arg);
+#if MQTT_TLS
+int mbedtls_hardware_poll(void *data, unsigned char *output, size_t len, size_t *olen);
+#endif
+
+/** Functions ************************************************************************************/
+
+int host_platform_init(const HostPlatformConfig_t *config)
+{
+    if (config == NULL)
+    {
+        return -1;
+    }
+
+    HostPlatform.startUs = _host_platform_monotonic_us();
+
+    if (pipe(HostPlatform.context.wakeFds) != 0 || fcntl(HostPlatform.context.wakeFds[0], F_SETFL, O_NONBLOCK) != 0 ||
+        fcntl(HostPlatform.context.wakeFds[1], F_SETFL, O_NONBLOCK) != 0)
+    {
+        printf("Failed to create the wake pipe: %s\n", strerror(errno));
+        return -1;
+    }
+
+    ip4_addr_t ip;
+    ip4_addr_t netmask;
+    ip4_addr_t gateway;
+    if (!ip4addr_aton(config->ip, &ip) || !ip4addr_aton(config->netmask, &netmask) || !ip4addr_aton(config->gateway, &gateway))
+    {
+        printf("Invalid interface address\n");
+        return -1;
+    }
+
+    lwip_init();
+    if (netif_add(&HostPlatform.netif, &ip, &netmask, &gateway, (void *)config->tapName, host_tap_netif_init, ethernet_input) == NULL)
+    {
+        return -1;
+    }
+    netif_set_default(&HostPlatform.netif);
+    netif_set_up(&HostPlatform.netif);
+    netif_set_link_up(&HostPlatform.netif);
+
+    printf("lwIP up on %s with address %s\n", config->tapName, config->ip);
+
+    return 0;
+}
+
+struct netif *host_platform_netif(void)
+{
+    return &HostPlatform.netif;
+}
+
+/** Time *****************************************************************************************/
+
+uint64_t time_us_64(void)
+{
+    return _host_platform_monotonic_us() - HostPlatform.startUs;
+}
+
+u32_t sys_now(void)
+{
+    return (u32_t)(time_us_64() / 1000u);
+}
+
+void sleep_us(uint64_t us)
+{
+    struct timespec ts = {
+        .tv_sec = (time_t)(us / 1000000u),
+        .tv_nsec = (long)(us % 1000000u) * 1000,
+    };
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR)
+    {
+    }
+}
+
+void sleep_ms(uint32_t ms)
+{
+    sleep_us((uint64_t)ms * 1000u);
+}
+
+void panic(const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    fprintf(stderr, "PANIC: ");
+    vfprintf(stderr, fmt, args);
+    fprintf(stderr, "\n");
+    va_end(args);
+
+    exit(EXIT_FAILURE);
+}
+
+#if MQTT_TLS
+/** Entropy source of mbedTLS, pico_mbedtls has the one of the firmware, see MBEDTLS_ENTROPY_HARDWARE_ALT */
+int mbedtls_hardware_poll(void *data, unsigned char *output, size_t len, size_t *olen)
+{
+    (void)data;
+
+    ssize_t got = getrandom(output, len, 0);
+    *olen = got > 0 ? (size_t)got : 0;
+
+    return got < 0 ? -1 : 0;
+}
+#endif
+
+uint32_t get_rand_32(void)
+{
+    uint32_t value;
+    if (getrandom(&value, sizeof(value), 0) != sizeof(value))
+    {
+        value = (uint32_t)_host_platform_monotonic_us() ^ (uint32_t)getpid();
+    }
+
+    return value;
+}
+
+/** lwIP only runs on the main loop thread */
+sys_prot_t sys_arch_protect(void)
+{
+    return 0;
+}
+
+void sys_arch_unprotect(sys_prot_t pval)
+{
+    (void)pval;
+}
+
+/** cyw43_arch and async context *****************************************************************/
+
+void cyw43_arch_poll(void)
+{
+    host_tap_poll(&HostPlatform.netif);
+    sys_check_timeouts();
+
+    /** Drain the pipe before running the workers so a wake during the run is not lost */
+    uint8_t drain[64];
+    while (read(HostPlatform.context.wakeFds[0], drain, sizeof(drain)) > 0)
+    {
+    }
+    __atomic_store_n(&HostPlatform.context.wakePending, false, __ATOMIC_SEQ_CST);
+
+    for (async_when_pending_worker_t *worker = HostPlatform.context.workers; worker != NULL; worker = worker->next)
+    {
+        if (__atomic_exchange_n(&worker->work_pending, false, __ATOMIC_SEQ_CST))
+        {
+            worker->do_work(&HostPlatform.context, worker);
+        }
+    }
+}
+
+void cyw43_arch_wait_for_work_until(absolute_time_t until)
+{
+    if (__atomic_load_n(&HostPlatform.context.wakePending, __ATOMIC_SEQ_CST))
+    {
+        return;
+    }
+
+    uint64_t nowUs = time_us_64();
+    if (until <= nowUs)
+    {
+        return;
+    }
+
+    /** Wake up for the next lwIP timer too, the client relies on them for its timeouts */
+    uint64_t timeoutMs = (until - nowUs + 999u) / 1000u;
+    uint32_t timerMs = sys_timeouts_sleeptime();
+    if (timerMs < timeoutMs)
+    {
+        timeoutMs = timerMs;
+    }
+
+    struct pollfd fds[2] = {
+        {.fd = host_tap_fd(), .events = POLLIN},
+        {.fd = HostPlatform.context.wakeFds[0], .events = POLLIN},
+    };
+    poll(fds, 2, (int)timeoutMs);
+}
+
+async_context_t *cyw43_arch_async_context(void)
+{
+    return &HostPlatform.context;
+}
+
+bool async_context_add_when_pending_worker(async_context_t *context, async_when_pending_worker_t *worker)
+{
+    if (context == NULL || worker == NULL)
+    {
+        return false;
+    }
+
+    worker->next = context->workers;
+    context->workers = worker;
+
+    return true;
+}
+
+void async_context_set_work_pending(async_context_t *context, async_when_pending_worker_t *worker)
+{
+    __atomic_store_n(&worker->work_pending, true, __ATOMIC_SEQ_CST);
+
+    /** One byte is enough to end the poll, the rest would only fill the pipe */
+    if (!__atomic_exchange_n(&context->wakePending, true, __ATOMIC_SEQ_CST))
+    {
+        uint8_t byte = 0;
+        (void)write(context->wakeFds[1], &byte, 1);
+    }
+}
+
+/** Core 1 ***************************************************************************************/
+
+void multicore_launch_core1(void (*entry)(void))
+{
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, _host_platform_core1, (void *)entry) != 0)
+    {
+        panic("Failed to start core 1");
+    }
+    pthread_detach(thread);
+}
+
+void __sev(void)
+{
+    pthread_mutex_lock(&HostPlatform.eventLock);
+    HostPlatform.eventPending = true;
+    pthread_cond_broadcast(&HostPlatform.event);
+    pthread_mutex_unlock(&HostPlatform.eventLock);
+}
+
+bool best_effort_wfe_or_timeout(absolute_time_t timeout_timestamp)
+{
+    /** pthread_cond_timedwait() takes an absolute CLOCK_REALTIME time */
+    uint64_t nowUs = time_us_64();
+    uint64_t waitUs = timeout_timestamp > nowUs ? timeout_timestamp - nowUs : 0;
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    uint64_t ns = (uint64_t)deadline.tv_nsec + waitUs * 1000u;
+    deadline.tv_sec += (time_t)(ns / 1000000000u);
+    deadline.tv_nsec = (long)(ns % 1000000000u);
+
+    pthread_mutex_lock(&HostPlatform.eventLock);
+    while (!HostPlatform.eventPending && pthread_cond_timedwait(&HostPlatform.event, &HostPlatform.eventLock, &deadline) == 0)
+    {
+    }
+    HostPlatform.eventPending = false;
+    pthread_mutex_unlock(&HostPlatform.eventLock);
+
+    return time_us_64() >= timeout_timestamp;
+}
+
+/** Flash ****************************************************************************************/
+
+int flash_device_pico_init(FlashDevice_t *device)
+{
+    return flash_device_ram_init(device, HostPlatform.store, sizeof(HostPlatform.store));
+}
+
+int flash_device_pico_settings_init(FlashDevice_t *device)
+{
+    return flash_device_ram_init(device, HostPlatform.settings, sizeof(HostPlatform.settings));
+}
+
+/**
+ * @brief Monotonic time in microseconds, from an arbitrary origin
+ */
+static uint64_t _host_platform_monotonic_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+/**
+ * @brief pthread entry of core 1
+ */
+static void *_host_platform_core1(void *arg)
+{
+    void (*entry)(void) = (void (*)(void))arg;
+    entry();
+
+    return NULL;
+}
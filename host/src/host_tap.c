@@ -0,0 +1,128 @@
+/** Includes *************************************************************************************/
+#include "host_tap.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <linux/if.h>
+#include <linux/if_tun.h>
+
+#include "lwip/etharp.h"
+#include "lwip/pbuf.h"
+#include "netif/ethernet.h"
+
+#include "pico/rand.h"
+
+/** Defines **************************************************************************************/
+#define HOST_TAP_MTU 1500
+#define HOST_TAP_FRAME_SIZE (HOST_TAP_MTU + SIZEOF_ETH_HDR)
+
+/** Typedefs *************************************************************************************/
+typedef struct
+{
+    int fd;
+} HostTap_t;
+
+/** Variables ************************************************************************************/
+static HostTap_t HostTap = {
+    .fd = -1,
+};
+
+/** Prototypes ***********************************************************************************/
+static err_t _host_tap_output(struct netif *netif, struct pbuf *p);
+
+/** Functions ************************************************************************************/
+
+err_t host_tap_netif_init(struct netif *netif)
+{
+    const char *name = (const char *)netif->state;
+
+    HostTap.fd = open("/dev/net/tun", O_RDWR | O_NONBLOCK);
+    if (HostTap.fd < 0)
+    {
+        printf("Failed to open /dev/net/tun: %s\n", strerror(errno));
+        return ERR_IF;
+    }
+
+    /** Ethernet frames without the packet information header */
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
+    strncpy(ifr.ifr_name, name, IFNAMSIZ - 1);
+    if (ioctl(HostTap.fd, TUNSETIFF, &ifr) < 0)
+    {
+        printf("Failed to attach to %s: %s\n", name, strerror(errno));
+        close(HostTap.fd);
+        HostTap.fd = -1;
+        return ERR_IF;
+    }
+
+    netif->name[0] = 't';
+    netif->name[1] = 'p';
+    netif->output = etharp_output;
+    netif->linkoutput = _host_tap_output;
+    netif->mtu = HOST_TAP_MTU;
+    netif->flags = NETIF_FLAG_BROADCAST | NETIF_FLAG_ETHARP | NETIF_FLAG_ETHERNET;
+
+    /** Locally administered unicast address, random so several clients can share the bridge */
+    uint32_t random = get_rand_32();
+    netif->hwaddr_len = ETH_HWADDR_LEN;
+    netif->hwaddr[0] = 0x02;
+    netif->hwaddr[1] = 0x00;
+    memcpy(&netif->hwaddr[2], &random, sizeof(random));
+
+    return ERR_OK;
+}
+
+void host_tap_poll(struct netif *netif)
+{
+    uint8_t frame[HOST_TAP_FRAME_SIZE];
+    ssize_t len;
+
+    while (HostTap.fd >= 0 && (len = read(HostTap.fd, frame, sizeof(frame))) > 0)
+    {
+        struct pbuf *p = pbuf_alloc(PBUF_RAW, (u16_t)len, PBUF_POOL);
+        if (p == NULL)
+        {
+            /** Out of pbufs, TCP sends it again */
+            continue;
+        }
+
+        pbuf_take(p, frame, (u16_t)len);
+        if (netif->input(p, netif) != ERR_OK)
+        {
+            pbuf_free(p);
+        }
+    }
+}
+
+int host_tap_fd(void)
+{
+    return HostTap.fd;
+}
+
+/**
+ * @brief Link output of the interface, writes the pbuf chain as one frame
+ */
+static err_t _host_tap_output(struct netif *netif, struct pbuf *p)
+{
+    (void)netif;
+
+    uint8_t frame[HOST_TAP_FRAME_SIZE];
+    if (p->tot_len > sizeof(frame))
+    {
+        return ERR_BUF;
+    }
+
+    pbuf_copy_partial(p, frame, p->tot_len, 0);
+    if (write(HostTap.fd, frame, p->tot_len) != p->tot_len)
+    {
+        return ERR_IF;
+    }
+
+    return ERR_OK;
+}
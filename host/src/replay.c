@@ -0,0 +1,384 @@
+/** Includes *************************************************************************************/
+#include "app_core.h"
+#include "cbor_reader.h"
+#include "mqtt_topic.h"
+#include "report_policy.h"
+
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Feeds recorded sensor traces through the report policies of the application core and reports
+ * how much of the telemetry they hold back. A trace is a CSV file of "milliseconds,value" lines,
+ * the value in the unit of the topic, e.g. 23.45 for degrees, lines that don't parse are skipped.
+ * Without a file a synthetic day of an indoor temperature is replayed.
+ *
+ * Every policy is also checked from the receiver side, the exit status is a failure if one of
+ * these does not hold: the value rebuilt from the reports, adding up the deltas, is the sample
+ * right after a report and at most the deadband away from the samples in between, no sample
+ * that came maxSilenceMs or more after the last report is held back, and the CBOR payload of
+ * every report decodes with cbor_reader to its JSON payload.
+ */
+
+/** Defines **************************************************************************************/
+
+/** Fraction digits of the values, centi-degrees like the firmware */
+#define REPLAY_DECIMALS 2
+#define REPLAY_SCALE 100.0
+
+/** MQTT overhead of a QoS 1 publish of one sample: fixed header, topic length and packet id */
+#define REPLAY_PUBLISH_OVERHEAD (2 + 2 + (sizeof(MQTT_TEMPERATURE_TOPIC) - 1) + 2)
+
+/** Self-describe tag the publish queue puts in front of a CBOR payload */
+#define REPLAY_CBOR_TAG_LEN 3
+
+/** Synthetic trace, one day of samples at the firmware sample interval */
+#define REPLAY_SYNTHETIC_MS (24u * 3600u * 1000u)
+
+/** Typedefs *************************************************************************************/
+
+typedef struct
+{
+    uint32_t timeMs;
+    int32_t value; /** Fixed point, REPLAY_DECIMALS */
+} ReplaySample_t;
+
+typedef struct
+{
+    ReplaySample_t *samples;
+    size_t count;
+    size_t capacity;
+} ReplayTrace_t;
+
+typedef struct
+{
+    const char *name;
+    ReportPolicyConfig_t config;
+} ReplayPolicy_t;
+
+/** Variables ************************************************************************************/
+static ReplayPolicy_t ReplayPolicies[] = {
+    {"every sample", {.absDeadband = -1}},
+    {"repeats only", {.absDeadband = 0}},
+    {"firmware", {.absDeadband = MQTT_TEMPERATURE_DEADBAND, .relDeadbandPermille = MQTT_TEMPERATURE_DEADBAND_PERMILLE,
+                  .maxSilenceMs = MQTT_TEMPERATURE_MAX_SILENCE_MS, .delta = MQTT_TEMPERATURE_DELTA}},
+    {"firmware delta", {.absDeadband = MQTT_TEMPERATURE_DEADBAND, .relDeadbandPermille = MQTT_TEMPERATURE_DEADBAND_PERMILLE,
+                        .maxSilenceMs = MQTT_TEMPERATURE_MAX_SILENCE_MS, .delta = true}},
+    {"custom", {.absDeadband = MQTT_TEMPERATURE_DEADBAND, .relDeadbandPermille = MQTT_TEMPERATURE_DEADBAND_PERMILLE,
+                .maxSilenceMs = MQTT_TEMPERATURE_MAX_SILENCE_MS, .delta = MQTT_TEMPERATURE_DELTA}},
+};
+
+/** The custom policy is only run when it was set on the command line */
+static bool ReplayCustom = false;
+
+/** Prototypes ***********************************************************************************/
+static int _replay_load(ReplayTrace_t *trace, const char *path);
+static int _replay_synthesize(ReplayTrace_t *trace);
+static int _replay_append(ReplayTrace_t *trace, uint32_t timeMs, int32_t value);
+static uint32_t _replay_run(const char *name, const ReplayTrace_t *trace);
+static uint32_t _replay_fail(const char *policy, size_t index, const char *what, int64_t expected, int64_t actual);
+static bool _replay_same(const uint8_t *json, int jsonLen, const uint8_t *cbor, int cborLen);
+
+/** Functions ************************************************************************************/
+
+int main(int argc, char **argv)
+{
+    ReportPolicyConfig_t *custom = &ReplayPolicies[sizeof(ReplayPolicies) / sizeof(ReplayPolicies[0]) - 1].config;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "a:r:s:dh")) != -1)
+    {
+        switch (opt)
+        {
+        case 'a':
+            custom->absDeadband = (int32_t)lround(strtod(optarg, NULL) * REPLAY_SCALE);
+            break;
+        case 'r':
+            custom->relDeadbandPermille = (uint16_t)strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            custom->maxSilenceMs = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'd':
+            custom->delta = true;
+            break;
+        default:
+            printf("Usage: %s [-a deadband] [-r deadband per mille] [-s max silence ms] [-d] [trace.csv ...]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+        ReplayCustom = true;
+    }
+
+    ReplayTrace_t trace = {0};
+    if (optind == argc)
+    {
+        if (_replay_synthesize(&trace) != 0)
+        {
+            return EXIT_FAILURE;
+        }
+        uint32_t failures = _replay_run("synthetic day", &trace);
+        free(trace.samples);
+        return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    uint32_t failures = 0;
+
+    for (int i = optind; i < argc; i++)
+    {
+        trace.count = 0;
+        if (_replay_load(&trace, argv[i]) != 0)
+        {
+            printf("Failed to read %s\n", argv[i]);
+            free(trace.samples);
+            return EXIT_FAILURE;
+        }
+        failures += _replay_run(argv[i], &trace);
+    }
+
+    free(trace.samples);
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/**
+ * @brief Read a trace from a CSV file
+ * @param trace The trace, appended to
+ * @param path The file
+ * @return int 0 on success, -1 on failure
+ */
+static int _replay_load(ReplayTrace_t *trace, const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+    {
+        return -1;
+    }
+
+    char line[128];
+    int rc = 0;
+    while (rc == 0 && fgets(line, sizeof(line), file) != NULL)
+    {
+        char *end;
+        unsigned long timeMs = strtoul(line, &end, 10);
+        if (end == line || *end != ',')
+        {
+            continue;
+        }
+
+        char *valueStart = end + 1;
+        double value = strtod(valueStart, &end);
+        if (end == valueStart)
+        {
+            continue;
+        }
+
+        rc = _replay_append(trace, (uint32_t)timeMs, (int32_t)lround(value * REPLAY_SCALE));
+    }
+
+    fclose(file);
+    return rc;
+}
+
+/**
+ * @brief Make up a day of an indoor temperature, a slow daily swing, a heating cycle and sensor noise
+ * @param trace The trace, appended to
+ * @return int 0 on success, -1 on failure
+ */
+static int _replay_synthesize(ReplayTrace_t *trace)
+{
+    uint32_t rng = 0x9E3779B9u;
+
+    for (uint32_t timeMs = 0; timeMs < REPLAY_SYNTHETIC_MS; timeMs += MQTT_SAMPLE_INTERVAL_MS)
+    {
+        double hours = timeMs / 3600000.0;
+        double celsius = 21.0 + 1.5 * sin(2.0 * M_PI * (hours - 9.0) / 24.0) + 0.3 * sin(2.0 * M_PI * hours / 0.75);
+
+        /** About +-0.05 degrees of noise, the averaged ADC reading still moves by a count or two */
+        rng ^= rng << 13;
+        rng ^= rng >> 17;
+        rng ^= rng << 5;
+        celsius += ((double)(rng % 11u) - 5.0) / 100.0;
+
+        if (_replay_append(trace, timeMs, (int32_t)lround(celsius * REPLAY_SCALE)) != 0)
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Add a sample to a trace
+ * @param trace The trace
+ * @param timeMs Time of the sample
+ * @param value The value, fixed point
+ * @return int 0 on success, -1 if out of memory
+ */
+static int _replay_append(ReplayTrace_t *trace, uint32_t timeMs, int32_t value)
+{
+    if (trace->count == trace->capacity)
+    {
+        size_t capacity = trace->capacity != 0 ? trace->capacity * 2 : 1024;
+        ReplaySample_t *samples = realloc(trace->samples, capacity * sizeof(ReplaySample_t));
+        if (samples == NULL)
+        {
+            return -1;
+        }
+        trace->samples = samples;
+        trace->capacity = capacity;
+    }
+
+    trace->samples[trace->count++] = (ReplaySample_t){.timeMs = timeMs, .value = value};
+    return 0;
+}
+
+/**
+ * @brief Replay a trace through every policy, print the traffic of each and check what a receiver gets
+ * @param name Name of the trace
+ * @param trace The trace
+ * @return uint32_t Samples that failed a check, see the comment at the top
+ */
+static uint32_t _replay_run(const char *name, const ReplayTrace_t *trace)
+{
+    printf("%s: %zu samples\n", name, trace->count);
+    printf("%-16s %9s %9s %7s %7s %10s %10s %8s %9s %9s\n",
+           "policy", "published", "suppr", "hb", "delta", "json B", "cbor B", "saved", "max err", "max gap");
+
+    uint64_t baselineBytes = 0;
+    uint32_t failures = 0;
+    for (size_t p = 0; p < sizeof(ReplayPolicies) / sizeof(ReplayPolicies[0]); p++)
+    {
+        const ReplayPolicy_t *entry = &ReplayPolicies[p];
+        if (p == sizeof(ReplayPolicies) / sizeof(ReplayPolicies[0]) - 1 && !ReplayCustom)
+        {
+            continue;
+        }
+
+        ReportPolicy_t policy;
+        report_policy_init(&policy, &entry->config);
+
+        uint64_t jsonBytes = 0;
+        uint64_t cborBytes = 0;
+        int64_t received = 0;
+        bool receivedAny = false;
+        int64_t maxError = 0;
+        uint32_t lastReportMs = 0;
+        uint32_t maxGapMs = 0;
+
+        for (size_t i = 0; i < trace->count; i++)
+        {
+            const ReplaySample_t *sample = &trace->samples[i];
+            ReportPolicyReport_t report;
+            if (report_policy_check(&policy, sample->value, sample->timeMs, &report))
+            {
+                uint8_t json[APP_CORE_SAMPLE_LEN];
+                uint8_t cbor[APP_CORE_SAMPLE_LEN];
+                int jsonLen = report_policy_encode(&report, MQTT_FORMAT_JSON, "t", REPLAY_DECIMALS, json, sizeof(json));
+                int cborLen = report_policy_encode(&report, MQTT_FORMAT_CBOR, "t", REPLAY_DECIMALS, cbor, sizeof(cbor));
+                if (jsonLen < 0 || cborLen < 0)
+                {
+                    printf("Sample %zu does not fit in %d bytes\n", i, APP_CORE_SAMPLE_LEN);
+                    continue;
+                }
+                if (!_replay_same(json, jsonLen, cbor, cborLen))
+                {
+                    printf("Sample %zu: the CBOR payload does not decode to %.*s\n", i, jsonLen, (const char *)json);
+                    failures++;
+                }
+                jsonBytes += (uint64_t)jsonLen + REPLAY_PUBLISH_OVERHEAD;
+                cborBytes += (uint64_t)cborLen + REPLAY_CBOR_TAG_LEN + REPLAY_PUBLISH_OVERHEAD;
+                report_policy_sent(&policy, &report, sample->value, sample->timeMs);
+
+                /** A delta on top of what the receiver has, it must land on the sample */
+                if (report.delta && !receivedAny)
+                {
+                    failures += _replay_fail(entry->name, i, "delta before any full value", 0, 1);
+                }
+                received = report.delta ? received + report.value : report.value;
+                if (received != sample->value)
+                {
+                    failures += _replay_fail(entry->name, i, "rebuilt value", sample->value, received);
+                }
+                if (receivedAny && sample->timeMs - lastReportMs > maxGapMs)
+                {
+                    maxGapMs = sample->timeMs - lastReportMs;
+                }
+                receivedAny = true;
+                lastReportMs = sample->timeMs;
+            }
+            else if (receivedAny && entry->config.maxSilenceMs != 0 && sample->timeMs - lastReportMs >= entry->config.maxSilenceMs)
+            {
+                failures += _replay_fail(entry->name, i, "ms since the last report", entry->config.maxSilenceMs - 1,
+                                         sample->timeMs - lastReportMs);
+            }
+
+            if (receivedAny)
+            {
+                int64_t error = (int64_t)sample->value - received;
+                error = error < 0 ? -error : error;
+                maxError = error > maxError ? error : maxError;
+
+                /** Held back only while within the band around the last report */
+                int64_t band = report_policy_band(&policy);
+                if (error > (band > 0 ? band : 0))
+                {
+                    failures += _replay_fail(entry->name, i, "error", band > 0 ? band : 0, error);
+                }
+            }
+        }
+
+        if (p == 0)
+        {
+            baselineBytes = jsonBytes;
+        }
+
+        printf("%-16s %9lu %9lu %7lu %7lu %10llu %10llu %7.1f%% %9.2f %8lus\n", entry->name,
+               (unsigned long)policy.stats.sent, (unsigned long)policy.stats.suppressed,
+               (unsigned long)policy.stats.heartbeats, (unsigned long)policy.stats.deltas,
+               (unsigned long long)jsonBytes, (unsigned long long)cborBytes,
+               baselineBytes != 0 ? 100.0 - (double)jsonBytes * 100.0 / (double)baselineBytes : 0.0,
+               (double)maxError / REPLAY_SCALE, (unsigned long)(maxGapMs / 1000u));
+    }
+
+    return failures;
+}
+
+/**
+ * @brief Print a failed check of a policy
+ * @param policy Name of the policy
+ * @param index The sample
+ * @param what What was checked
+ * @param expected The limit or the expected value
+ * @param actual What the receiver got
+ * @return uint32_t 1, the failure to count
+ */
+static uint32_t _replay_fail(const char *policy, size_t index, const char *what, int64_t expected, int64_t actual)
+{
+    printf("%s, sample %zu: %s %lld, expected %lld\n", policy, index, what, (long long)actual, (long long)expected);
+    return 1;
+}
+
+/**
+ * @brief Check that the CBOR payload of a report decodes to its JSON payload
+ * @param json The JSON payload
+ * @param jsonLen Its length
+ * @param cbor The CBOR payload
+ * @param cborLen Its length
+ * @return bool True if they match
+ */
+static bool _replay_same(const uint8_t *json, int jsonLen, const uint8_t *cbor, int cborLen)
+{
+    char decoded[APP_CORE_SAMPLE_LEN];
+    JsonWriter_t writer;
+    json_writer_init(&writer, decoded, sizeof(decoded));
+    if (cbor_reader_to_json(cbor, (uint32_t)cborLen, &writer) != 0)
+    {
+        return false;
+    }
+
+    int len = json_writer_finish(&writer);
+    return len == jsonLen && memcmp(decoded, json, (size_t)len) == 0;
+}
@@ -0,0 +1,475 @@
+/** Includes *************************************************************************************/
+#include "fake_lwip.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lwip/ip_addr.h"
+#include "lwip/netif.h"
+
+/** Defines **************************************************************************************/
+/** MQTT 3.1.1 packet bytes */
+#define FAKE_MQTT_CONNECT_PACKET 0x10
+#define FAKE_MQTT_CONNACK_PACKET 0x20
+
+/** Typedefs *************************************************************************************/
+/** Variables ************************************************************************************/
+FakeTcp_t FakeTcp;
+FakeMqtt_t FakeMqtt;
+
+/** The interface the addresses are logged from */
+static struct netif _fake_netif;
+struct netif *netif_list = &_fake_netif;
+
+static uint32_t _fake_pbuf_live = 0;
+
+/** Prototypes ***********************************************************************************/
+static void _fake_tcp_queuelen(void);
+static int _fake_mqtt_request(const char *topic, u8_t qos, u16_t packetId, bool publish, mqtt_request_cb_t cb, void *arg);
+static void _fake_mqtt_drop(void);
+
+/** Functions ************************************************************************************/
+
+void fake_lwip_reset(void)
+{
+    memset(&FakeTcp, 0, sizeof(FakeTcp));
+    FakeTcp.connectResult = ERR_OK;
+    FakeTcp.closeResult = ERR_OK;
+
+    memset(&FakeMqtt, 0, sizeof(FakeMqtt));
+    FakeMqtt.connectResult = ERR_OK;
+}
+
+err_t fake_tcp_ack(u16_t len)
+{
+    if (len > FakeTcp.unacked)
+    {
+        len = (u16_t)FakeTcp.unacked;
+    }
+    FakeTcp.unacked -= len;
+    FakeTcp.pcb.snd_buf += len;
+    _fake_tcp_queuelen();
+
+    return FakeTcp.sent != NULL ? FakeTcp.sent(FakeTcp.arg, &FakeTcp.pcb, len) : ERR_OK;
+}
+
+struct pbuf *fake_pbuf_chain(const uint8_t *data, const u16_t *lens, uint16_t count)
+{
+    struct pbuf *head = NULL;
+    struct pbuf *tail = NULL;
+    for (uint16_t i = 0; i < count; i++)
+    {
+        struct pbuf *p = calloc(1, sizeof(struct pbuf) + lens[i]);
+        p->payload = (uint8_t *)(p + 1);
+        memcpy(p->payload, data, lens[i]);
+        data += lens[i];
+        p->len = lens[i];
+        p->ref = 1;
+        _fake_pbuf_live++;
+
+        /** tot_len is the length of the pbuf and all that follow it */
+        for (struct pbuf *q = head; q != NULL; q = q->next)
+        {
+            q->tot_len += lens[i];
+        }
+        p->tot_len = lens[i];
+
+        if (tail == NULL)
+        {
+            head = p;
+        }
+        else
+        {
+            tail->next = p;
+        }
+        tail = p;
+    }
+
+    return head;
+}
+
+uint32_t fake_pbuf_live(void)
+{
+    return _fake_pbuf_live;
+}
+
+void fake_mqtt_connection(mqtt_connection_status_t status)
+{
+    mqtt_client_t *client = FakeMqtt.client;
+    mqtt_connection_cb_t cb = FakeMqtt.connectionCb;
+    if (status == MQTT_CONNECT_ACCEPTED)
+    {
+        /** Fixed header, acknowledge flags, return code */
+        client->rx_buffer[0] = FAKE_MQTT_CONNACK_PACKET;
+        client->rx_buffer[1] = 2;
+        client->rx_buffer[2] = 0;
+        client->rx_buffer[3] = 0;
+    }
+    else
+    {
+        /** Closed, disconnecting it again does nothing */
+        _fake_mqtt_drop();
+        FakeMqtt.connectionCb = NULL;
+    }
+
+    if (cb != NULL)
+    {
+        cb(client, FakeMqtt.connectionArg, status);
+    }
+}
+
+int fake_mqtt_answer(uint32_t request, err_t err)
+{
+    if (request >= FakeMqtt.requestCount || FakeMqtt.requests[request].done)
+    {
+        return -1;
+    }
+
+    FakeMqttRequest_t *taken = &FakeMqtt.requests[request];
+    taken->done = true;
+    if (taken->cb != NULL)
+    {
+        taken->cb(taken->arg, err);
+    }
+
+    return 0;
+}
+
+uint32_t fake_mqtt_pending(void)
+{
+    uint32_t pending = 0;
+    for (uint32_t i = 0; i < FakeMqtt.requestCount; i++)
+    {
+        pending += !FakeMqtt.requests[i].done;
+    }
+
+    return pending;
+}
+
+/** The lwIP calls, declared by the lwIP headers */
+
+struct tcp_pcb *tcp_new_ip_type(u8_t type)
+{
+    (void)type;
+
+    memset(&FakeTcp.pcb, 0, sizeof(FakeTcp.pcb));
+    FakeTcp.pcb.snd_buf = TCP_SND_BUF;
+    FakeTcp.pcb.mss = TCP_MSS;
+    FakeTcp.open = true;
+    FakeTcp.unacked = 0;
+
+    return &FakeTcp.pcb;
+}
+
+void tcp_arg(struct tcp_pcb *pcb, void *arg)
+{
+    (void)pcb;
+    FakeTcp.arg = arg;
+}
+
+void tcp_recv(struct tcp_pcb *pcb, tcp_recv_fn recv)
+{
+    (void)pcb;
+    FakeTcp.recv = recv;
+}
+
+void tcp_sent(struct tcp_pcb *pcb, tcp_sent_fn sent)
+{
+    (void)pcb;
+    FakeTcp.sent = sent;
+}
+
+void tcp_err(struct tcp_pcb *pcb, tcp_err_fn err)
+{
+    (void)pcb;
+    FakeTcp.err = err;
+}
+
+void tcp_poll(struct tcp_pcb *pcb, tcp_poll_fn poll, u8_t interval)
+{
+    (void)pcb;
+    (void)interval;
+    FakeTcp.poll = poll;
+}
+
+err_t tcp_connect(struct tcp_pcb *pcb, const ip_addr_t *ipaddr, u16_t port, tcp_connected_fn connected)
+{
+    (void)pcb;
+    FakeTcp.remoteAddr = *ipaddr;
+    FakeTcp.remotePort = port;
+    FakeTcp.connected = connected;
+
+    return FakeTcp.connectResult;
+}
+
+err_t tcp_close(struct tcp_pcb *pcb)
+{
+    if (pcb != &FakeTcp.pcb || !FakeTcp.open)
+    {
+        printf("tcp_close() of a pcb that is not open\n");
+        abort();
+    }
+
+    FakeTcp.closes++;
+    if (FakeTcp.closeResult == ERR_OK)
+    {
+        FakeTcp.open = false;
+    }
+
+    return FakeTcp.closeResult;
+}
+
+void tcp_abort(struct tcp_pcb *pcb)
+{
+    if (pcb != &FakeTcp.pcb || !FakeTcp.open)
+    {
+        printf("tcp_abort() of a pcb that is not open\n");
+        abort();
+    }
+
+    FakeTcp.aborts++;
+    FakeTcp.open = false;
+}
+
+void tcp_recved(struct tcp_pcb *pcb, u16_t len)
+{
+    (void)pcb;
+    FakeTcp.recved += len;
+}
+
+err_t tcp_write(struct tcp_pcb *pcb, const void *dataptr, u16_t len, u8_t apiflags)
+{
+    if (FakeTcp.writeMemErrors > 0)
+    {
+        FakeTcp.writeMemErrors--;
+        return ERR_MEM;
+    }
+
+    /** lwIP refuses data beyond the send buffer with ERR_MEM, the client must not try */
+    if (len > tcp_sndbuf(pcb))
+    {
+        FakeTcp.oversized++;
+        return ERR_MEM;
+    }
+
+    uint32_t keep = FakeTcp.writtenLen < FAKE_TCP_CAPTURE_SIZE ? FAKE_TCP_CAPTURE_SIZE - FakeTcp.writtenLen : 0;
+    memcpy(&FakeTcp.written[FakeTcp.writtenLen], dataptr, len < keep ? len : keep);
+    FakeTcp.writtenLen += len;
+    FakeTcp.unacked += len;
+    FakeTcp.writes++;
+    if (apiflags & TCP_WRITE_FLAG_MORE)
+    {
+        FakeTcp.moreWrites++;
+    }
+
+    pcb->snd_buf -= len;
+    _fake_tcp_queuelen();
+
+    return ERR_OK;
+}
+
+err_t tcp_output(struct tcp_pcb *pcb)
+{
+    (void)pcb;
+    FakeTcp.outputs++;
+    return ERR_OK;
+}
+
+u8_t pbuf_free(struct pbuf *p)
+{
+    /** Like lwIP, the chain is freed up to the first pbuf that is still referenced */
+    u8_t freed = 0;
+    while (p != NULL)
+    {
+        if (--p->ref > 0)
+        {
+            break;
+        }
+        struct pbuf *next = p->next;
+        free(p);
+        _fake_pbuf_live--;
+        freed++;
+        p = next;
+    }
+
+    return freed;
+}
+
+void pbuf_ref(struct pbuf *p)
+{
+    p->ref++;
+}
+
+void pbuf_cat(struct pbuf *head, struct pbuf *tail)
+{
+    struct pbuf *p = head;
+    for (; p->next != NULL; p = p->next)
+    {
+        p->tot_len += tail->tot_len;
+    }
+    p->tot_len += tail->tot_len;
+    p->next = tail;
+}
+
+int ipaddr_aton(const char *cp, ip_addr_t *addr)
+{
+    unsigned int a, b, c, d;
+    char extra;
+    if (sscanf(cp, "%u.%u.%u.%u%c", &a, &b, &c, &d, &extra) != 4 || a > 255 || b > 255 || c > 255 || d > 255)
+    {
+        return 0;
+    }
+
+    /** Network order, like lwIP */
+    uint8_t bytes[4] = {(uint8_t)a, (uint8_t)b, (uint8_t)c, (uint8_t)d};
+    memcpy(addr, bytes, sizeof(bytes));
+
+    return 1;
+}
+
+char *ipaddr_ntoa(const ip_addr_t *addr)
+{
+    static char text[16];
+    uint8_t bytes[4];
+    memcpy(bytes, addr, sizeof(bytes));
+    snprintf(text, sizeof(text), "%u.%u.%u.%u", bytes[0], bytes[1], bytes[2], bytes[3]);
+
+    return text;
+}
+
+err_t mqtt_client_connect(mqtt_client_t *client, const ip_addr_t *ipaddr, u16_t port, mqtt_connection_cb_t cb, void *arg,
+                          const struct mqtt_connect_client_info_t *client_info)
+{
+    (void)ipaddr;
+    (void)port;
+    (void)client_info;
+
+    if (FakeMqtt.connectResult != ERR_OK)
+    {
+        return FakeMqtt.connectResult;
+    }
+
+    /** lwIP wipes the client, the packet ids start over, and queues the CONNECT with the clean session flag */
+    memset(client, 0, sizeof(*client));
+    static const uint8_t connect[] = {FAKE_MQTT_CONNECT_PACKET, 10, 0, 4, 'M', 'Q', 'T', 'T', 4, 0x02, 0, 60};
+    memcpy(client->output.buf, connect, sizeof(connect));
+    client->output.put = sizeof(connect);
+
+    FakeMqtt.client = client;
+    FakeMqtt.connectionCb = cb;
+    FakeMqtt.connectionArg = arg;
+    FakeMqtt.connects++;
+
+    return ERR_OK;
+}
+
+void mqtt_disconnect(mqtt_client_t *client)
+{
+    /** No callback, like lwIP when the application closes the connection */
+    if (client == FakeMqtt.client && FakeMqtt.connectionCb != NULL)
+    {
+        _fake_mqtt_drop();
+        FakeMqtt.connectionCb = NULL;
+        FakeMqtt.disconnects++;
+    }
+}
+
+void mqtt_set_inpub_callback(mqtt_client_t *client, mqtt_incoming_publish_cb_t pub_cb, mqtt_incoming_data_cb_t data_cb, void *arg)
+{
+    (void)client;
+    FakeMqtt.publishCb = pub_cb;
+    FakeMqtt.dataCb = data_cb;
+    FakeMqtt.inpubArg = arg;
+}
+
+err_t mqtt_publish(mqtt_client_t *client, const char *topic, const void *payload, u16_t payload_length, u8_t qos, u8_t retain,
+                   mqtt_request_cb_t cb, void *arg)
+{
+    (void)payload;
+    (void)payload_length;
+    (void)retain;
+
+    /** Like lwIP the packet id is taken before the request slot and the output buffer are checked */
+    u16_t packetId = 0;
+    if (qos > 0)
+    {
+        if (++client->pkt_id_seq == 0)
+        {
+            client->pkt_id_seq++;
+        }
+        packetId = client->pkt_id_seq;
+    }
+
+    if (FakeMqtt.publishMemErrors > 0)
+    {
+        FakeMqtt.publishMemErrors--;
+        return ERR_MEM;
+    }
+    if (_fake_mqtt_request(topic, qos, packetId, true, cb, arg) != 0)
+    {
+        return ERR_MEM;
+    }
+
+    /** A QoS 0 publish is done once it is written, without a callback */
+    if (qos == 0)
+    {
+        FakeMqtt.requests[FakeMqtt.requestCount - 1].done = true;
+    }
+
+    return ERR_OK;
+}
+
+err_t mqtt_sub_unsub(mqtt_client_t *client, const char *topic, u8_t qos, mqtt_request_cb_t cb, void *arg, u8_t sub)
+{
+    (void)sub;
+
+    if (++client->pkt_id_seq == 0)
+    {
+        client->pkt_id_seq++;
+    }
+
+    return _fake_mqtt_request(topic, qos, client->pkt_id_seq, false, cb, arg) == 0 ? ERR_OK : ERR_MEM;
+}
+
+/**
+ * @brief Record a request, if lwIP would have a request slot for it
+ * @return int 0 on success, -1 without a slot
+ */
+static int _fake_mqtt_request(const char *topic, u8_t qos, u16_t packetId, bool publish, mqtt_request_cb_t cb, void *arg)
+{
+    if (fake_mqtt_pending() >= MQTT_REQ_MAX_IN_FLIGHT || FakeMqtt.requestCount >= FAKE_MQTT_REQUESTS)
+    {
+        return -1;
+    }
+
+    FakeMqtt.requests[FakeMqtt.requestCount++] = (FakeMqttRequest_t){
+        .topic = topic,
+        .qos = qos,
+        .packetId = packetId,
+        .publish = publish,
+        .cb = cb,
+        .arg = arg,
+    };
+
+    return 0;
+}
+
+/**
+ * @brief The connection is gone, lwIP forgets its requests without calling them back
+ */
+static void _fake_mqtt_drop(void)
+{
+    for (uint32_t i = 0; i < FakeMqtt.requestCount; i++)
+    {
+        FakeMqtt.requests[i].done = true;
+    }
+}
+
+/**
+ * @brief lwIP counts the pbufs queued for sending, this counts full segments of the unacknowledged data
+ */
+static void _fake_tcp_queuelen(void)
+{
+    FakeTcp.pcb.snd_queuelen = (u16_t)((FakeTcp.unacked + FakeTcp.pcb.mss - 1) / FakeTcp.pcb.mss);
+}
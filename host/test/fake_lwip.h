@@ -0,0 +1,146 @@
+#ifndef _FAKE_LWIP_H_
+#define _FAKE_LWIP_H_
+/**
+ * The raw TCP and pbuf calls of lwIP, faked for the unit tests. There is one connection, its
+ * pcb is a real struct tcp_pcb so the macros of lwip/tcp.h (tcp_sndbuf(), tcp_mss(), Nagle)
+ * work on it. What the code under test wrote is captured, and a test plays the other side by
+ * calling the callbacks it set, e.g. through fake_tcp_ack().
+ *
+ * The MQTT client of lwIP is faked the same way one level up: its requests are recorded with
+ * the packet ids lwIP would give them, and a test answers them with fake_mqtt_answer().
+ */
+/** Includes *************************************************************************************/
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "lwip/apps/mqtt.h"
+#include "lwip/apps/mqtt_priv.h"
+#include "lwip/pbuf.h"
+#include "lwip/tcp.h"
+
+/** Defines **************************************************************************************/
+
+/** Bytes of tcp_write() data that are captured */
+#define FAKE_TCP_CAPTURE_SIZE 65536
+
+/** MQTT requests recorded */
+#define FAKE_MQTT_REQUESTS 64
+
+/** Typedefs *************************************************************************************/
+
+typedef struct
+{
+    struct tcp_pcb pcb;
+    bool open; /** Created and neither closed nor aborted */
+    void *arg;
+    tcp_recv_fn recv;
+    tcp_sent_fn sent;
+    tcp_err_fn err;
+    tcp_poll_fn poll;
+    tcp_connected_fn connected;
+    ip_addr_t remoteAddr;
+    u16_t remotePort;
+
+    err_t connectResult;     /** Returned by tcp_connect() */
+    err_t closeResult;       /** Returned by tcp_close() */
+    uint32_t writeMemErrors; /** The next tcp_write() calls fail with ERR_MEM */
+
+    uint8_t written[FAKE_TCP_CAPTURE_SIZE];
+    uint32_t writtenLen; /** Bytes accepted by tcp_write(), only the first FAKE_TCP_CAPTURE_SIZE are kept */
+    uint32_t unacked;    /** Written and not acknowledged by fake_tcp_ack() */
+    uint32_t writes;
+    uint32_t moreWrites; /** Writes flagged TCP_WRITE_FLAG_MORE */
+    uint32_t oversized;  /** Writes longer than tcp_sndbuf() allowed, lwIP would refuse them */
+    uint32_t outputs;
+    uint32_t closes;
+    uint32_t aborts;
+    uint32_t recved; /** Sum of tcp_recved() */
+} FakeTcp_t;
+
+/** A PUBLISH, SUBSCRIBE or UNSUBSCRIBE the faked MQTT client took */
+typedef struct
+{
+    const char *topic; /** As passed, the callers keep their topics */
+    u8_t qos;
+    u16_t packetId; /** 0 for QoS 0 publishes, like lwIP */
+    bool publish;
+    mqtt_request_cb_t cb;
+    void *arg;
+    bool done; /** Answered, or dropped with its connection */
+} FakeMqttRequest_t;
+
+typedef struct
+{
+    mqtt_client_t *client; /** Of the last connect */
+    mqtt_connection_cb_t connectionCb;
+    void *connectionArg;
+    mqtt_incoming_publish_cb_t publishCb;
+    mqtt_incoming_data_cb_t dataCb;
+    void *inpubArg;
+
+    err_t connectResult;       /** Returned by mqtt_client_connect() */
+    uint32_t publishMemErrors; /** The next mqtt_publish() calls fail with ERR_MEM */
+
+    FakeMqttRequest_t requests[FAKE_MQTT_REQUESTS];
+    uint32_t requestCount;
+    uint32_t connects;
+    uint32_t disconnects;
+} FakeMqtt_t;
+
+/** Variables ************************************************************************************/
+extern FakeTcp_t FakeTcp;
+extern FakeMqtt_t FakeMqtt;
+
+/** Prototypes ***********************************************************************************/
+/** Functions ************************************************************************************/
+
+/**
+ * @brief Forget the connections and the captures, the next pcb has an empty send buffer of
+ *        TCP_SND_BUF and TCP_MSS segments
+ */
+void fake_lwip_reset(void);
+
+/**
+ * @brief The server acknowledges data, frees its room in the send buffer and calls the sent callback
+ * @param len Bytes acknowledged, at most what is unacknowledged
+ * @return err_t What the sent callback returned
+ */
+err_t fake_tcp_ack(u16_t len);
+
+/**
+ * @brief Build a pbuf chain the way the recv callback gets it, each pbuf holding one reference
+ * @param data The data of the whole chain
+ * @param lens Length of each pbuf
+ * @param count Number of pbufs
+ * @return struct pbuf* The head of the chain
+ */
+struct pbuf *fake_pbuf_chain(const uint8_t *data, const u16_t *lens, uint16_t count);
+
+/**
+ * @brief Pbufs made by fake_pbuf_chain() that were not freed yet
+ * @return uint32_t The count
+ */
+uint32_t fake_pbuf_live(void);
+
+/**
+ * @brief The broker answers the connect or the connection ends. A drop forgets the requests
+ *        without calling them back, like lwIP, then the connection callback is called.
+ * @param status MQTT_CONNECT_ACCEPTED with a CONNACK without session in the receive buffer, or the reason of the drop
+ */
+void fake_mqtt_connection(mqtt_connection_status_t status);
+
+/**
+ * @brief The broker answers a request: a PUBACK or SUBACK with ERR_OK, a timeout or a refusal otherwise
+ * @param request Index of the request in FakeMqtt.requests
+ * @param err The result passed to the request callback
+ * @return int 0 on success, -1 if there is no such request or it was answered
+ */
+int fake_mqtt_answer(uint32_t request, err_t err);
+
+/**
+ * @brief Requests taken and neither answered nor dropped, what lwIP holds request slots for
+ * @return uint32_t The count
+ */
+uint32_t fake_mqtt_pending(void);
+
+#endif /* _FAKE_LWIP_H_ */
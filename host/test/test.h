@@ -0,0 +1,71 @@
+#ifndef _TEST_H_
+#define _TEST_H_
+/**
+ * Checks of the host unit tests. A test is a program that runs its cases with TEST_RUN() and
+ * returns TEST_RESULT() from main(), a failed check prints where it failed and the case goes on.
+ * Measurements print a line starting with "bench", they are not checked.
+ */
+/** Includes *************************************************************************************/
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/** Defines **************************************************************************************/
+
+#define TEST_CHECK(cond)                                                          \
+    do                                                                            \
+    {                                                                             \
+        if (!(cond))                                                              \
+        {                                                                         \
+            printf("%s:%d: %s: check failed: %s\n", __FILE__, __LINE__, TestName, \
+                   #cond);                                                        \
+            TestFailures++;                                                       \
+        }                                                                         \
+    } while (0)
+
+/** Integers of any type, both are printed when they differ */
+#define TEST_EQUAL(actual, expected)                                                        \
+    do                                                                                      \
+    {                                                                                       \
+        long long _actual = (long long)(actual);                                            \
+        long long _expected = (long long)(expected);                                        \
+        if (_actual != _expected)                                                           \
+        {                                                                                   \
+            printf("%s:%d: %s: %s is %lld, expected %lld\n", __FILE__, __LINE__, TestName, \
+                   #actual, _actual, _expected);                                            \
+            TestFailures++;                                                                 \
+        }                                                                                   \
+    } while (0)
+
+#define TEST_RUN(fn)        \
+    do                      \
+    {                       \
+        TestName = #fn;     \
+        printf("%s\n", #fn); \
+        fn();               \
+    } while (0)
+
+#define TEST_RESULT() (TestFailures == 0 ? EXIT_SUCCESS : EXIT_FAILURE)
+
+/** Variables ************************************************************************************/
+static const char *TestName = "";
+static int TestFailures = 0;
+
+/** Functions ************************************************************************************/
+
+/**
+ * @brief Monotonic time for the measurements
+ * @return uint64_t Nanoseconds
+ */
+static inline uint64_t test_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+#endif /* _TEST_H_ */
@@ -0,0 +1,217 @@
+/** Includes *************************************************************************************/
+#include "backoff.h"
+#include "test.h"
+
+/**
+ * The reconnect policy of backoff.c: the bounds of each delay, the reset after a stable
+ * connection, and a fleet of devices that lose their broker at the same moment, against the
+ * fixed retry delay they would otherwise use.
+ */
+
+/** Defines **************************************************************************************/
+#define TEST_BASE_MS 1000
+#define TEST_CAP_MS 60000
+
+/** The fleet: the broker is down for a while, then accepts a limited number of connects per slot */
+#define TEST_FLEET_DEVICES 1000
+#define TEST_FLEET_STEP_MS 10
+#define TEST_FLEET_SLOT_MS 100
+#define TEST_FLEET_SLOT_CONNECTS 20
+#define TEST_FLEET_OUTAGE_MS 10000
+#define TEST_FLEET_END_MS 600000
+
+/** Typedefs *************************************************************************************/
+
+/** How the fleet got back */
+typedef struct
+{
+    uint32_t attempts;     /** Connects tried */
+    uint32_t peakAttempts; /** Most connects tried in one slot */
+    uint32_t allUpMs;      /** Time the last device got its connection, 0 if not all did */
+} TestFleet_t;
+
+/** Variables ************************************************************************************/
+static const BackoffConfig_t Config = {.baseMs = TEST_BASE_MS, .capMs = TEST_CAP_MS, .stableMs = 30000};
+
+/** Prototypes ***********************************************************************************/
+static TestFleet_t _test_fleet(bool jitter);
+
+/** Functions ************************************************************************************/
+
+/**
+ * @brief Each delay is between the base and three times the previous one, and at most the cap
+ */
+static void test_backoff_bounds(void)
+{
+    Backoff_t backoff;
+    BackoffConfig_t bad = Config;
+    bad.baseMs = 0;
+    TEST_EQUAL(backoff_init(&backoff, &bad, 1), -1);
+    bad = Config;
+    bad.capMs = bad.baseMs - 1;
+    TEST_EQUAL(backoff_init(&backoff, &bad, 1), -1);
+    TEST_EQUAL(backoff_init(&backoff, &Config, 0), 0);
+    TEST_CHECK(backoff.rng != 0);
+
+    uint32_t previousMs = TEST_BASE_MS;
+    uint32_t capped = 0;
+    for (uint32_t i = 0; i < 1000; i++)
+    {
+        uint32_t delayMs = backoff_failed(&backoff, 0);
+        uint32_t upperMs = previousMs * 3 < TEST_CAP_MS ? previousMs * 3 : TEST_CAP_MS;
+        TEST_CHECK(delayMs >= TEST_BASE_MS && delayMs <= upperMs);
+        capped += delayMs > TEST_CAP_MS / 2;
+        previousMs = delayMs;
+    }
+    TEST_EQUAL(backoff.failures, 1000);
+
+    /** The delays do reach the upper half of the range */
+    TEST_CHECK(capped > 100);
+}
+
+/**
+ * @brief The delays start over from the base once a connection lasted stableMs, not before
+ */
+static void test_backoff_stable(void)
+{
+    Backoff_t backoff;
+    backoff_init(&backoff, &Config, 42);
+    for (uint32_t i = 0; i < 20; i++)
+    {
+        backoff_failed(&backoff, 0);
+    }
+
+    /** A short connection keeps the delays up */
+    backoff_connected(&backoff, 1000);
+    backoff_failed(&backoff, 1000 + Config.stableMs - 1);
+    TEST_EQUAL(backoff.failures, 21);
+
+    backoff_connected(&backoff, 100000);
+    uint32_t delayMs = backoff_failed(&backoff, 100000 + Config.stableMs);
+    TEST_EQUAL(backoff.failures, 1);
+    TEST_CHECK(delayMs <= 3 * TEST_BASE_MS);
+}
+
+/**
+ * @brief The time left counts down to the retry, also across the roll-over of the clock
+ */
+static void test_backoff_remaining(void)
+{
+    Backoff_t backoff;
+    backoff_init(&backoff, &Config, 7);
+    TEST_EQUAL(backoff_remaining(&backoff, 0), 0);
+
+    uint32_t nowMs = UINT32_MAX - 100;
+    uint32_t delayMs = backoff_failed(&backoff, nowMs);
+    TEST_EQUAL(backoff_remaining(&backoff, nowMs), delayMs);
+    TEST_EQUAL(backoff_remaining(&backoff, nowMs + delayMs - 1), 1);
+    TEST_EQUAL(backoff_remaining(&backoff, nowMs + delayMs), 0);
+    TEST_CHECK(!backoff.waiting);
+
+    /** A connect ends the wait */
+    backoff_failed(&backoff, 0);
+    backoff_connected(&backoff, 1);
+    TEST_EQUAL(backoff_remaining(&backoff, 1), 0);
+}
+
+/**
+ * @brief A fleet that lost the broker at once comes back without a thundering herd: the
+ *        retries spread out over the slots instead of arriving all together every second
+ */
+static void test_backoff_fleet(void)
+{
+    TestFleet_t jitter = _test_fleet(true);
+    TestFleet_t fixed = _test_fleet(false);
+
+    TEST_CHECK(jitter.allUpMs != 0);
+    TEST_CHECK(jitter.peakAttempts < fixed.peakAttempts / 4);
+    TEST_CHECK(jitter.attempts < fixed.attempts / 4);
+
+    printf("bench fleet of %u, broker down %u ms then %u connects per %u ms: "
+           "jitter %u attempts peak %u per slot all up at %u ms, fixed %u ms retry %u attempts peak %u per slot all up at %u ms\n",
+           TEST_FLEET_DEVICES, TEST_FLEET_OUTAGE_MS, TEST_FLEET_SLOT_CONNECTS, TEST_FLEET_SLOT_MS,
+           jitter.attempts, jitter.peakAttempts, jitter.allUpMs,
+           TEST_BASE_MS, fixed.attempts, fixed.peakAttempts, fixed.allUpMs);
+}
+
+int main(void)
+{
+    TEST_RUN(test_backoff_bounds);
+    TEST_RUN(test_backoff_stable);
+    TEST_RUN(test_backoff_remaining);
+    TEST_RUN(test_backoff_fleet);
+
+    return TEST_RESULT();
+}
+
+/**
+ * @brief Every device drops at time 0 and retries, with the policy or with a fixed delay of
+ *        the base. Connects fail while the broker is down or its slot is used up.
+ */
+static TestFleet_t _test_fleet(bool jitter)
+{
+    static Backoff_t devices[TEST_FLEET_DEVICES];
+    static uint32_t fixedRetryMs[TEST_FLEET_DEVICES];
+    static bool up[TEST_FLEET_DEVICES];
+    TestFleet_t fleet = {0};
+
+    for (uint32_t i = 0; i < TEST_FLEET_DEVICES; i++)
+    {
+        backoff_init(&devices[i], &Config, (i + 1) * 2654435761u);
+        backoff_failed(&devices[i], 0);
+        fixedRetryMs[i] = TEST_BASE_MS;
+        up[i] = false;
+    }
+
+    uint32_t down = TEST_FLEET_DEVICES;
+    uint32_t slotConnects = 0;
+    uint32_t slotAttempts = 0;
+    for (uint32_t nowMs = 0; nowMs < TEST_FLEET_END_MS && down > 0; nowMs += TEST_FLEET_STEP_MS)
+    {
+        if (nowMs % TEST_FLEET_SLOT_MS == 0)
+        {
+            slotConnects = 0;
+            slotAttempts = 0;
+        }
+
+        for (uint32_t i = 0; i < TEST_FLEET_DEVICES; i++)
+        {
+            bool due = jitter ? backoff_remaining(&devices[i], nowMs) == 0 : nowMs >= fixedRetryMs[i];
+            if (up[i] || !due)
+            {
+                continue;
+            }
+
+            fleet.attempts++;
+            slotAttempts++;
+            if (nowMs >= TEST_FLEET_OUTAGE_MS && slotConnects < TEST_FLEET_SLOT_CONNECTS)
+            {
+                slotConnects++;
+                up[i] = true;
+                down--;
+                backoff_connected(&devices[i], nowMs);
+                continue;
+            }
+
+            if (jitter)
+            {
+                backoff_failed(&devices[i], nowMs);
+            }
+            else
+            {
+                fixedRetryMs[i] = nowMs + TEST_BASE_MS;
+            }
+        }
+
+        if (slotAttempts > fleet.peakAttempts)
+        {
+            fleet.peakAttempts = slotAttempts;
+        }
+        if (down == 0)
+        {
+            fleet.allUpMs = nowMs;
+        }
+    }
+
+    return fleet;
+}
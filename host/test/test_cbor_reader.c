@@ -0,0 +1,284 @@
+/** Includes *************************************************************************************/
+#include "cbor_reader.h"
+#include "cbor_writer.h"
+#include "report_policy.h"
+#include "test.h"
+
+/**
+ * The CBOR of cbor_writer.c decoded back by cbor_reader.c: the item heads at every argument
+ * size, documents converted to the JSON json_writer.c writes for the same values, truncated and
+ * malformed input, and the size and encode time of the telemetry samples against JSON.
+ */
+
+/** Defines **************************************************************************************/
+#define TEST_BUFFER_SIZE 512
+
+/** Samples of a batch in the size comparison, as publish_queue.c frames them */
+#define TEST_BATCH_SAMPLES 10
+
+/** Samples encoded by the benchmark */
+#define TEST_BENCH_SAMPLES 1000000
+
+/** Typedefs *************************************************************************************/
+/** Variables ************************************************************************************/
+static uint8_t Cbor[TEST_BUFFER_SIZE];
+static char Json[TEST_BUFFER_SIZE];
+static char Converted[TEST_BUFFER_SIZE];
+
+/** Prototypes ***********************************************************************************/
+static int _test_cbor_document(uint8_t *buffer, uint16_t size);
+static int _test_json_document(char *buffer, uint16_t size);
+static int _test_to_json(const uint8_t *data, uint32_t len);
+
+/** Functions ************************************************************************************/
+
+/**
+ * @brief Every item head decodes to its type and argument, the argument takes 0, 1, 2 or 4 bytes
+ */
+static void test_cbor_reader_items(void)
+{
+    static const struct
+    {
+        uint32_t value;
+        uint16_t len;
+    } uints[] = {{0, 1}, {23, 1}, {24, 2}, {255, 2}, {256, 3}, {65535, 3}, {65536, 5}, {UINT32_MAX, 5}};
+
+    for (uint32_t i = 0; i < sizeof(uints) / sizeof(uints[0]); i++)
+    {
+        CborWriter_t writer;
+        cbor_writer_init(&writer, Cbor, sizeof(Cbor));
+        cbor_writer_uint(&writer, uints[i].value);
+        TEST_EQUAL(cbor_writer_finish(&writer), uints[i].len);
+
+        CborReader_t reader;
+        CborItem_t item;
+        cbor_reader_init(&reader, Cbor, uints[i].len);
+        TEST_EQUAL(cbor_reader_next(&reader, &item), 1);
+        TEST_EQUAL(item.type, CBOR_ITEM_UINT);
+        TEST_EQUAL(item.value, uints[i].value);
+        TEST_EQUAL(cbor_reader_next(&reader, &item), 0);
+    }
+
+    CborWriter_t writer;
+    cbor_writer_init(&writer, Cbor, sizeof(Cbor));
+    cbor_writer_int(&writer, -1);
+    cbor_writer_int(&writer, INT32_MIN);
+    cbor_writer_text(&writer, "abc");
+    cbor_writer_array(&writer, 3);
+    cbor_writer_map(&writer, 300);
+    cbor_writer_tag(&writer, CBOR_TAG_SELF_DESCRIBE);
+    cbor_writer_bool(&writer, true);
+    int len = cbor_writer_finish(&writer);
+    TEST_CHECK(len > 0);
+
+    CborReader_t reader;
+    CborItem_t item;
+    cbor_reader_init(&reader, Cbor, (uint32_t)len);
+    TEST_EQUAL(cbor_reader_next(&reader, &item), 1);
+    TEST_EQUAL(item.type, CBOR_ITEM_NINT);
+    TEST_EQUAL(item.value, 0);
+    TEST_EQUAL(cbor_reader_next(&reader, &item), 1);
+    TEST_EQUAL(item.type, CBOR_ITEM_NINT);
+    TEST_EQUAL(item.value, INT32_MAX);
+    TEST_EQUAL(cbor_reader_next(&reader, &item), 1);
+    TEST_EQUAL(item.type, CBOR_ITEM_TEXT);
+    TEST_EQUAL(item.value, 3);
+    TEST_CHECK(memcmp(item.data, "abc", 3) == 0);
+    TEST_EQUAL(cbor_reader_next(&reader, &item), 1);
+    TEST_EQUAL(item.type, CBOR_ITEM_ARRAY);
+    TEST_EQUAL(item.value, 3);
+    TEST_EQUAL(cbor_reader_next(&reader, &item), 1);
+    TEST_EQUAL(item.type, CBOR_ITEM_MAP);
+    TEST_EQUAL(item.value, 300);
+    TEST_EQUAL(cbor_reader_next(&reader, &item), 1);
+    TEST_EQUAL(item.type, CBOR_ITEM_TAG);
+    TEST_EQUAL(item.value, CBOR_TAG_SELF_DESCRIBE);
+    TEST_EQUAL(cbor_reader_next(&reader, &item), 1);
+    TEST_EQUAL(item.type, CBOR_ITEM_SIMPLE);
+    TEST_EQUAL(cbor_reader_next(&reader, &item), 0);
+
+    /** Too small a buffer fails */
+    cbor_writer_init(&writer, Cbor, 4);
+    cbor_writer_uint(&writer, 65536);
+    TEST_EQUAL(cbor_writer_finish(&writer), -1);
+}
+
+/**
+ * @brief A document with nested maps and arrays, decimal fractions, text and the self-describe
+ *        tag converts to the JSON written for the same values
+ */
+static void test_cbor_reader_round_trip(void)
+{
+    int cborLen = _test_cbor_document(Cbor, sizeof(Cbor));
+    int jsonLen = _test_json_document(Json, sizeof(Json));
+    TEST_CHECK(cborLen > 0 && jsonLen > 0);
+    TEST_EQUAL(_test_to_json(Cbor, (uint32_t)cborLen), jsonLen);
+    TEST_CHECK(memcmp(Converted, Json, (size_t)jsonLen) == 0);
+
+    /** The samples of every centi-degree of the sensor range, full values and deltas */
+    uint32_t mismatches = 0;
+    for (int32_t value = -5000; value <= 15000; value++)
+    {
+        ReportPolicyReport_t report = {.delta = value % 3 == 0, .value = value};
+        int sampleLen = report_policy_encode(&report, MQTT_FORMAT_CBOR, "t", 2, Cbor, sizeof(Cbor));
+        jsonLen = report_policy_encode(&report, MQTT_FORMAT_JSON, "t", 2, (uint8_t *)Json, sizeof(Json));
+        int convertedLen = _test_to_json(Cbor, (uint32_t)sampleLen);
+        mismatches += convertedLen != jsonLen || memcmp(Converted, Json, (size_t)jsonLen) != 0;
+    }
+    TEST_EQUAL(mismatches, 0);
+}
+
+/**
+ * @brief Every truncation of a document is refused, as are reserved heads, trailing data, floats,
+ *        and nesting deeper than the JSON writer takes
+ */
+static void test_cbor_reader_malformed(void)
+{
+    int len = _test_cbor_document(Cbor, sizeof(Cbor));
+    for (int cut = 0; cut < len; cut++)
+    {
+        TEST_EQUAL(_test_to_json(Cbor, (uint32_t)cut), -1);
+    }
+
+    /** Trailing item */
+    Cbor[len] = 0x01;
+    TEST_EQUAL(_test_to_json(Cbor, (uint32_t)len + 1), -1);
+
+    static const uint8_t reserved[] = {0x1C};
+    static const uint8_t indefiniteText[] = {0x7F, 0x61, 'a', 0xFF};
+    static const uint8_t half[] = {0xF9, 0x3C, 0x00};
+    static const uint8_t shortText[] = {0x63, 'a', 'b'};
+    static const uint8_t decimalExponent[] = {0xC4, 0x82, 0x01, 0x05};
+    TEST_EQUAL(_test_to_json(reserved, sizeof(reserved)), -1);
+    TEST_EQUAL(_test_to_json(indefiniteText, sizeof(indefiniteText)), -1);
+    TEST_EQUAL(_test_to_json(half, sizeof(half)), -1);
+    TEST_EQUAL(_test_to_json(shortText, sizeof(shortText)), -1);
+    TEST_EQUAL(_test_to_json(decimalExponent, sizeof(decimalExponent)), -1);
+
+    uint8_t nested[CBOR_READER_MAX_DEPTH + 2];
+    memset(nested, 0x81, sizeof(nested));
+    nested[sizeof(nested) - 1] = 0x00;
+    TEST_EQUAL(_test_to_json(nested, sizeof(nested)), -1);
+    TEST_EQUAL(_test_to_json(&nested[2], sizeof(nested) - 2), 2 * (CBOR_READER_MAX_DEPTH - 1) + 1);
+}
+
+/**
+ * @brief Bytes of a sample and of a batch, and the encode time of a sample, CBOR against JSON
+ */
+static void test_cbor_reader_size(void)
+{
+    uint32_t cborBytes = 0;
+    uint32_t jsonBytes = 0;
+    uint32_t samples = 0;
+    for (int32_t value = 1500; value <= 3500; value++, samples++)
+    {
+        ReportPolicyReport_t report = {.value = value};
+        cborBytes += (uint32_t)report_policy_encode(&report, MQTT_FORMAT_CBOR, "t", 2, Cbor, sizeof(Cbor));
+        jsonBytes += (uint32_t)report_policy_encode(&report, MQTT_FORMAT_JSON, "t", 2, (uint8_t *)Json, sizeof(Json));
+    }
+    TEST_CHECK(cborBytes < jsonBytes);
+
+    /** A batch: [s,s,...] against the self-describe tag, an indefinite array and a break */
+    ReportPolicyReport_t report = {.value = 2345};
+    uint32_t cborSample = (uint32_t)report_policy_encode(&report, MQTT_FORMAT_CBOR, "t", 2, Cbor, sizeof(Cbor));
+    uint32_t jsonSample = (uint32_t)report_policy_encode(&report, MQTT_FORMAT_JSON, "t", 2, (uint8_t *)Json, sizeof(Json));
+    uint32_t cborBatch = 4 + TEST_BATCH_SAMPLES * cborSample + 1;
+    uint32_t jsonBatch = 1 + TEST_BATCH_SAMPLES * jsonSample + (TEST_BATCH_SAMPLES - 1) + 1;
+
+    volatile int sink = 0;
+    uint64_t startNs = test_now_ns();
+    for (uint32_t i = 0; i < TEST_BENCH_SAMPLES; i++)
+    {
+        report.value = 2000 + (int32_t)(i % 1000);
+        sink += report_policy_encode(&report, MQTT_FORMAT_CBOR, "t", 2, Cbor, sizeof(Cbor));
+    }
+    double cborNs = (double)(test_now_ns() - startNs) / TEST_BENCH_SAMPLES;
+    startNs = test_now_ns();
+    for (uint32_t i = 0; i < TEST_BENCH_SAMPLES; i++)
+    {
+        report.value = 2000 + (int32_t)(i % 1000);
+        sink += report_policy_encode(&report, MQTT_FORMAT_JSON, "t", 2, (uint8_t *)Json, sizeof(Json));
+    }
+    double jsonNs = (double)(test_now_ns() - startNs) / TEST_BENCH_SAMPLES;
+    (void)sink;
+
+    printf("bench cbor: sample %.2f bytes against %.2f JSON, batch of %u %u bytes against %u JSON, encode %.0f ns against %.0f ns\n",
+           (double)cborBytes / samples, (double)jsonBytes / samples, TEST_BATCH_SAMPLES, (unsigned)cborBatch, (unsigned)jsonBatch,
+           cborNs, jsonNs);
+}
+
+int main(void)
+{
+    TEST_RUN(test_cbor_reader_items);
+    TEST_RUN(test_cbor_reader_round_trip);
+    TEST_RUN(test_cbor_reader_malformed);
+    TEST_RUN(test_cbor_reader_size);
+
+    return TEST_RESULT();
+}
+
+/**
+ * @brief 55799({"t": 23.45, "list": [1, -2, 4([-3, 7]), {}], "ok": false, "name": "pico \"w\""})
+ * @return int Its length, -1 if it did not fit
+ */
+static int _test_cbor_document(uint8_t *buffer, uint16_t size)
+{
+    CborWriter_t writer;
+    cbor_writer_init(&writer, buffer, size);
+    cbor_writer_tag(&writer, CBOR_TAG_SELF_DESCRIBE);
+    cbor_writer_map(&writer, 4);
+    cbor_writer_text(&writer, "t");
+    cbor_writer_decimal(&writer, 2345, 2);
+    cbor_writer_text(&writer, "list");
+    cbor_writer_array(&writer, 4);
+    cbor_writer_int(&writer, 1);
+    cbor_writer_int(&writer, -2);
+    cbor_writer_decimal(&writer, 7, 3);
+    cbor_writer_map(&writer, 0);
+    cbor_writer_text(&writer, "ok");
+    cbor_writer_bool(&writer, false);
+    cbor_writer_text(&writer, "name");
+    cbor_writer_text(&writer, "pico \"w\"");
+    return cbor_writer_finish(&writer);
+}
+
+/**
+ * @brief The same document as JSON
+ */
+static int _test_json_document(char *buffer, uint16_t size)
+{
+    JsonWriter_t writer;
+    json_writer_init(&writer, buffer, size);
+    json_writer_begin_object(&writer);
+    json_writer_key(&writer, "t");
+    json_writer_fixed(&writer, 2345, 2);
+    json_writer_key(&writer, "list");
+    json_writer_begin_array(&writer);
+    json_writer_int(&writer, 1);
+    json_writer_int(&writer, -2);
+    json_writer_fixed(&writer, 7, 3);
+    json_writer_begin_object(&writer);
+    json_writer_end_object(&writer);
+    json_writer_end_array(&writer);
+    json_writer_key(&writer, "ok");
+    json_writer_bool(&writer, false);
+    json_writer_key(&writer, "name");
+    json_writer_string(&writer, "pico \"w\"");
+    json_writer_end_object(&writer);
+    return json_writer_finish(&writer);
+}
+
+/**
+ * @brief Convert CBOR to JSON in Converted
+ * @return int Length of the JSON, -1 if the conversion failed
+ */
+static int _test_to_json(const uint8_t *data, uint32_t len)
+{
+    JsonWriter_t writer;
+    json_writer_init(&writer, Converted, sizeof(Converted));
+    if (cbor_reader_to_json(data, len, &writer) != 0)
+    {
+        return -1;
+    }
+    return json_writer_finish(&writer);
+}
@@ -0,0 +1,439 @@
+/** Includes *************************************************************************************/
+#include "client.h"
+#include "fake_lwip.h"
+#include "scheduler.h"
+#include "test.h"
+
+#include "pico/rand.h"
+
+/**
+ * The TCP client of client.c against faked lwIP calls, the scheduler and the clock are faked
+ * here. Each case connects a fresh client, the test plays the server through the callbacks.
+ */
+
+/** Defines **************************************************************************************/
+#define TEST_SERVER_IP "192.168.7.1"
+#define TEST_SERVER_PORT 4242
+
+/** Scheduler tasks of the client and its writer */
+#define TEST_CLIENT_TASK 3
+#define TEST_WRITER_TASK 4
+
+/** Bytes the server streams to a slow reader */
+#define TEST_STREAM_BYTES (512u * 1024u)
+
+/** Typedefs *************************************************************************************/
+/** Variables ************************************************************************************/
+static client_t Client;
+
+/** The faked platform */
+static uint64_t FakeNowUs = 1000000;
+static int FakeCurrentTask = SCHEDULER_INVALID_TASK;
+static uint32_t FakeWakes[SCHEDULER_MAX_TASKS];
+static uint32_t FakeDelayMs;
+
+/** Prototypes ***********************************************************************************/
+static void _test_connect(void);
+static void _test_run_client_task(void);
+static uint8_t _test_byte(uint32_t position);
+static bool _test_count_frame(void *arg, const uint8_t *frame, uint16_t len);
+
+/** Functions ************************************************************************************/
+
+/**
+ * @brief A connect goes to the server and the client is connected once lwIP says so
+ */
+static void test_client_connect(void)
+{
+    TEST_EQUAL(client_init(&Client, TEST_SERVER_IP), 0);
+    TEST_EQUAL(Client.state, CLIENT_DISCONNECTED);
+
+    fake_lwip_reset();
+    client_task(&Client);
+    TEST_EQUAL(Client.state, CLIENT_CONNECTING);
+    TEST_CHECK(FakeTcp.open);
+    TEST_EQUAL(FakeTcp.remotePort, TEST_SERVER_PORT);
+    TEST_CHECK(strcmp(ipaddr_ntoa(&FakeTcp.remoteAddr), TEST_SERVER_IP) == 0);
+
+    TEST_EQUAL(FakeTcp.connected(FakeTcp.arg, &FakeTcp.pcb, ERR_OK), ERR_OK);
+    TEST_EQUAL(Client.state, CLIENT_CONNECTED);
+}
+
+/**
+ * @brief Received data goes through the ring to client_read() and opens the window again
+ */
+static void test_client_read(void)
+{
+    _test_connect();
+
+    const uint8_t data[] = "hello world";
+    const u16_t lens[] = {5, 6};
+    struct pbuf *p = fake_pbuf_chain(data, lens, 2);
+    TEST_EQUAL(FakeTcp.recv(FakeTcp.arg, &FakeTcp.pcb, p, ERR_OK), ERR_OK);
+
+    uint8_t read[16];
+    TEST_EQUAL(client_read(&Client, read, sizeof(read)), 11);
+    TEST_CHECK(memcmp(read, data, 11) == 0);
+    TEST_EQUAL(FakeTcp.recved, 11);
+    TEST_EQUAL(fake_pbuf_live(), 0);
+}
+
+/**
+ * @brief Queued data is written to TCP by the task
+ */
+static void test_client_write(void)
+{
+    _test_connect();
+
+    const uint8_t data[] = "publish";
+    TEST_EQUAL(client_write(&Client, data, sizeof(data), CLIENT_WRITE_PUSH), sizeof(data));
+    client_task(&Client);
+    TEST_EQUAL(FakeTcp.writtenLen, sizeof(data));
+    TEST_CHECK(memcmp(FakeTcp.written, data, sizeof(data)) == 0);
+    TEST_EQUAL(FakeTcp.outputs, 1);
+    TEST_CHECK(tcp_nagle_disabled(&FakeTcp.pcb));
+}
+
+/**
+ * @brief The tasks set with client_set_tasks() are woken: the client task for data to move,
+ *        the writer once a write that came short has room
+ */
+static void test_client_tasks(void)
+{
+    _test_connect();
+    TEST_EQUAL(client_set_tasks(NULL, TEST_CLIENT_TASK, TEST_WRITER_TASK), -1);
+    TEST_EQUAL(client_set_tasks(&Client, TEST_CLIENT_TASK, TEST_WRITER_TASK), 0);
+
+    const uint8_t data[] = "abc";
+    const u16_t lens[] = {3};
+    FakeTcp.recv(FakeTcp.arg, &FakeTcp.pcb, fake_pbuf_chain(data, lens, 1), ERR_OK);
+    TEST_EQUAL(FakeWakes[TEST_CLIENT_TASK], 1);
+
+    /** The client task moving data over does not wake itself */
+    FakeCurrentTask = TEST_CLIENT_TASK;
+    FakeTcp.recv(FakeTcp.arg, &FakeTcp.pcb, fake_pbuf_chain(data, lens, 1), ERR_OK);
+    FakeCurrentTask = SCHEDULER_INVALID_TASK;
+    TEST_EQUAL(FakeWakes[TEST_CLIENT_TASK], 1);
+
+    static uint8_t fill[CLIENT_TX_RING_SIZE + 1];
+    TEST_EQUAL(client_write(&Client, fill, sizeof(fill), 0), CLIENT_TX_RING_SIZE);
+    TEST_EQUAL(FakeWakes[TEST_CLIENT_TASK], 2);
+    TEST_EQUAL(FakeWakes[TEST_WRITER_TASK], 0);
+    client_task(&Client);
+    TEST_EQUAL(FakeWakes[TEST_WRITER_TASK], 1);
+}
+
+/**
+ * @brief The server streams faster than the reader drains a ring much smaller than the stream,
+ *        the window closes instead of data being dropped and every byte arrives in order
+ */
+static void test_client_stream(void)
+{
+    _test_connect();
+    client_set_tasks(&Client, TEST_CLIENT_TASK, TEST_WRITER_TASK);
+
+    static uint8_t segment[TCP_MSS];
+    uint8_t read[700];
+    uint32_t sent = 0;
+    uint32_t received = 0;
+    uint32_t errors = 0;
+    uint32_t windowFull = 0;
+    uint32_t maxPending = 0;
+    uint32_t round = 0;
+
+    uint64_t startNs = test_now_ns();
+    while (received < TEST_STREAM_BYTES)
+    {
+        /** The server sends while its window allows, the window is what was not recved yet */
+        uint32_t window = TCP_WND - (sent - FakeTcp.recved);
+        uint32_t len = TEST_STREAM_BYTES - sent;
+        len = len < TCP_MSS ? len : TCP_MSS;
+        len = len < window ? len : window;
+        if (len > 0)
+        {
+            for (uint32_t i = 0; i < len; i++)
+            {
+                segment[i] = _test_byte(sent + i);
+            }
+            const u16_t lens[] = {(u16_t)len};
+            FakeTcp.recv(FakeTcp.arg, &FakeTcp.pcb, fake_pbuf_chain(segment, lens, 1), ERR_OK);
+            sent += len;
+        }
+        else if (sent < TEST_STREAM_BYTES)
+        {
+            windowFull++;
+        }
+        maxPending = Client.rx.pending > maxPending ? Client.rx.pending : maxPending;
+
+        /** The reader takes less than the server sends, every other round */
+        if (round++ % 2 == 0)
+        {
+            uint32_t got = client_read(&Client, read, sizeof(read));
+            for (uint32_t i = 0; i < got; i++)
+            {
+                errors += read[i] != _test_byte(received + i);
+            }
+            received += got;
+        }
+
+        if (FakeWakes[TEST_CLIENT_TASK] > 0)
+        {
+            _test_run_client_task();
+        }
+    }
+    uint64_t elapsedNs = test_now_ns() - startNs;
+
+    TEST_EQUAL(errors, 0);
+    TEST_EQUAL(FakeTcp.recved, TEST_STREAM_BYTES);
+    TEST_EQUAL(fake_pbuf_live(), 0);
+    TEST_CHECK(windowFull > 0);
+    TEST_CHECK(maxPending <= TCP_WND);
+
+    printf("bench client stream: %u KiB through a %u byte ring in %.1f ms, %.0f KiB/s, window full %u times\n",
+           TEST_STREAM_BYTES / 1024, CLIENT_RX_RING_SIZE, elapsedNs / 1e6,
+           (TEST_STREAM_BYTES / 1024.0) / (elapsedNs / 1e9), windowFull);
+}
+
+/**
+ * @brief With a send buffer smaller than the queue, the pump writes what tcp_sndbuf() allows
+ *        and every acknowledgement refills exactly the room it freed
+ */
+static void test_client_partial_refill(void)
+{
+    _test_connect();
+    FakeTcp.pcb.snd_buf = 3000;
+
+    static uint8_t data[CLIENT_TX_RING_SIZE];
+    for (uint32_t i = 0; i < sizeof(data); i++)
+    {
+        data[i] = _test_byte(i);
+    }
+    TEST_EQUAL(client_write(&Client, data, sizeof(data), 0), sizeof(data));
+    client_task(&Client);
+    TEST_EQUAL(FakeTcp.writtenLen, 3000);
+    TEST_EQUAL(tcp_sndbuf(&FakeTcp.pcb), 0);
+    TEST_EQUAL(Client.tx_stats.window_full, 1);
+
+    /** Acknowledgements of odd sizes, the ring wraps on the way */
+    const u16_t acks[] = {1000, 1, 1459, 540, 3000, 3000};
+    uint32_t written = 3000;
+    for (uint32_t i = 0; i < sizeof(acks) / sizeof(acks[0]); i++)
+    {
+        uint32_t writes = FakeTcp.writes;
+        TEST_EQUAL(fake_tcp_ack(acks[i]), ERR_OK);
+        uint32_t expected = sizeof(data) - written < acks[i] ? sizeof(data) - written : acks[i];
+        written += expected;
+        TEST_EQUAL(FakeTcp.writtenLen, written);
+        TEST_CHECK(FakeTcp.writes > writes || expected == 0);
+    }
+    TEST_EQUAL(FakeTcp.writtenLen, sizeof(data));
+    TEST_CHECK(memcmp(FakeTcp.written, data, sizeof(data)) == 0);
+    TEST_EQUAL(FakeTcp.oversized, 0);
+    TEST_EQUAL(Client.tx_stats.bytes_written, sizeof(data));
+    TEST_EQUAL(Client.tx_stats.bytes_acked, sizeof(data));
+
+    /** A write that runs out of pbufs is retried by the poll callback */
+    _test_connect();
+    TEST_EQUAL(client_write(&Client, data, 100, 0), 100);
+    FakeTcp.writeMemErrors = 1;
+    client_task(&Client);
+    TEST_EQUAL(FakeTcp.writtenLen, 0);
+    TEST_EQUAL(Client.tx_stats.mem_errors, 1);
+    TEST_EQUAL(FakeTcp.poll(FakeTcp.arg, &FakeTcp.pcb), ERR_OK);
+    TEST_EQUAL(FakeTcp.writtenLen, 100);
+}
+
+/**
+ * @brief Frames sent with client_send_frame() decode on the other side, a frame that does not
+ *        fit whole is refused
+ */
+static void test_client_frames(void)
+{
+    _test_connect();
+
+    uint8_t frame[300];
+    for (uint32_t i = 0; i < sizeof(frame); i++)
+    {
+        frame[i] = _test_byte(i);
+    }
+    TEST_EQUAL(client_send_frame(&Client, frame, sizeof(frame), 0), 0);
+    TEST_EQUAL(client_send_frame(&Client, frame, 0, CLIENT_WRITE_PUSH), 0);
+    TEST_EQUAL(client_send_frame(&Client, frame, 10, 0), 0);
+    client_task(&Client);
+    TEST_EQUAL(FakeTcp.writtenLen, 3 * FRAME_HEADER_LEN + sizeof(frame) + 10);
+    TEST_EQUAL(FakeTcp.written[0], sizeof(frame) >> 8);
+    TEST_EQUAL(FakeTcp.written[1], sizeof(frame) & 0xFF);
+    TEST_CHECK(memcmp(&FakeTcp.written[FRAME_HEADER_LEN], frame, sizeof(frame)) == 0);
+    TEST_EQUAL(FakeTcp.written[FRAME_HEADER_LEN + sizeof(frame)], 0);
+    TEST_EQUAL(FakeTcp.written[FRAME_HEADER_LEN + sizeof(frame) + 1], 0);
+
+    /** Fill the ring so the next frame can't go whole */
+    static uint8_t fill[CLIENT_TX_RING_SIZE];
+    FakeTcp.pcb.snd_buf = 0;
+    uint32_t room = client_write(&Client, fill, CLIENT_TX_RING_SIZE - 5, 0);
+    TEST_EQUAL(room, CLIENT_TX_RING_SIZE - 5);
+    TEST_EQUAL(client_send_frame(&Client, frame, 4, 0), -1);
+    TEST_EQUAL(client_send_frame(&Client, frame, 3, 0), 0);
+
+    /** The decoder as the receive callback, frames arrive split over pbufs */
+    FrameDecoder_t decoder;
+    static uint8_t buffer[512];
+    uint32_t frames = 0;
+    frame_decoder_init(&decoder, buffer, sizeof(buffer), _test_count_frame, &frames);
+    client_set_recv_callback(&Client, frame_decoder_consume, &decoder);
+    uint8_t stream[2 * FRAME_HEADER_LEN + 310];
+    frame_encode_header(stream, 300);
+    memcpy(&stream[FRAME_HEADER_LEN], frame, 300);
+    frame_encode_header(&stream[FRAME_HEADER_LEN + 300], 10);
+    memcpy(&stream[2 * FRAME_HEADER_LEN + 300], frame, 10);
+    const u16_t lens[] = {1, 150, 100, sizeof(stream) - 251};
+    FakeTcp.recv(FakeTcp.arg, &FakeTcp.pcb, fake_pbuf_chain(stream, lens, 4), ERR_OK);
+    TEST_EQUAL(frames, 2);
+    TEST_EQUAL(decoder.stats.copied, 1);
+    TEST_EQUAL(FakeTcp.recved, sizeof(stream));
+}
+
+/**
+ * @brief After an error lwIP has freed the pcb, the client forgets it without closing it and
+ *        connects again once the delay is over
+ */
+static void test_client_error(void)
+{
+    _test_connect();
+
+    /** The fake aborts on a close or abort of a pcb that is not open */
+    FakeTcp.open = false;
+    FakeTcp.err(FakeTcp.arg, ERR_RST);
+    TEST_CHECK(Client.tcp_pcb == NULL);
+    TEST_EQUAL(Client.state, CLIENT_DISCONNECTED);
+    TEST_EQUAL(FakeTcp.closes, 0);
+    TEST_EQUAL(FakeTcp.aborts, 0);
+
+    FakeNowUs += (uint64_t)CLIENT_BACKOFF_CAP_MS * 1000u;
+    client_task(&Client);
+    TEST_EQUAL(Client.state, CLIENT_CONNECTING);
+    TEST_CHECK(FakeTcp.open);
+    TEST_EQUAL(FakeTcp.closes, 0);
+}
+
+/**
+ * @brief A close from the server closes the pcb once, an abort if the close fails
+ */
+static void test_client_remote_close(void)
+{
+    _test_connect();
+    const uint8_t data[] = "unread";
+    const u16_t lens[] = {6};
+    FakeTcp.recv(FakeTcp.arg, &FakeTcp.pcb, fake_pbuf_chain(data, lens, 1), ERR_OK);
+
+    TEST_EQUAL(FakeTcp.recv(FakeTcp.arg, &FakeTcp.pcb, NULL, ERR_OK), ERR_OK);
+    TEST_EQUAL(FakeTcp.closes, 1);
+    TEST_EQUAL(FakeTcp.aborts, 0);
+    TEST_CHECK(!FakeTcp.open);
+    TEST_CHECK(Client.tcp_pcb == NULL);
+    TEST_EQUAL(Client.state, CLIENT_DISCONNECTED);
+    TEST_EQUAL(fake_pbuf_live(), 0);
+
+    /** The next connect does not touch the closed pcb */
+    FakeNowUs += (uint64_t)CLIENT_BACKOFF_CAP_MS * 1000u;
+    client_task(&Client);
+    TEST_EQUAL(FakeTcp.closes, 1);
+    TEST_EQUAL(Client.state, CLIENT_CONNECTING);
+
+    _test_connect();
+    FakeTcp.closeResult = ERR_MEM;
+    TEST_EQUAL(FakeTcp.recv(FakeTcp.arg, &FakeTcp.pcb, NULL, ERR_OK), ERR_ABRT);
+    TEST_EQUAL(FakeTcp.aborts, 1);
+    TEST_CHECK(Client.tcp_pcb == NULL);
+}
+
+int main(void)
+{
+    TEST_RUN(test_client_connect);
+    TEST_RUN(test_client_read);
+    TEST_RUN(test_client_write);
+    TEST_RUN(test_client_tasks);
+    TEST_RUN(test_client_stream);
+    TEST_RUN(test_client_partial_refill);
+    TEST_RUN(test_client_frames);
+    TEST_RUN(test_client_error);
+    TEST_RUN(test_client_remote_close);
+
+    return TEST_RESULT();
+}
+
+/**
+ * @brief Connect a fresh client
+ */
+static void _test_connect(void)
+{
+    fake_lwip_reset();
+    memset(FakeWakes, 0, sizeof(FakeWakes));
+    client_init(&Client, TEST_SERVER_IP);
+    client_task(&Client);
+    FakeTcp.connected(FakeTcp.arg, &FakeTcp.pcb, ERR_OK);
+}
+
+/**
+ * @brief Dispatch the client task like the scheduler would after a wake
+ */
+static void _test_run_client_task(void)
+{
+    FakeWakes[TEST_CLIENT_TASK] = 0;
+    FakeCurrentTask = TEST_CLIENT_TASK;
+    client_task(&Client);
+    FakeCurrentTask = SCHEDULER_INVALID_TASK;
+}
+
+/**
+ * @brief The byte at a position of the stream, not periodic in the ring size
+ */
+static uint8_t _test_byte(uint32_t position)
+{
+    return (uint8_t)((position * 2654435761u) >> 24);
+}
+
+/**
+ * @brief Counts the frames the decoder hands over
+ */
+static bool _test_count_frame(void *arg, const uint8_t *frame, uint16_t len)
+{
+    (void)frame;
+    (void)len;
+    (*(uint32_t *)arg)++;
+    return true;
+}
+
+/** The faked platform, declared by pico/stdlib.h, pico/rand.h and scheduler.h */
+
+uint64_t time_us_64(void)
+{
+    return FakeNowUs;
+}
+
+uint32_t get_rand_32(void)
+{
+    return 0x12345678u;
+}
+
+int scheduler_wake(int taskId)
+{
+    if (taskId < 0 || taskId >= SCHEDULER_MAX_TASKS)
+    {
+        return -1;
+    }
+    FakeWakes[taskId]++;
+    return 0;
+}
+
+int scheduler_delay(int taskId, uint32_t delayMs)
+{
+    (void)taskId;
+    FakeDelayMs = delayMs;
+    return 0;
+}
+
+int scheduler_current_task(void)
+{
+    return FakeCurrentTask;
+}
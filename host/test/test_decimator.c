@@ -0,0 +1,238 @@
+/** Includes *************************************************************************************/
+#include "decimator.h"
+#include "test.h"
+
+#include <math.h>
+
+/**
+ * The averaging decimator of decimator.c as the ADC sampler drives it: the rounding of a block,
+ * the resolution gained by oversampling a noisy input, and raw samples paced by the ADC clock
+ * drained by polls that come late, against one conversion taken whenever the loop gets to it.
+ */
+
+/** Defines **************************************************************************************/
+#define TEST_RAW_RATE_HZ 1000
+#define TEST_POLL_MS 100
+
+/** The ramp of the pacing test, the value tells the time of a conversion */
+#define TEST_RAMP_START_V 0.5
+#define TEST_RAMP_V_PER_SAMPLE 0.00005
+
+/** Period of the single conversions of the loop before the sampler */
+#define TEST_LOOP_SAMPLE_MS 500
+
+/** Output samples of the oversampling and pacing runs */
+#define TEST_OUTPUTS 400
+
+/** Typedefs *************************************************************************************/
+/** Variables ************************************************************************************/
+static uint32_t Seed = 1;
+
+/** Prototypes ***********************************************************************************/
+static uint32_t _test_rand(void);
+static uint16_t _test_convert(double volts);
+static double _test_ramp(uint32_t index);
+
+/** Functions ************************************************************************************/
+
+/**
+ * @brief Factors and fraction bits out of range are refused
+ */
+static void test_decimator_init(void)
+{
+    Decimator_t decimator;
+    TEST_EQUAL(decimator_init(NULL, 4, 0), -1);
+    TEST_EQUAL(decimator_init(&decimator, 0, 0), -1);
+    TEST_EQUAL(decimator_init(&decimator, DECIMATOR_MAX_FACTOR + 1, 0), -1);
+    TEST_EQUAL(decimator_init(&decimator, 4, 17), -1);
+    TEST_EQUAL(decimator_init(&decimator, DECIMATOR_MAX_FACTOR, 16), 0);
+}
+
+/**
+ * @brief A block gives its rounded average scaled by the fraction bits, the largest block of
+ *        full scale samples does not overflow
+ */
+static void test_decimator_average(void)
+{
+    Decimator_t decimator;
+    uint32_t out = 0;
+    decimator_init(&decimator, 4, 0);
+    TEST_CHECK(!decimator_push(&decimator, 10, &out));
+    TEST_CHECK(!decimator_push(&decimator, 11, &out));
+    TEST_CHECK(!decimator_push(&decimator, 11, &out));
+    TEST_CHECK(decimator_push(&decimator, 11, &out));
+    TEST_EQUAL(out, 11);
+
+    /** 10.75 with two fraction bits is exact */
+    decimator_init(&decimator, 4, 2);
+    for (uint32_t i = 0; i < 4; i++)
+    {
+        decimator_push(&decimator, i == 0 ? 10 : 11, &out);
+    }
+    TEST_EQUAL(out, 43);
+
+    /** The next block starts from nothing, a reset drops a partial one */
+    decimator_init(&decimator, 2, 0);
+    decimator_push(&decimator, 4095, &out);
+    decimator_reset(&decimator);
+    decimator_push(&decimator, 1, &out);
+    TEST_CHECK(decimator_push(&decimator, 2, &out));
+    TEST_EQUAL(out, 2);
+
+    decimator_init(&decimator, DECIMATOR_MAX_FACTOR, 16);
+    bool done = false;
+    for (uint32_t i = 0; i < DECIMATOR_MAX_FACTOR; i++)
+    {
+        done = decimator_push(&decimator, 4095, &out);
+    }
+    TEST_CHECK(done);
+    TEST_EQUAL(out, 4095u << 16);
+}
+
+/**
+ * @brief Oversampling a noisy input by 4^n with n fraction bits brings the error of each output
+ *        down about 2^n times, below one step of the 12 bit converter
+ */
+static void test_decimator_oversampling(void)
+{
+    static const uint8_t bits[] = {0, 1, 2, 3, 4};
+    double rms[sizeof(bits)];
+
+    for (uint32_t b = 0; b < sizeof(bits); b++)
+    {
+        uint32_t factor = 1u << (2 * bits[b]);
+        Decimator_t decimator;
+        decimator_init(&decimator, factor, bits[b]);
+
+        double squares = 0;
+        for (uint32_t k = 0; k < TEST_OUTPUTS; k++)
+        {
+            /** A level between two codes, with about one code of noise */
+            double level = 1.0 + (k % 7) * 0.0917;
+            uint32_t out = 0;
+            for (uint32_t i = 0; i < factor; i++)
+            {
+                double noise = ((double)(_test_rand() % 2001) - 1000.0) / 1000.0 * 3.3 / 4096;
+                decimator_push(&decimator, _test_convert(level + noise), &out);
+            }
+            double error = (double)out / (1u << bits[b]) - level / 3.3 * 4096;
+            squares += error * error;
+        }
+        rms[b] = sqrt(squares / TEST_OUTPUTS);
+        printf("bench decimator: oversampling %u with %u extra bits, rms error %.3f LSB\n", (unsigned)factor, (unsigned)bits[b], rms[b]);
+    }
+
+    TEST_CHECK(rms[4] < rms[0] / 4);
+    TEST_CHECK(rms[4] < 0.25);
+    for (uint32_t b = 1; b < sizeof(bits); b++)
+    {
+        TEST_CHECK(rms[b] < rms[b - 1]);
+    }
+}
+
+/**
+ * @brief Conversions paced by the ADC clock and drained by polls that come late give the same
+ *        outputs as polls on time: the time of a sample follows from its number. One conversion
+ *        taken whenever the loop gets to it is off by however late the loop was.
+ */
+static void test_decimator_pacing(void)
+{
+    const uint32_t factor = TEST_RAW_RATE_HZ / 10;
+    Decimator_t paced;
+    Decimator_t jittered;
+    decimator_init(&paced, factor, 4);
+    decimator_init(&jittered, factor, 4);
+
+    static uint32_t reference[TEST_OUTPUTS];
+    uint32_t outputs = 0;
+    for (uint32_t i = 0; outputs < TEST_OUTPUTS; i++)
+    {
+        uint32_t out;
+        if (decimator_push(&paced, _test_convert(_test_ramp(i)), &out))
+        {
+            reference[outputs++] = out;
+        }
+    }
+
+    /** Polls late by up to three poll periods, e.g. while Wi-Fi or lwIP holds the core */
+    uint32_t rawIndex = 0;
+    uint32_t produced = 0;
+    uint32_t mismatches = 0;
+    uint32_t timeErrorMs = 0;
+    double polledSquares = 0;
+    uint32_t polled = 0;
+    for (uint32_t nowMs = 0; produced < TEST_OUTPUTS;)
+    {
+        nowMs += TEST_POLL_MS + _test_rand() % (3 * TEST_POLL_MS);
+
+        /** What the DMA wrote since the last poll */
+        uint32_t rawEnd = nowMs * (TEST_RAW_RATE_HZ / 1000);
+        for (; rawIndex < rawEnd && produced < TEST_OUTPUTS; rawIndex++)
+        {
+            uint32_t out;
+            if (decimator_push(&jittered, _test_convert(_test_ramp(rawIndex)), &out))
+            {
+                mismatches += out != reference[produced];
+
+                /** The centre of the block, from the ramp value, against the one from the number */
+                double valueMs = ((double)out / 16 * 3.3 / 4096 - TEST_RAMP_START_V) / TEST_RAMP_V_PER_SAMPLE * 1000 / TEST_RAW_RATE_HZ;
+                double expectedMs = (produced * factor + (factor - 1) / 2.0) * 1000 / TEST_RAW_RATE_HZ;
+                uint32_t errorMs = (uint32_t)fabs(valueMs - expectedMs);
+                timeErrorMs = errorMs > timeErrorMs ? errorMs : timeErrorMs;
+                produced++;
+            }
+        }
+
+        /** The old way: one conversion when the loop gets to it, stamped with the time it was due */
+        for (uint32_t dueMs = (polled + 1) * TEST_LOOP_SAMPLE_MS; dueMs <= nowMs; dueMs += TEST_LOOP_SAMPLE_MS)
+        {
+            double lateMs = nowMs - dueMs;
+            polledSquares += lateMs * lateMs;
+            polled++;
+        }
+    }
+
+    TEST_EQUAL(mismatches, 0);
+    TEST_CHECK(timeErrorMs <= 2);
+    printf("bench decimator: %u paced outputs identical under late polls, time error at most %u ms; "
+           "a conversion taken when the loop gets to it is off by %.0f ms rms\n",
+           (unsigned)produced, (unsigned)timeErrorMs, polled != 0 ? sqrt(polledSquares / polled) : 0.0);
+}
+
+int main(void)
+{
+    TEST_RUN(test_decimator_init);
+    TEST_RUN(test_decimator_average);
+    TEST_RUN(test_decimator_oversampling);
+    TEST_RUN(test_decimator_pacing);
+
+    return TEST_RESULT();
+}
+
+/**
+ * @brief xorshift32
+ */
+static uint32_t _test_rand(void)
+{
+    Seed ^= Seed << 13;
+    Seed ^= Seed >> 17;
+    Seed ^= Seed << 5;
+    return Seed;
+}
+
+/**
+ * @brief A conversion of the 12 bit ADC with a 3.3 V reference, to the nearest code
+ */
+static uint16_t _test_convert(double volts)
+{
+    double code = floor(volts / 3.3 * 4096 + 0.5);
+    return (uint16_t)(code < 0 ? 0 : code > 4095 ? 4095 : code);
+}
+
+/**
+ * @brief A slow ramp, so the value tells the time
+ */
+static double _test_ramp(uint32_t index)
+{
+    return TEST_RAMP_START_V + index * TEST_RAMP_V_PER_SAMPLE;
+}
@@ -0,0 +1,463 @@
+/** Includes *************************************************************************************/
+#include "flash_log.h"
+#include "test.h"
+
+/**
+ * The record log of flash_log.c over the RAM backed NOR device of flash_device_ram.c: even wear
+ * of the sectors as the ring wraps, the power cut at every point of a run of appends, the state
+ * recovered by a remount, and a record consumed after its sector was reused.
+ */
+
+/** Defines **************************************************************************************/
+#define TEST_MAX_SECTORS 8
+#define TEST_RECORDS 256
+
+/** Appends of the wear test, the log is remounted every TEST_WEAR_REMOUNT of them */
+#define TEST_WEAR_APPENDS 4000
+#define TEST_WEAR_REMOUNT 100
+
+/** Records appended by the power loss test, a power cut is tried every TEST_CUT_STEP bytes */
+#define TEST_CUT_RECORDS 60
+#define TEST_CUT_STEP 29
+
+/** Typedefs *************************************************************************************/
+
+/** The RAM device with its erases counted and a power cut after a number of programmed bytes */
+typedef struct
+{
+    FlashDevice_t ram;    /** The device underneath */
+    FlashDevice_t device; /** The device handed to the log */
+    uint32_t erases[TEST_MAX_SECTORS];
+    int64_t budget;       /** Bytes programmed before the power is cut, negative for never */
+    bool dead;            /** The power was cut, every operation fails */
+} TestFlash_t;
+
+/** Variables ************************************************************************************/
+static uint8_t Storage[TEST_MAX_SECTORS * FLASH_DEVICE_SECTOR_SIZE];
+static TestFlash_t Flash;
+static FlashLog_t Log;
+
+/** Prototypes ***********************************************************************************/
+static void _test_flash_init(uint32_t sectors);
+static void _test_flash_power_on(void);
+static uint16_t _test_payload(uint32_t index, uint8_t *payload);
+static int _test_append(uint32_t index);
+static uint32_t _test_replay(uint32_t *indices, uint32_t max, bool consume);
+static int _test_read(void *arg, uint32_t offset, void *buffer, uint32_t len);
+static int _test_program(void *arg, uint32_t offset, const void *data, uint32_t len);
+static int _test_erase(void *arg, uint32_t offset);
+
+/** Functions ************************************************************************************/
+
+/**
+ * @brief Records come back in order with their payload, a rewind hands out the unconsumed again
+ */
+static void test_flash_log_replay(void)
+{
+    _test_flash_init(4);
+    FlashLogRecord_t record;
+    uint8_t payload[FLASH_LOG_MAX_PAYLOAD];
+    TEST_EQUAL(flash_log_peek(&Log, &record, payload, sizeof(payload)), 0);
+    TEST_EQUAL(flash_log_append(&Log, 0, payload, FLASH_LOG_MAX_PAYLOAD + 1, 0), -1);
+
+    for (uint32_t i = 0; i < 20; i++)
+    {
+        TEST_EQUAL(_test_append(i), 0);
+    }
+    TEST_EQUAL(flash_log_pending(&Log), 20);
+
+    /** Read all, consume the first half */
+    uint32_t indices[TEST_RECORDS];
+    TEST_EQUAL(_test_replay(indices, 10, true), 10);
+    TEST_EQUAL(_test_replay(indices, TEST_RECORDS, false), 10);
+    TEST_EQUAL(indices[0], 10);
+    TEST_EQUAL(flash_log_pending(&Log), 10);
+
+    flash_log_rewind(&Log);
+    TEST_EQUAL(_test_replay(indices, TEST_RECORDS, true), 10);
+    TEST_EQUAL(indices[0], 10);
+    TEST_EQUAL(indices[9], 19);
+    TEST_EQUAL(flash_log_pending(&Log), 0);
+    TEST_EQUAL(Log.stats.consumed, 20);
+}
+
+/**
+ * @brief Appending and consuming for long, with remounts in between, erases every sector as
+ *        often as the others
+ */
+static void test_flash_log_wear(void)
+{
+    _test_flash_init(TEST_MAX_SECTORS);
+    uint32_t indices[TEST_RECORDS];
+    uint32_t next = 0;
+
+    for (uint32_t i = 0; i < TEST_WEAR_APPENDS; i++)
+    {
+        TEST_EQUAL(_test_append(i), 0);
+        if (i % 3 == 2)
+        {
+            /** Delivered in bursts */
+            uint32_t count = _test_replay(indices, TEST_RECORDS, true);
+            TEST_EQUAL(count, 3);
+            TEST_EQUAL(indices[0], next);
+            next += count;
+        }
+        if (i % TEST_WEAR_REMOUNT == TEST_WEAR_REMOUNT - 1)
+        {
+            TEST_EQUAL(flash_log_init(&Log, &Flash.device), 0);
+        }
+    }
+    TEST_EQUAL(Log.stats.dropped, 0);
+
+    uint32_t least = UINT32_MAX;
+    uint32_t most = 0;
+    for (uint32_t sector = 0; sector < TEST_MAX_SECTORS; sector++)
+    {
+        least = Flash.erases[sector] < least ? Flash.erases[sector] : least;
+        most = Flash.erases[sector] > most ? Flash.erases[sector] : most;
+    }
+    TEST_CHECK(least > 0);
+    TEST_CHECK(most - least <= 1);
+
+    printf("bench flash log: %u appends over %u sectors, erases per sector %u to %u\n",
+           TEST_WEAR_APPENDS, TEST_MAX_SECTORS, (unsigned)least, (unsigned)most);
+}
+
+/**
+ * @brief Undelivered records are dropped oldest sector first once the ring is full, the newest
+ *        are kept
+ */
+static void test_flash_log_wrap(void)
+{
+    _test_flash_init(2);
+    uint32_t appended = 0;
+    while (Log.stats.dropped == 0)
+    {
+        TEST_EQUAL(_test_append(appended), 0);
+        appended++;
+    }
+
+    uint32_t indices[TEST_RECORDS];
+    uint32_t count = _test_replay(indices, TEST_RECORDS, false);
+    TEST_EQUAL(count, flash_log_pending(&Log));
+    TEST_EQUAL(count + Log.stats.dropped, appended);
+    TEST_EQUAL(indices[0], Log.stats.dropped);
+    TEST_EQUAL(indices[count - 1], appended - 1);
+}
+
+/**
+ * @brief A remount finds the pending records, the next one to deliver and where to append
+ */
+static void test_flash_log_remount(void)
+{
+    /** Blank and too small */
+    _test_flash_init(4);
+    TEST_EQUAL(flash_log_pending(&Log), 0);
+    TEST_EQUAL(Log.nextSequence, 1);
+    Flash.device.size = FLASH_DEVICE_SECTOR_SIZE;
+    TEST_EQUAL(flash_log_init(&Log, &Flash.device), -1);
+    Flash.device.size = 4 * FLASH_DEVICE_SECTOR_SIZE;
+    TEST_EQUAL(flash_log_init(&Log, &Flash.device), 0);
+
+    /** Across a sector boundary, some consumed */
+    uint32_t indices[TEST_RECORDS];
+    for (uint32_t i = 0; i < 50; i++)
+    {
+        TEST_EQUAL(_test_append(i), 0);
+    }
+    TEST_EQUAL(_test_replay(indices, 7, true), 7);
+    TEST_EQUAL(_test_replay(indices, 3, false), 3);
+    uint32_t sequence = Log.nextSequence;
+    uint32_t writeOffset = Log.writeOffset;
+
+    TEST_EQUAL(flash_log_init(&Log, &Flash.device), 0);
+    TEST_EQUAL(flash_log_pending(&Log), 43);
+    TEST_EQUAL(Log.nextSequence, sequence);
+    TEST_EQUAL(Log.writeOffset, writeOffset);
+
+    /** Read but not consumed is handed out again */
+    TEST_EQUAL(_test_append(50), 0);
+    TEST_EQUAL(flash_log_init(&Log, &Flash.device), 0);
+    TEST_EQUAL(_test_replay(indices, TEST_RECORDS, true), 44);
+    TEST_EQUAL(indices[0], 7);
+    TEST_EQUAL(indices[43], 50);
+
+    /** All consumed, nothing comes back */
+    TEST_EQUAL(flash_log_init(&Log, &Flash.device), 0);
+    TEST_EQUAL(flash_log_pending(&Log), 0);
+    TEST_EQUAL(_test_replay(indices, TEST_RECORDS, false), 0);
+    TEST_EQUAL(_test_append(51), 0);
+    TEST_EQUAL(_test_replay(indices, TEST_RECORDS, false), 1);
+    TEST_EQUAL(indices[0], 51);
+}
+
+/**
+ * @brief The power is cut at every point of a run of appends: after a remount every append that
+ *        completed is there and intact, the one cut is gone or whole, and appending carries on
+ *        behind them
+ */
+static void test_flash_log_power_loss(void)
+{
+    /** Bytes programmed by the whole run */
+    _test_flash_init(4);
+    for (uint32_t i = 0; i < TEST_CUT_RECORDS; i++)
+    {
+        _test_append(i);
+    }
+    int64_t total = -Flash.budget - 1;
+
+    uint32_t cuts = 0;
+    uint32_t corrupt = 0;
+    for (int64_t cut = 0; cut < total; cut += TEST_CUT_STEP)
+    {
+        _test_flash_init(4);
+        Flash.budget = cut;
+        uint32_t completed = 0;
+        while (completed < TEST_CUT_RECORDS && _test_append(completed) == 0)
+        {
+            completed++;
+        }
+        TEST_CHECK(Flash.dead);
+
+        _test_flash_power_on();
+        TEST_EQUAL(flash_log_init(&Log, &Flash.device), 0);
+        corrupt += Log.stats.corrupt;
+
+        /** A cut in the padding of the last page finds the record whole */
+        uint32_t pending = flash_log_pending(&Log);
+        TEST_CHECK(pending == completed || pending == completed + 1);
+
+        TEST_EQUAL(_test_append(1000), 0);
+        uint32_t indices[TEST_RECORDS];
+        uint32_t count = _test_replay(indices, TEST_RECORDS, false);
+        TEST_EQUAL(count, pending + 1);
+        for (uint32_t i = 0; i < pending && i < count; i++)
+        {
+            TEST_EQUAL(indices[i], i);
+        }
+        TEST_EQUAL(indices[count - 1], 1000);
+        cuts++;
+    }
+
+    printf("bench flash log: %u power cuts over %u bytes programmed, %u left a corrupt record\n",
+           (unsigned)cuts, (unsigned)total, (unsigned)corrupt);
+}
+
+/**
+ * @brief A cut while a record is consumed leaves it live or consumed, never lost or corrupt
+ */
+static void test_flash_log_power_loss_consume(void)
+{
+    for (int64_t cut = 0; cut <= FLASH_DEVICE_PAGE_SIZE; cut += 8)
+    {
+        _test_flash_init(4);
+        for (uint32_t i = 0; i < 4; i++)
+        {
+            _test_append(i);
+        }
+
+        FlashLogRecord_t record;
+        uint8_t payload[FLASH_LOG_MAX_PAYLOAD];
+        TEST_EQUAL(flash_log_peek(&Log, &record, payload, sizeof(payload)), 1);
+        Flash.budget = cut;
+        flash_log_consume(&Log, record.offset, record.sequence);
+
+        _test_flash_power_on();
+        TEST_EQUAL(flash_log_init(&Log, &Flash.device), 0);
+        TEST_EQUAL(Log.stats.corrupt, 0);
+        uint32_t indices[TEST_RECORDS];
+        uint32_t count = _test_replay(indices, TEST_RECORDS, false);
+        TEST_CHECK(count == 3 || count == 4);
+        TEST_EQUAL(indices[count - 1], 3);
+    }
+}
+
+/**
+ * @brief A record consumed after the log wrapped over its sector leaves the newer record at the
+ *        same offset live
+ */
+static void test_flash_log_stale_consume(void)
+{
+    _test_flash_init(2);
+    TEST_EQUAL(_test_append(0), 0);
+    FlashLogRecord_t old;
+    uint8_t payload[FLASH_LOG_MAX_PAYLOAD];
+    TEST_EQUAL(flash_log_peek(&Log, &old, payload, sizeof(payload)), 1);
+    flash_log_advance(&Log, &old);
+
+    /** Fill both sectors and open the first one again */
+    uint32_t appended = 1;
+    while (Log.stats.erases < 3)
+    {
+        TEST_EQUAL(_test_append(appended), 0);
+        appended++;
+    }
+    while (Log.writeOffset <= old.offset)
+    {
+        TEST_EQUAL(_test_append(appended), 0);
+        appended++;
+    }
+    uint32_t pending = flash_log_pending(&Log);
+
+    TEST_EQUAL(flash_log_consume(&Log, old.offset, old.sequence), -1);
+    TEST_EQUAL(Log.stats.stale, 1);
+    TEST_EQUAL(flash_log_pending(&Log), pending);
+
+    /** The record now at that offset is still delivered */
+    uint32_t indices[TEST_RECORDS];
+    flash_log_rewind(&Log);
+    TEST_EQUAL(_test_replay(indices, TEST_RECORDS, false), pending);
+    TEST_EQUAL(indices[pending - 1], appended - 1);
+
+    /** Consumed with its own sequence number it goes */
+    flash_log_rewind(&Log);
+    FlashLogRecord_t record;
+    TEST_EQUAL(flash_log_peek(&Log, &record, payload, sizeof(payload)), 1);
+    TEST_CHECK(record.sequence != old.sequence);
+    TEST_EQUAL(flash_log_consume(&Log, record.offset, record.sequence), 0);
+    TEST_EQUAL(flash_log_pending(&Log), pending - 1);
+}
+
+int main(void)
+{
+    TEST_RUN(test_flash_log_replay);
+    TEST_RUN(test_flash_log_wear);
+    TEST_RUN(test_flash_log_wrap);
+    TEST_RUN(test_flash_log_remount);
+    TEST_RUN(test_flash_log_power_loss);
+    TEST_RUN(test_flash_log_power_loss_consume);
+    TEST_RUN(test_flash_log_stale_consume);
+
+    return TEST_RESULT();
+}
+
+/**
+ * @brief Erase the storage, set up the counting device over its first sectors and mount the log
+ */
+static void _test_flash_init(uint32_t sectors)
+{
+    memset(&Flash, 0, sizeof(Flash));
+    TEST_EQUAL(flash_device_ram_init(&Flash.ram, Storage, sizeof(Storage)), 0);
+    Flash.device = Flash.ram;
+    Flash.device.size = sectors * FLASH_DEVICE_SECTOR_SIZE;
+    Flash.device.read = _test_read;
+    Flash.device.program = _test_program;
+    Flash.device.erase = _test_erase;
+    Flash.device.arg = &Flash;
+    Flash.budget = -1;
+    TEST_EQUAL(flash_log_init(&Log, &Flash.device), 0);
+}
+
+/**
+ * @brief Power back on after a cut, the storage keeps what was programmed
+ */
+static void _test_flash_power_on(void)
+{
+    Flash.dead = false;
+    Flash.budget = -1;
+}
+
+/**
+ * @brief The payload of a record, its length and bytes follow from its index
+ * @return uint16_t Length of the payload
+ */
+static uint16_t _test_payload(uint32_t index, uint8_t *payload)
+{
+    uint16_t len = (uint16_t)(10 + (index * 37) % 200);
+    for (uint16_t i = 0; i < len; i++)
+    {
+        payload[i] = (uint8_t)(index * 31 + i);
+    }
+    return len;
+}
+
+/**
+ * @brief Append the record of an index, the index is its time
+ */
+static int _test_append(uint32_t index)
+{
+    uint8_t payload[FLASH_LOG_MAX_PAYLOAD];
+    uint16_t len = _test_payload(index, payload);
+    return flash_log_append(&Log, (uint8_t)index, payload, len, index);
+}
+
+/**
+ * @brief Read the records to deliver, checking their payload
+ * @param indices The indices of the records read
+ * @param max Most records to read
+ * @param consume Consume them as well
+ * @return uint32_t Records read
+ */
+static uint32_t _test_replay(uint32_t *indices, uint32_t max, bool consume)
+{
+    uint32_t count = 0;
+    while (count < max)
+    {
+        FlashLogRecord_t record;
+        uint8_t payload[FLASH_LOG_MAX_PAYLOAD];
+        int rc = flash_log_peek(&Log, &record, payload, sizeof(payload));
+        TEST_CHECK(rc >= 0);
+        if (rc <= 0)
+        {
+            break;
+        }
+
+        uint8_t expected[FLASH_LOG_MAX_PAYLOAD];
+        uint16_t len = _test_payload(record.timeMs, expected);
+        TEST_EQUAL(record.len, len);
+        TEST_EQUAL(record.topic, (uint8_t)record.timeMs);
+        TEST_CHECK(record.len == len && memcmp(payload, expected, len) == 0);
+
+        flash_log_advance(&Log, &record);
+        if (consume)
+        {
+            TEST_EQUAL(flash_log_consume(&Log, record.offset, record.sequence), 0);
+        }
+        indices[count++] = record.timeMs;
+    }
+
+    return count;
+}
+
+static int _test_read(void *arg, uint32_t offset, void *buffer, uint32_t len)
+{
+    TestFlash_t *flash = arg;
+    return flash->dead ? -1 : flash->ram.read(flash->ram.arg, offset, buffer, len);
+}
+
+/**
+ * @brief Program, once the budget is used up only its first bytes are programmed and the power
+ *        is cut. With no budget the bytes programmed are counted down from -1.
+ */
+static int _test_program(void *arg, uint32_t offset, const void *data, uint32_t len)
+{
+    TestFlash_t *flash = arg;
+    if (flash->dead)
+    {
+        return -1;
+    }
+    if (flash->budget < 0 || flash->budget >= (int64_t)len)
+    {
+        flash->budget -= len;
+        return flash->ram.program(flash->ram.arg, offset, data, len);
+    }
+
+    static uint8_t partial[FLASH_DEVICE_SECTOR_SIZE];
+    memset(partial, 0xFF, len);
+    memcpy(partial, data, (size_t)flash->budget);
+    flash->ram.program(flash->ram.arg, offset, partial, len);
+    flash->budget = 0;
+    flash->dead = true;
+    return -1;
+}
+
+static int _test_erase(void *arg, uint32_t offset)
+{
+    TestFlash_t *flash = arg;
+    if (flash->dead)
+    {
+        return -1;
+    }
+    flash->erases[offset / flash->device.sectorSize]++;
+    return flash->ram.erase(flash->ram.arg, offset);
+}
@@ -0,0 +1,242 @@
+/** Includes *************************************************************************************/
+#include "frame_codec.h"
+#include "test.h"
+
+/**
+ * The length prefixed frames of frame_codec.c: whole frames handed over in place, frames split
+ * across spans reassembled, frames held back by the handler offered again, and oversized frames
+ * skipped with the stream kept in step.
+ */
+
+/** Defines **************************************************************************************/
+#define TEST_BUFFER_SIZE 64
+#define TEST_FRAMES 32
+
+/** Typedefs *************************************************************************************/
+
+/** Records the frames it is handed */
+typedef struct
+{
+    uint8_t data[TEST_FRAMES][TEST_BUFFER_SIZE * 2];
+    uint16_t lens[TEST_FRAMES];
+    const uint8_t *where[TEST_FRAMES]; /** Where the frame was handed over */
+    uint32_t count;
+    uint32_t refuse; /** The next frames are held back */
+} TestHandler_t;
+
+/** Variables ************************************************************************************/
+static uint8_t Buffer[TEST_BUFFER_SIZE];
+static TestHandler_t Handler;
+static FrameDecoder_t Decoder;
+
+/** Prototypes ***********************************************************************************/
+static bool _test_handler(void *arg, const uint8_t *frame, uint16_t len);
+static void _test_init(void);
+static uint16_t _test_encode(uint8_t *stream, const uint8_t *frame, uint16_t len);
+
+/** Functions ************************************************************************************/
+
+/**
+ * @brief The header is the length, big endian
+ */
+static void test_frame_codec_header(void)
+{
+    uint8_t header[FRAME_HEADER_LEN];
+    frame_encode_header(header, 0x1234);
+    TEST_EQUAL(header[0], 0x12);
+    TEST_EQUAL(header[1], 0x34);
+    frame_encode_header(header, FRAME_MAX_LEN);
+    TEST_EQUAL(header[0], 0xFF);
+    TEST_EQUAL(header[1], 0xFF);
+
+    _test_init();
+    TEST_EQUAL(frame_decoder_init(NULL, Buffer, sizeof(Buffer), _test_handler, &Handler), -1);
+    TEST_EQUAL(frame_decoder_init(&Decoder, NULL, sizeof(Buffer), _test_handler, &Handler), -1);
+    TEST_EQUAL(frame_decoder_init(&Decoder, Buffer, sizeof(Buffer), NULL, &Handler), -1);
+}
+
+/**
+ * @brief Frames that are whole in the span are handed over in place, empty frames too
+ */
+static void test_frame_codec_in_place(void)
+{
+    _test_init();
+    uint8_t stream[64];
+    uint16_t len = _test_encode(stream, (const uint8_t *)"hello", 5);
+    len += _test_encode(&stream[len], NULL, 0);
+    len += _test_encode(&stream[len], (const uint8_t *)"world!", 6);
+
+    TEST_EQUAL(frame_decoder_consume(&Decoder, stream, len), len);
+    TEST_EQUAL(Handler.count, 3);
+    TEST_EQUAL(Handler.lens[0], 5);
+    TEST_CHECK(memcmp(Handler.data[0], "hello", 5) == 0);
+    TEST_CHECK(Handler.where[0] == &stream[2]);
+    TEST_EQUAL(Handler.lens[1], 0);
+    TEST_EQUAL(Handler.lens[2], 6);
+    TEST_CHECK(Handler.where[2] == &stream[11]);
+    TEST_EQUAL(Decoder.stats.frames, 3);
+    TEST_EQUAL(Decoder.stats.copied, 0);
+}
+
+/**
+ * @brief Fed one byte at a time, the headers and the frames are reassembled in the buffer
+ */
+static void test_frame_codec_split(void)
+{
+    _test_init();
+    uint8_t stream[64];
+    uint16_t len = _test_encode(stream, (const uint8_t *)"split frame", 11);
+    len += _test_encode(&stream[len], (const uint8_t *)"x", 1);
+
+    for (uint16_t i = 0; i < len; i++)
+    {
+        TEST_EQUAL(frame_decoder_consume(&Decoder, &stream[i], 1), 1);
+    }
+    TEST_EQUAL(Handler.count, 2);
+    TEST_EQUAL(Handler.lens[0], 11);
+    TEST_CHECK(memcmp(Handler.data[0], "split frame", 11) == 0);
+    TEST_CHECK(Handler.where[0] == Buffer);
+    TEST_EQUAL(Handler.lens[1], 1);
+    TEST_EQUAL(Handler.data[1][0], 'x');
+    TEST_EQUAL(Decoder.stats.copied, 2);
+
+    /** Split in the middle of the body, the rest of the span is handed over in place */
+    _test_init();
+    len = _test_encode(stream, (const uint8_t *)"abcdef", 6);
+    len += _test_encode(&stream[len], (const uint8_t *)"gh", 2);
+    TEST_EQUAL(frame_decoder_consume(&Decoder, stream, 5), 5);
+    TEST_EQUAL(Handler.count, 0);
+    TEST_EQUAL(frame_decoder_consume(&Decoder, &stream[5], len - 5), len - 5);
+    TEST_EQUAL(Handler.count, 2);
+    TEST_CHECK(memcmp(Handler.data[0], "abcdef", 6) == 0);
+    TEST_CHECK(Handler.where[0] == Buffer);
+    TEST_CHECK(Handler.where[1] == &stream[10]);
+}
+
+/**
+ * @brief A frame the handler holds back stops the decoder before it, it is offered again on
+ *        the next call
+ */
+static void test_frame_codec_hold_back(void)
+{
+    _test_init();
+    uint8_t stream[64];
+    uint16_t first = _test_encode(stream, (const uint8_t *)"one", 3);
+    uint16_t len = first + _test_encode(&stream[first], (const uint8_t *)"two", 3);
+
+    /** Held back in place, the bytes are not consumed */
+    Handler.refuse = 1;
+    TEST_EQUAL(frame_decoder_consume(&Decoder, stream, len), 0);
+    TEST_EQUAL(frame_decoder_consume(&Decoder, stream, len), len);
+    TEST_EQUAL(Handler.count, 2);
+    TEST_CHECK(memcmp(Handler.data[0], "one", 3) == 0);
+
+    /** Held back once reassembled, the frame stays in the buffer and goes first next time */
+    _test_init();
+    TEST_EQUAL(frame_decoder_consume(&Decoder, stream, 3), 3);
+    Handler.refuse = 1;
+    TEST_EQUAL(frame_decoder_consume(&Decoder, &stream[3], len - 3), 2);
+    TEST_EQUAL(Handler.count, 0);
+    TEST_EQUAL(frame_decoder_consume(&Decoder, &stream[first], len - first), len - first);
+    TEST_EQUAL(Handler.count, 2);
+    TEST_CHECK(memcmp(Handler.data[0], "one", 3) == 0);
+    TEST_CHECK(memcmp(Handler.data[1], "two", 3) == 0);
+}
+
+/**
+ * @brief A split frame longer than the buffer is skipped, the frames after it still decode
+ */
+static void test_frame_codec_oversized(void)
+{
+    _test_init();
+    static uint8_t large[TEST_BUFFER_SIZE + 10];
+    memset(large, 'L', sizeof(large));
+    static uint8_t stream[sizeof(large) + 16];
+    uint16_t len = _test_encode(stream, large, sizeof(large));
+    len += _test_encode(&stream[len], (const uint8_t *)"ok", 2);
+
+    /** Whole in the span it is handed over in place, the buffer size does not matter */
+    TEST_EQUAL(frame_decoder_consume(&Decoder, stream, len), len);
+    TEST_EQUAL(Handler.count, 2);
+    TEST_EQUAL(Handler.lens[0], sizeof(large));
+
+    _test_init();
+    for (uint16_t i = 0; i < len; i += 7)
+    {
+        uint16_t span = len - i < 7 ? len - i : 7;
+        TEST_EQUAL(frame_decoder_consume(&Decoder, &stream[i], span), span);
+    }
+    TEST_EQUAL(Decoder.stats.oversized, 1);
+    TEST_EQUAL(Handler.count, 1);
+    TEST_EQUAL(Handler.lens[0], 2);
+    TEST_CHECK(memcmp(Handler.data[0], "ok", 2) == 0);
+}
+
+/**
+ * @brief A reset drops the frame in progress
+ */
+static void test_frame_codec_reset(void)
+{
+    _test_init();
+    uint8_t stream[64];
+    uint16_t len = _test_encode(stream, (const uint8_t *)"lost", 4);
+    frame_decoder_consume(&Decoder, stream, 3);
+    frame_decoder_reset(&Decoder);
+
+    len = _test_encode(stream, (const uint8_t *)"kept", 4);
+    TEST_EQUAL(frame_decoder_consume(&Decoder, stream, len), len);
+    TEST_EQUAL(Handler.count, 1);
+    TEST_CHECK(memcmp(Handler.data[0], "kept", 4) == 0);
+}
+
+int main(void)
+{
+    TEST_RUN(test_frame_codec_header);
+    TEST_RUN(test_frame_codec_in_place);
+    TEST_RUN(test_frame_codec_split);
+    TEST_RUN(test_frame_codec_hold_back);
+    TEST_RUN(test_frame_codec_oversized);
+    TEST_RUN(test_frame_codec_reset);
+
+    return TEST_RESULT();
+}
+
+static bool _test_handler(void *arg, const uint8_t *frame, uint16_t len)
+{
+    TestHandler_t *handler = arg;
+    if (handler->refuse > 0)
+    {
+        handler->refuse--;
+        return false;
+    }
+
+    if (handler->count < TEST_FRAMES && len <= sizeof(handler->data[0]))
+    {
+        memcpy(handler->data[handler->count], frame, len);
+        handler->lens[handler->count] = len;
+        handler->where[handler->count] = frame;
+    }
+    handler->count++;
+
+    return true;
+}
+
+static void _test_init(void)
+{
+    memset(&Handler, 0, sizeof(Handler));
+    TEST_EQUAL(frame_decoder_init(&Decoder, Buffer, sizeof(Buffer), _test_handler, &Handler), 0);
+}
+
+/**
+ * @brief Append a frame to a stream
+ * @return uint16_t Bytes appended
+ */
+static uint16_t _test_encode(uint8_t *stream, const uint8_t *frame, uint16_t len)
+{
+    frame_encode_header(stream, len);
+    if (len > 0)
+    {
+        memcpy(&stream[FRAME_HEADER_LEN], frame, len);
+    }
+    return FRAME_HEADER_LEN + len;
+}
@@ -0,0 +1,156 @@
+/** Includes *************************************************************************************/
+#include "histogram.h"
+#include "test.h"
+
+/**
+ * The log2 buckets of histogram.c at their edges, and the percentiles taken from them on an
+ * empty histogram, a single value, a spread of values and values past the last bucket.
+ */
+
+/** Defines **************************************************************************************/
+/** Typedefs *************************************************************************************/
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+/** Functions ************************************************************************************/
+
+/**
+ * @brief Bucket k holds the values of bit length k, the last one everything longer
+ */
+static void test_histogram_bucket(void)
+{
+    TEST_EQUAL(histogram_bucket(0), 0);
+    TEST_EQUAL(histogram_bucket(1), 1);
+
+    for (uint8_t k = 1; k < 32; k++)
+    {
+        uint8_t below = k < HISTOGRAM_BUCKETS - 1 ? k : HISTOGRAM_BUCKETS - 1;
+        uint8_t at = k + 1 < HISTOGRAM_BUCKETS - 1 ? k + 1 : HISTOGRAM_BUCKETS - 1;
+        TEST_EQUAL(histogram_bucket((1u << k) - 1), below);
+        TEST_EQUAL(histogram_bucket(1u << k), at);
+    }
+
+    TEST_EQUAL(histogram_bucket(1u << (HISTOGRAM_BUCKETS - 2)), HISTOGRAM_BUCKETS - 1);
+    TEST_EQUAL(histogram_bucket(UINT32_MAX), HISTOGRAM_BUCKETS - 1);
+}
+
+/**
+ * @brief Adding counts the value, its sum and the largest one, a reset empties it all
+ */
+static void test_histogram_add(void)
+{
+    Histogram_t histogram;
+    histogram_reset(&histogram);
+    histogram_add(&histogram, 0);
+    histogram_add(&histogram, 3);
+    histogram_add(&histogram, 4);
+    histogram_add(&histogram, UINT32_MAX);
+    histogram_add(NULL, 1);
+
+    TEST_EQUAL(histogram.count, 4);
+    TEST_EQUAL(histogram.max, UINT32_MAX);
+    TEST_EQUAL(histogram.sum, 7 + (uint64_t)UINT32_MAX);
+    TEST_EQUAL(histogram.buckets[0], 1);
+    TEST_EQUAL(histogram.buckets[2], 1);
+    TEST_EQUAL(histogram.buckets[3], 1);
+    TEST_EQUAL(histogram.buckets[HISTOGRAM_BUCKETS - 1], 1);
+
+    histogram_reset(&histogram);
+    TEST_EQUAL(histogram.count, 0);
+    TEST_EQUAL(histogram.max, 0);
+    TEST_EQUAL(histogram.sum, 0);
+    TEST_EQUAL(histogram.buckets[HISTOGRAM_BUCKETS - 1], 0);
+}
+
+/**
+ * @brief An empty histogram has 0 at every percentile, a single value is every percentile
+ */
+static void test_histogram_percentile_edges(void)
+{
+    static const uint8_t Percents[] = {0, 50, 100, 101, 255};
+
+    Histogram_t histogram;
+    histogram_reset(&histogram);
+    for (uint8_t i = 0; i < sizeof(Percents); i++)
+    {
+        TEST_EQUAL(histogram_percentile(&histogram, Percents[i]), 0);
+    }
+    TEST_EQUAL(histogram_percentile(NULL, 50), 0);
+
+    /** Capped to the value, not the upper bound of its bucket */
+    static const uint32_t Values[] = {0, 1, 5, 1000, 1u << 24, UINT32_MAX};
+    for (uint8_t v = 0; v < sizeof(Values) / sizeof(Values[0]); v++)
+    {
+        histogram_reset(&histogram);
+        histogram_add(&histogram, Values[v]);
+        for (uint8_t i = 0; i < sizeof(Percents); i++)
+        {
+            TEST_EQUAL(histogram_percentile(&histogram, Percents[i]), Values[v]);
+        }
+    }
+}
+
+/**
+ * @brief The percentile is the upper bound of the bucket its rank falls in, the largest value
+ *        for the last rank, past 100 is 100
+ */
+static void test_histogram_percentile_spread(void)
+{
+    Histogram_t histogram;
+    histogram_reset(&histogram);
+    for (uint8_t i = 0; i < 50; i++)
+    {
+        histogram_add(&histogram, 1);
+    }
+    for (uint8_t i = 0; i < 49; i++)
+    {
+        histogram_add(&histogram, 1000);
+    }
+    histogram_add(&histogram, 5000000);
+
+    TEST_EQUAL(histogram_percentile(&histogram, 0), 1);
+    TEST_EQUAL(histogram_percentile(&histogram, 50), 1);
+    TEST_EQUAL(histogram_percentile(&histogram, 51), 1023);
+    TEST_EQUAL(histogram_percentile(&histogram, 99), 1023);
+    TEST_EQUAL(histogram_percentile(&histogram, 100), 5000000);
+    TEST_EQUAL(histogram_percentile(&histogram, 101), 5000000);
+    TEST_EQUAL(histogram_percentile(&histogram, 255), 5000000);
+
+    /** Zeros have a bucket of their own */
+    histogram_reset(&histogram);
+    histogram_add(&histogram, 0);
+    histogram_add(&histogram, 0);
+    histogram_add(&histogram, 7);
+    TEST_EQUAL(histogram_percentile(&histogram, 66), 0);
+    TEST_EQUAL(histogram_percentile(&histogram, 67), 7);
+}
+
+/**
+ * @brief The last bucket has no upper bound, any percentile falling in it is the largest value
+ */
+static void test_histogram_percentile_last_bucket(void)
+{
+    Histogram_t histogram;
+    histogram_reset(&histogram);
+    histogram_add(&histogram, 1u << 24);
+    histogram_add(&histogram, 1u << 30);
+    histogram_add(&histogram, UINT32_MAX - 1);
+
+    TEST_EQUAL(histogram_percentile(&histogram, 0), UINT32_MAX - 1);
+    TEST_EQUAL(histogram_percentile(&histogram, 50), UINT32_MAX - 1);
+    TEST_EQUAL(histogram_percentile(&histogram, 100), UINT32_MAX - 1);
+
+    /** The bucket before the last one still has its bound */
+    histogram_add(&histogram, (1u << 23) + 1);
+    TEST_EQUAL(histogram_percentile(&histogram, 25), (1u << 24) - 1);
+}
+
+int main(void)
+{
+    TEST_RUN(test_histogram_bucket);
+    TEST_RUN(test_histogram_add);
+    TEST_RUN(test_histogram_percentile_edges);
+    TEST_RUN(test_histogram_percentile_spread);
+    TEST_RUN(test_histogram_percentile_last_bucket);
+
+    return TEST_RESULT();
+}
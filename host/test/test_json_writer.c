@@ -0,0 +1,264 @@
+/** Includes *************************************************************************************/
+#include "json_writer.h"
+#include "test.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/**
+ * The JSON encoder of json_writer.c: fixed-point numbers against printf's "%.2f", a document
+ * with every kind of value, the bounds of the buffer at every size, the errors of the nesting,
+ * and the cost of a telemetry record against the sprintf() the client used before.
+ */
+
+/** Defines **************************************************************************************/
+#define TEST_BUFFER_SIZE 256
+
+/** Records encoded by the benchmark */
+#define TEST_BENCH_RECORDS 1000000
+
+/** Typedefs *************************************************************************************/
+/** Variables ************************************************************************************/
+static char Buffer[TEST_BUFFER_SIZE];
+
+/** Prototypes ***********************************************************************************/
+static int _test_document(char *buffer, uint16_t size);
+static int _test_record(char *buffer, uint16_t size, int32_t centiC);
+static uint64_t _test_cycles(void);
+
+/** Functions ************************************************************************************/
+
+/**
+ * @brief Fixed-point values are written like printf writes them, signs and INT32_MIN included
+ */
+static void test_json_writer_fixed(void)
+{
+    static const struct
+    {
+        int32_t value;
+        uint8_t decimals;
+        const char *text;
+    } cases[] = {
+        {2345, 2, "23.45"},
+        {-5, 2, "-0.05"},
+        {0, 2, "0.00"},
+        {7, 0, "7"},
+        {-1, 9, "-0.000000001"},
+        {INT32_MIN, 0, "-2147483648"},
+        {INT32_MAX, 3, "2147483.647"},
+    };
+
+    for (uint32_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+    {
+        JsonWriter_t writer;
+        json_writer_init(&writer, Buffer, sizeof(Buffer));
+        json_writer_fixed(&writer, cases[i].value, cases[i].decimals);
+        int len = json_writer_finish(&writer);
+        TEST_EQUAL(len, strlen(cases[i].text));
+        TEST_CHECK(len > 0 && memcmp(Buffer, cases[i].text, (size_t)len) == 0);
+    }
+
+    /** Every centi-degree of the sensor range */
+    char expected[32];
+    uint32_t mismatches = 0;
+    for (int32_t centiC = -5000; centiC <= 15000; centiC++)
+    {
+        JsonWriter_t writer;
+        json_writer_init(&writer, Buffer, sizeof(Buffer));
+        json_writer_fixed(&writer, centiC, 2);
+        int len = json_writer_finish(&writer);
+        int expectedLen = snprintf(expected, sizeof(expected), "%.2f", centiC / 100.0);
+        mismatches += len != expectedLen || memcmp(Buffer, expected, (size_t)expectedLen) != 0;
+    }
+    TEST_EQUAL(mismatches, 0);
+
+    JsonWriter_t writer;
+    json_writer_init(&writer, Buffer, sizeof(Buffer));
+    json_writer_fixed(&writer, 1, 10);
+    TEST_EQUAL(json_writer_finish(&writer), -1);
+}
+
+/**
+ * @brief Objects, arrays and every kind of value, with the commas between them and the
+ *        characters of strings and keys escaped
+ */
+static void test_json_writer_document(void)
+{
+    static const char expected[] = "{\"t\":23.45,\"ok\":true,\"none\":null,\"list\":[1,-2,[],{}],"
+                                   "\"s\":\"a\\\"b\\\\c\\u000a\",\"k\\u0001\":false}";
+    int len = _test_document(Buffer, sizeof(Buffer));
+    TEST_EQUAL(len, sizeof(expected) - 1);
+    TEST_CHECK(len > 0 && memcmp(Buffer, expected, (size_t)len) == 0);
+}
+
+/**
+ * @brief At every buffer size short of the document the writer fails without writing past the
+ *        end, at the exact size it succeeds
+ */
+static void test_json_writer_bounds(void)
+{
+    int len = _test_document(Buffer, sizeof(Buffer));
+    TEST_CHECK(len > 0);
+
+    static char bounded[TEST_BUFFER_SIZE + 8];
+    for (int size = 0; size <= len; size++)
+    {
+        memset(bounded, '#', sizeof(bounded));
+        int result = _test_document(bounded, (uint16_t)size);
+        TEST_EQUAL(result, size == len ? len : -1);
+        for (uint32_t i = (uint32_t)size; i < sizeof(bounded); i++)
+        {
+            TEST_CHECK(bounded[i] == '#');
+        }
+    }
+
+    JsonWriter_t writer;
+    json_writer_init(&writer, NULL, 16);
+    json_writer_int(&writer, 1);
+    TEST_EQUAL(json_writer_finish(&writer), -1);
+}
+
+/**
+ * @brief A close without an open, an open left open, a key without its value and nesting past
+ *        JSON_WRITER_MAX_DEPTH all fail the document
+ */
+static void test_json_writer_nesting(void)
+{
+    JsonWriter_t writer;
+    json_writer_init(&writer, Buffer, sizeof(Buffer));
+    json_writer_end_object(&writer);
+    TEST_EQUAL(json_writer_finish(&writer), -1);
+
+    json_writer_init(&writer, Buffer, sizeof(Buffer));
+    json_writer_begin_array(&writer);
+    TEST_EQUAL(json_writer_finish(&writer), -1);
+
+    json_writer_init(&writer, Buffer, sizeof(Buffer));
+    json_writer_begin_object(&writer);
+    json_writer_key(&writer, "k");
+    json_writer_end_object(&writer);
+    TEST_EQUAL(json_writer_finish(&writer), -1);
+
+    json_writer_init(&writer, Buffer, sizeof(Buffer));
+    for (uint32_t i = 0; i < JSON_WRITER_MAX_DEPTH; i++)
+    {
+        json_writer_begin_array(&writer);
+    }
+    for (uint32_t i = 0; i < JSON_WRITER_MAX_DEPTH; i++)
+    {
+        json_writer_end_array(&writer);
+    }
+    TEST_EQUAL(json_writer_finish(&writer), 2 * JSON_WRITER_MAX_DEPTH);
+
+    json_writer_init(&writer, Buffer, sizeof(Buffer));
+    for (uint32_t i = 0; i <= JSON_WRITER_MAX_DEPTH; i++)
+    {
+        json_writer_begin_array(&writer);
+    }
+    TEST_EQUAL(json_writer_finish(&writer), -1);
+}
+
+/**
+ * @brief Time and cycles of a {"t": 23.45} record, against sprintf() with "%.2f" of a float
+ */
+static void test_json_writer_bench(void)
+{
+    volatile int sink = 0;
+    uint64_t startNs = test_now_ns();
+    uint64_t startCycles = _test_cycles();
+    for (uint32_t i = 0; i < TEST_BENCH_RECORDS; i++)
+    {
+        sink += _test_record(Buffer, 20, 2000 + (int32_t)(i % 1000));
+    }
+    double writerNs = (double)(test_now_ns() - startNs) / TEST_BENCH_RECORDS;
+    double writerCycles = (double)(_test_cycles() - startCycles) / TEST_BENCH_RECORDS;
+
+    startNs = test_now_ns();
+    startCycles = _test_cycles();
+    for (uint32_t i = 0; i < TEST_BENCH_RECORDS; i++)
+    {
+        volatile float temp = (2000 + (int32_t)(i % 1000)) / 100.0f;
+        sink += sprintf(Buffer, "{ \"t\": %.2f }", temp);
+    }
+    double sprintfNs = (double)(test_now_ns() - startNs) / TEST_BENCH_RECORDS;
+    double sprintfCycles = (double)(_test_cycles() - startCycles) / TEST_BENCH_RECORDS;
+    (void)sink;
+
+    /** The record fits the 20 byte buffer of the old code with room to spare */
+    TEST_EQUAL(_test_record(Buffer, 20, -27315), 13);
+    TEST_EQUAL(_test_record(Buffer, 12, -27315), -1);
+
+    printf("bench json writer: record %.0f ns %.0f cycles, sprintf %%.2f %.0f ns %.0f cycles%s\n", writerNs, writerCycles,
+           sprintfNs, sprintfCycles, _test_cycles() == 0 ? " (no cycle counter)" : "");
+}
+
+int main(void)
+{
+    TEST_RUN(test_json_writer_fixed);
+    TEST_RUN(test_json_writer_document);
+    TEST_RUN(test_json_writer_bounds);
+    TEST_RUN(test_json_writer_nesting);
+    TEST_RUN(test_json_writer_bench);
+
+    return TEST_RESULT();
+}
+
+/**
+ * @brief A document with every kind of value
+ * @return int Its length, -1 if it did not fit
+ */
+static int _test_document(char *buffer, uint16_t size)
+{
+    JsonWriter_t writer;
+    json_writer_init(&writer, buffer, size);
+    json_writer_begin_object(&writer);
+    json_writer_key(&writer, "t");
+    json_writer_fixed(&writer, 2345, 2);
+    json_writer_key(&writer, "ok");
+    json_writer_bool(&writer, true);
+    json_writer_key(&writer, "none");
+    json_writer_null(&writer);
+    json_writer_key(&writer, "list");
+    json_writer_begin_array(&writer);
+    json_writer_int(&writer, 1);
+    json_writer_int(&writer, -2);
+    json_writer_begin_array(&writer);
+    json_writer_end_array(&writer);
+    json_writer_begin_object(&writer);
+    json_writer_end_object(&writer);
+    json_writer_end_array(&writer);
+    json_writer_key(&writer, "s");
+    json_writer_string(&writer, "a\"b\\c\n");
+    json_writer_key(&writer, "k\x01");
+    json_writer_bool(&writer, false);
+    json_writer_end_object(&writer);
+    return json_writer_finish(&writer);
+}
+
+/**
+ * @brief The telemetry record, as report_policy_encode() writes it
+ */
+static int _test_record(char *buffer, uint16_t size, int32_t centiC)
+{
+    JsonWriter_t writer;
+    json_writer_init(&writer, buffer, size);
+    json_writer_begin_object(&writer);
+    json_writer_key(&writer, "t");
+    json_writer_fixed(&writer, centiC, 2);
+    json_writer_end_object(&writer);
+    return json_writer_finish(&writer);
+}
+
+/**
+ * @brief The time stamp counter where there is one, it counts at a fixed rate close to the clock
+ * @return uint64_t Cycles, 0 without a counter
+ */
+static uint64_t _test_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
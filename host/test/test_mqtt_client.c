@@ -0,0 +1,454 @@
+/** Includes *************************************************************************************/
+#include "mqtt_client.h"
+#include "fake_lwip.h"
+#include "pool_stats.h"
+#include "scheduler.h"
+#include "test.h"
+
+#include "pico/rand.h"
+
+/**
+ * The QoS 1 publishes of mqtt_client.c against the faked lwIP MQTT client of fake_lwip.c, on a
+ * simulated clock. The task is run by hand and the broker answers through fake_mqtt_answer():
+ * the completions reach the done function in handle order whatever order the PUBACKs come in,
+ * a timed out publish goes out again with its packet id, also after a reconnect, and a publish
+ * given up after MQTT_PUBLISH_MAX_ATTEMPTS does not hold back the newer ones.
+ */
+
+/** Defines **************************************************************************************/
+
+#define TEST_TASK_ID 5
+
+/** Completions logged */
+#define TEST_DONE_LOG 16
+
+/** Typedefs *************************************************************************************/
+
+/** A completion passed to the done function */
+typedef struct
+{
+    uint32_t id;
+    MqttPublishResult_t result;
+    uint16_t packetId;
+    uint8_t attempts;
+} TestDone_t;
+
+/** Variables ************************************************************************************/
+static MqttClientData_t Client;
+static TestDone_t DoneLog[TEST_DONE_LOG];
+static uint32_t DoneCount;
+static uint64_t NowUs;
+static uint32_t Wakes;
+
+/** Prototypes ***********************************************************************************/
+static void _test_connect(void);
+static void _test_reconnect(void);
+static uint32_t _test_publish(const char *topic);
+static int _test_request(uint16_t packetId);
+static uint32_t _test_sent(uint16_t packetId);
+static void _test_done(void *arg, const MqttPublishHandle_t *handle);
+
+/** Functions ************************************************************************************/
+
+/**
+ * @brief The PUBACKs of three publishes come back last first, the completions are held back and
+ *        delivered in handle order once the oldest one is acknowledged
+ */
+static void test_mqtt_client_order(void)
+{
+    _test_connect();
+
+    uint32_t handles[3];
+    for (int i = 0; i < 3; i++)
+    {
+        handles[i] = _test_publish("pico/order");
+    }
+    TEST_EQUAL(handles[1], handles[0] + 1);
+    TEST_EQUAL(handles[2], handles[0] + 2);
+    mqtt_client_task(&Client);
+
+    int requests[3];
+    for (int i = 0; i < 3; i++)
+    {
+        MqttPublishHandle_t status;
+        TEST_EQUAL(mqtt_client_get_publish(&Client, handles[i], &status), 0);
+        TEST_EQUAL(status.attempts, 1);
+        requests[i] = _test_request(status.packetId);
+        TEST_CHECK(requests[i] >= 0);
+    }
+    if (TestFailures != 0)
+    {
+        return;
+    }
+
+    TEST_EQUAL(fake_mqtt_answer((uint32_t)requests[2], ERR_OK), 0);
+    TEST_EQUAL(DoneCount, 0);
+    TEST_EQUAL(fake_mqtt_answer((uint32_t)requests[0], ERR_OK), 0);
+    TEST_EQUAL(DoneCount, 1);
+    TEST_EQUAL(fake_mqtt_answer((uint32_t)requests[1], ERR_OK), 0);
+    TEST_EQUAL(DoneCount, 3);
+
+    for (uint32_t i = 0; i < 3 && i < DoneCount; i++)
+    {
+        TEST_EQUAL(DoneLog[i].id, handles[i]);
+        TEST_EQUAL(DoneLog[i].result, MQTT_PUBLISH_ACKED);
+    }
+
+    MqttClientStats_t stats;
+    mqtt_client_get_stats(&Client, &stats);
+    TEST_EQUAL(stats.published, 3);
+    TEST_EQUAL(stats.pubacks, 3);
+    TEST_EQUAL(stats.pubExpired, 0);
+}
+
+/**
+ * @brief A publish that timed out is sent again with the packet id of its first attempt, the new
+ *        publishes still get their own, and so do both after the connection dropped and the
+ *        new connect started the packet ids of lwIP over
+ */
+static void test_mqtt_client_retransmit(void)
+{
+    _test_connect();
+
+    uint32_t first = _test_publish("pico/retransmit");
+    mqtt_client_task(&Client);
+    MqttPublishHandle_t status;
+    TEST_EQUAL(mqtt_client_get_publish(&Client, first, &status), 0);
+    uint16_t packetId = status.packetId;
+    TEST_CHECK(packetId != 0);
+    int request = _test_request(packetId);
+    TEST_CHECK(request >= 0);
+    if (request < 0)
+    {
+        return;
+    }
+
+    /** lwIP gave up waiting for the PUBACK */
+    Wakes = 0;
+    TEST_EQUAL(fake_mqtt_answer((uint32_t)request, ERR_TIMEOUT), 0);
+    TEST_EQUAL(Wakes, 1);
+    mqtt_client_task(&Client);
+    TEST_EQUAL(_test_sent(packetId), 2);
+    TEST_EQUAL(mqtt_client_get_publish(&Client, first, &status), 0);
+    TEST_EQUAL(status.packetId, packetId);
+    TEST_EQUAL(status.attempts, 2);
+    TEST_EQUAL(status.result, MQTT_PUBLISH_PENDING);
+
+    /** The packet ids lwIP hands out carry on after the resend */
+    uint32_t second = _test_publish("pico/retransmit");
+    mqtt_client_task(&Client);
+    MqttPublishHandle_t secondStatus;
+    TEST_EQUAL(mqtt_client_get_publish(&Client, second, &secondStatus), 0);
+    TEST_CHECK(secondStatus.packetId != 0 && secondStatus.packetId != packetId);
+    TEST_EQUAL(_test_sent(secondStatus.packetId), 1);
+
+    /** Both are sent again on the next connection, with their packet ids */
+    fake_mqtt_connection(MQTT_CONNECT_DISCONNECTED);
+    TEST_EQUAL(Client.taskState, MQTT_CLIENT_DISCONNECTED);
+    TEST_EQUAL(fake_mqtt_pending(), 0);
+    _test_reconnect();
+    TEST_EQUAL(_test_sent(packetId), 3);
+    TEST_EQUAL(_test_sent(secondStatus.packetId), 2);
+    TEST_EQUAL(mqtt_client_get_publish(&Client, first, &status), 0);
+    TEST_EQUAL(status.packetId, packetId);
+    TEST_EQUAL(status.attempts, 3);
+
+    uint32_t third = _test_publish("pico/retransmit");
+    mqtt_client_task(&Client);
+    MqttPublishHandle_t thirdStatus;
+    TEST_EQUAL(mqtt_client_get_publish(&Client, third, &thirdStatus), 0);
+    TEST_CHECK(thirdStatus.packetId != 0 && thirdStatus.packetId != packetId && thirdStatus.packetId != secondStatus.packetId);
+
+    /** The last attempt of each is acknowledged */
+    TEST_EQUAL(fake_mqtt_answer((uint32_t)_test_request(secondStatus.packetId), ERR_OK), 0);
+    TEST_EQUAL(fake_mqtt_answer((uint32_t)_test_request(thirdStatus.packetId), ERR_OK), 0);
+    TEST_EQUAL(DoneCount, 0);
+    TEST_EQUAL(fake_mqtt_answer((uint32_t)_test_request(packetId), ERR_OK), 0);
+    TEST_EQUAL(DoneCount, 3);
+    TEST_EQUAL(DoneLog[0].id, first);
+    TEST_EQUAL(DoneLog[0].packetId, packetId);
+    TEST_EQUAL(DoneLog[0].result, MQTT_PUBLISH_ACKED);
+    TEST_EQUAL(DoneLog[1].id, second);
+    TEST_EQUAL(DoneLog[2].id, third);
+
+    MqttClientStats_t stats;
+    mqtt_client_get_stats(&Client, &stats);
+    TEST_EQUAL(stats.pubTimeouts, 1);
+    TEST_EQUAL(stats.disconnects, 1);
+    TEST_EQUAL(stats.published, 6);
+}
+
+/**
+ * @brief A publish that times out MQTT_PUBLISH_MAX_ATTEMPTS times completes as expired, the
+ *        newer publish acknowledged behind it is delivered right after and the next ones go on
+ */
+static void test_mqtt_client_expiry(void)
+{
+    _test_connect();
+
+    uint32_t first = _test_publish("pico/expiry");
+    uint32_t second = _test_publish("pico/expiry");
+    mqtt_client_task(&Client);
+    MqttPublishHandle_t status;
+    TEST_EQUAL(mqtt_client_get_publish(&Client, first, &status), 0);
+    uint16_t packetId = status.packetId;
+    TEST_EQUAL(mqtt_client_get_publish(&Client, second, &status), 0);
+
+    /** Held back behind the first one */
+    TEST_EQUAL(fake_mqtt_answer((uint32_t)_test_request(status.packetId), ERR_OK), 0);
+    TEST_EQUAL(DoneCount, 0);
+
+    for (int attempt = 1; attempt <= MQTT_PUBLISH_MAX_ATTEMPTS; attempt++)
+    {
+        TEST_EQUAL(_test_sent(packetId), attempt);
+        int request = _test_request(packetId);
+        TEST_CHECK(request >= 0);
+        if (request < 0)
+        {
+            return;
+        }
+        TEST_EQUAL(fake_mqtt_answer((uint32_t)request, ERR_TIMEOUT), 0);
+        if (attempt < MQTT_PUBLISH_MAX_ATTEMPTS)
+        {
+            TEST_EQUAL(DoneCount, 0);
+        }
+        mqtt_client_task(&Client);
+    }
+
+    /** Given up, not sent again */
+    TEST_EQUAL(_test_sent(packetId), MQTT_PUBLISH_MAX_ATTEMPTS);
+    TEST_EQUAL(fake_mqtt_pending(), 0);
+    TEST_EQUAL(DoneCount, 2);
+    TEST_EQUAL(DoneLog[0].id, first);
+    TEST_EQUAL(DoneLog[0].result, MQTT_PUBLISH_EXPIRED);
+    TEST_EQUAL(DoneLog[0].attempts, MQTT_PUBLISH_MAX_ATTEMPTS);
+    TEST_EQUAL(DoneLog[1].id, second);
+    TEST_EQUAL(DoneLog[1].result, MQTT_PUBLISH_ACKED);
+
+    /** The slot is free and the completions are not stalled */
+    uint32_t third = _test_publish("pico/expiry");
+    mqtt_client_task(&Client);
+    TEST_EQUAL(mqtt_client_get_publish(&Client, third, &status), 0);
+    TEST_EQUAL(status.attempts, 1);
+    TEST_EQUAL(fake_mqtt_answer((uint32_t)_test_request(status.packetId), ERR_OK), 0);
+    TEST_EQUAL(DoneCount, 3);
+    TEST_EQUAL(DoneLog[2].id, third);
+    TEST_EQUAL(DoneLog[2].result, MQTT_PUBLISH_ACKED);
+
+    MqttClientStats_t stats;
+    mqtt_client_get_stats(&Client, &stats);
+    TEST_EQUAL(stats.pubExpired, 1);
+    TEST_EQUAL(stats.pubTimeouts, MQTT_PUBLISH_MAX_ATTEMPTS);
+    TEST_EQUAL(stats.pubacks, 2);
+}
+
+int main(void)
+{
+    TEST_RUN(test_mqtt_client_order);
+    TEST_RUN(test_mqtt_client_retransmit);
+    TEST_RUN(test_mqtt_client_expiry);
+
+    return TEST_RESULT();
+}
+
+/**
+ * @brief Start a new client and bring it to subscribed, the broker accepts the connect and
+ *        every SUBSCRIBE
+ */
+static void _test_connect(void)
+{
+    fake_lwip_reset();
+    memset(DoneLog, 0, sizeof(DoneLog));
+    DoneCount = 0;
+    NowUs = 1000000;
+
+    const MqttClientConfig_t config = {
+        .clientId = "test",
+        .serverIp = "192.168.7.1",
+        .port = 1883,
+    };
+    TEST_EQUAL(mqtt_client_init(&Client, &config), 0);
+    Client.taskId = TEST_TASK_ID;
+    mqtt_client_set_publish_done(&Client, _test_done, &Client);
+
+    _test_reconnect();
+}
+
+/**
+ * @brief Run the task until the client connected and subscribed again, after the backoff of a drop
+ */
+static void _test_reconnect(void)
+{
+    /** Past the longest backoff */
+    if (Client.taskState == MQTT_CLIENT_DISCONNECTED && Client.stats.connects > 0)
+    {
+        NowUs += (uint64_t)MQTT_BACKOFF_CAP_MS * 2000u;
+    }
+
+    uint32_t connects = FakeMqtt.connects;
+    mqtt_client_task(&Client);
+    TEST_EQUAL(FakeMqtt.connects, connects + 1);
+    TEST_EQUAL(Client.taskState, MQTT_CLIENT_CONNECTING);
+
+    fake_mqtt_connection(MQTT_CONNECT_ACCEPTED);
+    mqtt_client_task(&Client);
+    TEST_EQUAL(Client.taskState, MQTT_CLIENT_CONNECTED);
+
+    for (int run = 0; run < 4 && Client.taskState != MQTT_CLIENT_SUBSCRIBED; run++)
+    {
+        mqtt_client_task(&Client);
+        for (uint32_t i = 0; i < FakeMqtt.requestCount; i++)
+        {
+            if (!FakeMqtt.requests[i].publish && !FakeMqtt.requests[i].done)
+            {
+                fake_mqtt_answer(i, ERR_OK);
+            }
+        }
+    }
+    TEST_EQUAL(Client.taskState, MQTT_CLIENT_SUBSCRIBED);
+}
+
+/**
+ * @brief Queue a QoS 1 publish at normal priority
+ * @param topic The topic
+ * @return uint32_t Its handle
+ */
+static uint32_t _test_publish(const char *topic)
+{
+    static const char payload[] = "{\"v\":1}";
+    uint32_t handle = 0;
+    TEST_EQUAL(mqtt_client_publish(&Client, OUTBOX_PRIORITY_NORMAL, topic, payload, sizeof(payload) - 1, 1, &handle), OUTBOX_QUEUED);
+    TEST_CHECK(handle != 0);
+
+    return handle;
+}
+
+/**
+ * @brief Find the last attempt of a publish
+ * @param packetId Its packet id
+ * @return int Index of the request in FakeMqtt.requests, -1 if it was not sent or was answered
+ */
+static int _test_request(uint16_t packetId)
+{
+    for (int i = (int)FakeMqtt.requestCount - 1; i >= 0; i--)
+    {
+        const FakeMqttRequest_t *request = &FakeMqtt.requests[i];
+        if (request->publish && request->packetId == packetId)
+        {
+            return request->done ? -1 : i;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * @brief Count the times a publish was sent
+ * @param packetId Its packet id
+ * @return uint32_t The count
+ */
+static uint32_t _test_sent(uint16_t packetId)
+{
+    uint32_t sent = 0;
+    for (uint32_t i = 0; i < FakeMqtt.requestCount; i++)
+    {
+        sent += FakeMqtt.requests[i].publish && FakeMqtt.requests[i].packetId == packetId;
+    }
+
+    return sent;
+}
+
+/**
+ * @brief Done function of the client, logs the completions
+ * @param arg The client
+ * @param handle The completed publish
+ */
+static void _test_done(void *arg, const MqttPublishHandle_t *handle)
+{
+    TEST_CHECK(arg == &Client);
+    if (DoneCount < TEST_DONE_LOG)
+    {
+        DoneLog[DoneCount] = (TestDone_t){
+            .id = handle->id,
+            .result = handle->result,
+            .packetId = handle->packetId,
+            .attempts = handle->attempts,
+        };
+    }
+    DoneCount++;
+}
+
+/** The platform, the scheduler and the application core, declared by their headers */
+
+uint64_t time_us_64(void)
+{
+    return NowUs;
+}
+
+uint32_t get_rand_32(void)
+{
+    return 0x12345678u;
+}
+
+void panic(const char *fmt, ...)
+{
+    printf("panic: %s\n", fmt);
+    abort();
+}
+
+int scheduler_wake(int taskId)
+{
+    TEST_EQUAL(taskId, TEST_TASK_ID);
+    Wakes++;
+    return 0;
+}
+
+int scheduler_delay(int taskId, uint32_t delayMs)
+{
+    (void)delayMs;
+    TEST_EQUAL(taskId, TEST_TASK_ID);
+    return 0;
+}
+
+int app_core_read_sample(AppCore_t *app, MqttTopic_t *topic, MqttPayloadFormat_t *format, char *payload)
+{
+    (void)app;
+    (void)topic;
+    (void)format;
+    (void)payload;
+    return 0;
+}
+
+void app_core_get_report_stats(const AppCore_t *app, ReportPolicyStats_t *stats)
+{
+    (void)app;
+    memset(stats, 0, sizeof(*stats));
+}
+
+int app_core_send_command(AppCore_t *app, AppCoreMsg_t msg, MqttTopic_t topic, const uint8_t *payload, uint32_t len)
+{
+    (void)app;
+    (void)msg;
+    (void)topic;
+    (void)payload;
+    (void)len;
+    return -1;
+}
+
+int pool_stats_count(void)
+{
+    return 0;
+}
+
+int pool_stats_get(int index, PoolStats_t *stats)
+{
+    (void)index;
+    (void)stats;
+    return -1;
+}
+
+void pool_stats_totals(uint32_t *totalBytes, uint32_t *peakBytes)
+{
+    *totalBytes = 0;
+    *peakBytes = 0;
+}
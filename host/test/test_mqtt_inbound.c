@@ -0,0 +1,335 @@
+/** Includes *************************************************************************************/
+#include "lwipopts.h"
+#include "mqtt_inbound.h"
+#include "test.h"
+
+/**
+ * The reassembly of incoming publishes of mqtt_inbound.c, fed the way the lwIP publish and data
+ * callbacks feed it: payloads split over fragments, payloads the size of the lwIP buffer,
+ * fragments longer than the publish header announced, topics and payloads too long to keep, a
+ * publish that cuts the previous one short, and the offsets passed to a streaming handler.
+ */
+
+/** Defines **************************************************************************************/
+#define TEST_GUARD_SIZE 64
+#define TEST_GUARD 0xA5
+
+/** Fragments recorded from a streaming handler */
+#define TEST_MAX_FRAGMENTS 16
+
+/** Typedefs *************************************************************************************/
+
+/** The reassembly state with guard bytes right after it */
+typedef struct
+{
+    MqttInbound_t inbound;
+    uint8_t guard[TEST_GUARD_SIZE];
+} TestInbound_t;
+
+/** A fragment passed to the streaming handler */
+typedef struct
+{
+    uint16_t len;
+    uint32_t offset;
+    uint32_t totLen;
+    bool last;
+} TestFragment_t;
+
+/** What the handlers got */
+typedef struct
+{
+    uint32_t messages;
+    uint8_t payload[MQTT_OUTPUT_RINGBUF_SIZE + 1];
+    uint32_t len;
+    bool terminated; /** The buffered payload ended in '\0' */
+    char topic[MQTT_INBOUND_TOPIC_LEN];
+    TestFragment_t fragments[TEST_MAX_FRAGMENTS];
+    uint32_t fragmentCount;
+} TestReceived_t;
+
+/** Variables ************************************************************************************/
+static TestInbound_t Test;
+static TestReceived_t Received;
+static uint8_t Payload[MQTT_OUTPUT_RINGBUF_SIZE + 64];
+
+/** Prototypes ***********************************************************************************/
+static void _test_init(void);
+static bool _test_guard_intact(void);
+static void _test_send(const char *topic, uint32_t totLen, const uint16_t *lens, uint32_t count);
+static void _test_message(void *arg, const char *topic, const uint8_t *payload, uint32_t len);
+static void _test_stream(void *arg, const char *topic, const uint8_t *data, uint16_t len, uint32_t offset, uint32_t totLen, bool last);
+
+/** Functions ************************************************************************************/
+
+/**
+ * @brief A payload split over fragments of every shape comes back whole to a buffered handler
+ */
+static void test_mqtt_inbound_fragments(void)
+{
+    static const uint16_t lens[] = {1, 200, 0, 57, 142};
+    _test_init();
+    _test_send("pico/cmd/config", 400, lens, sizeof(lens) / sizeof(lens[0]));
+
+    TEST_EQUAL(Received.messages, 1);
+    TEST_EQUAL(Received.len, 400);
+    TEST_CHECK(memcmp(Received.payload, Payload, 400) == 0);
+    TEST_CHECK(Received.terminated);
+    TEST_CHECK(strcmp(Received.topic, "pico/cmd/config") == 0);
+    TEST_EQUAL(Test.inbound.stats.messages, 1);
+    TEST_EQUAL(Test.inbound.stats.fragments, 5);
+    TEST_EQUAL(Test.inbound.stats.bytes, 400);
+
+    /** The slab is released, the next message starts from an empty arena */
+    TEST_EQUAL(Test.inbound.arenaUsed, 0);
+    TEST_CHECK(Test.inbound.slab == NULL);
+    TEST_CHECK(_test_guard_intact());
+}
+
+/**
+ * @brief A payload as large as the lwIP output buffer, which the old copy wrote one byte past the
+ *        end for, is refused by the arena that can't also hold its terminator and streamed whole.
+ *        One byte less fills the arena exactly.
+ */
+static void test_mqtt_inbound_ringbuf_size(void)
+{
+    _test_init();
+    uint16_t lens[] = {MQTT_OUTPUT_RINGBUF_SIZE / 2, MQTT_OUTPUT_RINGBUF_SIZE / 2};
+    _test_send("pico/cmd/config", MQTT_OUTPUT_RINGBUF_SIZE, lens, 2);
+    TEST_EQUAL(Received.messages, MQTT_OUTPUT_RINGBUF_SIZE + 1 <= MQTT_INBOUND_ARENA_SIZE ? 1 : 0);
+    TEST_EQUAL(Test.inbound.stats.tooLarge, MQTT_OUTPUT_RINGBUF_SIZE + 1 <= MQTT_INBOUND_ARENA_SIZE ? 0 : 1);
+    TEST_CHECK(_test_guard_intact());
+
+    lens[1] = MQTT_INBOUND_ARENA_SIZE - 1 - lens[0];
+    _test_send("pico/cmd/config", MQTT_INBOUND_ARENA_SIZE - 1, lens, 2);
+    TEST_EQUAL(Received.messages, 1);
+    TEST_EQUAL(Received.len, MQTT_INBOUND_ARENA_SIZE - 1);
+    TEST_CHECK(Received.terminated);
+    TEST_CHECK(memcmp(Received.payload, Payload, MQTT_INBOUND_ARENA_SIZE - 1) == 0);
+    TEST_CHECK(_test_guard_intact());
+
+    lens[1] = MQTT_OUTPUT_RINGBUF_SIZE / 2;
+    _test_send("pico/ota/chunk", MQTT_OUTPUT_RINGBUF_SIZE, lens, 2);
+    TEST_EQUAL(Received.messages, 1);
+    TEST_EQUAL(Received.len, MQTT_OUTPUT_RINGBUF_SIZE);
+    TEST_CHECK(memcmp(Received.payload, Payload, MQTT_OUTPUT_RINGBUF_SIZE) == 0);
+    TEST_CHECK(_test_guard_intact());
+}
+
+/**
+ * @brief Fragment bytes beyond the length the publish header announced are cut off
+ */
+static void test_mqtt_inbound_clamp(void)
+{
+    static const uint16_t lens[] = {30, 50};
+    _test_init();
+    _test_send("pico/cmd/config", 40, lens, 2);
+    TEST_EQUAL(Received.messages, 1);
+    TEST_EQUAL(Received.len, 40);
+    TEST_CHECK(Received.terminated);
+    TEST_EQUAL(Test.inbound.received, 40);
+    TEST_EQUAL(Test.inbound.stats.bytes, 80);
+
+    /** Enough to run off the end of the arena if it was not cut */
+    static const uint16_t longLens[] = {sizeof(Payload)};
+    _test_send("pico/cmd/config", 8, longLens, 1);
+    TEST_EQUAL(Received.len, 8);
+    TEST_CHECK(_test_guard_intact());
+
+    _test_send("pico/ota/chunk", 40, lens, 2);
+    TEST_EQUAL(Received.fragmentCount, 2);
+    TEST_EQUAL(Received.fragments[0].len, 30);
+    TEST_EQUAL(Received.fragments[1].len, 10);
+    TEST_EQUAL(Received.len, 40);
+}
+
+/**
+ * @brief A topic that does not fit is unhandled, as is one no filter matches, and their data is
+ *        dropped
+ */
+static void test_mqtt_inbound_unhandled(void)
+{
+    static const uint16_t lens[] = {10};
+    char topic[MQTT_INBOUND_TOPIC_LEN + 8];
+    _test_init();
+
+    /** "pico/cmd/config" padded out so "pico/cmd/#" would match it */
+    memset(topic, 'x', sizeof(topic));
+    memcpy(topic, "pico/cmd/", 9);
+    topic[MQTT_INBOUND_TOPIC_LEN] = '\0';
+    _test_send(topic, 10, lens, 1);
+    TEST_EQUAL(Test.inbound.stats.unhandled, 1);
+    TEST_EQUAL(Received.messages, 0);
+
+    topic[MQTT_INBOUND_TOPIC_LEN - 1] = '\0';
+    _test_send(topic, 10, lens, 1);
+    TEST_EQUAL(Test.inbound.stats.unhandled, 1);
+    TEST_EQUAL(Received.messages, 1);
+
+    _test_send("other/topic", 10, lens, 1);
+    TEST_EQUAL(Test.inbound.stats.unhandled, 2);
+    TEST_EQUAL(Received.messages, 0);
+    TEST_EQUAL(Test.inbound.stats.messages, 1);
+}
+
+/**
+ * @brief A buffered payload the arena can't hold is counted and its data discarded, the next
+ *        message is delivered
+ */
+static void test_mqtt_inbound_too_large(void)
+{
+    static const uint16_t lens[] = {MQTT_INBOUND_ARENA_SIZE / 2, MQTT_INBOUND_ARENA_SIZE / 2};
+    _test_init();
+    _test_send("pico/cmd/config", MQTT_INBOUND_ARENA_SIZE, lens, 2);
+    TEST_EQUAL(Test.inbound.stats.tooLarge, 1);
+    TEST_EQUAL(Test.inbound.stats.messages, 0);
+    TEST_EQUAL(Received.messages, 0);
+    TEST_EQUAL(Test.inbound.arenaUsed, 0);
+    TEST_CHECK(_test_guard_intact());
+
+    static const uint16_t small[] = {12};
+    _test_send("pico/cmd/config", 12, small, 1);
+    TEST_EQUAL(Received.messages, 1);
+    TEST_EQUAL(Test.inbound.stats.tooLarge, 1);
+}
+
+/**
+ * @brief A publish that arrives before the last fragment of the previous one releases its slab,
+ *        so two payloads that only fit one at a time are both taken
+ */
+static void test_mqtt_inbound_cut_short(void)
+{
+    const uint32_t totLen = MQTT_INBOUND_ARENA_SIZE / 2 + 10;
+    _test_init();
+
+    mqtt_inbound_publish(&Test.inbound, "pico/cmd/config", totLen);
+    TEST_EQUAL(Test.inbound.arenaUsed, totLen + 1);
+    mqtt_inbound_data(&Test.inbound, Payload, 100, false);
+
+    const uint16_t lens[] = {(uint16_t)totLen};
+    _test_send("pico/cmd/config", totLen, lens, 1);
+    TEST_EQUAL(Test.inbound.stats.tooLarge, 0);
+    TEST_EQUAL(Received.messages, 1);
+    TEST_EQUAL(Received.len, totLen);
+    TEST_CHECK(memcmp(Received.payload, Payload, totLen) == 0);
+    TEST_EQUAL(Test.inbound.arenaUsed, 0);
+}
+
+/**
+ * @brief A streaming handler gets every fragment in place with its offset, the total length and
+ *        the last flag, and nothing is copied into the arena
+ */
+static void test_mqtt_inbound_stream(void)
+{
+    static const uint16_t lens[] = {100, 0, 250, 7};
+    _test_init();
+    _test_send("pico/ota/chunk", 357, lens, 4);
+
+    static const uint32_t offsets[] = {0, 100, 100, 350};
+    TEST_EQUAL(Received.fragmentCount, 4);
+    for (uint32_t i = 0; i < 4; i++)
+    {
+        TEST_EQUAL(Received.fragments[i].len, lens[i]);
+        TEST_EQUAL(Received.fragments[i].offset, offsets[i]);
+        TEST_EQUAL(Received.fragments[i].totLen, 357);
+        TEST_EQUAL(Received.fragments[i].last, i == 3);
+    }
+    TEST_EQUAL(Received.len, 357);
+    TEST_CHECK(memcmp(Received.payload, Payload, 357) == 0);
+    TEST_CHECK(strcmp(Received.topic, "pico/ota/chunk") == 0);
+    TEST_EQUAL(Test.inbound.arenaUsed, 0);
+    TEST_EQUAL(Test.inbound.stats.messages, 1);
+}
+
+int main(void)
+{
+    for (uint32_t i = 0; i < sizeof(Payload); i++)
+    {
+        Payload[i] = (uint8_t)('a' + i % 26);
+    }
+
+    TEST_RUN(test_mqtt_inbound_fragments);
+    TEST_RUN(test_mqtt_inbound_ringbuf_size);
+    TEST_RUN(test_mqtt_inbound_clamp);
+    TEST_RUN(test_mqtt_inbound_unhandled);
+    TEST_RUN(test_mqtt_inbound_too_large);
+    TEST_RUN(test_mqtt_inbound_cut_short);
+    TEST_RUN(test_mqtt_inbound_stream);
+
+    return TEST_RESULT();
+}
+
+/**
+ * @brief A buffered handler for "pico/cmd/#" and a streaming one for "pico/ota/#", guard bytes set
+ */
+static void _test_init(void)
+{
+    mqtt_inbound_init(&Test.inbound);
+    memset(Test.guard, TEST_GUARD, sizeof(Test.guard));
+    TEST_EQUAL(mqtt_inbound_register_message(&Test.inbound, "pico/cmd/#", 1, _test_message, &Received), 0);
+    TEST_EQUAL(mqtt_inbound_register_stream(&Test.inbound, "pico/ota/#", 1, _test_stream, &Received), 0);
+    TEST_EQUAL(mqtt_inbound_register_stream(&Test.inbound, "pico/ota/#", 1, NULL, NULL), -1);
+}
+
+/**
+ * @brief Check nothing was written past the reassembly state
+ */
+static bool _test_guard_intact(void)
+{
+    for (uint32_t i = 0; i < sizeof(Test.guard); i++)
+    {
+        if (Test.guard[i] != TEST_GUARD)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Feed a message the way lwIP does, the publish then Payload in fragments
+ * @param topic The topic
+ * @param totLen The length the publish header announces
+ * @param lens Length of each fragment, the last one carries the last flag
+ * @param count Number of fragments
+ */
+static void _test_send(const char *topic, uint32_t totLen, const uint16_t *lens, uint32_t count)
+{
+    memset(&Received, 0, sizeof(Received));
+    mqtt_inbound_publish(&Test.inbound, topic, totLen);
+
+    uint32_t offset = 0;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        mqtt_inbound_data(&Test.inbound, &Payload[offset < sizeof(Payload) ? offset : 0], lens[i], i + 1 == count);
+        offset += lens[i];
+    }
+}
+
+static void _test_message(void *arg, const char *topic, const uint8_t *payload, uint32_t len)
+{
+    TestReceived_t *received = arg;
+    received->messages++;
+    received->len = len;
+    received->terminated = payload[len] == '\0';
+    if (len <= sizeof(received->payload))
+    {
+        memcpy(received->payload, payload, len);
+    }
+    strncpy(received->topic, topic, sizeof(received->topic) - 1);
+}
+
+static void _test_stream(void *arg, const char *topic, const uint8_t *data, uint16_t len, uint32_t offset, uint32_t totLen, bool last)
+{
+    TestReceived_t *received = arg;
+    if (received->fragmentCount < TEST_MAX_FRAGMENTS)
+    {
+        received->fragments[received->fragmentCount++] = (TestFragment_t){.len = len, .offset = offset, .totLen = totLen, .last = last};
+    }
+    if (offset + len <= sizeof(received->payload))
+    {
+        memcpy(&received->payload[offset], data, len);
+    }
+    received->len = offset + len;
+    received->messages += last;
+    strncpy(received->topic, topic, sizeof(received->topic) - 1);
+}
@@ -0,0 +1,333 @@
+/** Includes *************************************************************************************/
+#include "msg_queue.h"
+#include "test.h"
+
+#include <pthread.h>
+#include <sched.h>
+
+/**
+ * The message queue of msg_queue.c between the two cores: messages whole or not at all, bodies
+ * too large for the consumer, a header seen before its body, and a producer and a consumer thread
+ * standing in for core 1 and core 0 streaming messages of random length through it.
+ */
+
+/** Defines **************************************************************************************/
+#define TEST_QUEUE_SIZE 64
+
+/** Messages streamed through the queue by the stress test, over a queue the size of the samples one */
+#define TEST_STRESS_MESSAGES 2000000u
+#define TEST_STRESS_QUEUE_SIZE 2048
+#define TEST_STRESS_MAX_LEN 64
+
+/** Push and pop pairs timed on one thread */
+#define TEST_BENCH_MESSAGES 1000000u
+
+/** A sample body, the format byte and APP_CORE_SAMPLE_LEN */
+#define TEST_SAMPLE_LEN 33
+
+/** Typedefs *************************************************************************************/
+
+/** One side of the stress test */
+typedef struct
+{
+    MsgQueue_t *queue;
+    uint32_t seed;   /** Of the body lengths, the same on both sides */
+    uint32_t errors; /** Messages read that were not the ones pushed */
+    uint64_t stalls; /** Calls that moved nothing */
+    uint64_t bytes;  /** Body bytes moved */
+} TestStressSide_t;
+
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+static uint8_t _test_byte(uint32_t message, uint32_t index);
+static uint32_t _test_rand(uint32_t *seed);
+static void *_test_producer(void *arg);
+static void *_test_consumer(void *arg);
+
+/** Functions ************************************************************************************/
+
+/**
+ * @brief Sizes that are not a power of two and bodies without data are refused
+ */
+static void test_msg_queue_init(void)
+{
+    MsgQueue_t queue;
+    uint8_t storage[TEST_QUEUE_SIZE];
+    TEST_EQUAL(msg_queue_init(NULL, storage, sizeof(storage)), -1);
+    TEST_EQUAL(msg_queue_init(&queue, storage, 48), -1);
+    TEST_EQUAL(msg_queue_init(&queue, storage, sizeof(storage)), 0);
+    TEST_EQUAL(msg_queue_push(&queue, 1, 2, NULL, 4), -1);
+    TEST_EQUAL(msg_queue_push(NULL, 1, 2, NULL, 0), -1);
+}
+
+/**
+ * @brief Messages come out in order with their type, argument and body, empty bodies included
+ */
+static void test_msg_queue_order(void)
+{
+    MsgQueue_t queue;
+    uint8_t storage[TEST_QUEUE_SIZE];
+    msg_queue_init(&queue, storage, sizeof(storage));
+
+    MsgQueueHeader_t header;
+    uint8_t body[TEST_QUEUE_SIZE];
+    TEST_EQUAL(msg_queue_pop(&queue, &header, body, sizeof(body)), 0);
+
+    TEST_EQUAL(msg_queue_push(&queue, 1, 10, "abc", 3), 0);
+    TEST_EQUAL(msg_queue_push(&queue, 2, 20, NULL, 0), 0);
+    TEST_EQUAL(msg_queue_push(&queue, 3, 30, "de", 2), 0);
+
+    TEST_EQUAL(msg_queue_pop(&queue, &header, body, sizeof(body)), 1);
+    TEST_EQUAL(header.type, 1);
+    TEST_EQUAL(header.arg, 10);
+    TEST_EQUAL(header.len, 3);
+    TEST_CHECK(memcmp(body, "abc", 3) == 0);
+    TEST_EQUAL(msg_queue_pop(&queue, &header, NULL, 0), 1);
+    TEST_EQUAL(header.type, 2);
+    TEST_EQUAL(header.len, 0);
+    TEST_EQUAL(msg_queue_pop(&queue, &header, body, sizeof(body)), 1);
+    TEST_EQUAL(header.type, 3);
+    TEST_EQUAL(header.arg, 30);
+    TEST_CHECK(memcmp(body, "de", 2) == 0);
+    TEST_EQUAL(msg_queue_pop(&queue, &header, body, sizeof(body)), 0);
+}
+
+/**
+ * @brief A message that does not fit leaves nothing of itself in a full queue and is counted,
+ *        the space comes back as messages are taken
+ */
+static void test_msg_queue_full(void)
+{
+    MsgQueue_t queue;
+    uint8_t storage[TEST_QUEUE_SIZE];
+    msg_queue_init(&queue, storage, sizeof(storage));
+
+    uint8_t body[TEST_QUEUE_SIZE] = {0};
+    const uint16_t len = 12;
+    uint32_t pushed = 0;
+    while (msg_queue_push(&queue, (uint8_t)pushed, 0, body, len) == 0)
+    {
+        pushed++;
+    }
+    TEST_EQUAL(pushed, TEST_QUEUE_SIZE / (sizeof(MsgQueueHeader_t) + len));
+    TEST_EQUAL(queue.dropped, 1);
+    TEST_EQUAL(ring_buffer_used(&queue.ring), pushed * (sizeof(MsgQueueHeader_t) + len));
+
+    /** Larger than the whole queue */
+    TEST_EQUAL(msg_queue_push(&queue, 0, 0, body, TEST_QUEUE_SIZE), -1);
+    TEST_EQUAL(queue.dropped, 2);
+
+    MsgQueueHeader_t header;
+    TEST_EQUAL(msg_queue_pop(&queue, &header, body, sizeof(body)), 1);
+    TEST_EQUAL(header.type, 0);
+    TEST_EQUAL(msg_queue_push(&queue, 0xEE, 0, body, len), 0);
+    for (uint32_t i = 1; i < pushed; i++)
+    {
+        TEST_EQUAL(msg_queue_pop(&queue, &header, body, sizeof(body)), 1);
+        TEST_EQUAL(header.type, i);
+    }
+    TEST_EQUAL(msg_queue_pop(&queue, &header, body, sizeof(body)), 1);
+    TEST_EQUAL(header.type, 0xEE);
+    TEST_EQUAL(msg_queue_pop(&queue, &header, body, sizeof(body)), 0);
+}
+
+/**
+ * @brief A body larger than the consumer's buffer is dropped with its header returned, the next
+ *        message is intact
+ */
+static void test_msg_queue_oversize(void)
+{
+    MsgQueue_t queue;
+    uint8_t storage[TEST_QUEUE_SIZE];
+    msg_queue_init(&queue, storage, sizeof(storage));
+
+    msg_queue_push(&queue, 7, 1, "0123456789", 10);
+    msg_queue_push(&queue, 8, 2, "xy", 2);
+
+    MsgQueueHeader_t header;
+    uint8_t body[4];
+    TEST_EQUAL(msg_queue_pop(&queue, &header, body, sizeof(body)), -1);
+    TEST_EQUAL(header.type, 7);
+    TEST_EQUAL(header.len, 10);
+    TEST_EQUAL(msg_queue_pop(&queue, &header, body, sizeof(body)), 1);
+    TEST_EQUAL(header.type, 8);
+    TEST_CHECK(memcmp(body, "xy", 2) == 0);
+}
+
+/**
+ * @brief A header whose body is not written yet is kept by the consumer until the body is there,
+ *        as when core 1 is between the two writes of a push
+ */
+static void test_msg_queue_pending(void)
+{
+    MsgQueue_t queue;
+    uint8_t storage[TEST_QUEUE_SIZE];
+    msg_queue_init(&queue, storage, sizeof(storage));
+
+    const MsgQueueHeader_t written = {.len = 4, .type = 5, .arg = 6};
+    ring_buffer_write(&queue.ring, (const uint8_t *)&written, sizeof(written));
+
+    MsgQueueHeader_t header;
+    uint8_t body[TEST_QUEUE_SIZE];
+    TEST_EQUAL(msg_queue_pop(&queue, &header, body, sizeof(body)), 0);
+    TEST_CHECK(queue.hasPending);
+    ring_buffer_write(&queue.ring, (const uint8_t *)"ab", 2);
+    TEST_EQUAL(msg_queue_pop(&queue, &header, body, sizeof(body)), 0);
+    ring_buffer_write(&queue.ring, (const uint8_t *)"cd", 2);
+
+    TEST_EQUAL(msg_queue_pop(&queue, &header, body, sizeof(body)), 1);
+    TEST_CHECK(!queue.hasPending);
+    TEST_EQUAL(header.type, 5);
+    TEST_EQUAL(header.arg, 6);
+    TEST_EQUAL(header.len, 4);
+    TEST_CHECK(memcmp(body, "abcd", 4) == 0);
+}
+
+/**
+ * @brief A producer and a consumer thread stream messages of random length through the queue,
+ *        every one arrives whole and in order, and the throughput of the queue
+ */
+static void test_msg_queue_stress(void)
+{
+    static uint8_t storage[TEST_STRESS_QUEUE_SIZE];
+    MsgQueue_t queue;
+    msg_queue_init(&queue, storage, sizeof(storage));
+
+    TestStressSide_t producer = {.queue = &queue, .seed = 1};
+    TestStressSide_t consumer = {.queue = &queue, .seed = 1};
+    pthread_t producerThread;
+    pthread_t consumerThread;
+
+    uint64_t startNs = test_now_ns();
+    pthread_create(&producerThread, NULL, _test_producer, &producer);
+    pthread_create(&consumerThread, NULL, _test_consumer, &consumer);
+    pthread_join(producerThread, NULL);
+    pthread_join(consumerThread, NULL);
+    uint64_t elapsedNs = test_now_ns() - startNs;
+
+    TEST_EQUAL(consumer.errors, 0);
+    TEST_EQUAL(consumer.bytes, producer.bytes);
+    TEST_EQUAL(queue.dropped, producer.stalls);
+    TEST_EQUAL(ring_buffer_used(&queue.ring), 0);
+
+    printf("bench msg queue: %u messages, %.1f MiB of body through %u bytes in %.1f ms, %.2f M messages/s, "
+           "%" PRIu64 " full and %" PRIu64 " empty calls\n",
+           TEST_STRESS_MESSAGES, consumer.bytes / 1048576.0, TEST_STRESS_QUEUE_SIZE, elapsedNs / 1e6,
+           TEST_STRESS_MESSAGES / (elapsedNs / 1e3), producer.stalls, consumer.stalls);
+}
+
+/**
+ * @brief Time of a push and a pop of a sample on one thread, the cost without contention
+ */
+static void test_msg_queue_bench(void)
+{
+    static uint8_t storage[TEST_STRESS_QUEUE_SIZE];
+    MsgQueue_t queue;
+    msg_queue_init(&queue, storage, sizeof(storage));
+
+    uint8_t sample[TEST_SAMPLE_LEN];
+    memset(sample, 0x5A, sizeof(sample));
+    MsgQueueHeader_t header;
+    uint8_t body[TEST_SAMPLE_LEN];
+    volatile uint32_t sink = 0;
+
+    uint64_t startNs = test_now_ns();
+    for (uint32_t i = 0; i < TEST_BENCH_MESSAGES; i++)
+    {
+        msg_queue_push(&queue, 1, (uint8_t)i, sample, sizeof(sample));
+        sink += (uint32_t)msg_queue_pop(&queue, &header, body, sizeof(body));
+    }
+    double pairNs = (double)(test_now_ns() - startNs) / TEST_BENCH_MESSAGES;
+
+    TEST_EQUAL(sink, TEST_BENCH_MESSAGES);
+    printf("bench msg queue: push and pop of a %u byte sample %.0f ns\n", TEST_SAMPLE_LEN, pairNs);
+}
+
+int main(void)
+{
+    TEST_RUN(test_msg_queue_init);
+    TEST_RUN(test_msg_queue_order);
+    TEST_RUN(test_msg_queue_full);
+    TEST_RUN(test_msg_queue_oversize);
+    TEST_RUN(test_msg_queue_pending);
+    TEST_RUN(test_msg_queue_stress);
+    TEST_RUN(test_msg_queue_bench);
+
+    return TEST_RESULT();
+}
+
+/**
+ * @brief A byte of a message body, not periodic in the queue size
+ */
+static uint8_t _test_byte(uint32_t message, uint32_t index)
+{
+    return (uint8_t)(((message << 6) + index) * 2654435761u >> 24);
+}
+
+/**
+ * @brief xorshift32
+ */
+static uint32_t _test_rand(uint32_t *seed)
+{
+    uint32_t x = *seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *seed = x;
+    return x;
+}
+
+static void *_test_producer(void *arg)
+{
+    TestStressSide_t *side = arg;
+    uint8_t body[TEST_STRESS_MAX_LEN];
+
+    for (uint32_t message = 0; message < TEST_STRESS_MESSAGES; message++)
+    {
+        uint16_t len = (uint16_t)(_test_rand(&side->seed) % (TEST_STRESS_MAX_LEN + 1));
+        for (uint32_t i = 0; i < len; i++)
+        {
+            body[i] = _test_byte(message, i);
+        }
+
+        /** A full queue is counted as dropped, the same message is pushed again */
+        while (msg_queue_push(side->queue, (uint8_t)message, (uint8_t)(message >> 8), body, len) != 0)
+        {
+            side->stalls++;
+            sched_yield();
+        }
+        side->bytes += len;
+    }
+
+    return NULL;
+}
+
+static void *_test_consumer(void *arg)
+{
+    TestStressSide_t *side = arg;
+    uint8_t body[TEST_STRESS_MAX_LEN];
+
+    for (uint32_t message = 0; message < TEST_STRESS_MESSAGES;)
+    {
+        MsgQueueHeader_t header;
+        int rc = msg_queue_pop(side->queue, &header, body, sizeof(body));
+        if (rc == 0)
+        {
+            side->stalls++;
+            sched_yield();
+            continue;
+        }
+
+        uint16_t len = (uint16_t)(_test_rand(&side->seed) % (TEST_STRESS_MAX_LEN + 1));
+        bool whole = rc == 1 && header.len == len && header.type == (uint8_t)message && header.arg == (uint8_t)(message >> 8);
+        for (uint32_t i = 0; whole && i < len; i++)
+        {
+            whole = body[i] == _test_byte(message, i);
+        }
+        side->errors += !whole;
+        side->bytes += header.len;
+        message++;
+    }
+
+    return NULL;
+}
@@ -0,0 +1,418 @@
+/** Includes *************************************************************************************/
+#include "outbox.h"
+#include "test.h"
+
+/**
+ * The overload policies of outbox.c: the oldest entry making room and the drop function told
+ * about it, the new publish turned away, the producer held back until the block deadline and
+ * then turned away, the higher priorities sent first, and the counters against a model of the
+ * queues fed with random publishes and pumps.
+ */
+
+/** Defines **************************************************************************************/
+
+/** Depth of every queue in the cases */
+#define TEST_DEPTH 3
+
+#define TEST_BLOCK_MS 100
+
+/** Entries sent or dropped that are logged */
+#define TEST_LOG_SIZE 64
+
+/** Random publishes and pumps of the counters case */
+#define TEST_STEPS 20000
+
+/** Typedefs *************************************************************************************/
+
+/** The send and drop functions, they log the tags */
+typedef struct
+{
+    uint32_t sent[TEST_LOG_SIZE];
+    uint32_t sentCount;
+    uint32_t dropped[TEST_LOG_SIZE];
+    uint32_t droppedCount;
+    uint32_t room;  /** Entries the send function takes before it has no room */
+    bool qos0Only;  /** Only QoS 0 entries are taken, like while the in-flight window is full */
+    bool logging;   /** Off for the counters case */
+} TestNetwork_t;
+
+/** Variables ************************************************************************************/
+static TestNetwork_t Network;
+static Outbox_t Outbox;
+static OutboxEntry_t Entries[TEST_DEPTH * OUTBOX_PRIORITY_MAX];
+static uint32_t Seed = 1;
+
+/** Prototypes ***********************************************************************************/
+static void _test_init(OutboxPolicy_t policy);
+static OutboxStatus_t _test_publish(OutboxPriority_t priority, uint32_t tag, uint32_t nowMs);
+static int _test_send(void *arg, const OutboxEntry_t *entry);
+static void _test_drop(void *arg, const OutboxEntry_t *entry);
+static uint32_t _test_rand(void);
+
+/** Functions ************************************************************************************/
+
+/**
+ * @brief A full OUTBOX_DROP_OLDEST queue takes every publish, the oldest entry makes room and the
+ *        drop function gets it, the entries are sent oldest first
+ */
+static void test_outbox_drop_oldest(void)
+{
+    _test_init(OUTBOX_DROP_OLDEST);
+
+    for (uint32_t tag = 1; tag <= TEST_DEPTH + 2; tag++)
+    {
+        TEST_EQUAL(_test_publish(OUTBOX_PRIORITY_LOW, tag, 0), OUTBOX_QUEUED);
+    }
+    TEST_EQUAL(Network.droppedCount, 2);
+    TEST_EQUAL(Network.dropped[0], 1);
+    TEST_EQUAL(Network.dropped[1], 2);
+    TEST_EQUAL(outbox_check(&Outbox, OUTBOX_PRIORITY_LOW, 0), OUTBOX_QUEUED);
+
+    TEST_EQUAL(outbox_pump(&Outbox), 0);
+    TEST_EQUAL(Network.sentCount, TEST_DEPTH);
+    for (uint32_t i = 0; i < TEST_DEPTH && i < Network.sentCount; i++)
+    {
+        TEST_EQUAL(Network.sent[i], 3 + i);
+    }
+
+    OutboxQueueStats_t stats;
+    outbox_get_stats(&Outbox, OUTBOX_PRIORITY_LOW, &stats);
+    TEST_EQUAL(stats.queued, TEST_DEPTH + 2);
+    TEST_EQUAL(stats.droppedOldest, 2);
+    TEST_EQUAL(stats.sent, TEST_DEPTH);
+    TEST_EQUAL(stats.rejected, 0);
+    TEST_EQUAL(stats.depth, 0);
+    TEST_EQUAL(stats.maxDepth, TEST_DEPTH);
+}
+
+/**
+ * @brief A full OUTBOX_DROP_NEWEST queue turns the new publish away and keeps what it has, the
+ *        drop function is not called, a payload longer than OUTBOX_PAYLOAD_LEN is turned away
+ */
+static void test_outbox_drop_newest(void)
+{
+    _test_init(OUTBOX_DROP_NEWEST);
+
+    for (uint32_t tag = 1; tag <= TEST_DEPTH; tag++)
+    {
+        TEST_EQUAL(_test_publish(OUTBOX_PRIORITY_HIGH, tag, 0), OUTBOX_QUEUED);
+    }
+    TEST_EQUAL(_test_publish(OUTBOX_PRIORITY_HIGH, 10, 0), OUTBOX_REJECTED);
+    TEST_EQUAL(_test_publish(OUTBOX_PRIORITY_HIGH, 11, 0), OUTBOX_REJECTED);
+    TEST_EQUAL(outbox_check(&Outbox, OUTBOX_PRIORITY_HIGH, 0), OUTBOX_REJECTED);
+    TEST_EQUAL(Network.droppedCount, 0);
+
+    TEST_EQUAL(outbox_pump(&Outbox), 0);
+    TEST_EQUAL(Network.sentCount, TEST_DEPTH);
+    for (uint32_t i = 0; i < TEST_DEPTH && i < Network.sentCount; i++)
+    {
+        TEST_EQUAL(Network.sent[i], 1 + i);
+    }
+
+    /** Room again, but not for an entry too long */
+    static char payload[OUTBOX_PAYLOAD_LEN + 1];
+    TEST_EQUAL(outbox_publish(&Outbox, OUTBOX_PRIORITY_HIGH, "pico/high", payload, OUTBOX_PAYLOAD_LEN + 1, 1, 12, 0), OUTBOX_REJECTED);
+    TEST_EQUAL(outbox_publish(&Outbox, OUTBOX_PRIORITY_HIGH, "pico/high", payload, OUTBOX_PAYLOAD_LEN, 1, 13, 0), OUTBOX_QUEUED);
+
+    OutboxQueueStats_t stats;
+    outbox_get_stats(&Outbox, OUTBOX_PRIORITY_HIGH, &stats);
+    TEST_EQUAL(stats.queued, TEST_DEPTH + 1);
+    TEST_EQUAL(stats.rejected, 3);
+    TEST_EQUAL(stats.droppedOldest, 0);
+    TEST_EQUAL(stats.depth, 1);
+    TEST_EQUAL(stats.maxDepth, TEST_DEPTH);
+}
+
+/**
+ * @brief A full OUTBOX_BLOCK queue holds the producer back until blockMs after it was first held
+ *        back, then turns it away, the room made by a send ends the block and the next deadline
+ *        runs from the next time the queue is full
+ */
+static void test_outbox_block(void)
+{
+    _test_init(OUTBOX_BLOCK);
+
+    for (uint32_t tag = 1; tag <= TEST_DEPTH; tag++)
+    {
+        TEST_EQUAL(_test_publish(OUTBOX_PRIORITY_NORMAL, tag, 1000), OUTBOX_QUEUED);
+    }
+
+    /** The deadline runs from the first producer held back, not from each retry */
+    TEST_EQUAL(_test_publish(OUTBOX_PRIORITY_NORMAL, 10, 1000), OUTBOX_BLOCKED);
+    TEST_EQUAL(outbox_check(&Outbox, OUTBOX_PRIORITY_NORMAL, 1050), OUTBOX_BLOCKED);
+    TEST_EQUAL(_test_publish(OUTBOX_PRIORITY_NORMAL, 10, 1000 + TEST_BLOCK_MS - 1), OUTBOX_BLOCKED);
+    TEST_EQUAL(_test_publish(OUTBOX_PRIORITY_NORMAL, 10, 1000 + TEST_BLOCK_MS), OUTBOX_REJECTED);
+    TEST_EQUAL(outbox_check(&Outbox, OUTBOX_PRIORITY_NORMAL, 1000 + TEST_BLOCK_MS), OUTBOX_REJECTED);
+    TEST_EQUAL(Network.droppedCount, 0);
+
+    /** One entry sent, the producer is taken again */
+    Network.room = 1;
+    TEST_EQUAL(outbox_pump(&Outbox), TEST_DEPTH - 1);
+    TEST_EQUAL(Network.sent[0], 1);
+    TEST_EQUAL(_test_publish(OUTBOX_PRIORITY_NORMAL, 11, 2000), OUTBOX_QUEUED);
+
+    /** Full again, a new deadline */
+    TEST_EQUAL(_test_publish(OUTBOX_PRIORITY_NORMAL, 12, 3000), OUTBOX_BLOCKED);
+    TEST_EQUAL(_test_publish(OUTBOX_PRIORITY_NORMAL, 12, 3000 + TEST_BLOCK_MS - 1), OUTBOX_BLOCKED);
+    TEST_EQUAL(_test_publish(OUTBOX_PRIORITY_NORMAL, 12, 3000 + TEST_BLOCK_MS), OUTBOX_REJECTED);
+
+    Network.room = UINT32_MAX;
+    TEST_EQUAL(outbox_pump(&Outbox), 0);
+    TEST_EQUAL(Network.sentCount, TEST_DEPTH + 1);
+    TEST_EQUAL(Network.sent[Network.sentCount - 1], 11);
+
+    OutboxQueueStats_t stats;
+    outbox_get_stats(&Outbox, OUTBOX_PRIORITY_NORMAL, &stats);
+    TEST_EQUAL(stats.queued, TEST_DEPTH + 1);
+    TEST_EQUAL(stats.blocked, 4);
+    TEST_EQUAL(stats.timeouts, 2);
+    TEST_EQUAL(stats.rejected, 0);
+    TEST_EQUAL(stats.droppedOldest, 0);
+    TEST_EQUAL(stats.sent, TEST_DEPTH + 1);
+    TEST_EQUAL(stats.retries, 1);
+    TEST_EQUAL(stats.maxDepth, TEST_DEPTH);
+}
+
+/**
+ * @brief The pump sends the high priority entries first whatever order they were published in,
+ *        stops a priority when the send function has no room and still offers the lower ones
+ */
+static void test_outbox_priority(void)
+{
+    _test_init(OUTBOX_DROP_NEWEST);
+
+    TEST_EQUAL(_test_publish(OUTBOX_PRIORITY_LOW, 30, 0), OUTBOX_QUEUED);
+    TEST_EQUAL(_test_publish(OUTBOX_PRIORITY_NORMAL, 20, 0), OUTBOX_QUEUED);
+    TEST_EQUAL(_test_publish(OUTBOX_PRIORITY_HIGH, 10, 0), OUTBOX_QUEUED);
+    TEST_EQUAL(_test_publish(OUTBOX_PRIORITY_LOW, 31, 0), OUTBOX_QUEUED);
+    TEST_EQUAL(_test_publish(OUTBOX_PRIORITY_HIGH, 11, 0), OUTBOX_QUEUED);
+    TEST_EQUAL(outbox_pending(&Outbox), 5);
+
+    Network.room = 3;
+    TEST_EQUAL(outbox_pump(&Outbox), 2);
+    TEST_EQUAL(Network.sentCount, 3);
+    TEST_EQUAL(Network.sent[0], 10);
+    TEST_EQUAL(Network.sent[1], 11);
+    TEST_EQUAL(Network.sent[2], 20);
+
+    /** A newer high priority entry goes before the low ones left */
+    TEST_EQUAL(_test_publish(OUTBOX_PRIORITY_HIGH, 12, 0), OUTBOX_QUEUED);
+    Network.room = UINT32_MAX;
+    TEST_EQUAL(outbox_pump(&Outbox), 0);
+    TEST_EQUAL(Network.sentCount, 6);
+    TEST_EQUAL(Network.sent[3], 12);
+    TEST_EQUAL(Network.sent[4], 30);
+    TEST_EQUAL(Network.sent[5], 31);
+
+    /** The QoS 1 entry waits, the QoS 0 one of a lower priority goes */
+    Network.qos0Only = true;
+    TEST_EQUAL(_test_publish(OUTBOX_PRIORITY_NORMAL, 21, 0), OUTBOX_QUEUED);
+    uint32_t tag = 32;
+    TEST_EQUAL(outbox_publish(&Outbox, OUTBOX_PRIORITY_LOW, "pico/outbox", &tag, sizeof(tag), 0, tag, 0), OUTBOX_QUEUED);
+    TEST_EQUAL(outbox_pump(&Outbox), 1);
+    TEST_EQUAL(Network.sentCount, 7);
+    TEST_EQUAL(Network.sent[6], 32);
+
+    OutboxQueueStats_t stats;
+    outbox_get_stats(&Outbox, OUTBOX_PRIORITY_NORMAL, &stats);
+    TEST_EQUAL(stats.retries, 1);
+    TEST_EQUAL(stats.depth, 1);
+}
+
+/**
+ * @brief The counters of every priority against a model of the queues, for random publishes and
+ *        pumps with random room: the depth, the high water mark, the drops and the turned away
+ */
+static void test_outbox_counters(void)
+{
+    OutboxQueueStats_t model[OUTBOX_PRIORITY_MAX];
+    memset(model, 0, sizeof(model));
+
+    const OutboxQueueConfig_t configs[OUTBOX_PRIORITY_MAX] = {
+        [OUTBOX_PRIORITY_HIGH] = {.policy = OUTBOX_DROP_NEWEST, .depth = TEST_DEPTH},
+        [OUTBOX_PRIORITY_NORMAL] = {.policy = OUTBOX_BLOCK, .depth = TEST_DEPTH, .blockMs = TEST_BLOCK_MS},
+        [OUTBOX_PRIORITY_LOW] = {.policy = OUTBOX_DROP_OLDEST, .depth = TEST_DEPTH},
+    };
+    memset(&Network, 0, sizeof(Network));
+    TEST_EQUAL(outbox_init(&Outbox, configs, Entries, TEST_DEPTH * OUTBOX_PRIORITY_MAX, _test_send, _test_drop, &Network), 0);
+
+    uint32_t nowMs = 0;
+    uint32_t blockedSinceMs[OUTBOX_PRIORITY_MAX] = {0};
+    bool blocking[OUTBOX_PRIORITY_MAX] = {false};
+    for (uint32_t step = 0; step < TEST_STEPS; step++)
+    {
+        nowMs += _test_rand() % 20;
+        if (_test_rand() % 4 != 0)
+        {
+            OutboxPriority_t priority = (OutboxPriority_t)(_test_rand() % OUTBOX_PRIORITY_MAX);
+            OutboxQueueStats_t *queue = &model[priority];
+            OutboxStatus_t status = _test_publish(priority, step, nowMs);
+
+            /** What the policy of the queue answers */
+            OutboxStatus_t expected = OUTBOX_QUEUED;
+            if (queue->depth == TEST_DEPTH)
+            {
+                if (configs[priority].policy == OUTBOX_DROP_NEWEST)
+                {
+                    expected = OUTBOX_REJECTED;
+                    queue->rejected++;
+                }
+                else if (configs[priority].policy == OUTBOX_DROP_OLDEST)
+                {
+                    queue->droppedOldest++;
+                    queue->depth--;
+                }
+                else
+                {
+                    if (!blocking[priority])
+                    {
+                        blocking[priority] = true;
+                        blockedSinceMs[priority] = nowMs;
+                    }
+                    expected = nowMs - blockedSinceMs[priority] < TEST_BLOCK_MS ? OUTBOX_BLOCKED : OUTBOX_REJECTED;
+                    queue->blocked += expected == OUTBOX_BLOCKED;
+                    queue->timeouts += expected == OUTBOX_REJECTED;
+                }
+            }
+            if (expected == OUTBOX_QUEUED)
+            {
+                queue->queued++;
+                queue->depth++;
+                queue->maxDepth = queue->depth > queue->maxDepth ? queue->depth : queue->maxDepth;
+            }
+            TEST_EQUAL(status, expected);
+        }
+        else
+        {
+            Network.room = _test_rand() % (TEST_DEPTH * OUTBOX_PRIORITY_MAX + 1);
+            uint32_t room = Network.room;
+            for (int i = 0; i < OUTBOX_PRIORITY_MAX; i++)
+            {
+                uint32_t sent = model[i].depth < room ? model[i].depth : room;
+                room -= sent;
+                model[i].sent += sent;
+                model[i].depth -= sent;
+                model[i].retries += model[i].depth > 0;
+                blocking[i] = blocking[i] && sent == 0;
+            }
+            outbox_pump(&Outbox);
+        }
+    }
+
+    uint32_t pending = 0;
+    for (int i = 0; i < OUTBOX_PRIORITY_MAX; i++)
+    {
+        OutboxQueueStats_t stats;
+        outbox_get_stats(&Outbox, (OutboxPriority_t)i, &stats);
+        TEST_EQUAL(stats.depth, model[i].depth);
+        TEST_EQUAL(stats.maxDepth, model[i].maxDepth);
+        TEST_EQUAL(stats.queued, model[i].queued);
+        TEST_EQUAL(stats.sent, model[i].sent);
+        TEST_EQUAL(stats.droppedOldest, model[i].droppedOldest);
+        TEST_EQUAL(stats.rejected, model[i].rejected);
+        TEST_EQUAL(stats.blocked, model[i].blocked);
+        TEST_EQUAL(stats.timeouts, model[i].timeouts);
+        TEST_EQUAL(stats.retries, model[i].retries);
+        pending += model[i].depth;
+    }
+    TEST_EQUAL(outbox_pending(&Outbox), pending);
+    TEST_EQUAL(Network.droppedCount, model[OUTBOX_PRIORITY_LOW].droppedOldest);
+
+    /** Every policy was exercised */
+    TEST_CHECK(model[OUTBOX_PRIORITY_LOW].droppedOldest > 0);
+    TEST_CHECK(model[OUTBOX_PRIORITY_HIGH].rejected > 0);
+    TEST_CHECK(model[OUTBOX_PRIORITY_NORMAL].blocked > 0 && model[OUTBOX_PRIORITY_NORMAL].timeouts > 0);
+}
+
+int main(void)
+{
+    TEST_RUN(test_outbox_drop_oldest);
+    TEST_RUN(test_outbox_drop_newest);
+    TEST_RUN(test_outbox_block);
+    TEST_RUN(test_outbox_priority);
+    TEST_RUN(test_outbox_counters);
+
+    return TEST_RESULT();
+}
+
+/**
+ * @brief Initialise the outbox with every priority TEST_DEPTH deep under the same policy, the
+ *        send function has room for everything
+ * @param policy The policy of every priority
+ */
+static void _test_init(OutboxPolicy_t policy)
+{
+    memset(&Network, 0, sizeof(Network));
+    Network.room = UINT32_MAX;
+    Network.logging = true;
+
+    OutboxQueueConfig_t configs[OUTBOX_PRIORITY_MAX];
+    for (int i = 0; i < OUTBOX_PRIORITY_MAX; i++)
+    {
+        configs[i] = (OutboxQueueConfig_t){.policy = policy, .depth = TEST_DEPTH, .blockMs = TEST_BLOCK_MS};
+    }
+    TEST_EQUAL(outbox_init(&Outbox, configs, Entries, TEST_DEPTH * OUTBOX_PRIORITY_MAX, _test_send, _test_drop, &Network), 0);
+}
+
+/**
+ * @brief Publish a QoS 1 entry whose payload is its tag
+ * @param priority The queue
+ * @param tag The tag
+ * @param nowMs The current time
+ * @return OutboxStatus_t The answer of the outbox
+ */
+static OutboxStatus_t _test_publish(OutboxPriority_t priority, uint32_t tag, uint32_t nowMs)
+{
+    return outbox_publish(&Outbox, priority, "pico/outbox", &tag, sizeof(tag), 1, tag, nowMs);
+}
+
+/**
+ * @brief Send function, takes entries until it has no room and logs their tags
+ */
+static int _test_send(void *arg, const OutboxEntry_t *entry)
+{
+    TestNetwork_t *network = (TestNetwork_t *)arg;
+    if (network->room == 0 || (network->qos0Only && entry->qos != 0))
+    {
+        return -1;
+    }
+    network->room--;
+
+    /** The payload is the tag, the entry was copied whole */
+    uint32_t tag;
+    TEST_EQUAL(entry->len, sizeof(tag));
+    memcpy(&tag, entry->payload, sizeof(tag));
+    TEST_EQUAL(tag, entry->tag);
+
+    if (network->logging && network->sentCount < TEST_LOG_SIZE)
+    {
+        network->sent[network->sentCount] = entry->tag;
+    }
+    network->sentCount++;
+
+    return 0;
+}
+
+/**
+ * @brief Drop function, logs the tags
+ */
+static void _test_drop(void *arg, const OutboxEntry_t *entry)
+{
+    TestNetwork_t *network = (TestNetwork_t *)arg;
+    if (network->logging && network->droppedCount < TEST_LOG_SIZE)
+    {
+        network->dropped[network->droppedCount] = entry->tag;
+    }
+    network->droppedCount++;
+}
+
+/**
+ * @brief xorshift32
+ */
+static uint32_t _test_rand(void)
+{
+    Seed ^= Seed << 13;
+    Seed ^= Seed >> 17;
+    Seed ^= Seed << 5;
+    return Seed;
+}
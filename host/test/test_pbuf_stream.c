@@ -0,0 +1,224 @@
+/** Includes *************************************************************************************/
+#include "fake_lwip.h"
+#include "pbuf_stream.h"
+#include "test.h"
+
+/**
+ * The zero copy reader of pbuf_stream.c over pbuf chains made by fake_lwip.c. What a consumer
+ * takes must be handed to tcp_recved() exactly once, and a pbuf freed once all of it is taken.
+ */
+
+/** Defines **************************************************************************************/
+#define TEST_CONSUMED_SIZE 256
+
+/** Typedefs *************************************************************************************/
+
+/** Collects what it is offered, at most limit bytes per call */
+typedef struct
+{
+    uint8_t data[TEST_CONSUMED_SIZE];
+    uint32_t len;
+    uint16_t limit;
+    uint32_t calls;
+} TestConsumer_t;
+
+/** Variables ************************************************************************************/
+static const uint8_t TestData[] = "abcdefghijklmnopqrstuvwxyz0123456789";
+
+/** Prototypes ***********************************************************************************/
+static uint16_t _test_consume(void *arg, const uint8_t *data, uint16_t len);
+
+/** Functions ************************************************************************************/
+
+/**
+ * @brief Every pbuf of a chain is offered in turn, and freed once consumed
+ */
+static void test_pbuf_stream_chain(void)
+{
+    fake_lwip_reset();
+    TestConsumer_t consumer = {.limit = UINT16_MAX};
+    PbufStream_t stream;
+    pbuf_stream_init(&stream, &FakeTcp.pcb, _test_consume, &consumer);
+
+    const u16_t lens[] = {3, 4, 5};
+    pbuf_stream_push(&stream, fake_pbuf_chain(TestData, lens, 3));
+    TEST_EQUAL(stream.pending, 12);
+    TEST_EQUAL(FakeTcp.recved, 0);
+
+    TEST_EQUAL(pbuf_stream_process(&stream), 12);
+    TEST_EQUAL(consumer.calls, 3);
+    TEST_EQUAL(consumer.len, 12);
+    TEST_CHECK(memcmp(consumer.data, TestData, 12) == 0);
+    TEST_EQUAL(FakeTcp.recved, 12);
+    TEST_EQUAL(fake_pbuf_live(), 0);
+    TEST_CHECK(stream.head == NULL);
+    TEST_EQUAL(stream.stats.bytesReceived, 12);
+    TEST_EQUAL(stream.stats.bytesConsumed, 12);
+    TEST_EQUAL(stream.stats.pbufsReceived, 1);
+
+    /** Nothing left, nothing offered */
+    TEST_EQUAL(pbuf_stream_process(&stream), 0);
+    TEST_EQUAL(consumer.calls, 3);
+}
+
+/**
+ * @brief A consumer that takes part of a span stops the stream, the rest is offered again
+ *        and only what was taken opens the window
+ */
+static void test_pbuf_stream_partial(void)
+{
+    fake_lwip_reset();
+    TestConsumer_t consumer = {.limit = 5};
+    PbufStream_t stream;
+    pbuf_stream_init(&stream, &FakeTcp.pcb, _test_consume, &consumer);
+
+    const u16_t lens[] = {8, 6};
+    pbuf_stream_push(&stream, fake_pbuf_chain(TestData, lens, 2));
+
+    TEST_EQUAL(pbuf_stream_process(&stream), 5);
+    TEST_EQUAL(FakeTcp.recved, 5);
+    TEST_EQUAL(stream.pending, 9);
+    TEST_EQUAL(stream.offset, 5);
+    TEST_EQUAL(fake_pbuf_live(), 2);
+
+    /** The rest of the first pbuf is taken whole, the second only in part */
+    TEST_EQUAL(pbuf_stream_process(&stream), 8);
+    TEST_EQUAL(consumer.calls, 3);
+    TEST_EQUAL(FakeTcp.recved, 13);
+    TEST_EQUAL(fake_pbuf_live(), 1);
+    TEST_EQUAL(stream.offset, 5);
+
+    TEST_EQUAL(pbuf_stream_process(&stream), 1);
+    TEST_EQUAL(FakeTcp.recved, 14);
+    TEST_EQUAL(fake_pbuf_live(), 0);
+    TEST_EQUAL(consumer.len, 14);
+    TEST_CHECK(memcmp(consumer.data, TestData, 14) == 0);
+
+    /** A consumer that takes nothing leaves the window closed */
+    consumer.limit = 0;
+    const u16_t one[] = {6};
+    pbuf_stream_push(&stream, fake_pbuf_chain(TestData, one, 1));
+    TEST_EQUAL(pbuf_stream_process(&stream), 0);
+    TEST_EQUAL(FakeTcp.recved, 14);
+    TEST_EQUAL(stream.pending, 6);
+    pbuf_stream_reset(&stream);
+    TEST_EQUAL(fake_pbuf_live(), 0);
+}
+
+/**
+ * @brief Chains pushed behind unconsumed data are joined to it, peek and release cross pbufs
+ */
+static void test_pbuf_stream_push_behind(void)
+{
+    fake_lwip_reset();
+    PbufStream_t stream;
+    pbuf_stream_init(&stream, &FakeTcp.pcb, NULL, NULL);
+
+    const u16_t first[] = {3, 4};
+    const u16_t second[] = {5};
+    pbuf_stream_push(&stream, fake_pbuf_chain(TestData, first, 2));
+    pbuf_stream_release(&stream, 2);
+    pbuf_stream_push(&stream, fake_pbuf_chain(&TestData[7], second, 1));
+    TEST_EQUAL(stream.pending, 10);
+    TEST_EQUAL(stream.head->tot_len, 12);
+    TEST_EQUAL(stream.stats.pbufsReceived, 2);
+
+    /** Without a consumer, process does nothing */
+    TEST_EQUAL(pbuf_stream_process(&stream), 0);
+
+    const uint8_t *data = NULL;
+    TEST_EQUAL(pbuf_stream_peek(&stream, &data), 1);
+    TEST_EQUAL(data[0], 'c');
+
+    /** Over the end of the second pbuf, into the third */
+    pbuf_stream_release(&stream, 6);
+    TEST_EQUAL(fake_pbuf_live(), 1);
+    TEST_EQUAL(pbuf_stream_peek(&stream, &data), 4);
+    TEST_CHECK(memcmp(data, &TestData[8], 4) == 0);
+
+    /** Released beyond what is pending is clamped */
+    pbuf_stream_release(&stream, 100);
+    TEST_EQUAL(stream.pending, 0);
+    TEST_EQUAL(FakeTcp.recved, 12);
+    TEST_EQUAL(fake_pbuf_live(), 0);
+    TEST_EQUAL(pbuf_stream_peek(&stream, &data), 0);
+    TEST_CHECK(data == NULL);
+}
+
+/**
+ * @brief With window scaling more than 64 KiB can be pending, tcp_recved() takes a u16_t so a
+ *        larger release is split
+ */
+static void test_pbuf_stream_large_release(void)
+{
+    fake_lwip_reset();
+    PbufStream_t stream;
+    pbuf_stream_init(&stream, &FakeTcp.pcb, NULL, NULL);
+
+    static uint8_t data[80000];
+    const u16_t lens[] = {40000};
+    pbuf_stream_push(&stream, fake_pbuf_chain(data, lens, 1));
+    pbuf_stream_push(&stream, fake_pbuf_chain(&data[40000], lens, 1));
+    TEST_EQUAL(stream.pending, 80000);
+
+    pbuf_stream_release(&stream, 80000);
+    TEST_EQUAL(FakeTcp.recved, 80000);
+    TEST_EQUAL(fake_pbuf_live(), 0);
+}
+
+/**
+ * @brief A reset frees the pbufs without acknowledging them, a stream without a pcb never does
+ */
+static void test_pbuf_stream_reset(void)
+{
+    fake_lwip_reset();
+    TestConsumer_t consumer = {.limit = UINT16_MAX};
+    PbufStream_t stream;
+    pbuf_stream_init(&stream, &FakeTcp.pcb, _test_consume, &consumer);
+
+    const u16_t lens[] = {3, 4, 5};
+    pbuf_stream_push(&stream, fake_pbuf_chain(TestData, lens, 3));
+    pbuf_stream_release(&stream, 4);
+    pbuf_stream_reset(&stream);
+    TEST_EQUAL(FakeTcp.recved, 4);
+    TEST_EQUAL(fake_pbuf_live(), 0);
+    TEST_CHECK(stream.head == NULL);
+    TEST_CHECK(stream.pcb == NULL);
+
+    /** Detached, the data is still consumed */
+    pbuf_stream_push(&stream, fake_pbuf_chain(TestData, lens, 3));
+    TEST_EQUAL(pbuf_stream_process(&stream), 12);
+    TEST_EQUAL(FakeTcp.recved, 4);
+    TEST_EQUAL(fake_pbuf_live(), 0);
+
+    /** An empty push is ignored */
+    pbuf_stream_push(&stream, NULL);
+    TEST_EQUAL(stream.stats.pbufsReceived, 2);
+}
+
+int main(void)
+{
+    TEST_RUN(test_pbuf_stream_chain);
+    TEST_RUN(test_pbuf_stream_partial);
+    TEST_RUN(test_pbuf_stream_push_behind);
+    TEST_RUN(test_pbuf_stream_large_release);
+    TEST_RUN(test_pbuf_stream_reset);
+
+    return TEST_RESULT();
+}
+
+static uint16_t _test_consume(void *arg, const uint8_t *data, uint16_t len)
+{
+    TestConsumer_t *consumer = arg;
+    consumer->calls++;
+
+    uint16_t used = len < consumer->limit ? len : consumer->limit;
+    if (consumer->len + used > TEST_CONSUMED_SIZE)
+    {
+        used = (uint16_t)(TEST_CONSUMED_SIZE - consumer->len);
+    }
+    memcpy(&consumer->data[consumer->len], data, used);
+    consumer->len += used;
+
+    return used;
+}
@@ -0,0 +1,226 @@
+/** Includes *************************************************************************************/
+#include "power.h"
+#include "test.h"
+
+/**
+ * The duty cycle accounting of power.c on a simulated clock: the deadlines rounded up on the
+ * slack grid, a sleep over several cycles, a wait that returned without sleeping and keeps the
+ * time awake, and the keep alive and listen interval derived from the cycle at their bounds.
+ */
+
+/** Defines **************************************************************************************/
+
+#define TEST_CYCLE_MS 1000
+
+/** Milliseconds of the simulated clock in microseconds */
+#define TEST_MS(ms) ((uint64_t)(ms) * 1000u)
+
+/** Typedefs *************************************************************************************/
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+static void _test_init(Power_t *power, uint32_t slackMs);
+
+/** Functions ************************************************************************************/
+
+/**
+ * @brief A deadline is rounded up to the next multiple of the slack, one on the grid is kept, and
+ *        without slack or for a deadline already passed it is returned as is
+ */
+static void test_power_grid(void)
+{
+    Power_t power;
+    _test_init(&power, 100);
+
+    TEST_EQUAL(power_sleep(&power, TEST_MS(10), TEST_MS(1234) + 567), TEST_MS(1300));
+    power_wake(&power, TEST_MS(1300), true);
+    TEST_EQUAL(power_sleep(&power, TEST_MS(1301), TEST_MS(1400)), TEST_MS(1400));
+    power_wake(&power, TEST_MS(1400), true);
+    TEST_EQUAL(power_sleep(&power, TEST_MS(1401), TEST_MS(1500) + 1), TEST_MS(1600));
+    power_wake(&power, TEST_MS(1600), true);
+
+    /** Due or overdue, run now */
+    TEST_EQUAL(power_sleep(&power, TEST_MS(1600), TEST_MS(1600)), TEST_MS(1600));
+    power_wake(&power, TEST_MS(1600), false);
+    TEST_EQUAL(power_sleep(&power, TEST_MS(1700), TEST_MS(1650)), TEST_MS(1650));
+    power_wake(&power, TEST_MS(1700), false);
+
+    /** Deadlines within the slack of each other end up on one wake-up */
+    uint64_t first = power_sleep(&power, TEST_MS(1710), TEST_MS(1720));
+    power_wake(&power, TEST_MS(1710), false);
+    uint64_t second = power_sleep(&power, TEST_MS(1711), TEST_MS(1790));
+    TEST_EQUAL(first, second);
+    power_wake(&power, second, true);
+
+    /** Without slack every deadline is exact */
+    _test_init(&power, 0);
+    TEST_EQUAL(power_sleep(&power, TEST_MS(10), TEST_MS(1234) + 567), TEST_MS(1234) + 567);
+
+    /** No accounting, the deadline as is */
+    TEST_EQUAL(power_sleep(NULL, 0, TEST_MS(1234) + 567), TEST_MS(1234) + 567);
+}
+
+/**
+ * @brief A sleep over several cycles closes them all at once, the awake time is counted in the
+ *        cycle the loop went to sleep in and the next cycle starts on the grid of the cycles
+ */
+static void test_power_long_sleep(void)
+{
+    Power_t power;
+    _test_init(&power, 0);
+
+    /** 100 ms awake in the first cycle, then asleep until 3.5 cycles later */
+    power_sleep(&power, TEST_MS(100), TEST_MS(3500));
+    power_wake(&power, TEST_MS(3500), true);
+
+    PowerStats_t stats;
+    power_get_stats(&power, &stats);
+    TEST_EQUAL(stats.cycles, 0);
+
+    /** Going back to sleep accounts the cycles that ended */
+    power_sleep(&power, TEST_MS(3600), TEST_MS(4200));
+    power_get_stats(&power, &stats);
+    TEST_EQUAL(stats.cycles, 3);
+    TEST_EQUAL(stats.lastAwakeMs, 200);
+    TEST_EQUAL(stats.lastWakeups, 1);
+    TEST_EQUAL(stats.maxAwakeMs, 200);
+    TEST_EQUAL(stats.awakeUs, TEST_MS(200));
+    TEST_EQUAL(stats.elapsedUs, TEST_MS(3600));
+    TEST_EQUAL(stats.wakeups, 1);
+    TEST_EQUAL(stats.cycleAwakeUs.count, 1);
+    TEST_EQUAL(power.cycleStartUs, TEST_MS(3000));
+
+    /** The next cycle ends at 4 s, not 3.6 s + a cycle */
+    power_wake(&power, TEST_MS(4200), true);
+    power_sleep(&power, TEST_MS(4250), TEST_MS(5000));
+    power_get_stats(&power, &stats);
+    TEST_EQUAL(stats.cycles, 4);
+    TEST_EQUAL(stats.lastAwakeMs, 50);
+    TEST_EQUAL(stats.lastWakeups, 1);
+    TEST_EQUAL(stats.maxAwakeMs, 200);
+    TEST_EQUAL(stats.wakeups, 2);
+    TEST_EQUAL(stats.awakeUs, TEST_MS(250));
+}
+
+/**
+ * @brief A wait that returned without sleeping, an event was already pending, counts the time
+ *        since power_sleep() as awake and is not a wake-up
+ */
+static void test_power_no_sleep(void)
+{
+    Power_t power;
+    _test_init(&power, 0);
+
+    power_sleep(&power, TEST_MS(10), TEST_MS(500));
+    power_wake(&power, TEST_MS(15), false);
+    power_sleep(&power, TEST_MS(20), TEST_MS(500));
+
+    PowerStats_t stats;
+    power_get_stats(&power, &stats);
+    TEST_EQUAL(stats.awakeUs, TEST_MS(20));
+    TEST_EQUAL(stats.wakeups, 0);
+
+    /** A real sleep after it */
+    power_wake(&power, TEST_MS(500), true);
+    power_sleep(&power, TEST_MS(510), TEST_MS(1500));
+    power_get_stats(&power, &stats);
+    TEST_EQUAL(stats.awakeUs, TEST_MS(30));
+    TEST_EQUAL(stats.wakeups, 1);
+
+    /** Past the end of the cycle, the time given back belongs to the cycle that closes */
+    power_wake(&power, TEST_MS(1500), false);
+    power_sleep(&power, TEST_MS(1600), TEST_MS(2000));
+    power_get_stats(&power, &stats);
+    TEST_EQUAL(stats.cycles, 1);
+    TEST_EQUAL(stats.lastAwakeMs, 30 + 1600 - 510);
+    TEST_EQUAL(stats.lastWakeups, 1);
+    TEST_EQUAL(stats.awakeUs, TEST_MS(30) + TEST_MS(1600) - TEST_MS(510));
+
+    /** Waking again once awake changes nothing */
+    power_wake(&power, TEST_MS(1700), true);
+    power_wake(&power, TEST_MS(1800), true);
+    power_get_stats(&power, &stats);
+    TEST_EQUAL(stats.wakeups, 2);
+}
+
+/**
+ * @brief The keep alive is the longer of two cycles and the minimum, rounded up to whole cycles
+ *        and seconds and capped to what the CONNECT can carry
+ */
+static void test_power_keep_alive(void)
+{
+    /** The minimum, already whole cycles */
+    TEST_EQUAL(power_keep_alive_s(5000, 60), 60);
+    TEST_EQUAL(power_keep_alive_s(30000, 60), 60);
+
+    /** The minimum rounded up to whole cycles */
+    TEST_EQUAL(power_keep_alive_s(7000, 60), 63);
+    TEST_EQUAL(power_keep_alive_s(59999, 60), 120);
+
+    /** Two cycles */
+    TEST_EQUAL(power_keep_alive_s(45000, 60), 90);
+    TEST_EQUAL(power_keep_alive_s(1500, 0), 3);
+
+    /** Rounded up to a second */
+    TEST_EQUAL(power_keep_alive_s(1, 0), 1);
+    TEST_EQUAL(power_keep_alive_s(700, 1), 2);
+
+    /** No cycle, the minimum */
+    TEST_EQUAL(power_keep_alive_s(0, 60), 60);
+    TEST_EQUAL(power_keep_alive_s(0, UINT16_MAX), UINT16_MAX);
+
+    /** The 16 bit field of the CONNECT */
+    TEST_EQUAL(power_keep_alive_s(32767000, 0), 65534);
+    TEST_EQUAL(power_keep_alive_s(32768000, 0), UINT16_MAX);
+    TEST_EQUAL(power_keep_alive_s(2000000000, 60), UINT16_MAX);
+    TEST_EQUAL(power_keep_alive_s(UINT32_MAX, UINT16_MAX), UINT16_MAX);
+}
+
+/**
+ * @brief The listen interval is the whole beacons in a cycle, at least 1 and at most
+ *        POWER_RADIO_MAX_LISTEN_INTERVAL
+ */
+static void test_power_listen_interval(void)
+{
+    TEST_EQUAL(power_listen_interval(0), 1);
+    TEST_EQUAL(power_listen_interval(102), 1);
+    TEST_EQUAL(power_listen_interval(204), 1);
+    TEST_EQUAL(power_listen_interval(205), 2);
+
+    /** Just short of the cap and on it */
+    uint32_t maxMs = (uint32_t)((uint64_t)POWER_RADIO_MAX_LISTEN_INTERVAL * POWER_BEACON_INTERVAL_US / 1000u);
+    TEST_EQUAL(power_listen_interval(maxMs - 1), POWER_RADIO_MAX_LISTEN_INTERVAL - 1);
+    TEST_EQUAL(power_listen_interval(maxMs), POWER_RADIO_MAX_LISTEN_INTERVAL);
+    TEST_EQUAL(power_listen_interval(5000), POWER_RADIO_MAX_LISTEN_INTERVAL);
+    TEST_EQUAL(power_listen_interval(UINT32_MAX), POWER_RADIO_MAX_LISTEN_INTERVAL);
+}
+
+int main(void)
+{
+    TEST_RUN(test_power_grid);
+    TEST_RUN(test_power_long_sleep);
+    TEST_RUN(test_power_no_sleep);
+    TEST_RUN(test_power_keep_alive);
+    TEST_RUN(test_power_listen_interval);
+
+    return TEST_RESULT();
+}
+
+/**
+ * @brief Initialise the accounting at time 0 with a cycle of TEST_CYCLE_MS
+ * @param power The accounting
+ * @param slackMs The slack of the deadlines
+ */
+static void _test_init(Power_t *power, uint32_t slackMs)
+{
+    const PowerConfig_t config = {
+        .cycleMs = TEST_CYCLE_MS,
+        .slackMs = slackMs,
+    };
+    TEST_EQUAL(power_init(power, &config, 0), 0);
+
+    PowerConfig_t noCycle = config;
+    noCycle.cycleMs = 0;
+    Power_t other;
+    TEST_EQUAL(power_init(&other, &noCycle, 0), -1);
+    TEST_EQUAL(power_init(NULL, &config, 0), -1);
+}
@@ -0,0 +1,269 @@
+/** Includes *************************************************************************************/
+#include "publish_queue.h"
+#include "test.h"
+
+/**
+ * Batching of publish_queue.c: samples coalesced into arrays, the size and age limits of a
+ * batch, and batches and unbatched samples kept until the flush function manages to send them.
+ */
+
+/** Defines **************************************************************************************/
+#define TEST_FLUSHES 16
+
+/** Typedefs *************************************************************************************/
+
+/** What the flush function was handed */
+typedef struct
+{
+    MqttTopic_t topic;
+    char payload[PUBLISH_QUEUE_BATCH_SIZE + 1];
+    uint16_t len;
+} TestFlush_t;
+
+/** Variables ************************************************************************************/
+static TestFlush_t Flushes[TEST_FLUSHES];
+static uint32_t FlushCount;
+static uint32_t FailNext; /** The next flushes fail */
+
+/** Prototypes ***********************************************************************************/
+static int _test_flush(void *arg, MqttTopic_t topic, const char *payload, uint16_t len);
+static void _test_init(PublishQueue_t *queue, uint16_t maxBytes, uint32_t maxAgeMs);
+static int _test_add(PublishQueue_t *queue, MqttTopic_t topic, const char *sample, uint32_t nowMs);
+
+/** Functions ************************************************************************************/
+
+/**
+ * @brief Samples of a topic are coalesced into one JSON array, each topic has its own
+ */
+static void test_publish_queue_coalesce(void)
+{
+    PublishQueue_t queue;
+    _test_init(&queue, 100, 1000);
+
+    TEST_EQUAL(_test_add(&queue, MQTT_TOPIC_TEMP, "{\"t\":21.50}", 0), 0);
+    TEST_EQUAL(_test_add(&queue, MQTT_TOPIC_HUMIDITY, "{\"h\":40}", 10), 0);
+    TEST_EQUAL(_test_add(&queue, MQTT_TOPIC_TEMP, "{\"t\":21.75}", 20), 0);
+    TEST_EQUAL(FlushCount, 0);
+
+    TEST_EQUAL(publish_queue_flush(&queue, MQTT_TOPIC_TEMP), 0);
+    TEST_EQUAL(FlushCount, 1);
+    TEST_EQUAL(Flushes[0].topic, MQTT_TOPIC_TEMP);
+    TEST_CHECK(strcmp(Flushes[0].payload, "[{\"t\":21.50},{\"t\":21.75}]") == 0);
+
+    /** Flushing an empty batch sends nothing */
+    TEST_EQUAL(publish_queue_flush(&queue, MQTT_TOPIC_TEMP), 0);
+    TEST_EQUAL(FlushCount, 1);
+
+    TEST_EQUAL(publish_queue_flush(&queue, MQTT_TOPIC_HUMIDITY), 0);
+    TEST_CHECK(strcmp(Flushes[1].payload, "[{\"h\":40}]") == 0);
+    TEST_EQUAL(queue.stats.samples, 3);
+    TEST_EQUAL(queue.stats.flushes, 2);
+    TEST_EQUAL(queue.stats.payloadBytes, Flushes[0].len + Flushes[1].len);
+}
+
+/**
+ * @brief A batch goes once it reaches maxBytes with its closing, a sample that would overflow
+ *        the buffer starts the next batch
+ */
+static void test_publish_queue_size_boundary(void)
+{
+    PublishQueue_t queue;
+
+    /** "[" + 4 samples of 9 + 3 separators + "]" is 41 */
+    _test_init(&queue, 41, 60000);
+    for (int i = 0; i < 3; i++)
+    {
+        TEST_EQUAL(_test_add(&queue, MQTT_TOPIC_TEMP, "{\"t\":1.0}", 0), 0);
+    }
+    TEST_EQUAL(FlushCount, 0);
+    TEST_EQUAL(_test_add(&queue, MQTT_TOPIC_TEMP, "{\"t\":1.0}", 0), 0);
+    TEST_EQUAL(FlushCount, 1);
+    TEST_EQUAL(Flushes[0].len, 41);
+
+    /** At the size of the buffer, the sample that does not fit flushes the batch before it */
+    _test_init(&queue, PUBLISH_QUEUE_BATCH_SIZE, 60000);
+    char sample[200];
+    memset(sample, 'x', sizeof(sample));
+    sample[0] = '"';
+    sample[sizeof(sample) - 2] = '"';
+    sample[sizeof(sample) - 1] = '\0';
+    TEST_EQUAL(_test_add(&queue, MQTT_TOPIC_TEMP, sample, 0), 0);
+    TEST_EQUAL(_test_add(&queue, MQTT_TOPIC_TEMP, sample, 0), 0);
+    TEST_EQUAL(FlushCount, 0);
+    TEST_EQUAL(_test_add(&queue, MQTT_TOPIC_TEMP, sample, 0), 0);
+    TEST_EQUAL(FlushCount, 1);
+    TEST_EQUAL(Flushes[0].len, 1 + 2 * 199 + 1 + 1);
+    TEST_EQUAL(queue.batches[MQTT_TOPIC_TEMP].count, 1);
+
+    /** Larger than a batch */
+    char large[PUBLISH_QUEUE_BATCH_SIZE + 1];
+    memset(large, '1', sizeof(large) - 1);
+    large[sizeof(large) - 1] = '\0';
+    TEST_EQUAL(_test_add(&queue, MQTT_TOPIC_HUMIDITY, large, 0), -1);
+    TEST_EQUAL(queue.stats.dropped, 1);
+}
+
+/**
+ * @brief A batch goes once its oldest sample is maxAgeMs old, poll tells when the next one is due
+ */
+static void test_publish_queue_age(void)
+{
+    PublishQueue_t queue;
+    _test_init(&queue, PUBLISH_QUEUE_BATCH_SIZE, 1000);
+    TEST_EQUAL(publish_queue_poll(&queue, 0), UINT32_MAX);
+
+    _test_add(&queue, MQTT_TOPIC_TEMP, "1", 100);
+    _test_add(&queue, MQTT_TOPIC_HUMIDITY, "2", 400);
+    _test_add(&queue, MQTT_TOPIC_TEMP, "3", 900);
+    TEST_EQUAL(publish_queue_poll(&queue, 1000), 100);
+    TEST_EQUAL(FlushCount, 0);
+
+    TEST_EQUAL(publish_queue_poll(&queue, 1100), 300);
+    TEST_EQUAL(FlushCount, 1);
+    TEST_CHECK(strcmp(Flushes[0].payload, "[1,3]") == 0);
+
+    /** The age is a difference, it holds across the roll-over of the clock */
+    _test_init(&queue, PUBLISH_QUEUE_BATCH_SIZE, 1000);
+    _test_add(&queue, MQTT_TOPIC_TEMP, "1", UINT32_MAX - 500);
+    TEST_EQUAL(publish_queue_poll(&queue, 200), 299);
+    TEST_EQUAL(publish_queue_poll(&queue, 499), UINT32_MAX);
+    TEST_EQUAL(FlushCount, 1);
+}
+
+/**
+ * @brief A batch the flush function failed to send is kept and sent again
+ */
+static void test_publish_queue_flush_failure(void)
+{
+    PublishQueue_t queue;
+    _test_init(&queue, PUBLISH_QUEUE_BATCH_SIZE, 1000);
+    _test_add(&queue, MQTT_TOPIC_TEMP, "1", 0);
+    _test_add(&queue, MQTT_TOPIC_TEMP, "2", 0);
+
+    FailNext = 1;
+    TEST_EQUAL(publish_queue_poll(&queue, 1000), 1000);
+    TEST_EQUAL(queue.stats.flushErrors, 1);
+    TEST_EQUAL(queue.batches[MQTT_TOPIC_TEMP].count, 2);
+
+    /** Samples are still added behind it */
+    _test_add(&queue, MQTT_TOPIC_TEMP, "3", 1500);
+    TEST_EQUAL(publish_queue_poll(&queue, 2000), UINT32_MAX);
+    TEST_EQUAL(FlushCount, 1);
+    TEST_CHECK(strcmp(Flushes[0].payload, "[1,2,3]") == 0);
+}
+
+/**
+ * @brief Unbatched, a sample is sent at once, a failed one is kept until it is sent and the
+ *        samples behind it are refused
+ */
+static void test_publish_queue_unbatched(void)
+{
+    PublishQueue_t queue;
+    _test_init(&queue, 0, 1000);
+    TEST_EQUAL(_test_add(&queue, MQTT_TOPIC_TEMP, "1", 0), 0);
+    TEST_EQUAL(FlushCount, 1);
+    TEST_CHECK(strcmp(Flushes[0].payload, "1") == 0);
+
+    FailNext = 2;
+    TEST_EQUAL(_test_add(&queue, MQTT_TOPIC_TEMP, "2", 10), 0);
+    TEST_EQUAL(queue.stats.flushErrors, 1);
+    TEST_EQUAL(_test_add(&queue, MQTT_TOPIC_TEMP, "3", 20), -1);
+    TEST_EQUAL(queue.stats.dropped, 1);
+
+    /** Other topics are not held up */
+    TEST_EQUAL(_test_add(&queue, MQTT_TOPIC_HUMIDITY, "h", 20), 0);
+    TEST_EQUAL(FlushCount, 2);
+    TEST_CHECK(strcmp(Flushes[1].payload, "h") == 0);
+
+    /** Sent again as it was, without the framing of a batch, at once on the next poll */
+    TEST_EQUAL(publish_queue_poll(&queue, 30), UINT32_MAX);
+    TEST_EQUAL(FlushCount, 3);
+    TEST_EQUAL(Flushes[2].topic, MQTT_TOPIC_TEMP);
+    TEST_CHECK(strcmp(Flushes[2].payload, "2") == 0);
+
+    TEST_EQUAL(_test_add(&queue, MQTT_TOPIC_TEMP, "4", 40), 0);
+    TEST_CHECK(strcmp(Flushes[3].payload, "4") == 0);
+    TEST_EQUAL(queue.stats.samples, 5);
+}
+
+/**
+ * @brief CBOR batches are tagged indefinite arrays, single samples only get the tag, and
+ *        changing the format closes the batch
+ */
+static void test_publish_queue_cbor(void)
+{
+    PublishQueue_t queue;
+    _test_init(&queue, PUBLISH_QUEUE_BATCH_SIZE, 1000);
+    _test_add(&queue, MQTT_TOPIC_TEMP, "1", 0);
+    TEST_EQUAL(publish_queue_set_format(&queue, MQTT_TOPIC_TEMP, MQTT_FORMAT_CBOR), 0);
+    TEST_EQUAL(publish_queue_get_format(&queue, MQTT_TOPIC_TEMP), MQTT_FORMAT_CBOR);
+    TEST_EQUAL(FlushCount, 1);
+    TEST_CHECK(strcmp(Flushes[0].payload, "[1]") == 0);
+
+    const char samples[] = "\x01\x02";
+    publish_queue_add(&queue, MQTT_TOPIC_TEMP, &samples[0], 1, 0);
+    publish_queue_add(&queue, MQTT_TOPIC_TEMP, &samples[1], 1, 0);
+    publish_queue_flush(&queue, MQTT_TOPIC_TEMP);
+    TEST_EQUAL(Flushes[1].len, 7);
+    TEST_CHECK(memcmp(Flushes[1].payload, "\xD9\xD9\xF7\x9F\x01\x02\xFF", 7) == 0);
+
+    _test_init(&queue, 0, 1000);
+    publish_queue_set_format(&queue, MQTT_TOPIC_TEMP, MQTT_FORMAT_CBOR);
+    FailNext = 1;
+    publish_queue_add(&queue, MQTT_TOPIC_TEMP, &samples[0], 1, 0);
+    publish_queue_poll(&queue, 0);
+    TEST_EQUAL(FlushCount, 1);
+    TEST_EQUAL(Flushes[0].len, 4);
+    TEST_CHECK(memcmp(Flushes[0].payload, "\xD9\xD9\xF7\x01", 4) == 0);
+}
+
+int main(void)
+{
+    TEST_RUN(test_publish_queue_coalesce);
+    TEST_RUN(test_publish_queue_size_boundary);
+    TEST_RUN(test_publish_queue_age);
+    TEST_RUN(test_publish_queue_flush_failure);
+    TEST_RUN(test_publish_queue_unbatched);
+    TEST_RUN(test_publish_queue_cbor);
+
+    return TEST_RESULT();
+}
+
+/**
+ * @brief Records the payload, fails while FailNext is set
+ */
+static int _test_flush(void *arg, MqttTopic_t topic, const char *payload, uint16_t len)
+{
+    (void)arg;
+
+    if (FailNext > 0)
+    {
+        FailNext--;
+        return -1;
+    }
+
+    if (FlushCount < TEST_FLUSHES)
+    {
+        TestFlush_t *flush = &Flushes[FlushCount];
+        flush->topic = topic;
+        memcpy(flush->payload, payload, len);
+        flush->payload[len] = '\0';
+        flush->len = len;
+    }
+    FlushCount++;
+
+    return 0;
+}
+
+static void _test_init(PublishQueue_t *queue, uint16_t maxBytes, uint32_t maxAgeMs)
+{
+    const PublishQueueConfig_t config = {.maxBytes = maxBytes, .maxAgeMs = maxAgeMs};
+    TEST_EQUAL(publish_queue_init(queue, &config, _test_flush, NULL), 0);
+    FlushCount = 0;
+    FailNext = 0;
+}
+
+static int _test_add(PublishQueue_t *queue, MqttTopic_t topic, const char *sample, uint32_t nowMs)
+{
+    return publish_queue_add(queue, topic, sample, (uint16_t)strlen(sample), nowMs);
+}
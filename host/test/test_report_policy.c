@@ -0,0 +1,266 @@
+/** Includes *************************************************************************************/
+#include "report_policy.h"
+#include "test.h"
+
+/**
+ * The decisions of report_policy_check(): the absolute and the relative deadband and which of
+ * the two applies, values below zero, the heartbeat after maxSilenceMs and the deltas starting
+ * over from the full value it carries, and a change too large for a 32 bit delta.
+ */
+
+/** Defines **************************************************************************************/
+/** Typedefs *************************************************************************************/
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+static bool _test_report(ReportPolicy_t *policy, int32_t value, uint32_t nowMs, ReportPolicyReport_t *report);
+
+/** Functions ************************************************************************************/
+
+/**
+ * @brief The first value is always reported, then a change up to the absolute band is suppressed
+ *        and one past it reported, the band follows the last report and not the last value
+ */
+static void test_report_policy_absolute(void)
+{
+    ReportPolicy_t policy;
+    const ReportPolicyConfig_t config = {.absDeadband = 10};
+    TEST_EQUAL(report_policy_init(&policy, &config), 0);
+    TEST_EQUAL(report_policy_init(NULL, &config), -1);
+    TEST_EQUAL(report_policy_init(&policy, NULL), -1);
+
+    ReportPolicyReport_t report;
+    TEST_CHECK(_test_report(&policy, 2000, 0, &report));
+    TEST_EQUAL(report.reason, REPORT_FIRST);
+    TEST_EQUAL(report.value, 2000);
+    TEST_CHECK(!report.delta);
+
+    TEST_CHECK(!_test_report(&policy, 2010, 1000, &report));
+    TEST_CHECK(!_test_report(&policy, 1990, 2000, &report));
+    TEST_CHECK(_test_report(&policy, 2011, 3000, &report));
+    TEST_EQUAL(report.reason, REPORT_CHANGE);
+    TEST_EQUAL(report.value, 2011);
+
+    /** A slow drift is reported once it is a band away from the last report */
+    TEST_CHECK(!_test_report(&policy, 2016, 4000, &report));
+    TEST_CHECK(!_test_report(&policy, 2021, 5000, &report));
+    TEST_CHECK(_test_report(&policy, 2022, 6000, &report));
+
+    /** Not sent, the reference stays */
+    ReportPolicyReport_t unsent;
+    TEST_CHECK(report_policy_check(&policy, 2040, 7000, &unsent));
+    TEST_CHECK(!_test_report(&policy, 2030, 8000, &report));
+    TEST_EQUAL(report_policy_band(&policy), 10);
+
+    TEST_EQUAL(policy.stats.sent, 3);
+    TEST_EQUAL(policy.stats.suppressed, 5);
+    TEST_EQUAL(policy.stats.heartbeats, 0);
+
+    /** No band, every value, also a repeat */
+    const ReportPolicyConfig_t every = {.absDeadband = -1, .relDeadbandPermille = 100};
+    TEST_EQUAL(report_policy_init(&policy, &every), 0);
+    TEST_CHECK(_test_report(&policy, 2000, 0, &report));
+    TEST_CHECK(_test_report(&policy, 2000, 1000, &report));
+    TEST_EQUAL(report_policy_band(&policy), -1);
+
+    /** A band of 0, only repeats */
+    const ReportPolicyConfig_t repeats = {.absDeadband = 0};
+    TEST_EQUAL(report_policy_init(&policy, &repeats), 0);
+    TEST_CHECK(_test_report(&policy, 2000, 0, &report));
+    TEST_CHECK(!_test_report(&policy, 2000, 1000, &report));
+    TEST_CHECK(_test_report(&policy, 2001, 2000, &report));
+}
+
+/**
+ * @brief The relative band is taken from the last report, the larger of the two bands applies
+ */
+static void test_report_policy_relative(void)
+{
+    ReportPolicy_t policy;
+    const ReportPolicyConfig_t config = {.absDeadband = 10, .relDeadbandPermille = 20};
+    TEST_EQUAL(report_policy_init(&policy, &config), 0);
+
+    /** 2 % of 2000 is 40, larger than 10 */
+    ReportPolicyReport_t report;
+    TEST_CHECK(_test_report(&policy, 2000, 0, &report));
+    TEST_EQUAL(report_policy_band(&policy), 40);
+    TEST_CHECK(!_test_report(&policy, 2040, 1000, &report));
+    TEST_CHECK(!_test_report(&policy, 1960, 2000, &report));
+    TEST_CHECK(_test_report(&policy, 2041, 3000, &report));
+
+    /** 2 % of 2041 is 40.82, rounded down */
+    TEST_EQUAL(report_policy_band(&policy), 40);
+    TEST_CHECK(!_test_report(&policy, 2081, 4000, &report));
+    TEST_CHECK(_test_report(&policy, 2082, 5000, &report));
+
+    /** 2 % of 100 is 2, the absolute band applies */
+    TEST_CHECK(_test_report(&policy, 100, 6000, &report));
+    TEST_EQUAL(report_policy_band(&policy), 10);
+    TEST_CHECK(!_test_report(&policy, 110, 7000, &report));
+    TEST_CHECK(_test_report(&policy, 111, 8000, &report));
+
+    /** Around 0 */
+    TEST_CHECK(_test_report(&policy, 0, 9000, &report));
+    TEST_EQUAL(report_policy_band(&policy), 10);
+
+    /** The relative band of the largest values does not overflow */
+    TEST_CHECK(_test_report(&policy, INT32_MAX, 10000, &report));
+    TEST_EQUAL(report_policy_band(&policy), (int64_t)INT32_MAX * 20 / 1000);
+    TEST_CHECK(!_test_report(&policy, INT32_MAX - 42949672, 11000, &report));
+    TEST_CHECK(_test_report(&policy, INT32_MAX - 42949673, 12000, &report));
+}
+
+/**
+ * @brief Below zero the relative band is taken from the magnitude of the last report, and a
+ *        change across zero is reported like any other
+ */
+static void test_report_policy_negative(void)
+{
+    ReportPolicy_t policy;
+    const ReportPolicyConfig_t config = {.absDeadband = 10, .relDeadbandPermille = 20};
+    TEST_EQUAL(report_policy_init(&policy, &config), 0);
+
+    ReportPolicyReport_t report;
+    TEST_CHECK(_test_report(&policy, -2000, 0, &report));
+    TEST_EQUAL(report.value, -2000);
+    TEST_EQUAL(report_policy_band(&policy), 40);
+    TEST_CHECK(!_test_report(&policy, -2040, 1000, &report));
+    TEST_CHECK(!_test_report(&policy, -1960, 2000, &report));
+    TEST_CHECK(_test_report(&policy, -2041, 3000, &report));
+    TEST_EQUAL(report.value, -2041);
+
+    /** Across zero, the absolute band applies */
+    TEST_CHECK(_test_report(&policy, -5, 4000, &report));
+    TEST_EQUAL(report_policy_band(&policy), 10);
+    TEST_CHECK(!_test_report(&policy, 5, 5000, &report));
+    TEST_CHECK(_test_report(&policy, 6, 6000, &report));
+    TEST_EQUAL(report.value, 6);
+
+    /** The most negative value has a magnitude past 32 bits */
+    TEST_CHECK(_test_report(&policy, INT32_MIN, 7000, &report));
+    TEST_EQUAL(report_policy_band(&policy), -(int64_t)INT32_MIN * 20 / 1000);
+    TEST_CHECK(!_test_report(&policy, INT32_MIN + 42949672, 8000, &report));
+}
+
+/**
+ * @brief A value held back for maxSilenceMs goes out as a heartbeat with the full value, the
+ *        deltas after it are taken from it, so a receiver that lost a delta resyncs on it
+ */
+static void test_report_policy_heartbeat(void)
+{
+    ReportPolicy_t policy;
+    const ReportPolicyConfig_t config = {.absDeadband = 10, .maxSilenceMs = 60000, .delta = true};
+    TEST_EQUAL(report_policy_init(&policy, &config), 0);
+
+    ReportPolicyReport_t report;
+    TEST_CHECK(_test_report(&policy, 2000, 0, &report));
+    TEST_EQUAL(report.reason, REPORT_FIRST);
+    TEST_CHECK(!report.delta);
+    TEST_EQUAL(report.value, 2000);
+
+    TEST_CHECK(_test_report(&policy, 2020, 5000, &report));
+    TEST_EQUAL(report.reason, REPORT_CHANGE);
+    TEST_CHECK(report.delta);
+    TEST_EQUAL(report.value, 20);
+
+    TEST_CHECK(_test_report(&policy, 1995, 10000, &report));
+    TEST_CHECK(report.delta);
+    TEST_EQUAL(report.value, -25);
+
+    /** Silent up to just short of maxSilenceMs */
+    TEST_CHECK(!_test_report(&policy, 1999, 10000 + 59999, &report));
+    TEST_CHECK(_test_report(&policy, 2001, 10000 + 60000, &report));
+    TEST_EQUAL(report.reason, REPORT_HEARTBEAT);
+    TEST_CHECK(!report.delta);
+    TEST_EQUAL(report.value, 2001);
+
+    /** The next delta is from the heartbeat, not from the last change */
+    TEST_CHECK(_test_report(&policy, 2012, 75000, &report));
+    TEST_CHECK(report.delta);
+    TEST_EQUAL(report.value, 11);
+
+    /** Past the deadline and past the band at once, a change */
+    TEST_CHECK(_test_report(&policy, 2100, 75000 + 120000, &report));
+    TEST_EQUAL(report.reason, REPORT_CHANGE);
+    TEST_CHECK(report.delta);
+    TEST_EQUAL(report.value, 88);
+
+    /** The clock rolling over */
+    TEST_EQUAL(report_policy_init(&policy, &config), 0);
+    TEST_CHECK(_test_report(&policy, 2000, UINT32_MAX - 1000, &report));
+    TEST_CHECK(!_test_report(&policy, 2000, 58998, &report));
+    TEST_CHECK(_test_report(&policy, 2000, 58999, &report));
+    TEST_EQUAL(report.reason, REPORT_HEARTBEAT);
+
+    TEST_EQUAL(policy.stats.sent, 2);
+    TEST_EQUAL(policy.stats.heartbeats, 1);
+
+    /** No heartbeat without maxSilenceMs */
+    const ReportPolicyConfig_t quiet = {.absDeadband = 10};
+    TEST_EQUAL(report_policy_init(&policy, &quiet), 0);
+    TEST_CHECK(_test_report(&policy, 2000, 0, &report));
+    TEST_CHECK(!_test_report(&policy, 2000, UINT32_MAX, &report));
+}
+
+/**
+ * @brief A change that does not fit in a 32 bit delta goes out as the full value, the deltas
+ *        carry on from it
+ */
+static void test_report_policy_delta_overflow(void)
+{
+    ReportPolicy_t policy;
+    const ReportPolicyConfig_t config = {.absDeadband = 0, .delta = true};
+    TEST_EQUAL(report_policy_init(&policy, &config), 0);
+
+    ReportPolicyReport_t report;
+    TEST_CHECK(_test_report(&policy, INT32_MIN, 0, &report));
+    TEST_CHECK(_test_report(&policy, INT32_MAX, 1000, &report));
+    TEST_EQUAL(report.reason, REPORT_CHANGE);
+    TEST_CHECK(!report.delta);
+    TEST_EQUAL(report.value, INT32_MAX);
+
+    /** Just fits */
+    TEST_CHECK(_test_report(&policy, -1, 2000, &report));
+    TEST_CHECK(report.delta);
+    TEST_EQUAL(report.value, INT32_MIN);
+    TEST_CHECK(_test_report(&policy, INT32_MAX - 1, 3000, &report));
+    TEST_CHECK(report.delta);
+    TEST_EQUAL(report.value, INT32_MAX);
+
+    /** Just doesn't */
+    TEST_CHECK(_test_report(&policy, -3, 4000, &report));
+    TEST_CHECK(!report.delta);
+    TEST_EQUAL(report.value, -3);
+
+    TEST_EQUAL(policy.stats.sent, 5);
+    TEST_EQUAL(policy.stats.deltas, 2);
+}
+
+int main(void)
+{
+    TEST_RUN(test_report_policy_absolute);
+    TEST_RUN(test_report_policy_relative);
+    TEST_RUN(test_report_policy_negative);
+    TEST_RUN(test_report_policy_heartbeat);
+    TEST_RUN(test_report_policy_delta_overflow);
+
+    return TEST_RESULT();
+}
+
+/**
+ * @brief Check a value and mark the report sent if it is reported, like the application core
+ * @param policy The policy
+ * @param value The value
+ * @param nowMs Time of the value
+ * @param report Filled with the report
+ * @return bool True if the value was reported
+ */
+static bool _test_report(ReportPolicy_t *policy, int32_t value, uint32_t nowMs, ReportPolicyReport_t *report)
+{
+    if (!report_policy_check(policy, value, nowMs, report))
+    {
+        return false;
+    }
+
+    report_policy_sent(policy, report, value, nowMs);
+    return true;
+}
@@ -0,0 +1,301 @@
+/** Includes *************************************************************************************/
+#include "ring_buffer.h"
+#include "test.h"
+
+#include <pthread.h>
+#include <sched.h>
+
+/**
+ * The SPSC ring of ring_buffer.c: full and empty, copies and spans that wrap around the end of
+ * the storage, the free running indices rolling over, and a producer and a consumer thread
+ * streaming through it.
+ */
+
+/** Defines **************************************************************************************/
+#define TEST_RING_SIZE 16
+
+/** Bytes streamed through the ring by the stress test */
+#define TEST_STRESS_BYTES (16u * 1024u * 1024u)
+#define TEST_STRESS_RING_SIZE 4096
+
+/** Typedefs *************************************************************************************/
+
+/** One side of the stress test */
+typedef struct
+{
+    RingBuffer_t *ring;
+    uint32_t seed;     /** Of the chunk sizes */
+    uint32_t errors;   /** Bytes read that were not the ones written */
+    uint64_t stalls;   /** Calls that moved nothing */
+} TestStressSide_t;
+
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+static uint8_t _test_byte(uint32_t position);
+static uint32_t _test_rand(uint32_t *seed);
+static void *_test_producer(void *arg);
+static void *_test_consumer(void *arg);
+
+/** Functions ************************************************************************************/
+
+/**
+ * @brief Sizes that are not a power of two are refused
+ */
+static void test_ring_buffer_init(void)
+{
+    RingBuffer_t ring;
+    uint8_t storage[TEST_RING_SIZE];
+    TEST_EQUAL(ring_buffer_init(&ring, storage, 0), -1);
+    TEST_EQUAL(ring_buffer_init(&ring, storage, 12), -1);
+    TEST_EQUAL(ring_buffer_init(&ring, NULL, 16), -1);
+    TEST_EQUAL(ring_buffer_init(&ring, storage, sizeof(storage)), 0);
+    TEST_EQUAL(ring_buffer_used(&ring), 0);
+    TEST_EQUAL(ring_buffer_free(&ring), TEST_RING_SIZE);
+}
+
+/**
+ * @brief A full ring takes nothing more, an empty one gives nothing
+ */
+static void test_ring_buffer_full_empty(void)
+{
+    RingBuffer_t ring;
+    uint8_t storage[TEST_RING_SIZE];
+    ring_buffer_init(&ring, storage, sizeof(storage));
+
+    uint8_t data[TEST_RING_SIZE + 4];
+    for (uint32_t i = 0; i < sizeof(data); i++)
+    {
+        data[i] = (uint8_t)i;
+    }
+
+    const uint8_t *span = NULL;
+    uint8_t read[sizeof(data)];
+    TEST_EQUAL(ring_buffer_read(&ring, read, sizeof(read)), 0);
+    TEST_EQUAL(ring_buffer_peek(&ring, &span), 0);
+
+    /** Only what fits is taken */
+    TEST_EQUAL(ring_buffer_write(&ring, data, sizeof(data)), TEST_RING_SIZE);
+    TEST_EQUAL(ring_buffer_used(&ring), TEST_RING_SIZE);
+    TEST_EQUAL(ring_buffer_free(&ring), 0);
+    TEST_EQUAL(ring_buffer_write(&ring, data, 1), 0);
+
+    TEST_EQUAL(ring_buffer_read(&ring, read, sizeof(read)), TEST_RING_SIZE);
+    TEST_CHECK(memcmp(read, data, TEST_RING_SIZE) == 0);
+    TEST_EQUAL(ring_buffer_used(&ring), 0);
+
+    /** Consuming more than there is empties the ring */
+    ring_buffer_write(&ring, data, 5);
+    ring_buffer_consume(&ring, 100);
+    TEST_EQUAL(ring_buffer_used(&ring), 0);
+    TEST_EQUAL(ring.head, ring.tail);
+
+    ring_buffer_write(&ring, data, 5);
+    ring_buffer_reset(&ring);
+    TEST_EQUAL(ring_buffer_used(&ring), 0);
+    TEST_EQUAL(ring_buffer_free(&ring), TEST_RING_SIZE);
+}
+
+/**
+ * @brief Writes and reads that cross the end of the storage are split and put back together
+ */
+static void test_ring_buffer_wraparound(void)
+{
+    RingBuffer_t ring;
+    uint8_t storage[TEST_RING_SIZE];
+    ring_buffer_init(&ring, storage, sizeof(storage));
+
+    uint8_t data[TEST_RING_SIZE];
+    uint8_t read[TEST_RING_SIZE];
+    for (uint32_t i = 0; i < sizeof(data); i++)
+    {
+        data[i] = (uint8_t)(0xA0 + i);
+    }
+
+    /** Move the indices to 12, then write 10 across the end */
+    ring_buffer_write(&ring, data, 12);
+    ring_buffer_read(&ring, read, 12);
+    TEST_EQUAL(ring_buffer_write(&ring, data, 10), 10);
+    TEST_EQUAL(storage[12], 0xA0);
+    TEST_EQUAL(storage[15], 0xA3);
+    TEST_EQUAL(storage[0], 0xA4);
+    TEST_EQUAL(storage[5], 0xA9);
+
+    /** A span ends at the end of the storage, the rest is the next span */
+    const uint8_t *span = NULL;
+    TEST_EQUAL(ring_buffer_peek(&ring, &span), 4);
+    TEST_CHECK(span == &storage[12]);
+    ring_buffer_consume(&ring, 4);
+    TEST_EQUAL(ring_buffer_peek(&ring, &span), 6);
+    TEST_CHECK(span == &storage[0]);
+    TEST_CHECK(memcmp(span, &data[4], 6) == 0);
+
+    /** A read across the end */
+    ring_buffer_write(&ring, data, 10);
+    ring_buffer_consume(&ring, 6);
+    TEST_EQUAL(ring_buffer_read(&ring, read, sizeof(read)), 10);
+    TEST_CHECK(memcmp(read, data, 10) == 0);
+}
+
+/**
+ * @brief The indices count bytes and run freely, used and free hold when they roll over
+ */
+static void test_ring_buffer_index_rollover(void)
+{
+    RingBuffer_t ring;
+    uint8_t storage[TEST_RING_SIZE];
+    ring_buffer_init(&ring, storage, sizeof(storage));
+    ring.head = UINT32_MAX - 5;
+    ring.tail = UINT32_MAX - 5;
+
+    uint8_t data[TEST_RING_SIZE];
+    uint8_t read[TEST_RING_SIZE];
+    for (uint32_t i = 0; i < sizeof(data); i++)
+    {
+        data[i] = (uint8_t)(i * 7);
+    }
+
+    TEST_EQUAL(ring_buffer_write(&ring, data, 12), 12);
+    TEST_CHECK(ring.head < ring.tail);
+    TEST_EQUAL(ring_buffer_used(&ring), 12);
+    TEST_EQUAL(ring_buffer_free(&ring), 4);
+    TEST_EQUAL(ring_buffer_write(&ring, data, 8), 4);
+
+    TEST_EQUAL(ring_buffer_read(&ring, read, sizeof(read)), TEST_RING_SIZE);
+    TEST_CHECK(memcmp(read, data, 12) == 0);
+    TEST_CHECK(memcmp(&read[12], data, 4) == 0);
+    TEST_EQUAL(ring_buffer_used(&ring), 0);
+}
+
+/**
+ * @brief A producer and a consumer thread stream through the ring in chunks of random size,
+ *        every byte arrives in order
+ */
+static void test_ring_buffer_stress(void)
+{
+    static uint8_t storage[TEST_STRESS_RING_SIZE];
+    RingBuffer_t ring;
+    ring_buffer_init(&ring, storage, sizeof(storage));
+
+    TestStressSide_t producer = {.ring = &ring, .seed = 1};
+    TestStressSide_t consumer = {.ring = &ring, .seed = 2};
+    pthread_t producerThread;
+    pthread_t consumerThread;
+
+    uint64_t startNs = test_now_ns();
+    pthread_create(&producerThread, NULL, _test_producer, &producer);
+    pthread_create(&consumerThread, NULL, _test_consumer, &consumer);
+    pthread_join(producerThread, NULL);
+    pthread_join(consumerThread, NULL);
+    uint64_t elapsedNs = test_now_ns() - startNs;
+
+    TEST_EQUAL(consumer.errors, 0);
+    TEST_EQUAL(ring_buffer_used(&ring), 0);
+    TEST_EQUAL(ring.head, TEST_STRESS_BYTES);
+
+    printf("bench ring: %u MiB through %u bytes in %.1f ms, %.0f MiB/s, %" PRIu64 " full and %" PRIu64 " empty calls\n",
+           TEST_STRESS_BYTES >> 20, TEST_STRESS_RING_SIZE, elapsedNs / 1e6,
+           (TEST_STRESS_BYTES / 1048576.0) / (elapsedNs / 1e9), producer.stalls, consumer.stalls);
+}
+
+int main(void)
+{
+    TEST_RUN(test_ring_buffer_init);
+    TEST_RUN(test_ring_buffer_full_empty);
+    TEST_RUN(test_ring_buffer_wraparound);
+    TEST_RUN(test_ring_buffer_index_rollover);
+    TEST_RUN(test_ring_buffer_stress);
+
+    return TEST_RESULT();
+}
+
+/**
+ * @brief The byte at a position of the stream, not periodic in the ring size
+ */
+static uint8_t _test_byte(uint32_t position)
+{
+    return (uint8_t)((position * 2654435761u) >> 24);
+}
+
+/**
+ * @brief xorshift32
+ */
+static uint32_t _test_rand(uint32_t *seed)
+{
+    uint32_t x = *seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *seed = x;
+    return x;
+}
+
+static void *_test_producer(void *arg)
+{
+    TestStressSide_t *side = arg;
+    uint8_t chunk[TEST_STRESS_RING_SIZE];
+    uint32_t position = 0;
+
+    while (position < TEST_STRESS_BYTES)
+    {
+        uint32_t len = 1 + _test_rand(&side->seed) % sizeof(chunk);
+        if (len > TEST_STRESS_BYTES - position)
+        {
+            len = TEST_STRESS_BYTES - position;
+        }
+        for (uint32_t i = 0; i < len; i++)
+        {
+            chunk[i] = _test_byte(position + i);
+        }
+
+        uint32_t written = ring_buffer_write(side->ring, chunk, len);
+        if (written == 0)
+        {
+            /** The other side may share the CPU */
+            side->stalls++;
+            sched_yield();
+        }
+        position += written;
+    }
+
+    return NULL;
+}
+
+static void *_test_consumer(void *arg)
+{
+    TestStressSide_t *side = arg;
+    uint8_t chunk[TEST_STRESS_RING_SIZE];
+    uint32_t position = 0;
+
+    while (position < TEST_STRESS_BYTES)
+    {
+        /** Both ways out of the ring, copies and spans */
+        uint32_t len;
+        if (_test_rand(&side->seed) & 1)
+        {
+            len = ring_buffer_read(side->ring, chunk, 1 + _test_rand(&side->seed) % sizeof(chunk));
+        }
+        else
+        {
+            const uint8_t *span;
+            len = ring_buffer_peek(side->ring, &span);
+            memcpy(chunk, span, len);
+            ring_buffer_consume(side->ring, len);
+        }
+
+        if (len == 0)
+        {
+            side->stalls++;
+            sched_yield();
+        }
+        for (uint32_t i = 0; i < len; i++)
+        {
+            if (chunk[i] != _test_byte(position + i))
+            {
+                side->errors++;
+            }
+        }
+        position += len;
+    }
+
+    return NULL;
+}
@@ -0,0 +1,411 @@
+/** Includes *************************************************************************************/
+#include "scheduler.h"
+#include "test.h"
+
+#include <pthread.h>
+
+#include "pico/cyw43_arch.h"
+#include "pico/stdlib.h"
+
+/**
+ * The scheduler of scheduler.c against a faked platform. The cases run on a simulated clock
+ * that only moves when a case moves it or the loop sleeps. The measurement runs on the real
+ * clock: another thread wakes a task at random times, and the wake to dispatch latency of the
+ * scheduler is compared with the 10 ms sleep loop main.c had before it.
+ */
+
+/** Defines **************************************************************************************/
+
+/** Built with SCHEDULER_MAX_TASKS above 32, the wake mask takes two words */
+#define TEST_HIGH_TASK 35
+
+#define TEST_LOG_SIZE 64
+
+/** The measurement */
+#define TEST_BENCH_WAKES 200
+#define TEST_BENCH_MAX_GAP_US 3000
+#define TEST_OLD_LOOP_SLEEP_US 10000
+
+/** Typedefs *************************************************************************************/
+
+typedef struct
+{
+    uint64_t nowUs;
+    bool realTime;
+    bool wakePending;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    async_when_pending_worker_t *worker;
+    char context; /** Only its address is used */
+} FakePlatform_t;
+
+/** Variables ************************************************************************************/
+static FakePlatform_t Fake = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+/** Ids of the dispatched tasks, in dispatch order */
+static int Log[TEST_LOG_SIZE];
+static uint32_t LogLen;
+
+/** Dispatches of _test_task(), read by the waker thread */
+static uint32_t Dispatched;
+
+/** Prototypes ***********************************************************************************/
+static int _test_task(void *arg);
+static int _test_reschedule_task(void *arg);
+static void _test_reset(uint64_t nowUs);
+static void *_test_waker(void *arg);
+static void _test_sleep_us(uint64_t us);
+
+/** Functions ************************************************************************************/
+
+/**
+ * @brief Tasks run in deadline order, equal deadlines round robin
+ */
+static void test_scheduler_deadline_order(void)
+{
+    _test_reset(1000000);
+    int a = scheduler_add_task(_test_task, (void *)(intptr_t)0, 30);
+    int b = scheduler_add_task(_test_task, (void *)(intptr_t)1, 10);
+    int c = scheduler_add_task(_test_task, (void *)(intptr_t)2, 20);
+    TEST_EQUAL(a, 0);
+    TEST_EQUAL(b, 1);
+    TEST_EQUAL(c, 2);
+
+    /** All are due at once on the first run */
+    uint64_t next = scheduler_run();
+    TEST_EQUAL(LogLen, 3);
+    TEST_EQUAL(Log[0], 0);
+    TEST_EQUAL(Log[1], 1);
+    TEST_EQUAL(Log[2], 2);
+    TEST_EQUAL(next, Fake.nowUs + 10000);
+
+    /** Step 5 ms at a time through 60 ms: b every 10, c every 20, a every 30, ties round robin */
+    LogLen = 0;
+    for (int i = 0; i < 12; i++)
+    {
+        Fake.nowUs += 5000;
+        scheduler_run();
+    }
+    const int expected[] = {1, 2, 1, 0, 1, 2, 1, 1, 0, 2, 1};
+    TEST_EQUAL(LogLen, sizeof(expected) / sizeof(expected[0]));
+    for (uint32_t i = 0; i < LogLen && i < sizeof(expected) / sizeof(expected[0]); i++)
+    {
+        TEST_EQUAL(Log[i], expected[i]);
+    }
+
+    /** A delay replaces the period for one run */
+    LogLen = 0;
+    TEST_EQUAL(scheduler_delay(a, 1), 0);
+    TEST_EQUAL(scheduler_delay(99, 1), -1);
+    Fake.nowUs += 1000;
+    scheduler_run();
+    TEST_EQUAL(LogLen, 1);
+    TEST_EQUAL(Log[0], a);
+}
+
+/**
+ * @brief A task that keeps rescheduling itself without delay runs once per scheduler_run()
+ */
+static void test_scheduler_no_starvation(void)
+{
+    _test_reset(1000000);
+    scheduler_add_task(_test_reschedule_task, (void *)(intptr_t)0, 1000);
+    scheduler_add_task(_test_task, (void *)(intptr_t)1, 1000);
+
+    scheduler_run();
+    TEST_EQUAL(LogLen, 2);
+    TEST_EQUAL(Log[0], 0);
+    TEST_EQUAL(Log[1], 1);
+
+    LogLen = 0;
+    uint64_t next = scheduler_run();
+    TEST_EQUAL(LogLen, 1);
+    TEST_EQUAL(Log[0], 0);
+    TEST_EQUAL(next, Fake.nowUs);
+}
+
+/**
+ * @brief Woken tasks run on the next scheduler_run() ahead of their deadline, in both words of the mask
+ */
+static void test_scheduler_wake_mask(void)
+{
+    _test_reset(1000000);
+    for (int i = 0; i <= TEST_HIGH_TASK; i++)
+    {
+        TEST_EQUAL(scheduler_add_task(_test_task, (void *)(intptr_t)i, 60000), i);
+    }
+    scheduler_run();
+
+    LogLen = 0;
+    Fake.wakePending = false;
+    Fake.nowUs += 1000;
+    TEST_EQUAL(scheduler_wake(TEST_HIGH_TASK), 0);
+    TEST_EQUAL(scheduler_wake(3), 0);
+    TEST_EQUAL(scheduler_wake(3), 0);
+    TEST_EQUAL(scheduler_wake(TEST_HIGH_TASK + 1), -1);
+    TEST_EQUAL(scheduler_wake(SCHEDULER_INVALID_TASK), -1);
+    TEST_CHECK(Fake.wakePending);
+
+    /** A pending wake keeps the loop from sleeping */
+    TEST_CHECK(!scheduler_wait_until(Fake.nowUs + 5000000));
+
+    Fake.nowUs += 250;
+    scheduler_run();
+    TEST_EQUAL(LogLen, 2);
+    TEST_EQUAL(Log[0], 3);
+    TEST_EQUAL(Log[1], TEST_HIGH_TASK);
+
+    /** Latency from the first wake of each task */
+    SchedulerStats_t stats;
+    scheduler_get_stats(&stats);
+    TEST_EQUAL(stats.wakeCount, 2);
+    TEST_EQUAL(stats.wakeLatencyLastUs, 250);
+    TEST_EQUAL(stats.wakeLatencyMaxUs, 250);
+
+    /** The mask is clear, nothing runs until a deadline or a wake */
+    LogLen = 0;
+    scheduler_run();
+    TEST_EQUAL(LogLen, 0);
+    TEST_CHECK(scheduler_wait_until(Fake.nowUs + 1000));
+}
+
+/**
+ * @brief Deadlines hold across the roll-over of the 32 bit microsecond and millisecond clocks
+ */
+static void test_scheduler_rollover(void)
+{
+    const uint64_t starts[] = {UINT32_MAX - 2500ull, (uint64_t)UINT32_MAX * 1000u - 2500u};
+    for (size_t s = 0; s < sizeof(starts) / sizeof(starts[0]); s++)
+    {
+        _test_reset(starts[s]);
+        scheduler_add_task(_test_task, (void *)(intptr_t)0, 1);
+        scheduler_add_task(_test_task, (void *)(intptr_t)1, 4);
+
+        /** 10 ms in 100 us steps, the 1 ms task runs 11 times and the 4 ms one 3 times */
+        uint32_t runs[2] = {0};
+        for (int i = 0; i <= 100; i++)
+        {
+            LogLen = 0;
+            uint64_t next = scheduler_run();
+            TEST_CHECK(next > Fake.nowUs);
+            TEST_CHECK(next <= Fake.nowUs + 1000);
+            for (uint32_t j = 0; j < LogLen; j++)
+            {
+                runs[Log[j]]++;
+            }
+            Fake.nowUs += 100;
+        }
+        TEST_EQUAL(runs[0], 11);
+        TEST_EQUAL(runs[1], 3);
+    }
+}
+
+/**
+ * @brief Without tasks the loop sleeps for the longest idle time, and it sleeps until the deadline
+ */
+static void test_scheduler_idle(void)
+{
+    _test_reset(1000000);
+    TEST_EQUAL(scheduler_run(), Fake.nowUs + SCHEDULER_MAX_IDLE_MS * 1000ull);
+    TEST_CHECK(!scheduler_wait_until(Fake.nowUs));
+
+    uint64_t deadline = Fake.nowUs + 2000;
+    TEST_CHECK(scheduler_wait_until(deadline));
+    TEST_EQUAL(Fake.nowUs, deadline);
+
+    SchedulerStats_t stats;
+    scheduler_get_stats(&stats);
+    TEST_EQUAL(stats.sleepCount, 1);
+}
+
+/**
+ * @brief Wake to dispatch latency on the real clock, scheduler against the old 10 ms loop
+ */
+static void test_scheduler_bench_wake_latency(void)
+{
+    _test_reset(0);
+    Fake.realTime = true;
+    int task = scheduler_add_task(_test_task, (void *)(intptr_t)0, 60000);
+    scheduler_run();
+    LogLen = 0;
+
+    /** The scheduler loop of main.c */
+    pthread_t waker;
+    pthread_create(&waker, NULL, _test_waker, (void *)(intptr_t)task);
+    SchedulerStats_t scheduler;
+    do
+    {
+        scheduler_wait_until(scheduler_run());
+        scheduler_get_stats(&scheduler);
+    } while (scheduler.wakeCount < TEST_BENCH_WAKES);
+    pthread_join(waker, NULL);
+
+    /** The loop main.c had before, everything ran every 10 ms */
+    _test_reset(0);
+    Fake.realTime = true;
+    task = scheduler_add_task(_test_task, (void *)(intptr_t)0, 60000);
+    scheduler_run();
+    pthread_create(&waker, NULL, _test_waker, (void *)(intptr_t)task);
+    SchedulerStats_t old;
+    do
+    {
+        _test_sleep_us(TEST_OLD_LOOP_SLEEP_US);
+        scheduler_run();
+        scheduler_get_stats(&old);
+    } while (old.wakeCount < TEST_BENCH_WAKES);
+    pthread_join(waker, NULL);
+    Fake.realTime = false;
+
+    TEST_EQUAL(scheduler.wakeCount, TEST_BENCH_WAKES);
+    TEST_EQUAL(old.wakeCount, TEST_BENCH_WAKES);
+    printf("bench wake to dispatch: scheduler mean %" PRIu64 " us max %" PRIu64 " us, 10 ms loop mean %" PRIu64 " us max %" PRIu64 " us\n",
+           scheduler.wakeLatencyTotalUs / TEST_BENCH_WAKES, scheduler.wakeLatencyMaxUs,
+           old.wakeLatencyTotalUs / TEST_BENCH_WAKES, old.wakeLatencyMaxUs);
+}
+
+int main(void)
+{
+    /** The sleep of the real clock times out on the monotonic clock, like time_us_64() */
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&Fake.cond, &attr);
+
+    TEST_RUN(test_scheduler_deadline_order);
+    TEST_RUN(test_scheduler_no_starvation);
+    TEST_RUN(test_scheduler_wake_mask);
+    TEST_RUN(test_scheduler_rollover);
+    TEST_RUN(test_scheduler_idle);
+    TEST_RUN(test_scheduler_bench_wake_latency);
+
+    return TEST_RESULT();
+}
+
+/**
+ * @brief Logs its id, passed as the argument
+ */
+static int _test_task(void *arg)
+{
+    __atomic_fetch_add(&Dispatched, 1, __ATOMIC_SEQ_CST);
+    if (LogLen < TEST_LOG_SIZE)
+    {
+        Log[LogLen++] = (int)(intptr_t)arg;
+    }
+    return 0;
+}
+
+/**
+ * @brief Logs its id and asks to run again at once
+ */
+static int _test_reschedule_task(void *arg)
+{
+    _test_task(arg);
+    scheduler_delay(scheduler_current_task(), 0);
+    return 0;
+}
+
+/**
+ * @brief Start the scheduler over on the simulated clock
+ */
+static void _test_reset(uint64_t nowUs)
+{
+    Fake.nowUs = nowUs;
+    Fake.realTime = false;
+    Fake.wakePending = false;
+    LogLen = 0;
+    TEST_EQUAL(scheduler_init(), 0);
+}
+
+/**
+ * @brief Wakes the task given as the argument TEST_BENCH_WAKES times at random intervals, each
+ *        time after the last wake was dispatched so none are merged
+ */
+static void *_test_waker(void *arg)
+{
+    unsigned int seed = 1;
+    for (uint32_t i = 0; i < TEST_BENCH_WAKES; i++)
+    {
+        _test_sleep_us(500 + (uint64_t)rand_r(&seed) % TEST_BENCH_MAX_GAP_US);
+        uint32_t dispatched = __atomic_load_n(&Dispatched, __ATOMIC_SEQ_CST);
+        scheduler_wake((int)(intptr_t)arg);
+        while (__atomic_load_n(&Dispatched, __ATOMIC_SEQ_CST) == dispatched)
+        {
+            _test_sleep_us(100);
+        }
+    }
+    return NULL;
+}
+
+static void _test_sleep_us(uint64_t us)
+{
+    struct timespec ts = {.tv_sec = (time_t)(us / 1000000u), .tv_nsec = (long)(us % 1000000u) * 1000};
+    nanosleep(&ts, NULL);
+}
+
+/** The faked platform, declared by pico/stdlib.h, pico/cyw43_arch.h and pico/async_context.h */
+
+uint64_t time_us_64(void)
+{
+    return Fake.realTime ? test_now_ns() / 1000u : Fake.nowUs;
+}
+
+void cyw43_arch_wait_for_work_until(absolute_time_t until)
+{
+    if (!Fake.realTime)
+    {
+        /** Nothing else happens on the simulated clock, the sleep lasts until the deadline */
+        if (!Fake.wakePending && until > Fake.nowUs)
+        {
+            Fake.nowUs = until;
+        }
+        Fake.wakePending = false;
+        return;
+    }
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    uint64_t nowUs = time_us_64();
+    uint64_t sleepUs = until > nowUs ? until - nowUs : 0;
+    deadline.tv_sec += (time_t)(sleepUs / 1000000u);
+    deadline.tv_nsec += (long)(sleepUs % 1000000u) * 1000;
+    if (deadline.tv_nsec >= 1000000000)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    pthread_mutex_lock(&Fake.lock);
+    while (!Fake.wakePending)
+    {
+        if (pthread_cond_timedwait(&Fake.cond, &Fake.lock, &deadline) != 0)
+        {
+            break;
+        }
+    }
+    Fake.wakePending = false;
+    pthread_mutex_unlock(&Fake.lock);
+}
+
+async_context_t *cyw43_arch_async_context(void)
+{
+    return (async_context_t *)&Fake.context;
+}
+
+bool async_context_add_when_pending_worker(async_context_t *context, async_when_pending_worker_t *worker)
+{
+    (void)context;
+    Fake.worker = worker;
+    return true;
+}
+
+void async_context_set_work_pending(async_context_t *context, async_when_pending_worker_t *worker)
+{
+    (void)context;
+    (void)worker;
+    pthread_mutex_lock(&Fake.lock);
+    Fake.wakePending = true;
+    pthread_cond_signal(&Fake.cond);
+    pthread_mutex_unlock(&Fake.lock);
+}
@@ -0,0 +1,337 @@
+/** Includes *************************************************************************************/
+#include "subscription_manager.h"
+#include "scheduler.h"
+#include "test.h"
+
+/**
+ * The subscriptions of subscription_manager.c against a faked lwIP MQTT client that records the
+ * SUBSCRIBE requests and answers them when a case says so: the requests kept in flight, the
+ * backoff and retry of a filter the broker refused, and the order the pipelined requests go out
+ * in while lwIP runs out of request slots.
+ */
+
+/** Defines **************************************************************************************/
+
+/** Filters of the cases, more than can be in flight */
+#define TEST_FILTERS 10
+
+#define TEST_TASK_ID 3
+
+/** Typedefs *************************************************************************************/
+
+/** A SUBSCRIBE request the faked client took */
+typedef struct
+{
+    int route; /** Index of the filter in the router */
+    uint8_t qos;
+    mqtt_request_cb_t cb;
+    void *arg;
+    bool answered;
+} FakeRequest_t;
+
+/** The faked lwIP MQTT client */
+typedef struct
+{
+    FakeRequest_t requests[64];
+    uint32_t requestCount;
+    uint32_t slots;       /** Request slots, taken by unanswered requests, ERR_MEM without one */
+    err_t subscribeError; /** Returned by the next mqtt_subscribe() calls instead of taking them */
+    uint32_t unsubscribes;
+    uint32_t wakes; /** Of TEST_TASK_ID */
+    uint32_t otherWakes;
+    char client; /** Only its address is used */
+} FakeMqtt_t;
+
+/** Variables ************************************************************************************/
+static FakeMqtt_t Fake;
+static TopicRouter_t Router;
+static SubscriptionManager_t Manager;
+
+/** Prototypes ***********************************************************************************/
+static void _test_start(uint32_t slots, uint32_t nowMs);
+static uint32_t _test_unanswered(void);
+static void _test_answer(uint32_t request, err_t err);
+
+/** Functions ************************************************************************************/
+
+/**
+ * @brief No more than SUBSCRIPTION_MAX_IN_FLIGHT requests are out at once, each SUBACK wakes the
+ *        task and lets the next one go, and the manager is done with the last SUBACK
+ */
+static void test_subscription_manager_in_flight(void)
+{
+    _test_start(MQTT_REQ_MAX_IN_FLIGHT, 0);
+    TEST_CHECK(!subscription_manager_done(&Manager));
+
+    TEST_EQUAL(subscription_manager_poll(&Manager, 0), UINT32_MAX);
+    TEST_EQUAL(Fake.requestCount, SUBSCRIPTION_MAX_IN_FLIGHT);
+    TEST_EQUAL(Manager.inFlight, SUBSCRIPTION_MAX_IN_FLIGHT);
+
+    /** Nothing more goes out before a SUBACK */
+    subscription_manager_poll(&Manager, 10);
+    TEST_EQUAL(Fake.requestCount, SUBSCRIPTION_MAX_IN_FLIGHT);
+
+    uint32_t maxInFlight = 0;
+    for (uint32_t answered = 0; answered < TEST_FILTERS; answered++)
+    {
+        _test_answer(answered, ERR_OK);
+        TEST_EQUAL(Fake.wakes, answered + 1);
+        subscription_manager_poll(&Manager, 20 + answered);
+        maxInFlight = Manager.inFlight > maxInFlight ? Manager.inFlight : maxInFlight;
+        TEST_EQUAL(Manager.inFlight, _test_unanswered());
+        TEST_EQUAL(subscription_manager_done(&Manager), answered + 1 == TEST_FILTERS);
+    }
+
+    TEST_EQUAL(maxInFlight, SUBSCRIPTION_MAX_IN_FLIGHT);
+    TEST_EQUAL(Fake.requestCount, TEST_FILTERS);
+    TEST_EQUAL(Fake.otherWakes, 0);
+    TEST_EQUAL(Fake.unsubscribes, 0);
+    TEST_EQUAL(Manager.stats.requests, TEST_FILTERS);
+    TEST_EQUAL(Manager.stats.acks, TEST_FILTERS);
+    TEST_EQUAL(Manager.stats.failures, 0);
+
+    /** A reconnect subscribes to everything again, the counters carry on */
+    _test_start(MQTT_REQ_MAX_IN_FLIGHT, 100);
+    TEST_CHECK(!subscription_manager_done(&Manager));
+    subscription_manager_poll(&Manager, 100);
+    TEST_EQUAL(Fake.requestCount, SUBSCRIPTION_MAX_IN_FLIGHT);
+    TEST_EQUAL(Manager.stats.requests, TEST_FILTERS + SUBSCRIPTION_MAX_IN_FLIGHT);
+}
+
+/**
+ * @brief A refused SUBACK frees its slot and retries the filter after a backoff that doubles on
+ *        every failure up to the maximum, a SUBACK at last makes the filter done
+ */
+static void test_subscription_manager_retry(void)
+{
+    const SubscriptionStats_t before = Manager.stats;
+    _test_start(MQTT_REQ_MAX_IN_FLIGHT, 1000);
+    subscription_manager_poll(&Manager, 1000);
+    for (uint32_t i = 1; i < SUBSCRIPTION_MAX_IN_FLIGHT; i++)
+    {
+        _test_answer(i, ERR_OK);
+    }
+    subscription_manager_poll(&Manager, 1000);
+
+    /** Refuse route 0 until the backoff reaches its maximum, answer everything else */
+    uint32_t nowMs = 1000;
+    uint32_t backoffMs = SUBSCRIPTION_RETRY_BASE_MS;
+    uint32_t failures = 0;
+    uint32_t request = 0;
+    for (; failures < 10; failures++)
+    {
+        _test_answer(request, ERR_ABRT);
+        TEST_EQUAL(Manager.entries[0].state, SUBSCRIPTION_RETRY);
+        TEST_EQUAL(Manager.inFlight, _test_unanswered());
+
+        /** The rest go on meanwhile, route 0 waits out its backoff */
+        for (uint32_t i = 0; i < Fake.requestCount; i++)
+        {
+            if (!Fake.requests[i].answered && Fake.requests[i].route != 0)
+            {
+                _test_answer(i, ERR_OK);
+            }
+        }
+        uint32_t requests = Fake.requestCount;
+        uint32_t waitMs = subscription_manager_poll(&Manager, nowMs + backoffMs - 1);
+        TEST_EQUAL(waitMs, 1);
+        for (uint32_t i = requests; i < Fake.requestCount; i++)
+        {
+            TEST_CHECK(Fake.requests[i].route != 0);
+        }
+
+        nowMs += backoffMs;
+        TEST_EQUAL(subscription_manager_poll(&Manager, nowMs), UINT32_MAX);
+        request = Fake.requestCount;
+        while (request > 0 && Fake.requests[request - 1].route != 0)
+        {
+            request--;
+        }
+        TEST_CHECK(request > 0);
+        request--;
+        TEST_EQUAL(Manager.entries[0].state, SUBSCRIPTION_IN_FLIGHT);
+
+        backoffMs = backoffMs * 2 > SUBSCRIPTION_RETRY_MAX_MS ? SUBSCRIPTION_RETRY_MAX_MS : backoffMs * 2;
+    }
+    TEST_EQUAL(backoffMs, SUBSCRIPTION_RETRY_MAX_MS);
+
+    for (uint32_t i = 0; i < Fake.requestCount; i++)
+    {
+        if (!Fake.requests[i].answered)
+        {
+            _test_answer(i, ERR_OK);
+        }
+        subscription_manager_poll(&Manager, nowMs);
+    }
+    TEST_CHECK(subscription_manager_done(&Manager));
+    TEST_EQUAL(Manager.entries[0].failures, 0);
+    TEST_EQUAL(Manager.stats.failures - before.failures, failures);
+    TEST_EQUAL(Manager.stats.acks - before.acks, TEST_FILTERS);
+    TEST_EQUAL(Manager.stats.requests - before.requests, TEST_FILTERS + failures);
+    TEST_EQUAL(Manager.inFlight, 0);
+
+    /** A request lwIP refuses outright, e.g. not connected, backs off the same way */
+    _test_start(MQTT_REQ_MAX_IN_FLIGHT, 5000);
+    Fake.subscribeError = ERR_CONN;
+    subscription_manager_poll(&Manager, 5000);
+    TEST_EQUAL(Fake.wakes, TEST_FILTERS);
+    TEST_EQUAL(subscription_manager_poll(&Manager, 5000), SUBSCRIPTION_RETRY_BASE_MS);
+    TEST_EQUAL(Fake.requestCount, 0);
+    TEST_EQUAL(Manager.inFlight, 0);
+    TEST_EQUAL(Manager.stats.failures - before.failures, failures + TEST_FILTERS);
+    Fake.subscribeError = ERR_OK;
+    subscription_manager_poll(&Manager, 5000 + SUBSCRIPTION_RETRY_BASE_MS);
+    TEST_EQUAL(Fake.requestCount, SUBSCRIPTION_MAX_IN_FLIGHT);
+}
+
+/**
+ * @brief Pipelined requests go out in the order of the router, answered in any order. When lwIP
+ *        has no request slot no later filter jumps ahead, and a retried filter goes out before
+ *        the filters after it.
+ */
+static void test_subscription_manager_order(void)
+{
+    _test_start(2, 0);
+    subscription_manager_poll(&Manager, 0);
+    TEST_EQUAL(Fake.requestCount, 2);
+    TEST_EQUAL(Manager.entries[2].state, SUBSCRIPTION_PENDING);
+    TEST_EQUAL(Manager.entries[3].state, SUBSCRIPTION_PENDING);
+
+    /** SUBACKs out of order */
+    _test_answer(1, ERR_OK);
+    subscription_manager_poll(&Manager, 1);
+    _test_answer(0, ERR_ABRT);
+    subscription_manager_poll(&Manager, 2);
+    TEST_EQUAL(Fake.requestCount, 4);
+
+    /** Route 0 comes back before the filters not sent yet */
+    uint32_t nowMs = SUBSCRIPTION_RETRY_BASE_MS;
+    while (!subscription_manager_done(&Manager))
+    {
+        TEST_CHECK(Fake.requestCount < sizeof(Fake.requests) / sizeof(Fake.requests[0]));
+        subscription_manager_poll(&Manager, nowMs);
+        for (uint32_t i = 0; i < Fake.requestCount; i++)
+        {
+            if (!Fake.requests[i].answered)
+            {
+                _test_answer(i, ERR_OK);
+                break;
+            }
+        }
+        nowMs += 10;
+    }
+
+    static const int expected[] = {0, 1, 2, 3, 0, 4, 5, 6, 7, 8, 9};
+    TEST_EQUAL(Fake.requestCount, sizeof(expected) / sizeof(expected[0]));
+    for (uint32_t i = 0; i < Fake.requestCount; i++)
+    {
+        TEST_EQUAL(Fake.requests[i].route, expected[i]);
+        TEST_EQUAL(Fake.requests[i].qos, Router.routes[expected[i]].qos);
+    }
+}
+
+int main(void)
+{
+    TEST_RUN(test_subscription_manager_in_flight);
+    TEST_RUN(test_subscription_manager_retry);
+    TEST_RUN(test_subscription_manager_order);
+
+    return TEST_RESULT();
+}
+
+/**
+ * @brief Reset the faked client and start subscribing to TEST_FILTERS filters
+ * @param slots Request slots of the faked client
+ * @param nowMs The start time
+ */
+static void _test_start(uint32_t slots, uint32_t nowMs)
+{
+    memset(&Fake, 0, sizeof(Fake));
+    Fake.slots = slots;
+
+    topic_router_init(&Router);
+    for (uint32_t i = 0; i < TEST_FILTERS; i++)
+    {
+        char filter[TOPIC_ROUTER_FILTER_LEN];
+        snprintf(filter, sizeof(filter), "pico/%u/+", (unsigned)i);
+        TEST_EQUAL(topic_router_add(&Router, filter, (uint8_t)(i % 3)), (int)i);
+    }
+
+    subscription_manager_start(&Manager, (mqtt_client_t *)&Fake.client, &Router, TEST_TASK_ID, nowMs);
+}
+
+/**
+ * @brief Requests taken and not answered
+ */
+static uint32_t _test_unanswered(void)
+{
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < Fake.requestCount; i++)
+    {
+        count += !Fake.requests[i].answered;
+    }
+    return count;
+}
+
+/**
+ * @brief The broker answers a request: a SUBACK with ERR_OK, a refusal or a timeout otherwise
+ * @param request Index of the request in Fake.requests
+ * @param err The result passed to the request callback
+ */
+static void _test_answer(uint32_t request, err_t err)
+{
+    FakeRequest_t *taken = &Fake.requests[request];
+    TEST_CHECK(request < Fake.requestCount && !taken->answered);
+    if (request >= Fake.requestCount || taken->answered)
+    {
+        return;
+    }
+    taken->answered = true;
+    taken->cb(taken->arg, err);
+}
+
+/** The faked lwIP MQTT client, declared by lwip/apps/mqtt.h, and the scheduler */
+
+err_t mqtt_sub_unsub(mqtt_client_t *client, const char *topic, u8_t qos, mqtt_request_cb_t cb, void *arg, u8_t sub)
+{
+    if (!sub)
+    {
+        Fake.unsubscribes++;
+        return ERR_VAL;
+    }
+    TEST_CHECK(client == (mqtt_client_t *)&Fake.client);
+    if (Fake.subscribeError != ERR_OK)
+    {
+        return Fake.subscribeError;
+    }
+    if (_test_unanswered() >= Fake.slots || Fake.requestCount >= sizeof(Fake.requests) / sizeof(Fake.requests[0]))
+    {
+        return ERR_MEM;
+    }
+
+    int route = -1;
+    for (int i = 0; i < topic_router_count(&Router); i++)
+    {
+        if (strcmp(topic, topic_router_get(&Router, i)->filter) == 0)
+        {
+            route = i;
+        }
+    }
+    TEST_CHECK(route >= 0);
+
+    Fake.requests[Fake.requestCount++] = (FakeRequest_t){.route = route, .qos = qos, .cb = cb, .arg = arg};
+    return ERR_OK;
+}
+
+int scheduler_wake(int taskId)
+{
+    if (taskId == TEST_TASK_ID)
+    {
+        Fake.wakes++;
+    }
+    else
+    {
+        Fake.otherWakes++;
+    }
+    return 0;
+}
@@ -0,0 +1,246 @@
+/** Includes *************************************************************************************/
+#include "topic_router.h"
+#include "test.h"
+
+/**
+ * The filter trie of topic_router.c: exact and wildcard filters and their precedence, levels
+ * whose hashes collide, a node with many children, and the cost of a match as filters are added.
+ * Built with room for more routes than the client uses, see CMakeLists.txt.
+ */
+
+/** Defines **************************************************************************************/
+#define TEST_BENCH_MATCHES 200000
+
+/** Typedefs *************************************************************************************/
+/** Variables ************************************************************************************/
+static TopicRouter_t Router;
+
+/** Prototypes ***********************************************************************************/
+static uint16_t _test_hash(const char *level);
+static double _test_bench_ns(const char *const *topics, uint32_t count);
+static double _test_bench_strcmp_ns(const char *const *topics, uint32_t count);
+
+/** Functions ************************************************************************************/
+
+/**
+ * @brief Literal levels win over '+', which wins over '#', '$' topics escape first level wildcards
+ */
+static void test_topic_router_match(void)
+{
+    topic_router_init(&Router);
+    int exact = topic_router_add(&Router, "home/led", 1);
+    int plus = topic_router_add(&Router, "home/+", 0);
+    int hash = topic_router_add(&Router, "home/#", 0);
+    int deep = topic_router_add(&Router, "home/+/set", 2);
+    int all = topic_router_add(&Router, "#", 0);
+    TEST_EQUAL(topic_router_count(&Router), 5);
+
+    TEST_EQUAL(topic_router_match(&Router, "home/led"), exact);
+    TEST_EQUAL(topic_router_match(&Router, "home/fan"), plus);
+    TEST_EQUAL(topic_router_match(&Router, "home/fan/set"), deep);
+    TEST_EQUAL(topic_router_match(&Router, "home/fan/get"), hash);
+    TEST_EQUAL(topic_router_match(&Router, "home"), hash);
+    TEST_EQUAL(topic_router_match(&Router, "office/led"), all);
+    TEST_EQUAL(topic_router_match(&Router, "$SYS/uptime"), TOPIC_ROUTER_NO_ROUTE);
+    TEST_EQUAL(topic_router_match(&Router, "home/led/"), hash);
+
+    TEST_EQUAL(topic_router_get(&Router, deep)->qos, 2);
+    TEST_CHECK(strcmp(topic_router_get(&Router, deep)->filter, "home/+/set") == 0);
+    TEST_CHECK(topic_router_get(&Router, 5) == NULL);
+}
+
+/**
+ * @brief Invalid and duplicate filters are refused without changing the trie
+ */
+static void test_topic_router_invalid(void)
+{
+    topic_router_init(&Router);
+    TEST_EQUAL(topic_router_add(&Router, "a/b", 0), 0);
+    TEST_EQUAL(topic_router_add(&Router, "a/b", 1), TOPIC_ROUTER_NO_ROUTE);
+    TEST_EQUAL(topic_router_add(&Router, "", 0), TOPIC_ROUTER_NO_ROUTE);
+    TEST_EQUAL(topic_router_add(&Router, "a/b+", 0), TOPIC_ROUTER_NO_ROUTE);
+    TEST_EQUAL(topic_router_add(&Router, "a/#/b", 0), TOPIC_ROUTER_NO_ROUTE);
+    uint8_t nodes = Router.nodeCount;
+    uint8_t children = Router.childTotal;
+    TEST_EQUAL(topic_router_add(&Router, "a/#", 0), 1);
+    TEST_EQUAL(topic_router_add(&Router, "a/#", 0), TOPIC_ROUTER_NO_ROUTE);
+    TEST_EQUAL(Router.nodeCount, nodes);
+    TEST_EQUAL(Router.childTotal, children);
+
+    /** Full */
+    char filter[16];
+    int route = 0;
+    for (uint32_t i = 0; route != TOPIC_ROUTER_NO_ROUTE; i++)
+    {
+        snprintf(filter, sizeof(filter), "f/%u", (unsigned)i);
+        route = topic_router_add(&Router, filter, 0);
+    }
+    TEST_EQUAL(topic_router_count(&Router), TOPIC_ROUTER_MAX_ROUTES);
+    TEST_EQUAL(topic_router_match(&Router, "f/0"), 2);
+}
+
+/**
+ * @brief Levels with the same hash are told apart by their text
+ */
+static void test_topic_router_collision(void)
+{
+    /** Find two levels with the same 16 bit hash */
+    static uint16_t seen[65536];
+    char first[16] = "";
+    char second[16] = "";
+    for (uint32_t i = 1; i < 100000 && second[0] == '\0'; i++)
+    {
+        char level[16];
+        snprintf(level, sizeof(level), "c%u", (unsigned)i);
+        uint16_t hash = _test_hash(level);
+        if (seen[hash] != 0)
+        {
+            snprintf(first, sizeof(first), "c%u", (unsigned)seen[hash]);
+            memcpy(second, level, sizeof(second));
+        }
+        seen[hash] = (uint16_t)i;
+    }
+    TEST_CHECK(second[0] != '\0');
+
+    topic_router_init(&Router);
+    char filter[32];
+    snprintf(filter, sizeof(filter), "x/%s", first);
+    int a = topic_router_add(&Router, filter, 0);
+    topic_router_add(&Router, "x/other", 0);
+    snprintf(filter, sizeof(filter), "x/%s", second);
+    int b = topic_router_add(&Router, filter, 0);
+    TEST_CHECK(a != TOPIC_ROUTER_NO_ROUTE && b != TOPIC_ROUTER_NO_ROUTE);
+
+    snprintf(filter, sizeof(filter), "x/%s", first);
+    TEST_EQUAL(topic_router_match(&Router, filter), a);
+    snprintf(filter, sizeof(filter), "x/%s", second);
+    TEST_EQUAL(topic_router_match(&Router, filter), b);
+    TEST_EQUAL(topic_router_match(&Router, "x/c0"), TOPIC_ROUTER_NO_ROUTE);
+}
+
+/**
+ * @brief Children added to several nodes in turn stay sorted runs, every filter is found
+ */
+static void test_topic_router_many_children(void)
+{
+    topic_router_init(&Router);
+    char filter[32];
+    int routes[TOPIC_ROUTER_MAX_ROUTES];
+    for (uint32_t i = 0; i < TOPIC_ROUTER_MAX_ROUTES; i++)
+    {
+        /** Interleaved between three parents, so runs in the middle grow */
+        snprintf(filter, sizeof(filter), "p%u/s%u", (unsigned)(i % 3), (unsigned)i);
+        routes[i] = topic_router_add(&Router, filter, 0);
+        TEST_EQUAL(routes[i], i);
+    }
+
+    for (uint32_t i = 0; i < TOPIC_ROUTER_MAX_ROUTES; i++)
+    {
+        snprintf(filter, sizeof(filter), "p%u/s%u", (unsigned)(i % 3), (unsigned)i);
+        TEST_EQUAL(topic_router_match(&Router, filter), routes[i]);
+        snprintf(filter, sizeof(filter), "p%u/s%u", (unsigned)((i + 1) % 3), (unsigned)i);
+        TEST_EQUAL(topic_router_match(&Router, filter), TOPIC_ROUTER_NO_ROUTE);
+    }
+
+    for (uint8_t n = 0; n < Router.nodeCount; n++)
+    {
+        const TopicRouterNode_t *node = &Router.nodes[n];
+        for (uint8_t i = 1; i < node->childCount; i++)
+        {
+            TEST_CHECK(Router.nodes[Router.children[node->childStart + i - 1]].hash <= Router.nodes[Router.children[node->childStart + i]].hash);
+        }
+    }
+}
+
+/**
+ * @brief The time of a match as the filters under one level grow, against a strcmp() over
+ *        every filter
+ */
+static void test_topic_router_bench(void)
+{
+    static const uint32_t counts[] = {4, 16, 64, TOPIC_ROUTER_MAX_ROUTES};
+    static char names[TOPIC_ROUTER_MAX_ROUTES][32];
+    static const char *topics[TOPIC_ROUTER_MAX_ROUTES];
+
+    for (uint32_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++)
+    {
+        topic_router_init(&Router);
+        for (uint32_t i = 0; i < counts[c]; i++)
+        {
+            snprintf(names[i], sizeof(names[i]), "pico/cmd/output%u", (unsigned)i);
+            topics[i] = names[i];
+            TEST_EQUAL(topic_router_add(&Router, names[i], 0), i);
+        }
+
+        double trieNs = _test_bench_ns(topics, counts[c]);
+        double strcmpNs = _test_bench_strcmp_ns(topics, counts[c]);
+        printf("bench topic router: %u filters, match %.0f ns, strcmp over the filters %.0f ns\n",
+               (unsigned)counts[c], trieNs, strcmpNs);
+    }
+}
+
+int main(void)
+{
+    TEST_RUN(test_topic_router_match);
+    TEST_RUN(test_topic_router_invalid);
+    TEST_RUN(test_topic_router_collision);
+    TEST_RUN(test_topic_router_many_children);
+    TEST_RUN(test_topic_router_bench);
+
+    return TEST_RESULT();
+}
+
+/**
+ * @brief The level hash of topic_router.c, FNV-1a folded to 16 bits
+ */
+static uint16_t _test_hash(const char *level)
+{
+    uint32_t hash = 2166136261u;
+    for (; *level != '\0'; level++)
+    {
+        hash ^= (uint8_t)*level;
+        hash *= 16777619u;
+    }
+
+    return (uint16_t)(hash ^ (hash >> 16));
+}
+
+/**
+ * @brief Mean time of topic_router_match() over the topics
+ */
+static double _test_bench_ns(const char *const *topics, uint32_t count)
+{
+    volatile int sink = 0;
+    uint64_t startNs = test_now_ns();
+    for (uint32_t i = 0; i < TEST_BENCH_MATCHES; i++)
+    {
+        sink += topic_router_match(&Router, topics[i % count]);
+    }
+    (void)sink;
+
+    return (double)(test_now_ns() - startNs) / TEST_BENCH_MATCHES;
+}
+
+/**
+ * @brief Mean time to find the topics with a strcmp() over every registered filter
+ */
+static double _test_bench_strcmp_ns(const char *const *topics, uint32_t count)
+{
+    volatile int sink = 0;
+    uint64_t startNs = test_now_ns();
+    for (uint32_t i = 0; i < TEST_BENCH_MATCHES; i++)
+    {
+        const char *topic = topics[i % count];
+        for (int route = 0; route < topic_router_count(&Router); route++)
+        {
+            if (strcmp(topic_router_get(&Router, route)->filter, topic) == 0)
+            {
+                sink += route;
+                break;
+            }
+        }
+    }
+    (void)sink;
+
+    return (double)(test_now_ns() - startNs) / TEST_BENCH_MATCHES;
+}
@@ -0,0 +1,69 @@
+#!/bin/sh
+# Full handshake then resumed sessions against a local mosquitto, registered with ctest when the
+# benchmark is built with BENCH_MQTT_TLS. The broker certificate and key are broker.crt and
+# broker.key next to the CA, as made by the openssl commands of README.md, and the TAP interface
+# has to be up with the broker address. Skipped (77) when mosquitto or the interface is missing.
+#
+#   tls_session.sh <pico_client_bench> <ca.crt> <broker address> <port>
+
+bench=$1
+ca=$2
+address=$3
+port=$4
+reconnects=3
+
+certs=$(dirname "$ca")
+if ! command -v mosquitto >/dev/null 2>&1; then
+    echo "mosquitto not found, skipped"
+    exit 77
+fi
+if ! ip -o addr show 2>/dev/null | grep -q "inet $address/"; then
+    echo "no interface has $address, bring up the TAP interface of README.md, skipped"
+    exit 77
+fi
+for file in "$ca" "$certs/broker.crt" "$certs/broker.key"; do
+    if [ ! -r "$file" ]; then
+        echo "$file not found, see TLS in README.md"
+        exit 1
+    fi
+done
+
+dir=$(mktemp -d)
+trap 'kill $broker 2>/dev/null; rm -rf "$dir"' EXIT
+cat >"$dir/mosquitto.conf" <<EOF
+listener $port $address
+allow_anonymous true
+persistence false
+cafile $ca
+certfile $certs/broker.crt
+keyfile $certs/broker.key
+EOF
+mosquitto -c "$dir/mosquitto.conf" >"$dir/broker.log" 2>&1 &
+broker=$!
+sleep 1
+if ! kill -0 $broker 2>/dev/null; then
+    cat "$dir/broker.log"
+    exit 1
+fi
+
+"$bench" -d 2 -r 50 -c $reconnects >"$dir/bench.log" 2>&1
+status=$?
+cat "$dir/bench.log"
+if [ $status -ne 0 ]; then
+    echo "pico_client_bench failed with $status"
+    exit 1
+fi
+
+# The first connect is a full handshake, every reconnect resumes its session
+if ! grep -q "^TLS full handshake, CONNECT to CONNACK: n [1-9]" "$dir/bench.log"; then
+    echo "no full handshake"
+    exit 1
+fi
+resumed=$(grep -c "^Reconnect [0-9]*:.*TLS resumed" "$dir/bench.log")
+if [ "$resumed" -ne $reconnects ]; then
+    echo "$resumed of $reconnects reconnects resumed the TLS session"
+    exit 1
+fi
+
+echo "full handshake and $resumed resumed sessions"
+exit 0
@@ -0,0 +1,112 @@
+#ifndef _ADC_SAMPLER_H_
+#define _ADC_SAMPLER_H_
+/** Includes *************************************************************************************/
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "decimator.h"
+#include "ring_buffer.h"
+
+/** Defines **************************************************************************************/
+
+/** ADC input of the on-board temperature sensor */
+#define ADC_SAMPLER_TEMP_INPUT 4
+
+/** Raw conversion rate, paced by the ADC clock divider. The ADC can't go below ~733 Hz. */
+#ifndef ADC_SAMPLER_RAW_RATE_HZ
+#define ADC_SAMPLER_RAW_RATE_HZ 1000
+#endif
+
+/** The DMA ring holds 2^ADC_SAMPLER_RING_BITS bytes of raw samples, poll faster than it fills */
+#ifndef ADC_SAMPLER_RING_BITS
+#define ADC_SAMPLER_RING_BITS 10
+#endif
+#define ADC_SAMPLER_RING_SAMPLES ((1u << ADC_SAMPLER_RING_BITS) / sizeof(uint16_t))
+
+/** Period the raw ring is drained at, 512 samples at 1 kHz leaves a 5x margin */
+#ifndef ADC_SAMPLER_POLL_MS
+#define ADC_SAMPLER_POLL_MS 100
+#endif
+
+/** Size in bytes of the queue of finished samples, a power of two */
+#ifndef ADC_SAMPLER_QUEUE_SIZE
+#define ADC_SAMPLER_QUEUE_SIZE 256
+#endif
+
+/** Typedefs *************************************************************************************/
+
+/** A finished, decimated sample */
+typedef struct
+{
+    uint32_t sequence; /** Output sample number, the sample was taken at sequence * outputPeriodMs */
+    uint32_t value;    /** Average raw value scaled by 2^extraBits */
+} AdcSample_t;
+
+/** Acquisition settings */
+typedef struct
+{
+    uint8_t input;           /** ADC input to sample */
+    uint32_t outputPeriodMs; /** Time between two output samples */
+    uint8_t extraBits;       /** Fraction bits kept by the decimator */
+    int notifyTaskId;        /** Scheduler task woken when samples are queued, SCHEDULER_INVALID_TASK for none */
+} AdcSamplerConfig_t;
+
+/** Acquisition counters */
+typedef struct
+{
+    uint32_t rawSamples; /** Conversions processed */
+    uint32_t outputs;    /** Decimated samples produced */
+    uint32_t overruns;   /** Polls that came too late, the DMA ring overwrote unread samples */
+    uint32_t queueFull;  /** Decimated samples dropped because the consumer fell behind */
+} AdcSamplerStats_t;
+
+/** The sampler, there is a single ADC so there is a single sampler */
+typedef struct
+{
+    AdcSamplerConfig_t config;
+    Decimator_t decimator;
+    int dataChannel; /** Copies the ADC FIFO into the raw ring */
+    int ctrlChannel; /** Re-arms the data channel every lap of the ring */
+    uint32_t readIndex;
+    uint32_t sequence;
+    uint64_t lastPollUs;
+    RingBuffer_t queue; /** Finished samples, single producer single consumer */
+    uint8_t queueStorage[ADC_SAMPLER_QUEUE_SIZE];
+    AdcSamplerStats_t stats;
+} AdcSampler_t;
+
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+/** Functions ************************************************************************************/
+
+/**
+ * @brief Start free-running acquisition
+ *
+ * The ADC converts at ADC_SAMPLER_RAW_RATE_HZ from its own clock and DMA copies every
+ * conversion into a ring, so the sample timing does not depend on the software at all.
+ *
+ * @param sampler The sampler
+ * @param config The acquisition settings
+ * @return int 0 on success, -1 on failure
+ */
+int adc_sampler_init(AdcSampler_t *sampler, const AdcSamplerConfig_t *config);
+
+/**
+ * @brief Decimate the raw samples the DMA wrote since the last poll and queue the results
+ *
+ * Should be called every ADC_SAMPLER_POLL_MS, the application core does it on core 1.
+ *
+ * @param sampler The sampler
+ * @return int 0 on success, -1 on failure
+ */
+int adc_sampler_poll(AdcSampler_t *sampler);
+
+/**
+ * @brief Take the oldest finished sample from the queue, consumer side
+ * @param sampler The sampler
+ * @param sample The sample
+ * @return bool True if a sample was read
+ */
+bool adc_sampler_read(AdcSampler_t *sampler, AdcSample_t *sample);
+
+#endif /* _ADC_SAMPLER_H_ */
@@ -0,0 +1,123 @@
+#ifndef _APP_CORE_H_
+#define _APP_CORE_H_
+/** Includes *************************************************************************************/
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "adc_sampler.h"
+#include "mqtt_topic.h"
+#include "msg_queue.h"
+#include "report_policy.h"
+
+/** Defines **************************************************************************************/
+
+/** Largest encoded sample, e.g. {"t":-12.34} or its CBOR equivalent */
+#define APP_CORE_SAMPLE_LEN 32
+
+/** Largest command payload forwarded to the application core, longer ones are dropped */
+#ifndef APP_CORE_COMMAND_LEN
+#define APP_CORE_COMMAND_LEN 256
+#endif
+
+/** Topic of a command that applies to no topic, e.g. APP_CORE_MSG_LED, core 1 ignores it */
+#define APP_CORE_NO_TOPIC ((MqttTopic_t)0)
+
+/** Size in bytes of the queue of encoded samples, application core to network core */
+#ifndef APP_CORE_SAMPLE_QUEUE_SIZE
+#define APP_CORE_SAMPLE_QUEUE_SIZE 2048
+#endif
+
+/** Size in bytes of the queue of commands, network core to application core */
+#ifndef APP_CORE_COMMAND_QUEUE_SIZE
+#define APP_CORE_COMMAND_QUEUE_SIZE 1024
+#endif
+
+/** Typedefs *************************************************************************************/
+
+/** Messages exchanged between the cores, the arg is the MqttTopic_t the message applies to */
+typedef enum
+{
+    APP_CORE_MSG_SAMPLE, /** Encoded sample, the body is the MqttPayloadFormat_t followed by the payload */
+    APP_CORE_MSG_LED,    /** LED command, the body is the payload of the led topic, no topic */
+    APP_CORE_MSG_FORMAT, /** Payload format of a topic, the body is "json" or "cbor" */
+} AppCoreMsg_t;
+
+/** Application core counters */
+typedef struct
+{
+    uint32_t samples;  /** Samples encoded */
+    uint32_t commands; /** Commands handled */
+} AppCoreStats_t;
+
+/**
+ * @brief The application, runs on core 1
+ *
+ * Core 1 owns the sampler, the encoding of the samples and the handling of the commands, core 0
+ * only runs Wi-Fi, lwIP and MQTT. The cores exchange messages through two single producer,
+ * single consumer queues so neither side ever blocks the other.
+ */
+typedef struct
+{
+    AdcSampler_t sampler;                        /** Core 1 */
+    MqttPayloadFormat_t formats[MQTT_TOPIC_MAX]; /** Encoding of each topic, core 1 */
+    ReportPolicy_t policies[MQTT_TOPIC_MAX];     /** Which samples of each topic are published, core 1 */
+    int netTaskId;                               /** Core 0 task woken when samples are queued */
+    MsgQueue_t samples;                          /** Core 1 to core 0 */
+    MsgQueue_t commands;                         /** Core 0 to core 1 */
+    uint8_t samplesStorage[APP_CORE_SAMPLE_QUEUE_SIZE];
+    uint8_t commandsStorage[APP_CORE_COMMAND_QUEUE_SIZE];
+    AppCoreStats_t stats; /** Core 1 */
+} AppCore_t;
+
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+/** Functions ************************************************************************************/
+
+/**
+ * @brief Start the acquisition and set up the queues, called on core 0 before app_core_launch()
+ * @param app The application
+ * @param samplerConfig The acquisition settings, the notify task is ignored
+ * @param netTaskId The core 0 task to wake when samples are queued
+ * @return int 0 on success, -1 on failure
+ */
+int app_core_init(AppCore_t *app, const AdcSamplerConfig_t *samplerConfig, int netTaskId);
+
+/**
+ * @brief Run the application on core 1
+ * @param app The application, must stay valid forever
+ * @return int 0 on success, -1 on failure
+ */
+int app_core_launch(AppCore_t *app);
+
+/**
+ * @brief Take the oldest encoded sample, core 0 side
+ * @param app The application
+ * @param topic Set to the topic of the sample
+ * @param format Set to the encoding of the sample
+ * @param payload Buffer for the sample, APP_CORE_SAMPLE_LEN bytes
+ * @return int Length of the sample, 0 if there is none, -1 on failure
+ */
+int app_core_read_sample(AppCore_t *app, MqttTopic_t *topic, MqttPayloadFormat_t *format, char *payload);
+
+/**
+ * @brief Get the reporting counters of all topics added up, core 0 side
+ *
+ * The counters are written by core 1, each one is read whole but they may be a sample apart.
+ *
+ * @param app The application
+ * @param stats Filled with the counters
+ */
+void app_core_get_report_stats(const AppCore_t *app, ReportPolicyStats_t *stats);
+
+/**
+ * @brief Forward a command to core 1, core 0 side
+ * @param app The application
+ * @param msg The command
+ * @param topic The topic the command applies to, APP_CORE_NO_TOPIC for none
+ * @param payload The payload
+ * @param len Length of the payload
+ * @return int 0 on success, -1 if it is too long or the queue is full
+ */
+int app_core_send_command(AppCore_t *app, AppCoreMsg_t msg, MqttTopic_t topic, const uint8_t *payload, uint32_t len);
+
+#endif /* _APP_CORE_H_ */
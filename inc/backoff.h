@@ -0,0 +1,80 @@
+#ifndef _BACKOFF_H_
+#define _BACKOFF_H_
+/** Includes *************************************************************************************/
+#include <stdbool.h>
+#include <stdint.h>
+
+/** Defines **************************************************************************************/
+
+/** A connection has to last this long before its drop starts the delays over from the base */
+#ifndef BACKOFF_STABLE_MS
+#define BACKOFF_STABLE_MS 30000
+#endif
+
+/** Typedefs *************************************************************************************/
+
+typedef struct
+{
+    uint32_t baseMs;   /** Shortest delay */
+    uint32_t capMs;    /** Longest delay */
+    uint32_t stableMs; /** Connected time after which the delay is reset, see BACKOFF_STABLE_MS */
+} BackoffConfig_t;
+
+/**
+ * Reconnect policy shared by the connection state machines.
+ *
+ * Every failed attempt or dropped connection waits a random delay between the base and three
+ * times the previous delay, capped ("decorrelated jitter"). Devices that lost their link at the
+ * same moment spread out instead of retrying in lockstep, and the delays grow while the other
+ * end keeps refusing. The delay goes back to the base once a connection has been stable.
+ */
+typedef struct
+{
+    BackoffConfig_t config;
+    uint32_t rng;         /** xorshift32 state, never 0 */
+    uint32_t delayMs;     /** Last delay, 0 once reset */
+    uint32_t retryMs;     /** No attempt before this time */
+    bool waiting;         /** retryMs is in the future */
+    bool connected;       /** Between backoff_connected() and the next failure */
+    uint32_t connectedMs; /** Time of backoff_connected() */
+    uint32_t failures;    /** Consecutive failures since the last reset */
+    uint32_t retries;     /** Delays handed out since init */
+} Backoff_t;
+
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+/** Functions ************************************************************************************/
+
+/**
+ * @brief Initialise a reconnect policy
+ * @param backoff The policy
+ * @param config The delays, copied
+ * @param seed Random seed, different on every device so they do not pick the same delays
+ * @return int 0 on success, -1 on failure
+ */
+int backoff_init(Backoff_t *backoff, const BackoffConfig_t *config, uint32_t seed);
+
+/**
+ * @brief Record a failed attempt or a dropped connection and pick the delay before the next attempt
+ * @param backoff The policy
+ * @param nowMs The current time in milliseconds
+ * @return uint32_t The delay in milliseconds
+ */
+uint32_t backoff_failed(Backoff_t *backoff, uint32_t nowMs);
+
+/**
+ * @brief Record a successful connect, the delays are reset if it lasts BackoffConfig_t.stableMs
+ * @param backoff The policy
+ * @param nowMs The current time in milliseconds
+ */
+void backoff_connected(Backoff_t *backoff, uint32_t nowMs);
+
+/**
+ * @brief Get the time left before the next attempt is allowed
+ * @param backoff The policy
+ * @param nowMs The current time in milliseconds
+ * @return uint32_t Milliseconds to wait, 0 to attempt now
+ */
+uint32_t backoff_remaining(Backoff_t *backoff, uint32_t nowMs);
+
+#endif /* _BACKOFF_H_ */
@@ -0,0 +1,84 @@
+#ifndef _CBOR_READER_H_
+#define _CBOR_READER_H_
+/** Includes *************************************************************************************/
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "json_writer.h"
+
+/** Defines **************************************************************************************/
+
+/** Deepest nesting cbor_reader_to_json() follows */
+#define CBOR_READER_MAX_DEPTH JSON_WRITER_MAX_DEPTH
+
+/** Longest text string or map key cbor_reader_to_json() converts */
+#define CBOR_READER_MAX_TEXT 128
+
+/** Typedefs *************************************************************************************/
+
+/** Kind of a decoded item */
+typedef enum
+{
+    CBOR_ITEM_UINT,   /** value is the integer */
+    CBOR_ITEM_NINT,   /** The integer is -1 - value */
+    CBOR_ITEM_BYTES,  /** value is the length, data points at the bytes */
+    CBOR_ITEM_TEXT,   /** value is the length, data points at the text, not null terminated */
+    CBOR_ITEM_ARRAY,  /** value is the number of items unless indefinite */
+    CBOR_ITEM_MAP,    /** value is the number of pairs unless indefinite */
+    CBOR_ITEM_TAG,    /** value is the tag, the tagged item follows */
+    CBOR_ITEM_SIMPLE, /** value is the simple value, 20 false, 21 true, 22 null */
+    CBOR_ITEM_FLOAT,  /** value holds the raw bits, not converted */
+    CBOR_ITEM_BREAK,  /** End of an indefinite array or map */
+} CborItemType_t;
+
+/** A decoded item head */
+typedef struct
+{
+    CborItemType_t type;
+    uint64_t value;
+    bool indefinite;
+    const uint8_t *data;
+} CborItem_t;
+
+/** Pull decoder over a buffer */
+typedef struct
+{
+    const uint8_t *data;
+    uint32_t len;
+    uint32_t pos;
+} CborReader_t;
+
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+/** Functions ************************************************************************************/
+
+/**
+ * @brief Start decoding a buffer
+ * @param reader The reader
+ * @param data The encoded data
+ * @param len Length of the data
+ */
+void cbor_reader_init(CborReader_t *reader, const uint8_t *data, uint32_t len);
+
+/**
+ * @brief Decode the next item head, strings are skipped over
+ * @param reader The reader
+ * @param item The item
+ * @return int 1 if an item was decoded, 0 at the end of the data, -1 on malformed data
+ */
+int cbor_reader_next(CborReader_t *reader, CborItem_t *item);
+
+/**
+ * @brief Convert one CBOR payload to JSON, decimal fractions become fixed-point numbers
+ *
+ * Meant for host side tools and tests, so the telemetry can be checked against the JSON
+ * encoding. Floats, byte strings and integers beyond 32 bits are not supported.
+ *
+ * @param data The encoded payload
+ * @param len Length of the payload
+ * @param json The writer the JSON goes to
+ * @return int 0 on success, -1 on malformed or unsupported data
+ */
+int cbor_reader_to_json(const uint8_t *data, uint32_t len, JsonWriter_t *json);
+
+#endif /* _CBOR_READER_H_ */
@@ -0,0 +1,106 @@
+#ifndef _CBOR_WRITER_H_
+#define _CBOR_WRITER_H_
+/** Includes *************************************************************************************/
+#include <stdbool.h>
+#include <stdint.h>
+
+/** Defines **************************************************************************************/
+
+/** Tags used by the telemetry payloads (RFC 8949) */
+#define CBOR_TAG_DECIMAL_FRACTION 4
+#define CBOR_TAG_SELF_DESCRIBE 55799
+
+/** Typedefs *************************************************************************************/
+
+/**
+ * @brief CBOR encoder writing into a caller supplied buffer
+ *
+ * No allocation and no floating point. Arrays and maps have a definite length given up front,
+ * the caller writes that many items (key and value pairs for maps). Once a write does not fit,
+ * the writer stops and cbor_writer_finish() reports the failure.
+ */
+typedef struct
+{
+    uint8_t *buffer;
+    uint16_t size;
+    uint16_t len;
+    bool failed;
+} CborWriter_t;
+
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+/** Functions ************************************************************************************/
+
+/**
+ * @brief Start writing into a buffer
+ * @param writer The writer
+ * @param buffer The buffer
+ * @param size Size of the buffer
+ */
+void cbor_writer_init(CborWriter_t *writer, uint8_t *buffer, uint16_t size);
+
+/**
+ * @brief Write an unsigned integer
+ * @param writer The writer
+ * @param value The value
+ */
+void cbor_writer_uint(CborWriter_t *writer, uint32_t value);
+
+/**
+ * @brief Write a signed integer
+ * @param writer The writer
+ * @param value The value
+ */
+void cbor_writer_int(CborWriter_t *writer, int32_t value);
+
+/**
+ * @brief Write a fixed-point value as a decimal fraction, e.g. 2345 with 2 decimals is 23.45
+ * @param writer The writer
+ * @param value The value scaled by 10^decimals
+ * @param decimals Number of decimals
+ */
+void cbor_writer_decimal(CborWriter_t *writer, int32_t value, uint8_t decimals);
+
+/**
+ * @brief Write a boolean
+ * @param writer The writer
+ * @param value The value
+ */
+void cbor_writer_bool(CborWriter_t *writer, bool value);
+
+/**
+ * @brief Write a text string
+ * @param writer The writer
+ * @param text The null terminated UTF-8 string
+ */
+void cbor_writer_text(CborWriter_t *writer, const char *text);
+
+/**
+ * @brief Start an array, followed by count items
+ * @param writer The writer
+ * @param count Number of items
+ */
+void cbor_writer_array(CborWriter_t *writer, uint32_t count);
+
+/**
+ * @brief Start a map, followed by count key and value pairs
+ * @param writer The writer
+ * @param count Number of pairs
+ */
+void cbor_writer_map(CborWriter_t *writer, uint32_t count);
+
+/**
+ * @brief Tag the next item
+ * @param writer The writer
+ * @param tag The tag
+ */
+void cbor_writer_tag(CborWriter_t *writer, uint32_t tag);
+
+/**
+ * @brief Finish the encoding
+ * @param writer The writer
+ * @return int The length of the encoding, -1 if it did not fit
+ */
+int cbor_writer_finish(const CborWriter_t *writer);
+
+#endif /* _CBOR_WRITER_H_ */
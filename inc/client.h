@@ -8,8 +8,34 @@
 #include "lwip/apps/mqtt.h"
 #include "lwip/apps/mqtt_priv.h" // needed to set hostname
 
+#include "backoff.h"
+#include "frame_codec.h"
+#include "pbuf_stream.h"
+#include "ring_buffer.h"
+
 /** Defines **************************************************************************************/
-#define BUF_SIZE 1024
+#define CLIENT_TASK_TIMEOUT_MS 100
+
+/** Size of the receive ring, must be a power of two */
+#ifndef CLIENT_RX_RING_SIZE
+#define CLIENT_RX_RING_SIZE 4096
+#endif
+
+/** Size of the transmit ring, must be a power of two. lwIP holds up to TCP_SND_BUF more */
+#ifndef CLIENT_TX_RING_SIZE
+#define CLIENT_TX_RING_SIZE 8192
+#endif
+
+/** client_write() flag: the data goes out at once, even under CLIENT_TX_BULK */
+#define CLIENT_WRITE_PUSH 0x01
+
+/** Random delay before connecting again after a failed connect or a drop, see backoff.h */
+#ifndef CLIENT_BACKOFF_BASE_MS
+#define CLIENT_BACKOFF_BASE_MS 1000
+#endif
+#ifndef CLIENT_BACKOFF_CAP_MS
+#define CLIENT_BACKOFF_CAP_MS 60000
+#endif
 
 #ifndef MQTT_TOPIC_LENGTH
 #define MQTT_TOPIC_LENGTH 100
@@ -19,22 +45,143 @@
 typedef enum {
     CLIENT_DISCONNECTED = 0,
     CLIENT_CONNECTED = 1,
+    CLIENT_CONNECTING = 2,
 } client_state_t;
 
+/** How the transmit queue is handed to TCP */
+typedef enum {
+    CLIENT_TX_BULK = 0,    // Nagle on, writes are coalesced into full segments while data is in flight
+    CLIENT_TX_LATENCY = 1, // Nagle off, every write is sent as soon as the window allows
+} client_tx_policy_t;
+
+/** Transmit counters since boot */
+typedef struct {
+    uint32_t bytes_queued;  // Accepted by client_write()
+    uint32_t bytes_written; // Handed to tcp_write()
+    uint32_t bytes_acked;   // Acknowledged by the server
+    uint32_t writes;        // tcp_write() calls
+    uint32_t window_full;   // Pumps stopped by tcp_sndbuf() or the segment queue, resumed by the sent callback
+    uint32_t mem_errors;    // tcp_write() out of pbufs or segments, retried by the sent callback or the task
+    uint32_t refused;       // client_write() calls that did not fit
+} client_tx_stats_t;
+
 typedef struct {
     mqtt_client_t *mqtt_client; // Pointer to the MQTT client
     struct mqtt_connect_client_info_t mqtt_client_info; // MQTT client info
     struct tcp_pcb *tcp_pcb;
     ip_addr_t remote_addr;
-    uint8_t buffer[BUF_SIZE];
-    uint16_t buffer_len;
+    PbufStream_t rx; // Received data, held in the pbufs until the receive callback consumes it
+    PbufStreamConsumeFn_t recv_cb;
+    void *recv_arg;
+    RingBuffer_t rx_ring; // Default receive path, filled by the lwIP recv callback, drained by client_read()
+    uint8_t rx_ring_storage[CLIENT_RX_RING_SIZE];
+    RingBuffer_t tx_ring; // Transmit queue, filled by client_write(), drained into lwIP as the window opens
+    uint8_t tx_ring_storage[CLIENT_TX_RING_SIZE];
+    client_tx_policy_t tx_policy;
+    volatile uint32_t tx_push_mark; // Ring position up to which the data is pushed, see CLIENT_WRITE_PUSH
+    uint32_t tx_acked;              // Bytes acknowledged on this connection, in ring positions
+    volatile bool tx_blocked;       // A write did not fit, writer_task_id is woken once there is room
+    client_tx_stats_t tx_stats;
+    int task_id; // Scheduler task id of client_task, woken when data arrives, client_read() frees space or client_write() queues data
+    int writer_task_id; // Scheduler task woken when the transmit ring has room again, see client_set_tasks()
     client_state_t state;
+    uint32_t connect_deadline_ms; // The connect in progress is given up at this time
+    Backoff_t backoff; // Delay before the next connect
 } client_t;
 
 /** Variables ************************************************************************************/
 /** Prototypes ***********************************************************************************/
 /** Functions ************************************************************************************/
 int client_init(client_t *client, const char *ip_address);
+
+/**
+ * @brief Set the scheduler tasks the client wakes.
+ *
+ * Until they are set nothing is woken and both sides only run on their periods.
+ *
+ * @param client Pointer to the client structure.
+ * @param task_id The task running client_task(), woken when data arrives, when client_read()
+ *                frees space in the receive ring and when client_write() queues data.
+ * @param writer_task_id The task calling client_write(), woken when a write that came short
+ *                       has room again. May be the same task.
+ * @return int 0 on success, -1 on failure
+ */
+int client_set_tasks(client_t *client, int task_id, int writer_task_id);
+
+/**
+ * @brief Set the callback that consumes the received data.
+ *
+ * The callback is handed the received data in place, without copying it out of the pbufs.
+ * The TCP window is only opened by the number of bytes it returns as consumed, data it does
+ * not consume is offered again on the next client_task() run.
+ *
+ * @param client Pointer to the client structure.
+ * @param recv_cb The callback, NULL restores the default receive ring read by client_read().
+ * @param arg Argument passed to the callback.
+ * @return int 0 on success, -1 on failure
+ */
+int client_set_recv_callback(client_t *client, PbufStreamConsumeFn_t recv_cb, void *arg);
+
+/**
+ * @brief Read received data from the receive ring.
+ *
+ * Safe to call from the other core while the lwIP callbacks run. When the ring fills up the
+ * TCP window is not opened again until the data has been read, so the server is throttled
+ * instead of the data being dropped.
+ *
+ * @param client Pointer to the client structure.
+ * @param data Destination buffer.
+ * @param len Size of the destination buffer.
+ * @return uint32_t Number of bytes read.
+ */
+uint32_t client_read(client_t *client, uint8_t *data, uint32_t len);
+
+/**
+ * @brief Queue data to send to the server.
+ *
+ * Never blocks and never fails with ERR_MEM: the data is copied into the transmit ring and
+ * written to TCP as tcp_sndbuf() allows, the sent callback refills lwIP as the server
+ * acknowledges. Accepts only what fits, when a write comes short writer_task_id is woken once
+ * half the ring is free again. Safe to call from the other core.
+ *
+ * @param client Pointer to the client structure.
+ * @param data The data.
+ * @param len Length of the data.
+ * @param flags CLIENT_WRITE_PUSH or 0.
+ * @return uint32_t Number of bytes queued, 0 while not connected.
+ */
+uint32_t client_write(client_t *client, const uint8_t *data, uint32_t len, uint8_t flags);
+
+/**
+ * @brief Queue a length prefixed frame, see frame_codec.h.
+ *
+ * The frame is queued whole or not at all. The receiving side splits the stream with a
+ * FrameDecoder_t, set as the receive callback on this side.
+ *
+ * @param client Pointer to the client structure.
+ * @param frame The frame.
+ * @param len Length of the frame.
+ * @param flags CLIENT_WRITE_PUSH or 0.
+ * @return int 0 on success, -1 if it does not fit now or the client is not connected.
+ */
+int client_send_frame(client_t *client, const uint8_t *frame, uint16_t len, uint8_t flags);
+
+/**
+ * @brief Select how queued data is handed to TCP, CLIENT_TX_BULK by default.
+ * @param client Pointer to the client structure.
+ * @param policy CLIENT_TX_BULK for throughput, CLIENT_TX_LATENCY for small frames that must not wait.
+ * @return int 0 on success, -1 on failure
+ */
+int client_set_tx_policy(client_t *client, client_tx_policy_t policy);
+
+/**
+ * @brief The client task runs the TCP connection state machine.
+ *
+ * It should be registered with the scheduler with a period of CLIENT_TASK_TIMEOUT_MS.
+ *
+ * @param client Pointer to the client structure.
+ * @return int 0 on success, -1 on failure
+ */
 int client_task(client_t *client);
 
 
@@ -0,0 +1,21 @@
+#ifndef _CRC32_H_
+#define _CRC32_H_
+/** Includes *************************************************************************************/
+#include <stdint.h>
+
+/** Defines **************************************************************************************/
+/** Typedefs *************************************************************************************/
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+/** Functions ************************************************************************************/
+
+/**
+ * @brief Update a CRC-32 (IEEE 802.3), start with 0
+ * @param crc The CRC so far
+ * @param data The data to add
+ * @param len Length of the data
+ * @return uint32_t The updated CRC
+ */
+uint32_t crc32_update(uint32_t crc, const void *data, uint32_t len);
+
+#endif /* _CRC32_H_ */
@@ -0,0 +1,56 @@
+#ifndef _DECIMATOR_H_
+#define _DECIMATOR_H_
+/** Includes *************************************************************************************/
+#include <stdbool.h>
+#include <stdint.h>
+
+/** Defines **************************************************************************************/
+
+/** Largest decimation factor, keeps the sum of 12 bit samples within 32 bits */
+#define DECIMATOR_MAX_FACTOR 65536
+
+/** Typedefs *************************************************************************************/
+
+/**
+ * @brief Averaging decimator
+ *
+ * Averages blocks of factor raw samples into one output sample. The average keeps extraBits
+ * fraction bits, so oversampling by 4^n gains n bits of resolution on a noisy input.
+ */
+typedef struct
+{
+    uint32_t factor;   /** Raw samples per output sample */
+    uint8_t extraBits; /** Fraction bits kept in the output */
+    uint32_t count;    /** Raw samples in the current block */
+    uint32_t sum;      /** Sum of the current block */
+} Decimator_t;
+
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+/** Functions ************************************************************************************/
+
+/**
+ * @brief Initialise the decimator
+ * @param decimator The decimator
+ * @param factor Raw samples per output sample, 1 to DECIMATOR_MAX_FACTOR
+ * @param extraBits Fraction bits kept in the output, at most 16
+ * @return int 0 on success, -1 on failure
+ */
+int decimator_init(Decimator_t *decimator, uint32_t factor, uint8_t extraBits);
+
+/**
+ * @brief Drop the current block
+ * @param decimator The decimator
+ */
+void decimator_reset(Decimator_t *decimator);
+
+/**
+ * @brief Add a raw sample
+ * @param decimator The decimator
+ * @param sample The raw 12 bit sample
+ * @param out The output sample, the rounded average scaled by 2^extraBits
+ * @return bool True if the sample completed a block and out was written
+ */
+bool decimator_push(Decimator_t *decimator, uint16_t sample, uint32_t *out);
+
+#endif /* _DECIMATOR_H_ */
@@ -0,0 +1,85 @@
+#ifndef _FLASH_DEVICE_H_
+#define _FLASH_DEVICE_H_
+/** Includes *************************************************************************************/
+#include <stdint.h>
+
+/** Defines **************************************************************************************/
+
+/** Smallest programmable unit, program calls are aligned to and a multiple of it */
+#define FLASH_DEVICE_PAGE_SIZE 256
+
+/** Smallest erasable unit */
+#define FLASH_DEVICE_SECTOR_SIZE 4096
+
+/** Size of the region reserved for the store at the end of the on-board flash */
+#ifndef FLASH_DEVICE_STORE_SIZE
+#define FLASH_DEVICE_STORE_SIZE (16 * FLASH_DEVICE_SECTOR_SIZE)
+#endif
+
+/** Size of the region reserved for settings, just below the store */
+#ifndef FLASH_DEVICE_SETTINGS_SIZE
+#define FLASH_DEVICE_SETTINGS_SIZE FLASH_DEVICE_SECTOR_SIZE
+#endif
+
+/** Typedefs *************************************************************************************/
+
+/**
+ * @brief A NOR flash region. Offsets are relative to the start of the region.
+ *
+ * Programming can only clear bits, so programming 0xFF over a byte leaves it as it is.
+ * Erasing sets a whole sector back to 0xFF.
+ */
+typedef struct
+{
+    uint32_t size;       /** Size of the region, a multiple of sectorSize */
+    uint32_t sectorSize; /** Erase size */
+
+    /**
+     * @brief Read from the region
+     * @return int 0 on success, -1 on failure
+     */
+    int (*read)(void *arg, uint32_t offset, void *buffer, uint32_t len);
+
+    /**
+     * @brief Program whole pages, offset and len are multiples of FLASH_DEVICE_PAGE_SIZE
+     * @return int 0 on success, -1 on failure
+     */
+    int (*program)(void *arg, uint32_t offset, const void *data, uint32_t len);
+
+    /**
+     * @brief Erase a sector, offset is a multiple of sectorSize
+     * @return int 0 on success, -1 on failure
+     */
+    int (*erase)(void *arg, uint32_t offset);
+
+    void *arg;
+} FlashDevice_t;
+
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+/** Functions ************************************************************************************/
+
+/**
+ * @brief Set up the device for the FLASH_DEVICE_STORE_SIZE region at the end of the on-board flash
+ * @param device The device to set up
+ * @return int 0 on success, -1 if the region overlaps the program image
+ */
+int flash_device_pico_init(FlashDevice_t *device);
+
+/**
+ * @brief Set up the device for the FLASH_DEVICE_SETTINGS_SIZE region just below the store
+ * @param device The device to set up
+ * @return int 0 on success, -1 if the region overlaps the program image
+ */
+int flash_device_pico_settings_init(FlashDevice_t *device);
+
+/**
+ * @brief Set up a RAM backed device that behaves like NOR flash, for host builds and benchmarks
+ * @param device The device to set up
+ * @param buffer The backing memory, erased by this call
+ * @param size Size of the backing memory, a multiple of FLASH_DEVICE_SECTOR_SIZE
+ * @return int 0 on success, -1 on failure
+ */
+int flash_device_ram_init(FlashDevice_t *device, uint8_t *buffer, uint32_t size);
+
+#endif /* _FLASH_DEVICE_H_ */
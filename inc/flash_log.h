@@ -0,0 +1,133 @@
+#ifndef _FLASH_LOG_H_
+#define _FLASH_LOG_H_
+/** Includes *************************************************************************************/
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "flash_device.h"
+
+/** Defines **************************************************************************************/
+
+/** Largest payload of a record, a record never spans two sectors */
+#ifndef FLASH_LOG_MAX_PAYLOAD
+#define FLASH_LOG_MAX_PAYLOAD 1024
+#endif
+
+/** Typedefs *************************************************************************************/
+
+/** A record read back from the log */
+typedef struct
+{
+    uint32_t offset;   /** Where the record lives, pass it to flash_log_consume() once it is delivered */
+    uint32_t sequence; /** Sequence number of its sector, tells it from a later record at the same offset */
+    uint8_t topic;
+    uint16_t len;    /** Payload length */
+    uint32_t timeMs; /** Time the record was appended */
+} FlashLogRecord_t;
+
+/** Log counters */
+typedef struct
+{
+    uint32_t appends;     /** Records appended */
+    uint32_t appendBytes; /** Payload bytes appended */
+    uint32_t consumed;    /** Records marked as delivered */
+    uint32_t dropped;     /** Undelivered records lost when the log wrapped */
+    uint32_t stale;       /** Consumes of records that were dropped since they were read */
+    uint32_t corrupt;     /** Records that failed their CRC, usually a write cut by a reset */
+    uint32_t erases;      /** Sectors erased */
+    uint32_t errors;      /** Failed device operations */
+} FlashLogStats_t;
+
+/**
+ * @brief Append-only log of CRC'd records over a flash region
+ *
+ * The region is used as a ring of sectors. Records are appended to the head sector and the
+ * next sector is erased when it is full, so every sector is erased equally often. A record is
+ * marked as consumed by clearing a flag byte in place, so delivering it costs no erase.
+ * When the ring wraps onto undelivered records the oldest sector is dropped.
+ */
+typedef struct
+{
+    const FlashDevice_t *device;
+    uint32_t sectorCount;
+    uint32_t nextSequence; /** Sequence number of the next sector opened */
+    uint32_t writeOffset;  /** Where the next record goes */
+    uint32_t tailOffset;   /** Oldest record not yet consumed, writeOffset when there is none */
+    uint32_t readOffset;   /** Next record handed out by flash_log_peek() */
+    uint32_t pending;      /** Records not yet consumed */
+    uint8_t page[FLASH_DEVICE_PAGE_SIZE];
+    FlashLogStats_t stats;
+} FlashLog_t;
+
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+/** Functions ************************************************************************************/
+
+/**
+ * @brief Mount the log, recovering its state from the flash and formatting it if it is blank
+ *
+ * A record cut by a reset fails its CRC, the rest of its sector is skipped and appending
+ * carries on in the next sector.
+ *
+ * @param log The log
+ * @param device The flash region, at least two sectors
+ * @return int 0 on success, -1 on failure
+ */
+int flash_log_init(FlashLog_t *log, const FlashDevice_t *device);
+
+/**
+ * @brief Append a record
+ * @param log The log
+ * @param topic Topic of the record
+ * @param payload The payload
+ * @param len Length of the payload, at most FLASH_LOG_MAX_PAYLOAD
+ * @param timeMs Time the payload was produced
+ * @return int 0 on success, -1 on failure
+ */
+int flash_log_append(FlashLog_t *log, uint8_t topic, const void *payload, uint16_t len, uint32_t timeMs);
+
+/**
+ * @brief Read the next record to deliver without moving past it
+ * @param log The log
+ * @param record The record header
+ * @param payload Buffer for the payload
+ * @param size Size of the buffer
+ * @return int 1 if a record was read, 0 if there is nothing left to deliver, -1 on failure
+ */
+int flash_log_peek(FlashLog_t *log, FlashLogRecord_t *record, void *payload, uint16_t size);
+
+/**
+ * @brief Move past the record returned by flash_log_peek() once it has been handed on
+ * @param log The log
+ * @param record The record returned by flash_log_peek()
+ */
+void flash_log_advance(FlashLog_t *log, const FlashLogRecord_t *record);
+
+/**
+ * @brief Mark a record as delivered, it is not returned again even after a reset
+ *
+ * The sector of the record may have been erased and reused since it was read, when the log
+ * wrapped while it was being delivered. The sequence number tells, the record at the offset
+ * is then a newer one and is left alone.
+ *
+ * @param log The log
+ * @param offset The offset of the record
+ * @param sequence The sequence number of the record's sector, from flash_log_peek()
+ * @return int 0 on success, -1 on failure or if the record was dropped since
+ */
+int flash_log_consume(FlashLog_t *log, uint32_t offset, uint32_t sequence);
+
+/**
+ * @brief Hand out the records that were read but not consumed again, e.g. after a reconnect
+ * @param log The log
+ */
+void flash_log_rewind(FlashLog_t *log);
+
+/**
+ * @brief Get the number of records not yet consumed
+ * @param log The log
+ * @return uint32_t The number of records
+ */
+uint32_t flash_log_pending(const FlashLog_t *log);
+
+#endif /* _FLASH_LOG_H_ */
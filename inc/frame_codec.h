@@ -0,0 +1,90 @@
+#ifndef _FRAME_CODEC_H_
+#define _FRAME_CODEC_H_
+/** Includes *************************************************************************************/
+#include <stdbool.h>
+#include <stdint.h>
+
+/** Defines **************************************************************************************/
+
+/** A frame is its length as a big endian uint16 followed by that many bytes */
+#define FRAME_HEADER_LEN 2
+#define FRAME_MAX_LEN UINT16_MAX
+
+/** Typedefs *************************************************************************************/
+
+/**
+ * @brief Called with each complete frame
+ * @param arg The argument passed to frame_decoder_init()
+ * @param frame The frame without its header, only valid for the duration of the call
+ * @param len Length of the frame
+ * @return bool False to hold the frame back, the decoder stops and offers it again on the next call
+ */
+typedef bool (*FrameHandlerFn_t)(void *arg, const uint8_t *frame, uint16_t len);
+
+/** Decoder counters */
+typedef struct
+{
+    uint32_t frames;    /** Frames handed to the handler */
+    uint32_t copied;    /** Frames that were split across spans and reassembled in the buffer */
+    uint32_t oversized; /** Frames longer than the buffer, dropped */
+} FrameDecoderStats_t;
+
+/**
+ * Splits a byte stream into length prefixed frames.
+ *
+ * A frame that arrives whole in one span is handed over in place, only the frames split across
+ * spans are copied into the buffer. frame_decoder_consume() has the signature of a
+ * PbufStreamConsumeFn_t, so the decoder can be set straight as the receive callback of the TCP
+ * client and a handler holding frames back closes the TCP window.
+ */
+typedef struct
+{
+    uint8_t *buffer;
+    uint16_t size;
+    uint8_t header[FRAME_HEADER_LEN];
+    uint8_t headerLen; /** Header bytes seen of the current frame */
+    uint16_t frameLen;
+    uint16_t received; /** Bytes of the current frame seen, complete at frameLen */
+    FrameHandlerFn_t handler;
+    void *arg;
+    FrameDecoderStats_t stats;
+} FrameDecoder_t;
+
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+/** Functions ************************************************************************************/
+
+/**
+ * @brief Write the header of a frame
+ * @param header FRAME_HEADER_LEN bytes
+ * @param len Length of the frame
+ */
+void frame_encode_header(uint8_t *header, uint16_t len);
+
+/**
+ * @brief Initialise a decoder
+ * @param decoder The decoder
+ * @param buffer Reassembly buffer, the longest frame that can be split across spans
+ * @param size Size of the buffer
+ * @param handler Called with every frame
+ * @param arg Argument passed to the handler
+ * @return int 0 on success, -1 on failure
+ */
+int frame_decoder_init(FrameDecoder_t *decoder, uint8_t *buffer, uint16_t size, FrameHandlerFn_t handler, void *arg);
+
+/**
+ * @brief Drop the frame in progress, e.g. when the connection is opened again
+ * @param decoder The decoder
+ */
+void frame_decoder_reset(FrameDecoder_t *decoder);
+
+/**
+ * @brief Feed received bytes to the decoder
+ * @param arg The decoder
+ * @param data The bytes
+ * @param len Number of bytes
+ * @return uint16_t Bytes consumed, less than len when the handler held a frame back
+ */
+uint16_t frame_decoder_consume(void *arg, const uint8_t *data, uint16_t len);
+
+#endif /* _FRAME_CODEC_H_ */
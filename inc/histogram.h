@@ -0,0 +1,59 @@
+#ifndef _HISTOGRAM_H_
+#define _HISTOGRAM_H_
+/** Includes *************************************************************************************/
+#include <stdint.h>
+
+/** Defines **************************************************************************************/
+
+/** Bucket i > 0 counts the values in [2^(i-1), 2^i), the last one everything above, about 16.8 s in microseconds */
+#define HISTOGRAM_BUCKETS 26
+
+/** Typedefs *************************************************************************************/
+
+/**
+ * @brief Log2 bucketed histogram in fixed memory
+ *
+ * Adding a value is a count leading zeros and an increment, cheap enough to run from the lwIP
+ * callbacks. The buckets of many devices can simply be added up on the fleet side.
+ */
+typedef struct
+{
+    uint32_t buckets[HISTOGRAM_BUCKETS]; /** Bucket 0 counts the zeros */
+    uint32_t count;
+    uint32_t max;
+    uint64_t sum;
+} Histogram_t;
+
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+/** Functions ************************************************************************************/
+
+/**
+ * @brief Empty a histogram
+ * @param histogram The histogram
+ */
+void histogram_reset(Histogram_t *histogram);
+
+/**
+ * @brief Count a value
+ * @param histogram The histogram
+ * @param value The value
+ */
+void histogram_add(Histogram_t *histogram, uint32_t value);
+
+/**
+ * @brief Estimate a percentile, the upper bound of the bucket it falls in
+ * @param histogram The histogram
+ * @param percent The percentile, 0 to 100
+ * @return uint32_t The estimate, never above the largest value counted, 0 if the histogram is empty
+ */
+uint32_t histogram_percentile(const Histogram_t *histogram, uint8_t percent);
+
+/**
+ * @brief Get the bucket a value is counted in
+ * @param value The value
+ * @return uint8_t The bucket index
+ */
+uint8_t histogram_bucket(uint32_t value);
+
+#endif /* _HISTOGRAM_H_ */
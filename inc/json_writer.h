@@ -0,0 +1,117 @@
+#ifndef _JSON_WRITER_H_
+#define _JSON_WRITER_H_
+/** Includes *************************************************************************************/
+#include <stdbool.h>
+#include <stdint.h>
+
+/** Defines **************************************************************************************/
+
+/** Deepest nesting of objects and arrays */
+#define JSON_WRITER_MAX_DEPTH 16
+
+/** Typedefs *************************************************************************************/
+
+/**
+ * @brief JSON encoder writing into a caller supplied buffer
+ *
+ * No allocation and no floating point, numbers are written from integers or fixed-point values.
+ * Once a write does not fit, the writer stops and json_writer_finish() reports the failure,
+ * nothing is ever written past the end of the buffer.
+ */
+typedef struct
+{
+    char *buffer;
+    uint16_t size;
+    uint16_t len;
+    uint8_t depth;
+    uint32_t hasItems; /** Bit per depth, set once the container has an item and needs a comma */
+    bool afterKey;     /** The next value belongs to a key, no comma */
+    bool failed;       /** A write did not fit or the nesting is wrong */
+} JsonWriter_t;
+
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+/** Functions ************************************************************************************/
+
+/**
+ * @brief Start writing into a buffer
+ * @param writer The writer
+ * @param buffer The buffer
+ * @param size Size of the buffer
+ */
+void json_writer_init(JsonWriter_t *writer, char *buffer, uint16_t size);
+
+/**
+ * @brief Open an object, as a value or inside an array
+ * @param writer The writer
+ */
+void json_writer_begin_object(JsonWriter_t *writer);
+
+/**
+ * @brief Close the innermost object
+ * @param writer The writer
+ */
+void json_writer_end_object(JsonWriter_t *writer);
+
+/**
+ * @brief Open an array, as a value or inside an array
+ * @param writer The writer
+ */
+void json_writer_begin_array(JsonWriter_t *writer);
+
+/**
+ * @brief Close the innermost array
+ * @param writer The writer
+ */
+void json_writer_end_array(JsonWriter_t *writer);
+
+/**
+ * @brief Write the key of the next member of an object
+ * @param writer The writer
+ * @param key The key, escaped as needed
+ */
+void json_writer_key(JsonWriter_t *writer, const char *key);
+
+/**
+ * @brief Write a signed integer value
+ * @param writer The writer
+ * @param value The value
+ */
+void json_writer_int(JsonWriter_t *writer, int32_t value);
+
+/**
+ * @brief Write a fixed-point value, e.g. 2345 with 2 decimals is written as 23.45
+ * @param writer The writer
+ * @param value The value scaled by 10^decimals
+ * @param decimals Number of decimals, at most 9
+ */
+void json_writer_fixed(JsonWriter_t *writer, int32_t value, uint8_t decimals);
+
+/**
+ * @brief Write a boolean value
+ * @param writer The writer
+ * @param value The value
+ */
+void json_writer_bool(JsonWriter_t *writer, bool value);
+
+/**
+ * @brief Write a null value
+ * @param writer The writer
+ */
+void json_writer_null(JsonWriter_t *writer);
+
+/**
+ * @brief Write a string value
+ * @param writer The writer
+ * @param value The string, escaped as needed
+ */
+void json_writer_string(JsonWriter_t *writer, const char *value);
+
+/**
+ * @brief Finish the document
+ * @param writer The writer
+ * @return int The length of the document, -1 if it did not fit or a container is still open
+ */
+int json_writer_finish(const JsonWriter_t *writer);
+
+#endif /* _JSON_WRITER_H_ */
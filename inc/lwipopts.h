@@ -9,21 +9,28 @@
 #define NO_SYS                      1
 #endif
 
+// MQTT clients running at once, each one holds a sys timeout for its keep alive and a TCP pcb
+#ifndef MQTT_CONNECTIONS
+#define MQTT_CONNECTIONS            1
+#endif
+
 // Need this to be able to use the lwip sys timeouts, otherwise panic
-#define MEMP_NUM_SYS_TIMEOUT        (LWIP_NUM_SYS_TIMEOUT_INTERNAL+1)
+#define MEMP_NUM_SYS_TIMEOUT        (LWIP_NUM_SYS_TIMEOUT_INTERNAL+MQTT_CONNECTIONS)
+#define MEMP_NUM_TCP_PCB            (MQTT_CONNECTIONS+4)
 
 // allow override in some examples
 #ifndef LWIP_SOCKET
 #define LWIP_SOCKET                 0
 #endif
-#if PICO_CYW43_ARCH_POLL
-#define MEM_LIBC_MALLOC             1
-#else
-// MEM_LIBC_MALLOC is incompatible with non polling versions
+// mem_malloc() takes the smallest free block of the fixed size pools in lwippools.h instead of
+// the libc heap, so the RAM of lwIP is bounded at build time and does not fragment over time.
+// There is no lwIP heap, MEM_SIZE is not used.
+// The high water mark of every pool is in lwip_stats, see pool_stats.h.
 #define MEM_LIBC_MALLOC             0
-#endif
+#define MEM_USE_POOLS               1
+#define MEM_USE_POOLS_TRY_BIGGER_POOL 1
+#define MEMP_USE_CUSTOM_POOLS       1
 #define MEM_ALIGNMENT               4
-#define MEM_SIZE                    4000
 #define MEMP_NUM_TCP_SEG            32
 #define MEMP_NUM_ARP_QUEUE          10
 #define PBUF_POOL_SIZE              24
@@ -39,9 +46,10 @@
 #define LWIP_NETIF_LINK_CALLBACK    1
 #define LWIP_NETIF_HOSTNAME         1
 #define LWIP_NETCONN                0
+#define LWIP_STATS                  1
 #define MEM_STATS                   0
 #define SYS_STATS                   0
-#define MEMP_STATS                  0
+#define MEMP_STATS                  1
 #define LINK_STATS                  0
 // #define ETH_PAD_SIZE                2
 #define LWIP_CHKSUM_ALGORITHM       3
@@ -55,9 +63,23 @@
 #define DHCP_DOES_ARP_CHECK         0
 #define LWIP_DHCP_DOES_ACD_CHECK    0
 
+// MQTT app, a whole publish batch (PUBLISH_QUEUE_BATCH_SIZE) plus topic and header must fit
+#define MQTT_OUTPUT_RINGBUF_SIZE    1024
+// MQTT app, requests awaiting an ack, bounds how many SUBSCRIBEs are pipelined on connect
+#define MQTT_REQ_MAX_IN_FLIGHT      16
+
+// MQTT over TLS, see MQTT_TLS in CMakeLists.txt and mbedtls_config.h. The TLS state of each
+// connection and the config of each client come from the large pool of lwippools.h, the record
+// buffers of mbedTLS from the libc heap as MBEDTLS_PLATFORM_MEMORY is not set.
+#if MQTT_TLS
+#define LWIP_ALTCP                  1
+#define LWIP_ALTCP_TLS              1
+#define LWIP_ALTCP_TLS_MBEDTLS      1
+#define ALTCP_MBEDTLS_AUTHMODE      MBEDTLS_SSL_VERIFY_REQUIRED
+#endif
+
 #ifndef NDEBUG
 #define LWIP_DEBUG                  1
-#define LWIP_STATS                  1
 #define LWIP_STATS_DISPLAY          1
 #endif
 
@@ -0,0 +1,30 @@
+// Pools behind mem_malloc(), see MEM_USE_POOLS in lwipopts.h. Included by lwIP itself, several
+// times, with different definitions of the LWIP_MALLOC_MEMPOOL macros, so there is no guard.
+//
+// The sizes are the usable bytes of a block and have to be literal numbers in ascending order.
+// Small blocks are the DHCP and DNS state, medium ones the PBUF_RAM pbufs of small MQTT
+// packets and large ones a full segment (TCP_MSS plus headers), also used for the single pbuf
+// copies of LWIP_NETIF_TX_SINGLE_PBUF. The counts grow with the number of connections.
+
+#ifndef LWIP_POOL_SMALL_COUNT
+#define LWIP_POOL_SMALL_COUNT (24 + 8 * MQTT_CONNECTIONS)
+#endif
+#ifndef LWIP_POOL_MEDIUM_COUNT
+#define LWIP_POOL_MEDIUM_COUNT (8 + 8 * MQTT_CONNECTIONS)
+#endif
+#ifndef LWIP_POOL_LARGE_COUNT
+#if MQTT_TLS
+// one more per connection for its TLS state and per client for its config, one for the DRBG
+#define LWIP_POOL_LARGE_COUNT (5 + 6 * MQTT_CONNECTIONS)
+#else
+#define LWIP_POOL_LARGE_COUNT (4 + 4 * MQTT_CONNECTIONS)
+#endif
+#endif
+
+#if MEM_USE_POOLS
+LWIP_MALLOC_MEMPOOL_START
+LWIP_MALLOC_MEMPOOL(LWIP_POOL_SMALL_COUNT, 128)
+LWIP_MALLOC_MEMPOOL(LWIP_POOL_MEDIUM_COUNT, 512)
+LWIP_MALLOC_MEMPOOL(LWIP_POOL_LARGE_COUNT, 1600)
+LWIP_MALLOC_MEMPOOL_END
+#endif
@@ -0,0 +1,65 @@
+#ifndef _MBEDTLS_CONFIG_H_
+#define _MBEDTLS_CONFIG_H_
+
+// mbedTLS configuration of MQTT_TLS, found through MBEDTLS_CONFIG_FILE by pico_mbedtls and the
+// host build. TLS 1.2 client only, ECDHE with AES-128-GCM and SHA-256, sessions resumed by id
+// or ticket, see mqtt_tls.h. The broker certificate has to be RSA or ECDSA P-256 signed with
+// SHA-256. There is no wall clock, the validity dates of the certificates are not checked.
+
+// Entropy from the TRNG of the RP2350 through pico_rand, mbedtls_hardware_poll() is provided by
+// pico_mbedtls, and by host_platform.c on the host
+#define MBEDTLS_ENTROPY_HARDWARE_ALT
+#define MBEDTLS_NO_PLATFORM_ENTROPY
+#define MBEDTLS_ENTROPY_MAX_SOURCES 2
+#define MBEDTLS_ENTROPY_C
+#define MBEDTLS_CTR_DRBG_C
+
+// SHA-256 runs on the accelerator of the RP2350 when pico_mbedtls links pico_sha256, it carries
+// the handshake hash, the PRF and the certificate digests
+#define MBEDTLS_SHA256_C
+#if LIB_PICO_SHA256
+#define MBEDTLS_SHA256_ALT
+#endif
+#define MBEDTLS_MD_C
+
+// No AES hardware, the tables stay in flash
+#define MBEDTLS_AES_C
+#define MBEDTLS_AES_ROM_TABLES
+#define MBEDTLS_CIPHER_C
+#define MBEDTLS_GCM_C
+
+// Key exchange and certificates, the big number assembly of the Cortex-M33 speeds up ECDHE
+#define MBEDTLS_HAVE_ASM
+#define MBEDTLS_BIGNUM_C
+#define MBEDTLS_ECP_C
+#define MBEDTLS_ECP_DP_SECP256R1_ENABLED
+#define MBEDTLS_ECP_NIST_OPTIM
+#define MBEDTLS_ECDH_C
+#define MBEDTLS_ECDSA_C
+#define MBEDTLS_RSA_C
+#define MBEDTLS_PKCS1_V15
+#define MBEDTLS_ASN1_PARSE_C
+#define MBEDTLS_ASN1_WRITE_C
+#define MBEDTLS_OID_C
+#define MBEDTLS_PK_C
+#define MBEDTLS_PK_PARSE_C
+#define MBEDTLS_BASE64_C
+#define MBEDTLS_PEM_PARSE_C
+#define MBEDTLS_X509_USE_C
+#define MBEDTLS_X509_CRT_PARSE_C
+
+// TLS
+#define MBEDTLS_SSL_TLS_C
+#define MBEDTLS_SSL_CLI_C
+#define MBEDTLS_SSL_PROTO_TLS1_2
+#define MBEDTLS_KEY_EXCHANGE_ECDHE_ECDSA_ENABLED
+#define MBEDTLS_KEY_EXCHANGE_ECDHE_RSA_ENABLED
+#define MBEDTLS_SSL_CIPHERSUITES MBEDTLS_TLS_ECDHE_ECDSA_WITH_AES_128_GCM_SHA256, MBEDTLS_TLS_ECDHE_RSA_WITH_AES_128_GCM_SHA256
+#define MBEDTLS_SSL_SERVER_NAME_INDICATION
+#define MBEDTLS_SSL_SESSION_TICKETS
+
+// A record from the broker can be 16 KiB, ours are at most MQTT_OUTPUT_RINGBUF_SIZE long
+#define MBEDTLS_SSL_IN_CONTENT_LEN 16384
+#define MBEDTLS_SSL_OUT_CONTENT_LEN 2048
+
+#endif /* _MBEDTLS_CONFIG_H_ */
@@ -1,15 +1,42 @@
 #ifndef _MQTT_CLIENT_H_
 #define _MQTT_CLIENT_H_
 /** Includes *************************************************************************************/
+#include <stddef.h>
+
 #include "lwip/apps/mqtt.h"
 #include "lwip/apps/mqtt_priv.h" // needed to set hostname
 
+#include "app_core.h"
+#include "backoff.h"
+#include "flash_device.h"
+#include "flash_log.h"
+#include "histogram.h"
+#include "mqtt_inbound.h"
+#include "mqtt_topic.h"
+#include "outbox.h"
+#include "power.h"
+#include "publish_queue.h"
+#include "subscription_manager.h"
+
+// MQTT over TLS, the session is resumed across reconnects, see the MQTT_TLS option in CMakeLists.txt
+#ifndef MQTT_TLS
+#define MQTT_TLS 0
+#endif
+#if MQTT_TLS
+#include "mqtt_tls.h"
+#endif
+
 /** Defines **************************************************************************************/
 #ifndef MQTT_TOPIC_LEN
 #define MQTT_TOPIC_LEN 100
 #endif
 
-// keep alive in seconds
+// longest client id, it is also the first level of the topics of the client
+#ifndef MQTT_CLIENT_ID_LEN
+#define MQTT_CLIENT_ID_LEN 32
+#endif
+
+// shortest keep alive in seconds, the one used is aligned to MQTT_PUBLISH_CYCLE_MS, see power_keep_alive_s()
 #define MQTT_KEEP_ALIVE_S 60
 
 // qos passed to mqtt_subscribe
@@ -20,8 +47,96 @@
 #define MQTT_PUBLISH_QOS 1
 #define MQTT_PUBLISH_RETAIN 0
 
+// 0 keeps the session on the broker across reconnects, keyed by CLIENT_ID. When the broker
+// still has it, the subscriptions are not sent again and the QoS 1 messages published to us
+// while we were away are delivered.
+#ifndef MQTT_CLEAN_SESSION
+#define MQTT_CLEAN_SESSION 0
+#endif
+
+// live QoS 1 publishes kept until their PUBACK, they are sent again after a reconnect. Together
+// with MQTT_STORE_DRAIN_WINDOW and the SUBSCRIBE pipeline they have to fit in MQTT_REQ_MAX_IN_FLIGHT.
+#ifndef MQTT_INFLIGHT_WINDOW
+#define MQTT_INFLIGHT_WINDOW 4
+#endif
+
+// a live publish that timed out, after MQTT_REQ_TIMEOUT, or that a drop cut off is sent again
+// with its packet id, at most MQTT_PUBLISH_MAX_ATTEMPTS times in all, then it completes as
+// MQTT_PUBLISH_EXPIRED. 0 retries until acknowledged: a publish the broker never acknowledges
+// then keeps its in-flight slot for good and, as completions are delivered in publish order,
+// holds back the completion of every publish after it.
+#ifndef MQTT_PUBLISH_MAX_ATTEMPTS
+#define MQTT_PUBLISH_MAX_ATTEMPTS 5
+#endif
+
+// random delay before connecting again after a refused connect or a drop, see backoff.h
+#ifndef MQTT_BACKOFF_BASE_MS
+#define MQTT_BACKOFF_BASE_MS 500
+#endif
+#ifndef MQTT_BACKOFF_CAP_MS
+#define MQTT_BACKOFF_CAP_MS 60000
+#endif
+
+// a snapshot of MqttClientStats_t is published on MQTT_STATS_TOPIC every MQTT_STATS_INTERVAL_MS
+// at QoS 0 while connected, the first one once connected, followed by the lwIP pool usage on
+// MQTT_POOL_STATS_LEVEL. 0 disables the snapshots. They go through the outbox and are at most
+// OUTBOX_PAYLOAD_LEN long.
+#ifndef MQTT_STATS_INTERVAL_MS
+#define MQTT_STATS_INTERVAL_MS 60000
+#endif
+#ifndef MQTT_STATS_LEN
+#define MQTT_STATS_LEN OUTBOX_PAYLOAD_LEN
+#endif
+
+// publishes wait in the outbox until lwIP has room for them, see outbox.h. The telemetry is
+// queued at normal priority and holds the samples back on core 1 for up to MQTT_OUTBOX_BLOCK_MS
+// once its queue is full, then goes to the flash store. The snapshots are queued at low
+// priority and replace the older ones, high priority is left to mqtt_client_publish() callers
+// and turns the newest away.
+#ifndef MQTT_OUTBOX_HIGH_DEPTH
+#define MQTT_OUTBOX_HIGH_DEPTH 2
+#endif
+#ifndef MQTT_OUTBOX_NORMAL_DEPTH
+#define MQTT_OUTBOX_NORMAL_DEPTH 4
+#endif
+#ifndef MQTT_OUTBOX_LOW_DEPTH
+#define MQTT_OUTBOX_LOW_DEPTH 2
+#endif
+#ifndef MQTT_OUTBOX_BLOCK_MS
+#define MQTT_OUTBOX_BLOCK_MS 5000
+#endif
+#define MQTT_OUTBOX_DEPTH (MQTT_OUTBOX_HIGH_DEPTH + MQTT_OUTBOX_NORMAL_DEPTH + MQTT_OUTBOX_LOW_DEPTH)
+
+// QoS 1 publishes tracked from the outbox to their completion, the completions are delivered in
+// publish order and the oldest incomplete one holds back new publishes once they are all in use
+#define MQTT_PUBLISH_HANDLES (MQTT_OUTBOX_DEPTH + MQTT_INFLIGHT_WINDOW)
+
+// default scheduler period of mqtt_client_task
 #define MQTT_CLIENT_TASK_TIMEOUT_ms 100
 
+// samples are batched per topic into one JSON array and published once the batch reaches
+// MQTT_BATCH_MAX_BYTES or its oldest sample is MQTT_BATCH_MAX_AGE_MS old.
+// 0 disables batching and every sample is published on its own.
+#ifndef MQTT_BATCH_MAX_BYTES
+#define MQTT_BATCH_MAX_BYTES 0
+#endif
+#ifndef MQTT_BATCH_MAX_AGE_MS
+#define MQTT_BATCH_MAX_AGE_MS 30000
+#endif
+
+// time between two publishes of the telemetry, the radio wakes once per cycle in POWER_SAVE
+#define MQTT_PUBLISH_CYCLE_MS (MQTT_BATCH_MAX_BYTES == 0 ? MQTT_SAMPLE_INTERVAL_MS : MQTT_BATCH_MAX_AGE_MS)
+
+// batches published while offline are kept in the flash store and replayed on reconnect,
+// with at most MQTT_STORE_DRAIN_WINDOW replayed publishes waiting for their PUBACK and
+// the store drained every MQTT_STORE_DRAIN_INTERVAL_MS.
+#ifndef MQTT_STORE_DRAIN_WINDOW
+#define MQTT_STORE_DRAIN_WINDOW 4
+#endif
+#ifndef MQTT_STORE_DRAIN_INTERVAL_MS
+#define MQTT_STORE_DRAIN_INTERVAL_MS 50
+#endif
+
 
 /** Typedefs *************************************************************************************/
 
@@ -34,35 +149,225 @@ typedef enum
     MQTT_CLIENT_SUBSCRIBED,
 } MqttClientState_t;
 
-/** Available topics to push to */
-typedef enum 
+typedef struct MqttClientData_s MqttClientData_t;
+
+/** A replayed record waiting for its PUBACK */
+typedef struct
+{
+    MqttClientData_t *client;
+    uint32_t offset;   /** Offset of the record in the flash store */
+    uint32_t sequence; /** Sequence number of its sector, the sector may be reused before the PUBACK */
+    bool used;
+    uint64_t sentUs; /** When it was published, for the PUBACK latency */
+} MqttStoreSlot_t;
+
+/** Outcome of a QoS 1 publish */
+typedef enum
 {
-    MQTT_TOPIC_BOOT,
-    MQTT_TOPIC_TEMP,
-    MQTT_TOPIC_HUMIDITY,
-    MQTT_TOPIC_PRESSURE,
-    MQTT_TOPIC_MAX
-} MqttTopic_t;
+    MQTT_PUBLISH_PENDING, /** In the outbox or waiting for its PUBACK */
+    MQTT_PUBLISH_ACKED,   /** The broker acknowledged it */
+    MQTT_PUBLISH_DROPPED, /** Removed from the outbox to make room before it was sent */
+    MQTT_PUBLISH_EXPIRED, /** Not acknowledged after MQTT_PUBLISH_MAX_ATTEMPTS */
+} MqttPublishResult_t;
 
-/** The client data structure */
+/** Tracks a QoS 1 publish from the outbox to its completion */
+typedef struct
+{
+    uint32_t id;                /** Handle returned by mqtt_client_publish(), increasing in publish order */
+    const char *topic;          /** Topic of the publish */
+    MqttPublishResult_t result; /** MQTT_PUBLISH_PENDING until it completes */
+    uint8_t attempts;           /** Times it was handed to lwIP */
+    uint16_t packetId;          /** MQTT packet id, kept by the retransmissions */
+    uint32_t queuedMs;          /** Taken by the outbox */
+    uint64_t firstSentUs;       /** First handed to lwIP, 0 if it never was */
+    uint64_t doneUs;            /** Acknowledged, dropped or given up */
+} MqttPublishHandle_t;
+
+/**
+ * @brief Called with every QoS 1 publish once it is complete
+ *
+ * The completions are delivered in publish order, one acknowledged before an older publish is
+ * held back until that one completes. Runs in the lwIP callbacks or the client task.
+ *
+ * @param arg The argument passed to mqtt_client_set_publish_done()
+ * @param handle The publish, only valid for the duration of the call
+ */
+typedef void (*MqttPublishDoneFn_t)(void *arg, const MqttPublishHandle_t *handle);
+
+/** A live QoS 1 publish waiting for its PUBACK, lwIP drops its requests when the connection goes */
+typedef struct
+{
+    MqttClientData_t *client;
+    uint32_t id;       /** Handle of the publish, see MqttPublishHandle_t */
+    const char *topic; /** Outlives the slot, see OutboxEntry_t */
+    uint16_t len;
+    bool used;
+    bool sent; /** Published on the current connection */
+    uint64_t sentUs; /** When it was last published, for the PUBACK latency */
+    char payload[PUBLISH_QUEUE_BATCH_SIZE];
+} MqttInflightSlot_t;
+
+/** Client counters and timings since boot, see MQTT_STATS_TOPIC */
 typedef struct
 {
-    mqtt_client_t *mqttClientInst;
+    Histogram_t pubackUs;     /** Publish to PUBACK, live and replayed publishes */
+    Histogram_t connectUs;    /** CONNECT to CONNACK */
+    uint32_t published;       /** QoS 1 publishes handed to lwIP, including the resends */
+    uint32_t pubacks;         /** Publishes acknowledged */
+    uint32_t pubTimeouts;     /** Publishes lwIP gave up waiting for */
+    uint32_t pubErrors;       /** Publishes that failed otherwise */
+    uint32_t pubExpired;      /** Live publishes given up after MQTT_PUBLISH_MAX_ATTEMPTS */
+    uint32_t pubRefused;      /** Publishes lwIP had no room for, retried or stored */
+    uint32_t samplesLost;     /** Samples the publish queue refused, see publish_queue_add() */
+    uint32_t connects;        /** Accepted connects */
+    uint32_t connectFailures; /** Refused connects and connects that could not be sent */
+    uint32_t disconnects;     /** Established connections that dropped */
+    uint32_t lastConnectUs;   /** CONNECT to CONNACK, last connect */
+} MqttClientStats_t;
+
+/**
+ * Identity and broker of one client. Every instance has its own, so that several clients can
+ * run side by side, e.g. a primary and a standby broker, or many virtual devices on the host.
+ */
+typedef struct
+{
+    const char *clientId;      /** Client id and first level of the topics, copied */
+    const char *serverIp;      /** Broker address, dotted decimal */
+    uint16_t port;             /** Broker port */
+    const FlashDevice_t *store; /** Keeps the batches published while offline, copied, NULL for none */
+    const uint8_t *caCert;     /** MQTT_TLS only, CA of the broker certificate, see mqtt_tls_init() */
+    size_t caCertLen;
+    const char *serverName;    /** MQTT_TLS only, name or address in the broker certificate, must outlive the client */
+} MqttClientConfig_t;
+
+/** The client data structure */
+struct MqttClientData_s
+{
+    mqtt_client_t *mqttClientInst; /** Points to mqttClient once the first connect was started */
+    mqtt_client_t mqttClient;      /** Reused by every connect, see MEM_USE_POOLS in lwipopts.h */
     struct mqtt_connect_client_info_t mqttClientInfo;
-    char data[MQTT_OUTPUT_RINGBUF_SIZE];
-    char topic[MQTT_TOPIC_LEN];
-    uint32_t len;
+    MqttInbound_t inbound; /** Reassembles incoming publishes and hands them to the topic handlers */
+    AppCore_t *app; /** Encodes the samples and runs the commands on core 1, set by the owner of the application */
+    const Power_t *power; /** Duty cycle of the main loop for the stats, set by the owner of the loop, may be NULL */
     ip_addr_t mqtt_server_address;
     bool connect_done;
     int subscribe_count;
     bool stop_client;
-    MqttTopic_t taskState;
-} MqttClientData_t;
+    MqttClientState_t taskState;
+    int taskId; /** Scheduler task id, used by the lwIP callbacks to wake the task */
+    PublishQueue_t publishQueue;
+    Outbox_t outbox; /** Publishes waiting for room in lwIP */
+    OutboxEntry_t outboxEntries[MQTT_OUTBOX_DEPTH];
+    MqttPublishHandle_t handles[MQTT_PUBLISH_HANDLES]; /** Indexed by id modulo the size, reorders the completions */
+    uint32_t nextHandle;                               /** Id of the next QoS 1 publish */
+    uint32_t doneHandle;                               /** Oldest publish whose completion was not delivered */
+    MqttPublishDoneFn_t publishDone;
+    void *publishDoneArg;
+    SubscriptionManager_t subscriptions; /** Pipelines the SUBSCRIBE requests of the registered filters */
+    FlashDevice_t storeDevice;
+    FlashLog_t store; /** Batches that could not be published while offline */
+    bool storeReady;
+    MqttStoreSlot_t storeSlots[MQTT_STORE_DRAIN_WINDOW];
+    MqttInflightSlot_t inflight[MQTT_INFLIGHT_WINDOW];
+    bool sessionPresent;    /** The broker resumed the session on the last CONNACK */
+    bool sessionSubscribed; /** The filters were subscribed in a session since boot */
+    Backoff_t backoff;      /** Delay before the next connect */
+    char storePayload[PUBLISH_QUEUE_BATCH_SIZE]; /** Record being replayed, lwIP copies it */
+    MqttClientStats_t stats;
+    uint64_t connectStartUs;            /** When the last CONNECT was sent */
+#if MQTT_TLS
+    MqttTls_t tls; /** Config and cached session, kept across reconnects */
+#endif
+    uint32_t statsDueMs;                /** Next snapshot */
+    char statsPayload[MQTT_STATS_LEN]; /** Snapshot being published, lwIP copies it */
+    uint16_t port;                      /** Broker port */
+    char clientId[MQTT_CLIENT_ID_LEN];
+    char topicNames[MQTT_TOPIC_MAX][MQTT_TOPIC_LEN]; /** Indexed by MqttTopic_t, prefixed with the client id */
+    char statsTopic[MQTT_TOPIC_LEN];
+    char poolStatsTopic[MQTT_TOPIC_LEN];
+    char formatConfigFilter[MQTT_TOPIC_LEN];
+};
 
 
 /** Variables ************************************************************************************/
 /** Prototypes ***********************************************************************************/
 /** Functions ************************************************************************************/
+
+/**
+ * @brief Initialise the client data structure and its publish queue
+ *
+ * The client keeps no state outside of the structure, any number of them can be initialised
+ * as long as lwIP has a TCP pcb and a timeout for each, see MQTT_CONNECTIONS in lwipopts.h.
+ *
+ * @param client The client data structure
+ * @param config Identity and broker of the client
+ * @return int 0 on success, -1 on failure
+ */
+int mqtt_client_init(MqttClientData_t *client, const MqttClientConfig_t *config);
+
+/**
+ * @brief The mqtt client task runs the connection state machine and publishes the telemetry.
+ *
+ * It should be registered with the scheduler with a period of MQTT_CLIENT_TASK_TIMEOUT_ms and
+ * client->taskId set to the returned id, so that the lwIP callbacks can wake it.
+ *
+ * @param client The client data structure
+ * @return int 0 on success, -1 on failure
+ */
 int mqtt_client_task(MqttClientData_t *client);
 
+/**
+ * @brief Run instead of mqtt_client_task() while the network is down.
+ *
+ * Keeps sampling, the batches are stored in flash and replayed by mqtt_client_task() once the
+ * client is connected again.
+ *
+ * @param client The client data structure
+ * @return int 0 on success, -1 on failure
+ */
+int mqtt_client_offline_task(MqttClientData_t *client);
+
+/**
+ * @brief Queue a publish, it is sent by mqtt_client_task() as soon as lwIP has room
+ *
+ * QoS 1 publishes are kept until their PUBACK and sent again after a reconnect, like the
+ * telemetry, and are at most PUBLISH_QUEUE_BATCH_SIZE long. Each one gets a handle, its
+ * completion is passed to the function set with mqtt_client_set_publish_done().
+ *
+ * @param client The client data structure
+ * @param priority The queue, see MQTT_OUTBOX_HIGH_DEPTH
+ * @param topic The topic, must outlive the publish
+ * @param payload The payload, copied
+ * @param len Length of the payload
+ * @param qos 0 or 1
+ * @param handle Set to the handle of a QoS 1 publish that was taken, 0 otherwise, may be NULL
+ * @return OutboxStatus_t OUTBOX_BLOCKED asks the caller to keep the payload and try again later
+ */
+OutboxStatus_t mqtt_client_publish(MqttClientData_t *client, OutboxPriority_t priority, const char *topic,
+                                   const void *payload, uint16_t len, uint8_t qos, uint32_t *handle);
+
+/**
+ * @brief Set the function told about the completion of every QoS 1 publish, the telemetry included
+ * @param client The client data structure
+ * @param done The function, NULL for none
+ * @param arg Argument passed to the function
+ */
+void mqtt_client_set_publish_done(MqttClientData_t *client, MqttPublishDoneFn_t done, void *arg);
+
+/**
+ * @brief Get the state of a QoS 1 publish, it is kept until MQTT_PUBLISH_HANDLES newer ones were published
+ * @param client The client data structure
+ * @param handle The handle returned by mqtt_client_publish()
+ * @param status Filled with the state of the publish
+ * @return int 0 on success, -1 if the handle is unknown or too old
+ */
+int mqtt_client_get_publish(const MqttClientData_t *client, uint32_t handle, MqttPublishHandle_t *status);
+
+/**
+ * @brief Get a copy of the client counters and timings
+ * @param client The client data structure
+ * @param stats Filled with the counters
+ */
+void mqtt_client_get_stats(const MqttClientData_t *client, MqttClientStats_t *stats);
+
 #endif /* _MQTT_CLIENT_H_ */
\ No newline at end of file
@@ -0,0 +1,135 @@
+#ifndef _MQTT_INBOUND_H_
+#define _MQTT_INBOUND_H_
+/** Includes *************************************************************************************/
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "topic_router.h"
+
+/** Defines **************************************************************************************/
+#ifndef MQTT_INBOUND_TOPIC_LEN
+#define MQTT_INBOUND_TOPIC_LEN 100
+#endif
+
+/** Size of the arena buffered messages are reassembled in, bounds the largest buffered message */
+#ifndef MQTT_INBOUND_ARENA_SIZE
+#define MQTT_INBOUND_ARENA_SIZE 1024
+#endif
+
+/** Typedefs *************************************************************************************/
+
+/** How the payload of a topic is delivered */
+typedef enum
+{
+    MQTT_INBOUND_MODE_STREAM,   /** Each fragment is passed on as it arrives, no copy */
+    MQTT_INBOUND_MODE_BUFFERED, /** Fragments are copied into an arena slab, the handler gets the whole payload */
+} MqttInboundMode_t;
+
+/**
+ * @brief Streaming handler, called for every fragment of a payload
+ * @param arg The argument passed at registration
+ * @param topic The topic of the message
+ * @param data The fragment, only valid for the duration of the call
+ * @param len Length of the fragment
+ * @param offset Offset of the fragment in the payload
+ * @param totLen Total length of the payload
+ * @param last True for the last fragment
+ */
+typedef void (*MqttInboundStreamFn_t)(void *arg, const char *topic, const uint8_t *data, uint16_t len, uint32_t offset, uint32_t totLen, bool last);
+
+/**
+ * @brief Buffered handler, called once with the complete payload
+ * @param arg The argument passed at registration
+ * @param topic The topic of the message
+ * @param payload The payload, null terminated, released when the handler returns
+ * @param len Length of the payload without the terminator
+ */
+typedef void (*MqttInboundMessageFn_t)(void *arg, const char *topic, const uint8_t *payload, uint32_t len);
+
+/** A registered topic handler */
+typedef struct
+{
+    MqttInboundMode_t mode;
+    MqttInboundStreamFn_t streamFn;
+    MqttInboundMessageFn_t messageFn;
+    void *arg;
+} MqttInboundHandler_t;
+
+/** Reassembly counters */
+typedef struct
+{
+    uint32_t messages;  /** Messages delivered to a handler */
+    uint32_t fragments; /** Fragments received */
+    uint32_t bytes;     /** Payload bytes received */
+    uint32_t unhandled; /** Messages without a handler */
+    uint32_t tooLarge;  /** Buffered messages that did not fit in the arena */
+} MqttInboundStats_t;
+
+/** Reassembly state, one message is in flight at a time */
+typedef struct
+{
+    TopicRouter_t router; /** Topic filters, also the subscription list */
+    MqttInboundHandler_t handlers[TOPIC_ROUTER_MAX_ROUTES]; /** Indexed by route id */
+
+    char topic[MQTT_INBOUND_TOPIC_LEN]; /** Topic of the message in flight */
+    const MqttInboundHandler_t *current; /** Its handler, NULL if the message is discarded */
+    uint32_t totLen;
+    uint32_t received;
+    uint8_t *slab; /** Arena slab of a buffered message */
+
+    uint8_t arena[MQTT_INBOUND_ARENA_SIZE];
+    uint32_t arenaUsed;
+
+    MqttInboundStats_t stats;
+} MqttInbound_t;
+
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+/** Functions ************************************************************************************/
+
+/**
+ * @brief Initialise the reassembly state and clear the handlers
+ * @param inbound The reassembly state
+ */
+void mqtt_inbound_init(MqttInbound_t *inbound);
+
+/**
+ * @brief Register a streaming handler for a topic filter
+ * @param inbound The reassembly state
+ * @param filter The topic filter, may contain the '+' and '#' wildcards
+ * @param qos The QoS to subscribe to the filter with
+ * @param fn The handler
+ * @param arg Argument passed to the handler
+ * @return int 0 on success, -1 on failure
+ */
+int mqtt_inbound_register_stream(MqttInbound_t *inbound, const char *filter, uint8_t qos, MqttInboundStreamFn_t fn, void *arg);
+
+/**
+ * @brief Register a buffered handler for a topic filter
+ * @param inbound The reassembly state
+ * @param filter The topic filter, may contain the '+' and '#' wildcards
+ * @param qos The QoS to subscribe to the filter with
+ * @param fn The handler
+ * @param arg Argument passed to the handler
+ * @return int 0 on success, -1 on failure
+ */
+int mqtt_inbound_register_message(MqttInbound_t *inbound, const char *filter, uint8_t qos, MqttInboundMessageFn_t fn, void *arg);
+
+/**
+ * @brief Start a new message, call from the lwIP incoming publish callback
+ * @param inbound The reassembly state
+ * @param topic The topic of the message
+ * @param totLen The total length of the payload
+ */
+void mqtt_inbound_publish(MqttInbound_t *inbound, const char *topic, uint32_t totLen);
+
+/**
+ * @brief Add a fragment to the message, call from the lwIP incoming data callback
+ * @param inbound The reassembly state
+ * @param data The fragment
+ * @param len Length of the fragment
+ * @param last True if MQTT_DATA_FLAG_LAST is set
+ */
+void mqtt_inbound_data(MqttInbound_t *inbound, const uint8_t *data, uint16_t len, bool last);
+
+#endif /* _MQTT_INBOUND_H_ */
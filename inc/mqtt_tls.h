@@ -0,0 +1,86 @@
+#ifndef _MQTT_TLS_H_
+#define _MQTT_TLS_H_
+/** Includes *************************************************************************************/
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "lwip/altcp.h"
+#include "lwip/altcp_tls.h"
+#include "mbedtls/ssl.h"
+
+#include "histogram.h"
+
+/** Defines **************************************************************************************/
+
+/** Name or address in the broker certificate, see MQTT_TLS_SERVER_NAME in CMakeLists.txt */
+#ifndef MQTT_TLS_SERVER_NAME
+#define MQTT_TLS_SERVER_NAME SERVER_IP
+#endif
+
+/** Typedefs *************************************************************************************/
+
+/** Handshakes since boot, timed from CONNECT to CONNACK like MqttClientStats_t.connectUs */
+typedef struct
+{
+    Histogram_t fullUs;    /** Connects that verified the broker certificate */
+    Histogram_t resumedUs; /** Connects that resumed the cached session */
+    bool lastResumed;      /** The last accepted connect resumed the session */
+} MqttTlsStats_t;
+
+/**
+ * TLS of one client, on top of lwIP's altcp_tls and mbedTLS.
+ *
+ * The session of the last accepted connect is kept and offered on the next one, a broker that
+ * still knows it (session id cache or ticket) skips the key exchange and the certificate check,
+ * which is most of the handshake on this MCU. A connect is told to be resumed from the
+ * certificate not being verified, this holds for both ways of resuming.
+ */
+typedef struct
+{
+    struct altcp_tls_config *config; /** Trusts the CA of the broker, shared by the connects of the client */
+    const char *serverName;          /** Checked against the broker certificate, must outlive the client */
+    mbedtls_ssl_session session;     /** Offered on the next connect */
+    bool sessionValid;
+    bool verified; /** The broker certificate was verified on the current connect */
+    MqttTlsStats_t stats;
+} MqttTls_t;
+
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+/** Functions ************************************************************************************/
+
+/**
+ * @brief Initialise the TLS of a client, lwIP has to be initialised
+ * @param tls The TLS state
+ * @param caCert The CA certificate, PEM with its terminating nul or DER
+ * @param caCertLen Length of the certificate, including the nul of a PEM one
+ * @param serverName Name or address in the broker certificate, must outlive the client
+ * @return int 0 on success, -1 on failure
+ */
+int mqtt_tls_init(MqttTls_t *tls, const uint8_t *caCert, size_t caCertLen, const char *serverName);
+
+/**
+ * @brief Prepare the handshake of a new connection, call before lwIP connected the TCP connection
+ * @param tls The TLS state
+ * @param conn The connection of the client, its TLS layer is still idle
+ * @return int 0 on success, -1 on failure
+ */
+int mqtt_tls_start(MqttTls_t *tls, struct altcp_pcb *conn);
+
+/**
+ * @brief Count the handshake of an accepted connect and keep its session for the next one
+ * @param tls The TLS state
+ * @param conn The connection of the client
+ * @param connectUs CONNECT to CONNACK
+ * @return bool True if the session was resumed
+ */
+bool mqtt_tls_connected(MqttTls_t *tls, struct altcp_pcb *conn, uint32_t connectUs);
+
+/**
+ * @brief Drop the cached session, the next connect does a full handshake
+ * @param tls The TLS state
+ */
+void mqtt_tls_forget(MqttTls_t *tls);
+
+#endif /* _MQTT_TLS_H_ */
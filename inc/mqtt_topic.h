@@ -0,0 +1,88 @@
+#ifndef _MQTT_TOPIC_H_
+#define _MQTT_TOPIC_H_
+/** Includes *************************************************************************************/
+/** Defines **************************************************************************************/
+/** Topics below the client id, the full names are the client id and the level */
+#define MQTT_BOOT_LEVEL "/boot"
+#define MQTT_TEMPERATURE_LEVEL "/temperature"
+#define MQTT_HUMIDITY_LEVEL "/humidity"
+#define MQTT_PRESSURE_LEVEL "/pressure"
+
+/** Client statistics snapshot, see MQTT_STATS_INTERVAL_MS */
+#define MQTT_STATS_LEVEL "/$stats"
+
+/** lwIP memory pool usage and high water marks, published with the statistics */
+#define MQTT_POOL_STATS_LEVEL "/$stats/pools"
+
+/** Retained config topic selecting the payload format of a topic, the last level is the topic name */
+#define MQTT_FORMAT_CONFIG_LEVEL "/config/format/+"
+
+/** Topics of the client built with CLIENT_ID, see CMakeLists.txt */
+#define MQTT_BOOT_TOPIC CLIENT_ID MQTT_BOOT_LEVEL
+#define MQTT_TEMPERATURE_TOPIC CLIENT_ID MQTT_TEMPERATURE_LEVEL
+#define MQTT_HUMIDITY_TOPIC CLIENT_ID MQTT_HUMIDITY_LEVEL
+#define MQTT_PRESSURE_TOPIC CLIENT_ID MQTT_PRESSURE_LEVEL
+#define MQTT_STATS_TOPIC CLIENT_ID MQTT_STATS_LEVEL
+#define MQTT_FORMAT_CONFIG_TOPIC CLIENT_ID MQTT_FORMAT_CONFIG_LEVEL
+
+/**
+ * Time between two temperature samples, each one the average of the raw ADC conversions taken
+ * over the interval, keeping MQTT_SAMPLE_EXTRA_BITS fraction bits
+ */
+#ifndef MQTT_SAMPLE_INTERVAL_MS
+#define MQTT_SAMPLE_INTERVAL_MS 5000
+#endif
+#ifndef MQTT_SAMPLE_EXTRA_BITS
+#define MQTT_SAMPLE_EXTRA_BITS 4
+#endif
+
+/** Payload format of the temperature topic at boot, see MqttPayloadFormat_t */
+#ifndef MQTT_TEMPERATURE_FORMAT
+#define MQTT_TEMPERATURE_FORMAT MQTT_FORMAT_JSON
+#endif
+
+/**
+ * Reporting policy of the temperature topic, see ReportPolicyConfig_t. A sample is published when
+ * it is more than the deadband in centi-degrees, or the per mille of the last published value,
+ * away from the last published one, or when nothing was published for the max silence. 0 for both
+ * deadbands suppresses repeated values only, a max silence of 0 disables the heartbeat.
+ */
+#ifndef MQTT_TEMPERATURE_DEADBAND
+#define MQTT_TEMPERATURE_DEADBAND 10
+#endif
+#ifndef MQTT_TEMPERATURE_DEADBAND_PERMILLE
+#define MQTT_TEMPERATURE_DEADBAND_PERMILLE 0
+#endif
+#ifndef MQTT_TEMPERATURE_MAX_SILENCE_MS
+#define MQTT_TEMPERATURE_MAX_SILENCE_MS 60000
+#endif
+/** 1 publishes the change since the last published value as {"d": 0.12}, heartbeats carry the full value */
+#ifndef MQTT_TEMPERATURE_DELTA
+#define MQTT_TEMPERATURE_DELTA 0
+#endif
+
+/** Typedefs *************************************************************************************/
+
+/** Available topics to push to */
+typedef enum 
+{
+    MQTT_TOPIC_BOOT,
+    MQTT_TOPIC_TEMP,
+    MQTT_TOPIC_HUMIDITY,
+    MQTT_TOPIC_PRESSURE,
+    MQTT_TOPIC_MAX
+} MqttTopic_t;
+
+/** Payload encodings */
+typedef enum
+{
+    MQTT_FORMAT_JSON, /** Text JSON, batches are JSON arrays */
+    MQTT_FORMAT_CBOR, /** CBOR with the self-describe tag, batches are indefinite length arrays */
+    MQTT_FORMAT_MAX
+} MqttPayloadFormat_t;
+
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+/** Functions ************************************************************************************/
+
+#endif /* _MQTT_TOPIC_H_ */
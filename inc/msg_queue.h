@@ -0,0 +1,68 @@
+#ifndef _MSG_QUEUE_H_
+#define _MSG_QUEUE_H_
+/** Includes *************************************************************************************/
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "ring_buffer.h"
+
+/** Defines **************************************************************************************/
+/** Typedefs *************************************************************************************/
+
+/** Header in front of every message, type and arg are up to the user of the queue */
+typedef struct
+{
+    uint16_t len; /** Length of the body */
+    uint8_t type;
+    uint8_t arg;
+} MsgQueueHeader_t;
+
+/**
+ * Lock free single producer, single consumer queue of variable length messages.
+ *
+ * Built on a RingBuffer_t, so like the ring the producer and the consumer may run on different
+ * cores without locking. A message is either queued whole or not at all.
+ */
+typedef struct
+{
+    RingBuffer_t ring;
+    MsgQueueHeader_t pending; /** Header taken by the consumer while its body was still being written */
+    bool hasPending;          /** Consumer owned */
+    uint32_t dropped;         /** Messages that did not fit, producer owned */
+} MsgQueue_t;
+
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+/** Functions ************************************************************************************/
+
+/**
+ * @brief Initialise a queue over caller provided storage
+ * @param queue The queue
+ * @param storage The storage, must stay valid for the lifetime of the queue
+ * @param size Size of the storage, must be a power of two
+ * @return int 0 on success, -1 on failure
+ */
+int msg_queue_init(MsgQueue_t *queue, uint8_t *storage, uint32_t size);
+
+/**
+ * @brief Queue a message, producer side
+ * @param queue The queue
+ * @param type Message type, passed through to the consumer
+ * @param arg Message argument, passed through to the consumer
+ * @param data The body, may be NULL if len is 0
+ * @param len Length of the body
+ * @return int 0 on success, -1 if the queue is full
+ */
+int msg_queue_push(MsgQueue_t *queue, uint8_t type, uint8_t arg, const void *data, uint16_t len);
+
+/**
+ * @brief Take the oldest message, consumer side
+ * @param queue The queue
+ * @param header Set to the header of the message
+ * @param data Buffer for the body
+ * @param size Size of the buffer
+ * @return int 1 if a message was read, 0 if the queue is empty, -1 if the body did not fit and was dropped
+ */
+int msg_queue_pop(MsgQueue_t *queue, MsgQueueHeader_t *header, void *data, uint16_t size);
+
+#endif /* _MSG_QUEUE_H_ */
@@ -0,0 +1,177 @@
+#ifndef _OUTBOX_H_
+#define _OUTBOX_H_
+/** Includes *************************************************************************************/
+#include <stdbool.h>
+#include <stdint.h>
+
+/** Defines **************************************************************************************/
+
+/** Largest payload of a queued publish, longer ones are rejected */
+#ifndef OUTBOX_PAYLOAD_LEN
+#define OUTBOX_PAYLOAD_LEN 896
+#endif
+
+/** Typedefs *************************************************************************************/
+
+/** Queues, sent in this order */
+typedef enum
+{
+    OUTBOX_PRIORITY_HIGH,
+    OUTBOX_PRIORITY_NORMAL,
+    OUTBOX_PRIORITY_LOW,
+    OUTBOX_PRIORITY_MAX
+} OutboxPriority_t;
+
+/** What a full queue does with a new publish */
+typedef enum
+{
+    OUTBOX_DROP_OLDEST, /** The oldest entry makes room, the newest data wins */
+    OUTBOX_DROP_NEWEST, /** The new publish is rejected */
+    OUTBOX_BLOCK,       /** The producer is held back until blockMs after the queue filled up, then rejected */
+} OutboxPolicy_t;
+
+/** Result of a publish */
+typedef enum
+{
+    OUTBOX_QUEUED,   /** Taken, it is sent as soon as lwIP has room */
+    OUTBOX_BLOCKED,  /** Not taken, keep it and try again, the queue will have room before the deadline */
+    OUTBOX_REJECTED, /** Not taken and it won't be, too long, dropped by the policy or the deadline passed */
+} OutboxStatus_t;
+
+typedef struct
+{
+    OutboxPolicy_t policy;
+    uint8_t depth;    /** Entries, 0 disables the priority */
+    uint32_t blockMs; /** OUTBOX_BLOCK only, how long the producer is held back */
+} OutboxQueueConfig_t;
+
+/** A queued publish */
+typedef struct
+{
+    const char *topic; /** Must outlive the entry */
+    uint8_t qos;
+    uint16_t len;
+    uint32_t tag; /** Set by the producer, e.g. to track the publish */
+    char payload[OUTBOX_PAYLOAD_LEN];
+} OutboxEntry_t;
+
+/** Counters of one priority, the depth and its high water mark size the queues */
+typedef struct
+{
+    uint16_t depth;         /** Entries queued now */
+    uint16_t maxDepth;      /** Most entries queued at once */
+    uint32_t queued;        /** Publishes taken */
+    uint32_t sent;          /** Entries handed to lwIP */
+    uint32_t droppedOldest; /** Entries that made room for a newer one */
+    uint32_t rejected;      /** Publishes turned away, OUTBOX_DROP_NEWEST or too long */
+    uint32_t blocked;       /** Publishes the producer was told to hold back */
+    uint32_t timeouts;      /** Publishes rejected once the block deadline passed */
+    uint32_t retries;       /** Sends the send function had no room for */
+} OutboxQueueStats_t;
+
+/**
+ * @brief Hand an entry to the network
+ * @param arg The argument passed to outbox_init()
+ * @param entry The entry, copied by the callee
+ * @return int 0 when sent, -1 if there is no room now, the entry is offered again on the next pump
+ */
+typedef int (*OutboxSendFn_t)(void *arg, const OutboxEntry_t *entry);
+
+/**
+ * @brief Told about an entry OUTBOX_DROP_OLDEST removed to make room
+ * @param arg The argument passed to outbox_init()
+ * @param entry The entry, only valid for the duration of the call
+ */
+typedef void (*OutboxDropFn_t)(void *arg, const OutboxEntry_t *entry);
+
+typedef struct
+{
+    OutboxEntry_t *entries;  /** config.depth entries of the storage passed to outbox_init() */
+    uint8_t head;            /** Oldest entry */
+    uint8_t count;
+    bool blocking;           /** A producer was held back since the queue was last not full */
+    uint32_t blockedSinceMs; /** When the producer was first held back */
+    OutboxQueueConfig_t config;
+    OutboxQueueStats_t stats;
+} OutboxQueue_t;
+
+/**
+ * A bounded queue per priority in front of the network.
+ *
+ * Every publish gets a definite answer instead of a dropped error: taken, to be retried, or
+ * turned away. The pump sends the queues in priority order as long as the send function has
+ * room and is run again when lwIP frees some, a full queue applies its overload policy.
+ */
+typedef struct
+{
+    OutboxQueue_t queues[OUTBOX_PRIORITY_MAX];
+    OutboxSendFn_t send;
+    OutboxDropFn_t drop;
+    void *sendArg; /** Passed to send and drop */
+} Outbox_t;
+
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+/** Functions ************************************************************************************/
+
+/**
+ * @brief Initialise an outbox
+ * @param outbox The outbox
+ * @param configs The policy and depth of each priority, indexed by OutboxPriority_t
+ * @param entries Storage for the entries, shared out to the priorities in order
+ * @param count Number of entries, at least the sum of the depths
+ * @param send Hands an entry to the network
+ * @param drop Told about the entries dropped to make room, may be NULL
+ * @param arg Argument passed to the send and drop functions
+ * @return int 0 on success, -1 on failure
+ */
+int outbox_init(Outbox_t *outbox, const OutboxQueueConfig_t *configs, OutboxEntry_t *entries, uint16_t count,
+                OutboxSendFn_t send, OutboxDropFn_t drop, void *arg);
+
+/**
+ * @brief Queue a publish, the payload is copied
+ * @param outbox The outbox
+ * @param priority The queue
+ * @param topic The topic, must outlive the entry
+ * @param payload The payload
+ * @param len Length of the payload, at most OUTBOX_PAYLOAD_LEN
+ * @param qos The qos
+ * @param tag Copied to the entry
+ * @param nowMs The current time in milliseconds
+ * @return OutboxStatus_t Whether the publish was taken
+ */
+OutboxStatus_t outbox_publish(Outbox_t *outbox, OutboxPriority_t priority, const char *topic, const void *payload,
+                              uint16_t len, uint8_t qos, uint32_t tag, uint32_t nowMs);
+
+/**
+ * @brief What outbox_publish() would answer now, lets a producer hold its data back while blocked
+ * @param outbox The outbox
+ * @param priority The queue
+ * @param nowMs The current time in milliseconds
+ * @return OutboxStatus_t OUTBOX_QUEUED if a publish would be taken
+ */
+OutboxStatus_t outbox_check(Outbox_t *outbox, OutboxPriority_t priority, uint32_t nowMs);
+
+/**
+ * @brief Send the queued entries, highest priority first, until the send function has no room
+ * @param outbox The outbox
+ * @return uint16_t Entries still queued
+ */
+uint16_t outbox_pump(Outbox_t *outbox);
+
+/**
+ * @brief Count the entries waiting to be sent
+ * @param outbox The outbox
+ * @return uint16_t Entries queued over all priorities
+ */
+uint16_t outbox_pending(const Outbox_t *outbox);
+
+/**
+ * @brief Get a copy of the counters of a priority
+ * @param outbox The outbox
+ * @param priority The queue
+ * @param stats Filled with the counters
+ */
+void outbox_get_stats(const Outbox_t *outbox, OutboxPriority_t priority, OutboxQueueStats_t *stats);
+
+#endif /* _OUTBOX_H_ */
@@ -0,0 +1,96 @@
+#ifndef _PBUF_STREAM_H_
+#define _PBUF_STREAM_H_
+/** Includes *************************************************************************************/
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "lwip/pbuf.h"
+#include "lwip/tcp.h"
+
+/** Defines **************************************************************************************/
+/** Typedefs *************************************************************************************/
+
+/**
+ * @brief Called with a contiguous span of received data
+ * @param arg The argument passed to pbuf_stream_init()
+ * @param data Pointer into the pbuf payload, only valid for the duration of the call
+ * @param len Length of the span
+ * @return uint16_t Number of bytes consumed. Returning less than len stops the stream until
+ *         the next call to pbuf_stream_process(), the rest of the span is offered again then.
+ */
+typedef uint16_t (*PbufStreamConsumeFn_t)(void *arg, const uint8_t *data, uint16_t len);
+
+/** Stream reader counters */
+typedef struct
+{
+    uint32_t bytesReceived; /** Bytes pushed into the stream */
+    uint32_t bytesConsumed; /** Bytes released back to the TCP window */
+    uint32_t pbufsReceived; /** pbuf chains pushed into the stream */
+} PbufStreamStats_t;
+
+/**
+ * A zero copy reader over the pbuf chains handed over by the tcp recv callback.
+ * The pbufs are held until the consumer releases the data, the TCP window is only opened
+ * again by the amount released so the sender is throttled to the consumer's speed.
+ */
+typedef struct
+{
+    struct tcp_pcb *pcb;
+    struct pbuf *head; /** Chain of received pbufs, NULL if empty */
+    uint16_t offset;   /** Bytes of head already consumed */
+    uint32_t pending;  /** Bytes received but not consumed */
+    PbufStreamConsumeFn_t consume;
+    void *arg;
+    PbufStreamStats_t stats;
+} PbufStream_t;
+
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+/** Functions ************************************************************************************/
+
+/**
+ * @brief Initialise a stream reader
+ * @param stream The stream
+ * @param pcb The TCP pcb to acknowledge consumed data on, may be NULL
+ * @param consume The consumer, may be NULL if only pbuf_stream_peek() is used
+ * @param arg Argument passed to the consumer
+ */
+void pbuf_stream_init(PbufStream_t *stream, struct tcp_pcb *pcb, PbufStreamConsumeFn_t consume, void *arg);
+
+/**
+ * @brief Append a received pbuf chain to the stream
+ * @param stream The stream
+ * @param p The pbuf chain, the stream takes over the reference
+ */
+void pbuf_stream_push(PbufStream_t *stream, struct pbuf *p);
+
+/**
+ * @brief Hand the buffered data to the consumer until it is empty or the consumer stops
+ * @param stream The stream
+ * @return uint32_t Number of bytes consumed
+ */
+uint32_t pbuf_stream_process(PbufStream_t *stream);
+
+/**
+ * @brief Get the next contiguous span without consuming it
+ * @param stream The stream
+ * @param data Set to point at the span, valid until the next release, push or reset
+ * @return uint16_t Length of the span, 0 if the stream is empty
+ */
+uint16_t pbuf_stream_peek(PbufStream_t *stream, const uint8_t **data);
+
+/**
+ * @brief Release consumed bytes, freeing the pbufs and opening the TCP window
+ * @param stream The stream
+ * @param len Number of bytes to release, clamped to the bytes pending
+ */
+void pbuf_stream_release(PbufStream_t *stream, uint32_t len);
+
+/**
+ * @brief Free all buffered pbufs and detach the stream from its pcb
+ * @param stream The stream
+ * @note Does not acknowledge the data, use when the connection is closed.
+ */
+void pbuf_stream_reset(PbufStream_t *stream);
+
+#endif /* _PBUF_STREAM_H_ */
@@ -0,0 +1,45 @@
+#ifndef _POOL_STATS_H_
+#define _POOL_STATS_H_
+/** Includes *************************************************************************************/
+#include <stdint.h>
+
+/** Defines **************************************************************************************/
+/** Typedefs *************************************************************************************/
+
+/** Usage of one lwIP memory pool since boot */
+typedef struct
+{
+    const char *name; /** Pool name from memp_std.h, POOL_<size> for the mem_malloc() pools of lwippools.h */
+    uint16_t size;    /** Bytes per block */
+    uint16_t avail;   /** Blocks in the pool */
+    uint16_t used;    /** Blocks in use */
+    uint16_t max;     /** High water mark of used */
+    uint32_t err;     /** Allocations that found the pool empty */
+} PoolStats_t;
+
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+/** Functions ************************************************************************************/
+
+/**
+ * @brief Get the number of lwIP memory pools
+ * @return int The number of pools, 0 if lwIP keeps no pool statistics
+ */
+int pool_stats_count(void);
+
+/**
+ * @brief Get the usage of a pool
+ * @param index The pool, below pool_stats_count()
+ * @param stats Filled with the usage
+ * @return int 0 on success, -1 on failure
+ */
+int pool_stats_get(int index, PoolStats_t *stats);
+
+/**
+ * @brief Get the RAM of all the pools and the part of it that was ever in use at the same time per pool
+ * @param totalBytes Filled with the size of all the pools
+ * @param peakBytes Filled with the sum of the high water marks, an upper bound of the peak RAM use
+ */
+void pool_stats_totals(uint32_t *totalBytes, uint32_t *peakBytes);
+
+#endif /* _POOL_STATS_H_ */
@@ -0,0 +1,145 @@
+#ifndef _POWER_H_
+#define _POWER_H_
+/** Includes *************************************************************************************/
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "histogram.h"
+
+/** Defines **************************************************************************************/
+
+/** Duty cycled mode for battery nodes, see the POWER_SAVE option in CMakeLists.txt */
+#ifndef POWER_SAVE
+#define POWER_SAVE 0
+#endif
+
+/**
+ * Deadlines are rounded up to a multiple of the slack so the wake-ups of the tasks land
+ * together, a task runs at most this much late. 0 wakes exactly on every deadline.
+ */
+#ifndef POWER_TIMER_SLACK_MS
+#if POWER_SAVE
+#define POWER_TIMER_SLACK_MS 100
+#else
+#define POWER_TIMER_SLACK_MS 0
+#endif
+#endif
+
+/**
+ * Radio power save, time it stays up after the last frame. Covers the broker round trip and
+ * the delayed ACK of the PUBACK, which lwIP sends on its next TCP timer (TCP_TMR_INTERVAL).
+ */
+#ifndef POWER_RADIO_SLEEP_RET_MS
+#define POWER_RADIO_SLEEP_RET_MS 300
+#endif
+
+/** Longest listen interval in DTIM beacons, what the access point is told it buffers frames for */
+#ifndef POWER_RADIO_MAX_LISTEN_INTERVAL
+#define POWER_RADIO_MAX_LISTEN_INTERVAL 10
+#endif
+
+/** Beacon interval of most access points, 100 TU */
+#define POWER_BEACON_INTERVAL_US 102400u
+
+/** Typedefs *************************************************************************************/
+
+typedef struct
+{
+    uint32_t cycleMs; /** Publish cadence, the awake time is accounted per cycle */
+    uint32_t slackMs; /** See POWER_TIMER_SLACK_MS */
+} PowerConfig_t;
+
+/** Awake time and wake-ups, per cycle and since init */
+typedef struct
+{
+    uint32_t cycles;        /** Complete cycles */
+    uint32_t lastAwakeMs;   /** Awake time of the last complete cycle */
+    uint32_t lastWakeups;   /** Wake-ups in the last complete cycle */
+    uint32_t maxAwakeMs;    /** Longest awake time of a cycle */
+    uint64_t awakeUs;       /** Total awake time */
+    uint64_t elapsedUs;     /** Total time, the duty cycle is awakeUs / elapsedUs */
+    uint32_t wakeups;       /** Total wake-ups */
+    Histogram_t cycleAwakeUs; /** Awake time per cycle */
+} PowerStats_t;
+
+/**
+ * Duty cycle accounting of the main loop and coalescing of its wake-ups.
+ *
+ * Takes the time as an argument and has no hardware dependency, so the scheduling can be run
+ * on the host against a simulated clock.
+ */
+typedef struct
+{
+    PowerConfig_t config;
+    bool awake;
+    uint64_t startUs;       /** Time of power_init() */
+    uint64_t awakeSinceUs;  /** Last wake-up */
+    uint64_t sleepSinceUs;  /** Last power_sleep() */
+    uint64_t cycleStartUs;
+    uint64_t cycleAwakeUs;
+    uint32_t cycleWakeups;
+    PowerStats_t stats;
+} Power_t;
+
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+/** Functions ************************************************************************************/
+
+/**
+ * @brief Initialise the accounting, the loop is awake
+ * @param power The accounting
+ * @param config The cycle and the slack, copied
+ * @param nowUs The current time in microseconds
+ * @return int 0 on success, -1 on failure
+ */
+int power_init(Power_t *power, const PowerConfig_t *config, uint64_t nowUs);
+
+/**
+ * @brief The loop is about to sleep, get the time to sleep until
+ * @param power The accounting
+ * @param nowUs The current time in microseconds
+ * @param deadlineUs The next deadline of the scheduler
+ * @return uint64_t The deadline rounded up to the slack
+ */
+uint64_t power_sleep(Power_t *power, uint64_t nowUs, uint64_t deadlineUs);
+
+/**
+ * @brief The loop is back from its sleep
+ * @param power The accounting
+ * @param nowUs The current time in microseconds
+ * @param slept False if the loop had work pending and did not sleep, it is not counted as a wake-up
+ */
+void power_wake(Power_t *power, uint64_t nowUs, bool slept);
+
+/**
+ * @brief Get a copy of the statistics
+ * @param power The accounting
+ * @param stats Filled with the statistics
+ */
+void power_get_stats(const Power_t *power, PowerStats_t *stats);
+
+/**
+ * @brief MQTT keep alive for a publish cadence
+ *
+ * Every publish restarts the keep alive timer, with at least two cycles to spare no PINGREQ is
+ * sent while publishing and the radio only wakes for the publishes. When nothing is published
+ * the ping still falls on the cycle.
+ *
+ * @param cycleMs The publish cadence
+ * @param minKeepAliveS The shortest keep alive to use
+ * @return uint16_t The keep alive in seconds, a multiple of the cycle when it is a whole number of seconds
+ */
+uint16_t power_keep_alive_s(uint32_t cycleMs, uint16_t minKeepAliveS);
+
+/**
+ * @brief Number of DTIM beacons the radio sleeps through for a publish cadence
+ *
+ * Frames from the broker wait at the access point until the next listen, so the interval is
+ * the cycle up to POWER_RADIO_MAX_LISTEN_INTERVAL beacons.
+ *
+ * @param cycleMs The publish cadence
+ * @return uint8_t The listen interval, 1 to POWER_RADIO_MAX_LISTEN_INTERVAL
+ */
+uint8_t power_listen_interval(uint32_t cycleMs);
+
+#endif /* _POWER_H_ */
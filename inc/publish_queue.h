@@ -0,0 +1,137 @@
+#ifndef _PUBLISH_QUEUE_H_
+#define _PUBLISH_QUEUE_H_
+/** Includes *************************************************************************************/
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "mqtt_topic.h"
+
+/** Defines **************************************************************************************/
+
+/**
+ * Size of the batch buffer of each topic. A batch is published as a single message so this
+ * must fit in MQTT_OUTPUT_RINGBUF_SIZE together with the topic and the MQTT header.
+ */
+#ifndef PUBLISH_QUEUE_BATCH_SIZE
+#define PUBLISH_QUEUE_BATCH_SIZE 512
+#endif
+
+/** Typedefs *************************************************************************************/
+
+/**
+ * @brief Called when a batch is ready to be published
+ * @param arg The argument passed to publish_queue_init()
+ * @param topic The topic the batch belongs to
+ * @param payload The payload, a single sample or a JSON array of samples
+ * @param len The length of the payload
+ * @return int 0 on success, -1 on failure
+ */
+typedef int (*PublishQueueFlushFn_t)(void *arg, MqttTopic_t topic, const char *payload, uint16_t len);
+
+/** Batching limits */
+typedef struct
+{
+    uint16_t maxBytes; /** Flush once the batch payload reaches this size, 0 disables batching */
+    uint32_t maxAgeMs; /** Flush once the oldest sample in the batch is this old */
+} PublishQueueConfig_t;
+
+/** Publish queue counters */
+typedef struct
+{
+    uint32_t samples;      /** Samples added to the queue */
+    uint32_t flushes;      /** Batches handed to the flush function */
+    uint32_t flushErrors;  /** Batches the flush function failed to send */
+    uint32_t payloadBytes; /** Payload bytes handed to the flush function */
+    uint32_t dropped;      /** Samples refused, larger than a batch or behind a batch that could not be sent */
+} PublishQueueStats_t;
+
+/** A batch of samples for a single topic */
+typedef struct
+{
+    char payload[PUBLISH_QUEUE_BATCH_SIZE];
+    uint16_t len;
+    uint16_t count;
+    uint32_t firstSampleMs;
+    MqttPayloadFormat_t format; /** Encoding of the samples, decides how they are framed */
+    bool whole;                 /** An unbatched sample the flush function failed to send, kept as it is */
+} PublishBatch_t;
+
+/** The publish queue, one batch per topic */
+typedef struct
+{
+    PublishBatch_t batches[MQTT_TOPIC_MAX];
+    PublishQueueConfig_t config;
+    PublishQueueFlushFn_t flush;
+    void *flushArg;
+    PublishQueueStats_t stats;
+} PublishQueue_t;
+
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+/** Functions ************************************************************************************/
+
+/**
+ * @brief Initialise the publish queue
+ * @param queue The queue to initialise
+ * @param config The batching limits, maxBytes is clamped to PUBLISH_QUEUE_BATCH_SIZE
+ * @param flush Function called to publish a batch
+ * @param arg Argument passed to the flush function
+ * @return int 0 on success, -1 on failure
+ */
+int publish_queue_init(PublishQueue_t *queue, const PublishQueueConfig_t *config, PublishQueueFlushFn_t flush, void *arg);
+
+/**
+ * @brief Add a sample to the batch of a topic
+ *
+ * The sample is a complete JSON or CBOR value, matching the format of the topic. With batching
+ * disabled it is flushed straight away, otherwise it is appended to the array of the topic and
+ * the batch is flushed once it reaches config.maxBytes. CBOR payloads start with the
+ * self-describe tag so they can be told apart from JSON.
+ *
+ * A batch, or an unbatched sample, the flush function fails to send is kept and sent again by
+ * the next publish_queue_poll(), publish_queue_flush() or publish_queue_add(). A sample that
+ * does not fit behind it is refused.
+ *
+ * @param queue The queue
+ * @param topic The topic to publish the sample to
+ * @param sample The sample
+ * @param len The length of the sample
+ * @param nowMs The current time in milliseconds
+ * @return int 0 if the sample was sent or queued, -1 if it was refused
+ */
+int publish_queue_add(PublishQueue_t *queue, MqttTopic_t topic, const char *sample, uint16_t len, uint32_t nowMs);
+
+/**
+ * @brief Change the payload format of a topic, the samples already batched are flushed first
+ * @param queue The queue
+ * @param topic The topic
+ * @param format The new format
+ * @return int 0 on success, -1 on failure, the batch is dropped if it could not be flushed
+ */
+int publish_queue_set_format(PublishQueue_t *queue, MqttTopic_t topic, MqttPayloadFormat_t format);
+
+/**
+ * @brief Get the payload format of a topic
+ * @param queue The queue
+ * @param topic The topic
+ * @return MqttPayloadFormat_t The format, JSON for an invalid topic
+ */
+MqttPayloadFormat_t publish_queue_get_format(const PublishQueue_t *queue, MqttTopic_t topic);
+
+/**
+ * @brief Flush every batch whose oldest sample has reached config.maxAgeMs, and the unbatched samples kept after a failure
+ * @param queue The queue
+ * @param nowMs The current time in milliseconds
+ * @return uint32_t Milliseconds until the next batch expires, UINT32_MAX if the queue is empty
+ */
+uint32_t publish_queue_poll(PublishQueue_t *queue, uint32_t nowMs);
+
+/**
+ * @brief Flush the batch of a topic regardless of its age or size
+ * @param queue The queue
+ * @param topic The topic to flush
+ * @return int 0 on success or if the batch was empty, -1 on failure
+ */
+int publish_queue_flush(PublishQueue_t *queue, MqttTopic_t topic);
+
+#endif /* _PUBLISH_QUEUE_H_ */
@@ -0,0 +1,113 @@
+#ifndef _REPORT_POLICY_H_
+#define _REPORT_POLICY_H_
+/** Includes *************************************************************************************/
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "mqtt_topic.h"
+
+/** Defines **************************************************************************************/
+/** Typedefs *************************************************************************************/
+
+/** When a topic reports, in the fixed point units of its values, e.g. centi-degrees */
+typedef struct
+{
+    int32_t absDeadband;          /** A value within this of the last report is suppressed, 0 only suppresses repeats, -1 none */
+    uint16_t relDeadbandPermille; /** Same relative to the last report, the larger of the two bands applies */
+    uint32_t maxSilenceMs;        /** Longest time without a report, the value goes out anyway, 0 for none */
+    bool delta;                   /** Report the change since the last report, heartbeats carry the full value */
+} ReportPolicyConfig_t;
+
+/** Why a value is reported */
+typedef enum
+{
+    REPORT_SUPPRESS,  /** Within the deadband */
+    REPORT_FIRST,     /** Nothing was reported yet */
+    REPORT_CHANGE,    /** Moved past the deadband */
+    REPORT_HEARTBEAT, /** maxSilenceMs expired */
+} ReportReason_t;
+
+/** A value to report */
+typedef struct
+{
+    ReportReason_t reason;
+    bool delta;    /** value is the change since the last report, a change past 32 bits goes out as the full value */
+    int32_t value; /** The value or its change */
+} ReportPolicyReport_t;
+
+typedef struct
+{
+    uint32_t sent;       /** Reports, all reasons */
+    uint32_t suppressed; /** Values within the deadband */
+    uint32_t heartbeats; /** Reports sent because of maxSilenceMs */
+    uint32_t deltas;     /** Reports sent as a change */
+} ReportPolicyStats_t;
+
+/**
+ * Reporting policy of one topic: a value is published when it moves past the deadband around
+ * the last reported value, or when the topic was silent for too long.
+ *
+ * The caller checks a value, publishes the report and only then calls report_policy_sent(), so a
+ * report that could not be queued is retried with the next value and the deltas stay consistent.
+ */
+typedef struct
+{
+    ReportPolicyConfig_t config;
+    bool reported;     /** lastValue and lastMs are valid */
+    int32_t lastValue; /** Last reported value */
+    uint32_t lastMs;   /** Time of the last report */
+    ReportPolicyStats_t stats;
+} ReportPolicy_t;
+
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+/** Functions ************************************************************************************/
+
+/**
+ * @brief Initialise the policy, the first value is always reported
+ * @param policy The policy
+ * @param config The deadbands and the heartbeat, copied
+ * @return int 0 on success, -1 on failure
+ */
+int report_policy_init(ReportPolicy_t *policy, const ReportPolicyConfig_t *config);
+
+/**
+ * @brief Decide whether a value is reported, counts it as suppressed if not
+ * @param policy The policy
+ * @param value The new value
+ * @param nowMs Time of the value in milliseconds
+ * @param report Filled with what to publish when the value is reported
+ * @return bool True if the value is to be reported
+ */
+bool report_policy_check(ReportPolicy_t *policy, int32_t value, uint32_t nowMs, ReportPolicyReport_t *report);
+
+/**
+ * @brief The deadband around the last reported value, the larger of the absolute and relative bands
+ * @param policy The policy
+ * @return int64_t A change up to this much is suppressed, -1 if every value is reported
+ */
+int64_t report_policy_band(const ReportPolicy_t *policy);
+
+/**
+ * @brief The report from report_policy_check() was published, it is the new reference
+ * @param policy The policy
+ * @param report The report
+ * @param value The value the report was made for
+ * @param nowMs Time of the value in milliseconds
+ */
+void report_policy_sent(ReportPolicy_t *policy, const ReportPolicyReport_t *report, int32_t value, uint32_t nowMs);
+
+/**
+ * @brief Encode a report as a sample, {"t": 23.45} or {"d": -0.05} for a delta with the key "t"
+ * @param report The report
+ * @param format JSON or CBOR, a CBOR sample has no self-describe tag, the publish queue adds it
+ * @param key Key of the full value, a delta is always "d"
+ * @param decimals Fraction digits of the fixed point value
+ * @param buffer Buffer for the sample
+ * @param size Size of the buffer
+ * @return int Length of the sample, -1 if it does not fit
+ */
+int report_policy_encode(const ReportPolicyReport_t *report, MqttPayloadFormat_t format, const char *key, uint8_t decimals,
+                         uint8_t *buffer, uint16_t size);
+
+#endif /* _REPORT_POLICY_H_ */
@@ -0,0 +1,93 @@
+#ifndef _RING_BUFFER_H_
+#define _RING_BUFFER_H_
+/** Includes *************************************************************************************/
+#include <stdbool.h>
+#include <stdint.h>
+
+/** Defines **************************************************************************************/
+/** Typedefs *************************************************************************************/
+
+/**
+ * Lock free single producer, single consumer byte ring.
+ *
+ * The head is only written by the producer and the tail only by the consumer, so one side may
+ * run in an interrupt, a callback or on the other core without locking. Both indices run
+ * freely and are masked on access, the size must be a power of two.
+ */
+typedef struct
+{
+    uint8_t *buffer;
+    uint32_t size;
+    uint32_t mask;
+    volatile uint32_t head; /** Total bytes written, producer owned */
+    volatile uint32_t tail; /** Total bytes read, consumer owned */
+} RingBuffer_t;
+
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+/** Functions ************************************************************************************/
+
+/**
+ * @brief Initialise a ring over caller provided storage
+ * @param ring The ring
+ * @param storage The storage, must stay valid for the lifetime of the ring
+ * @param size Size of the storage, must be a power of two
+ * @return int 0 on success, -1 on failure
+ */
+int ring_buffer_init(RingBuffer_t *ring, uint8_t *storage, uint32_t size);
+
+/**
+ * @brief Empty the ring
+ * @param ring The ring
+ * @warning Only safe when neither the producer nor the consumer is running.
+ */
+void ring_buffer_reset(RingBuffer_t *ring);
+
+/**
+ * @brief Number of bytes available to read, consumer side
+ * @param ring The ring
+ * @return uint32_t Bytes available
+ */
+uint32_t ring_buffer_used(const RingBuffer_t *ring);
+
+/**
+ * @brief Number of bytes that can be written, producer side
+ * @param ring The ring
+ * @return uint32_t Bytes free
+ */
+uint32_t ring_buffer_free(const RingBuffer_t *ring);
+
+/**
+ * @brief Copy data into the ring, producer side
+ * @param ring The ring
+ * @param data The data
+ * @param len Length of the data
+ * @return uint32_t Bytes written, less than len if the ring is full
+ */
+uint32_t ring_buffer_write(RingBuffer_t *ring, const uint8_t *data, uint32_t len);
+
+/**
+ * @brief Copy data out of the ring, consumer side
+ * @param ring The ring
+ * @param data Destination buffer
+ * @param len Size of the destination buffer
+ * @return uint32_t Bytes read
+ */
+uint32_t ring_buffer_read(RingBuffer_t *ring, uint8_t *data, uint32_t len);
+
+/**
+ * @brief Get the next contiguous readable span without consuming it, consumer side
+ * @param ring The ring
+ * @param data Set to point at the span
+ * @return uint32_t Length of the span, 0 if the ring is empty
+ */
+uint32_t ring_buffer_peek(const RingBuffer_t *ring, const uint8_t **data);
+
+/**
+ * @brief Consume bytes previously returned by ring_buffer_peek(), consumer side
+ * @param ring The ring
+ * @param len Bytes to consume, clamped to the bytes available
+ */
+void ring_buffer_consume(RingBuffer_t *ring, uint32_t len);
+
+#endif /* _RING_BUFFER_H_ */
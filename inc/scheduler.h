@@ -0,0 +1,113 @@
+#ifndef _SCHEDULER_H_
+#define _SCHEDULER_H_
+/** Includes *************************************************************************************/
+#include <stdbool.h>
+#include <stdint.h>
+
+/** Defines **************************************************************************************/
+/** Task table size, up to 65535. Each MQTT client instance takes one task */
+#ifndef SCHEDULER_MAX_TASKS
+#define SCHEDULER_MAX_TASKS 8
+#endif
+
+/** Longest time the loop will sleep when no task has a deadline */
+#ifndef SCHEDULER_MAX_IDLE_MS
+#define SCHEDULER_MAX_IDLE_MS 1000
+#endif
+
+#define SCHEDULER_INVALID_TASK (-1)
+
+/** Typedefs *************************************************************************************/
+
+/** A cooperative task. Returns 0 on success, -1 on failure */
+typedef int (*SchedulerTaskFn_t)(void *arg);
+
+/** Scheduler statistics */
+typedef struct
+{
+    uint32_t dispatchCount;      /** Number of task dispatches */
+    uint32_t wakeCount;          /** Number of dispatches caused by scheduler_wake() */
+    uint32_t sleepCount;         /** Number of times the loop went to sleep */
+    uint64_t wakeLatencyLastUs;  /** Wake to dispatch latency of the last woken task */
+    uint64_t wakeLatencyMaxUs;   /** Worst wake to dispatch latency seen */
+    uint64_t wakeLatencyTotalUs; /** Sum of all wake to dispatch latencies, divide by wakeCount */
+} SchedulerStats_t;
+
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+/** Functions ************************************************************************************/
+
+/**
+ * @brief Initialise the scheduler
+ *
+ * Clears the task table and hooks the scheduler into the cyw43 async context so that
+ * scheduler_wake() can break the loop out of scheduler_wait_until().
+ *
+ * @return int 0 on success, -1 on failure
+ * @warning Must be called after cyw43_arch_init()
+ */
+int scheduler_init(void);
+
+/**
+ * @brief Register a task with the scheduler
+ *
+ * The task is run for the first time on the next call to scheduler_run() and then every
+ * periodMs milliseconds, unless it reschedules itself with scheduler_delay().
+ *
+ * @param fn The task function
+ * @param arg Argument passed to the task function
+ * @param periodMs The default period of the task in milliseconds
+ * @return int The task id on success, SCHEDULER_INVALID_TASK on failure
+ */
+int scheduler_add_task(SchedulerTaskFn_t fn, void *arg, uint32_t periodMs);
+
+/**
+ * @brief Request that a task is run as soon as possible
+ *
+ * Safe to call from lwIP/cyw43 callbacks, interrupt handlers and the other core.
+ *
+ * @param taskId The id returned by scheduler_add_task()
+ * @return int 0 on success, -1 on failure
+ */
+int scheduler_wake(int taskId);
+
+/**
+ * @brief Set the next deadline of a task relative to now
+ *
+ * When called by a task on itself this replaces the default period for the next run only.
+ *
+ * @param taskId The id returned by scheduler_add_task()
+ * @param delayMs Time from now until the task should run
+ * @return int 0 on success, -1 on failure
+ */
+int scheduler_delay(int taskId, uint32_t delayMs);
+
+/**
+ * @brief Get the id of the task that is currently being dispatched
+ * @return int The task id, SCHEDULER_INVALID_TASK if called outside of a task
+ */
+int scheduler_current_task(void);
+
+/**
+ * @brief Dispatch all tasks that have been woken or whose deadline has passed
+ * @return uint64_t The absolute time in microseconds since boot of the next deadline
+ */
+uint64_t scheduler_run(void);
+
+/**
+ * @brief Sleep until the given deadline or until an event needs servicing
+ *
+ * Returns early when a task is woken, or when the cyw43 driver or lwIP timers have work.
+ *
+ * @param deadlineUs Absolute time in microseconds since boot, normally from scheduler_run()
+ * @return bool True if the loop slept, false if there was work pending or the deadline had passed
+ */
+bool scheduler_wait_until(uint64_t deadlineUs);
+
+/**
+ * @brief Get a copy of the scheduler statistics
+ * @param stats Pointer to the structure to fill in
+ */
+void scheduler_get_stats(SchedulerStats_t *stats);
+
+#endif /* _SCHEDULER_H_ */
@@ -0,0 +1,99 @@
+#ifndef _SUBSCRIPTION_MANAGER_H_
+#define _SUBSCRIPTION_MANAGER_H_
+/** Includes *************************************************************************************/
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "lwip/apps/mqtt.h"
+
+#include "topic_router.h"
+
+/** Defines **************************************************************************************/
+
+/** SUBSCRIBE requests kept in flight at once, lwIP can't track more than MQTT_REQ_MAX_IN_FLIGHT */
+#ifndef SUBSCRIPTION_MAX_IN_FLIGHT
+#define SUBSCRIPTION_MAX_IN_FLIGHT MQTT_REQ_MAX_IN_FLIGHT
+#endif
+
+/** Retry backoff after a failed SUBSCRIBE, doubled on every failure up to the maximum */
+#ifndef SUBSCRIPTION_RETRY_BASE_MS
+#define SUBSCRIPTION_RETRY_BASE_MS 500
+#endif
+#ifndef SUBSCRIPTION_RETRY_MAX_MS
+#define SUBSCRIPTION_RETRY_MAX_MS 30000
+#endif
+
+/** Typedefs *************************************************************************************/
+
+/** State of a single filter */
+typedef enum
+{
+    SUBSCRIPTION_PENDING,   /** Not sent yet */
+    SUBSCRIPTION_IN_FLIGHT, /** Sent, waiting for the SUBACK */
+    SUBSCRIPTION_DONE,      /** SUBACK received */
+    SUBSCRIPTION_RETRY,     /** Failed, waiting for the backoff to expire */
+} SubscriptionState_t;
+
+typedef struct SubscriptionManager_s SubscriptionManager_t;
+
+/** Tracking of a single filter, passed to lwIP as the request callback argument */
+typedef struct
+{
+    SubscriptionManager_t *manager;
+    SubscriptionState_t state;
+    uint8_t failures;
+    uint32_t retryAtMs;
+} SubscriptionEntry_t;
+
+/** Subscription counters */
+typedef struct
+{
+    uint32_t requests; /** SUBSCRIBE requests sent */
+    uint32_t acks;     /** Successful SUBACKs */
+    uint32_t failures; /** Rejected or timed out requests */
+} SubscriptionStats_t;
+
+/** The subscription manager */
+struct SubscriptionManager_s
+{
+    mqtt_client_t *mqttClient;
+    const TopicRouter_t *router; /** The filters to subscribe to, one entry per route */
+    SubscriptionEntry_t entries[TOPIC_ROUTER_MAX_ROUTES];
+    uint8_t inFlight;
+    uint8_t done;
+    int taskId;        /** Scheduler task woken when a SUBACK arrives */
+    uint32_t nowMs;    /** Time of the last poll, used to time retries from the callbacks */
+    uint32_t startMs;  /** Time the subscriptions were started */
+    SubscriptionStats_t stats;
+};
+
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+/** Functions ************************************************************************************/
+
+/**
+ * @brief Start subscribing to every filter of a router on a new connection
+ * @param manager The manager
+ * @param mqttClient The connected lwIP mqtt client
+ * @param router The filters to subscribe to
+ * @param taskId Scheduler task to wake on every SUBACK so the next request goes out
+ * @param nowMs The current time in milliseconds
+ */
+void subscription_manager_start(SubscriptionManager_t *manager, mqtt_client_t *mqttClient, const TopicRouter_t *router, int taskId, uint32_t nowMs);
+
+/**
+ * @brief Send the pending and retried requests, keeping up to SUBSCRIPTION_MAX_IN_FLIGHT in flight
+ * @param manager The manager
+ * @param nowMs The current time in milliseconds
+ * @return uint32_t Milliseconds until the next retry, UINT32_MAX if nothing is waiting on a retry
+ */
+uint32_t subscription_manager_poll(SubscriptionManager_t *manager, uint32_t nowMs);
+
+/**
+ * @brief Check if every filter has been acknowledged
+ * @param manager The manager
+ * @return bool True when all subscriptions are done
+ */
+bool subscription_manager_done(const SubscriptionManager_t *manager);
+
+#endif /* _SUBSCRIPTION_MANAGER_H_ */
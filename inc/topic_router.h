@@ -0,0 +1,120 @@
+#ifndef _TOPIC_ROUTER_H_
+#define _TOPIC_ROUTER_H_
+/** Includes *************************************************************************************/
+#include <stdbool.h>
+#include <stdint.h>
+
+/** Defines **************************************************************************************/
+#ifndef TOPIC_ROUTER_MAX_ROUTES
+#define TOPIC_ROUTER_MAX_ROUTES 32
+#endif
+
+/** One node per distinct topic level, the root takes one */
+#ifndef TOPIC_ROUTER_MAX_NODES
+#define TOPIC_ROUTER_MAX_NODES 128
+#endif
+
+#ifndef TOPIC_ROUTER_FILTER_LEN
+#define TOPIC_ROUTER_FILTER_LEN 100
+#endif
+
+#define TOPIC_ROUTER_NO_ROUTE (-1)
+
+/** The nodes, routes and filter offsets are indexed with 8 bits, see TopicRouterNode_t */
+_Static_assert(TOPIC_ROUTER_MAX_NODES <= UINT8_MAX, "node indices and the node count are uint8_t");
+_Static_assert(TOPIC_ROUTER_MAX_ROUTES <= INT8_MAX, "route ids are int8_t and the route count uint8_t");
+_Static_assert(TOPIC_ROUTER_FILTER_LEN <= UINT8_MAX + 1, "level offsets and lengths in a filter are uint8_t");
+
+/** Typedefs *************************************************************************************/
+
+/** A registered topic filter */
+typedef struct
+{
+    char filter[TOPIC_ROUTER_FILTER_LEN];
+    uint8_t qos;
+} TopicRoute_t;
+
+/**
+ * A node of the filter trie, one per topic level.
+ * The level text is not copied, it points into the filter of the route that created the node.
+ * The children with a literal level are a run of TopicRouter_t.children sorted by hash, a
+ * level is found with a binary search.
+ */
+typedef struct
+{
+    uint16_t hash;        /** Hash of the level, compared before the text */
+    uint8_t levelRoute;   /** Route whose filter holds the level text */
+    uint8_t levelOffset;  /** Offset of the level text in that filter */
+    uint8_t levelLen;     /** Length of the level text */
+    uint8_t childStart;   /** First of the literal children in TopicRouter_t.children */
+    uint8_t childCount;   /** Number of literal children */
+    uint8_t plusChild;    /** Child for a '+' level, 0 if none */
+    int8_t route;         /** Route of the filter ending at this node */
+    int8_t hashRoute;     /** Route of the filter ending in '#' right below this node */
+} TopicRouterNode_t;
+
+/** The topic router */
+typedef struct
+{
+    TopicRoute_t routes[TOPIC_ROUTER_MAX_ROUTES];
+    uint8_t routeCount;
+    TopicRouterNode_t nodes[TOPIC_ROUTER_MAX_NODES]; /** nodes[0] is the root */
+    uint8_t nodeCount;
+    uint8_t children[TOPIC_ROUTER_MAX_NODES]; /** Literal children of all nodes, each node's run sorted by hash */
+    uint8_t childTotal;
+} TopicRouter_t;
+
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+/** Functions ************************************************************************************/
+
+/**
+ * @brief Initialise an empty router
+ * @param router The router
+ */
+void topic_router_init(TopicRouter_t *router);
+
+/**
+ * @brief Add a topic filter
+ *
+ * The filter may be an exact topic or use the MQTT '+' (one level) and '#' (all remaining
+ * levels, must be last) wildcards.
+ *
+ * @param router The router
+ * @param filter The filter
+ * @param qos The QoS to subscribe to the filter with
+ * @return int The route id on success, TOPIC_ROUTER_NO_ROUTE if the filter is invalid,
+ *         already registered or the router is full
+ */
+int topic_router_add(TopicRouter_t *router, const char *filter, uint8_t qos);
+
+/**
+ * @brief Find the route of a topic
+ *
+ * The cost depends on the number of levels in the topic, each level is a binary search among
+ * the children of a node, not on the number of filters.
+ * When several filters match, literal levels win over '+' which wins over '#'.
+ * Topics starting with '$' are not matched by a wildcard in the first level.
+ *
+ * @param router The router
+ * @param topic The topic of an incoming message
+ * @return int The route id, TOPIC_ROUTER_NO_ROUTE if no filter matches
+ */
+int topic_router_match(const TopicRouter_t *router, const char *topic);
+
+/**
+ * @brief Get the number of routes, the route ids run from 0 to this value - 1
+ * @param router The router
+ * @return int The number of routes
+ */
+int topic_router_count(const TopicRouter_t *router);
+
+/**
+ * @brief Get a route, used to build the subscription list
+ * @param router The router
+ * @param route The route id
+ * @return const TopicRoute_t* The route, NULL if the id is invalid
+ */
+const TopicRoute_t *topic_router_get(const TopicRouter_t *router, int route);
+
+#endif /* _TOPIC_ROUTER_H_ */
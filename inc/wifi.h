@@ -4,6 +4,34 @@
 #include "pico/stdlib.h"
 #include "pico/cyw43_arch.h"
 /** Defines **************************************************************************************/
+#define WIFI_TASK_INTERVAL_MS 100
+
+/** Time allowed to rejoin the cached access point before falling back to a full scan */
+#ifndef WIFI_FAST_CONNECT_TIMEOUT_MS
+#define WIFI_FAST_CONNECT_TIMEOUT_MS 1500
+#endif
+
+/** Keep the last good link in the settings flash so the first connect after a reset skips the scan too */
+#ifndef WIFI_CACHE_IN_FLASH
+#define WIFI_CACHE_IN_FLASH 1
+#endif
+
+/**
+ * Take the cached address statically when DHCP has not answered this long after the join.
+ * The lease may have been given away since, so it is off by default.
+ */
+#ifndef WIFI_DHCP_FALLBACK_MS
+#define WIFI_DHCP_FALLBACK_MS 0
+#endif
+
+/** Random delay before a connect after a failure or a drop, see backoff.h */
+#ifndef WIFI_BACKOFF_BASE_MS
+#define WIFI_BACKOFF_BASE_MS 250
+#endif
+#ifndef WIFI_BACKOFF_CAP_MS
+#define WIFI_BACKOFF_CAP_MS 30000
+#endif
+
 typedef enum
 {
     WIFI_TASK_DISCONNECTED = 0,
@@ -12,6 +40,19 @@ typedef enum
 } WifiTaskState_t;
 
 /** Typedefs *************************************************************************************/
+
+/** Connection counters and timings, the times run from the first connect request after a drop */
+typedef struct
+{
+    uint32_t connects;        /** Successful connects */
+    uint32_t fastConnects;    /** Of which rejoined the cached access point without a scan */
+    uint32_t fastFailures;    /** Rejoins that failed and fell back to a full scan */
+    uint32_t staticFallbacks; /** Connects that took the cached address because DHCP did not answer */
+    uint32_t linkUpMs;        /** Time to join the access point, last connect */
+    uint32_t ipMs;            /** Time to a usable address, last connect */
+    uint32_t backoffMs;       /** Delay before the last reconnect */
+} WifiStats_t;
+
 /** Variables ************************************************************************************/
 /** Prototypes ***********************************************************************************/
 /** Functions ************************************************************************************/
@@ -29,13 +70,31 @@ int wifi_init(const char *ssid, const char *password);
  * @brief The wifi task is used to handle the wifi connection.
  *
  * The wifi task is used to handle the wifi connection. Connecting and reconnecting
- * as needed. It should be called in a loop to ensure that the wifi connection is maintained.
+ * as needed. It should be registered with the scheduler with a period of WIFI_TASK_INTERVAL_MS
+ * to ensure that the wifi connection is maintained.
+ *
+ * The BSSID, channel and address of the last good link are cached. After a drop the station
+ * stays up so lwIP keeps the DHCP lease and confirms it with an INIT-REBOOT, and the join goes
+ * straight to the cached access point. A full scan is only done when that fails.
+ *
+ * Failed connects and drops wait a random, growing delay before the next connect so a fleet
+ * that lost its access point at once does not come back in lockstep.
  *
  * @return int 0 on success, -1 on failure
  *
  */
 int wifi_task(void);
 
+/**
+ * @brief Set the power management of the radio, from cyw43_pm_value() or one of the CYW43_*_PM presets
+ *
+ * Applied straight away when connected and again on every connect, the join resets it.
+ *
+ * @param pm The cyw43 power management value, the radio keeps CYW43_DEFAULT_PM until set
+ * @return int 0 on success, -1 if the radio refused it
+ */
+int wifi_set_power_management(uint32_t pm);
+
 /**
  * @brief Get the WiFi task state
  * 
@@ -46,4 +105,10 @@ int wifi_task(void);
  */
 WifiTaskState_t wifi_get_state(void);
 
+/**
+ * @brief Get a copy of the connection counters and timings
+ * @param stats Pointer to the structure to fill in
+ */
+void wifi_get_stats(WifiStats_t *stats);
+
 #endif /* _WIFI_H_ */
\ No newline at end of file
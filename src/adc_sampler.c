@@ -0,0 +1,155 @@
+/** Includes *************************************************************************************/
+#include "adc_sampler.h"
+#include "scheduler.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "pico/stdlib.h"
+#include "hardware/adc.h"
+#include "hardware/clocks.h"
+#include "hardware/dma.h"
+
+/** Defines **************************************************************************************/
+#define ADC_SAMPLER_RING_MASK (ADC_SAMPLER_RING_SAMPLES - 1)
+
+/** Time the DMA takes to go once round the raw ring */
+#define ADC_SAMPLER_RING_US ((uint64_t)ADC_SAMPLER_RING_SAMPLES * 1000000u / ADC_SAMPLER_RAW_RATE_HZ)
+
+/** Typedefs *************************************************************************************/
+/** Variables ************************************************************************************/
+/** Raw samples, aligned to its size so the DMA write address can wrap around it */
+static uint16_t AdcSamplerRing[ADC_SAMPLER_RING_SAMPLES] __attribute__((aligned(1u << ADC_SAMPLER_RING_BITS)));
+
+/** Written into the data channel by the control channel to start the next lap */
+static uint32_t AdcSamplerLapCount = ADC_SAMPLER_RING_SAMPLES;
+
+/** Prototypes ***********************************************************************************/
+/** Functions ************************************************************************************/
+
+int adc_sampler_init(AdcSampler_t *sampler, const AdcSamplerConfig_t *config)
+{
+    if (sampler == NULL || config == NULL || config->outputPeriodMs == 0)
+    {
+        return -1;
+    }
+
+    memset(sampler, 0, sizeof(AdcSampler_t));
+    sampler->config = *config;
+
+    uint64_t factor = (uint64_t)ADC_SAMPLER_RAW_RATE_HZ * config->outputPeriodMs / 1000u;
+    if (factor == 0 || factor > DECIMATOR_MAX_FACTOR || decimator_init(&sampler->decimator, (uint32_t)factor, config->extraBits) != 0)
+    {
+        printf("ADC output period %lu ms can't be decimated from %d Hz\n", (unsigned long)config->outputPeriodMs, ADC_SAMPLER_RAW_RATE_HZ);
+        return -1;
+    }
+
+    if (ring_buffer_init(&sampler->queue, sampler->queueStorage, sizeof(sampler->queueStorage)) != 0)
+    {
+        return -1;
+    }
+
+    /** Free-running conversions, every result goes to the FIFO and raises a DMA request */
+    adc_init();
+    if (config->input == ADC_SAMPLER_TEMP_INPUT)
+    {
+        adc_set_temp_sensor_enabled(true);
+    }
+    adc_select_input(config->input);
+    adc_fifo_setup(true, true, 1, false, false);
+    adc_set_clkdiv((float)clock_get_hz(clk_adc) / ADC_SAMPLER_RAW_RATE_HZ - 1.0f);
+
+    sampler->dataChannel = dma_claim_unused_channel(false);
+    sampler->ctrlChannel = dma_claim_unused_channel(false);
+    if (sampler->dataChannel < 0 || sampler->ctrlChannel < 0)
+    {
+        printf("No free DMA channel for the ADC\n");
+        return -1;
+    }
+
+    /** Data channel, one lap of the ring then hand over to the control channel */
+    dma_channel_config dataConfig = dma_channel_get_default_config(sampler->dataChannel);
+    channel_config_set_transfer_data_size(&dataConfig, DMA_SIZE_16);
+    channel_config_set_read_increment(&dataConfig, false);
+    channel_config_set_write_increment(&dataConfig, true);
+    channel_config_set_ring(&dataConfig, true, ADC_SAMPLER_RING_BITS);
+    channel_config_set_dreq(&dataConfig, DREQ_ADC);
+    channel_config_set_chain_to(&dataConfig, sampler->ctrlChannel);
+    dma_channel_configure(sampler->dataChannel, &dataConfig, AdcSamplerRing, &adc_hw->fifo, ADC_SAMPLER_RING_SAMPLES, false);
+
+    /** Control channel, reloads the transfer count which re-triggers the data channel where it left off */
+    dma_channel_config ctrlConfig = dma_channel_get_default_config(sampler->ctrlChannel);
+    channel_config_set_transfer_data_size(&ctrlConfig, DMA_SIZE_32);
+    channel_config_set_read_increment(&ctrlConfig, false);
+    channel_config_set_write_increment(&ctrlConfig, false);
+    dma_channel_configure(sampler->ctrlChannel, &ctrlConfig, &dma_hw->ch[sampler->dataChannel].al1_transfer_count_trig, &AdcSamplerLapCount, 1, false);
+
+    /** Start the data channel through the control channel, then the conversions */
+    adc_fifo_drain();
+    dma_channel_start(sampler->ctrlChannel);
+    sampler->lastPollUs = time_us_64();
+    adc_run(true);
+
+    return 0;
+}
+
+int adc_sampler_poll(AdcSampler_t *sampler)
+{
+    if (sampler == NULL)
+    {
+        return -1;
+    }
+
+    uint64_t nowUs = time_us_64();
+    if (nowUs - sampler->lastPollUs > ADC_SAMPLER_RING_US)
+    {
+        sampler->stats.overruns++;
+    }
+    sampler->lastPollUs = nowUs;
+
+    /** Everything up to where the DMA writes next is a finished conversion */
+    uint32_t writeIndex = ((uintptr_t)dma_channel_hw_addr(sampler->dataChannel)->write_addr - (uintptr_t)AdcSamplerRing) / sizeof(uint16_t);
+    writeIndex &= ADC_SAMPLER_RING_MASK;
+
+    bool produced = false;
+    while (sampler->readIndex != writeIndex)
+    {
+        uint16_t raw = AdcSamplerRing[sampler->readIndex] & 0x0FFF;
+        sampler->readIndex = (sampler->readIndex + 1) & ADC_SAMPLER_RING_MASK;
+        sampler->stats.rawSamples++;
+
+        AdcSample_t sample;
+        if (!decimator_push(&sampler->decimator, raw, &sample.value))
+        {
+            continue;
+        }
+        sample.sequence = sampler->sequence++;
+        sampler->stats.outputs++;
+
+        if (ring_buffer_free(&sampler->queue) < sizeof(sample))
+        {
+            sampler->stats.queueFull++;
+            continue;
+        }
+        ring_buffer_write(&sampler->queue, (const uint8_t *)&sample, sizeof(sample));
+        produced = true;
+    }
+
+    if (produced && sampler->config.notifyTaskId != SCHEDULER_INVALID_TASK)
+    {
+        scheduler_wake(sampler->config.notifyTaskId);
+    }
+
+    return 0;
+}
+
+bool adc_sampler_read(AdcSampler_t *sampler, AdcSample_t *sample)
+{
+    if (sampler == NULL || sample == NULL || ring_buffer_used(&sampler->queue) < sizeof(AdcSample_t))
+    {
+        return false;
+    }
+
+    ring_buffer_read(&sampler->queue, (uint8_t *)sample, sizeof(AdcSample_t));
+    return true;
+}
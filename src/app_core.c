@@ -0,0 +1,288 @@
+/** Includes *************************************************************************************/
+#include "app_core.h"
+#include "scheduler.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "pico/stdlib.h"
+#include "pico/flash.h"
+#include "pico/multicore.h"
+#include "hardware/sync.h"
+
+/** Defines **************************************************************************************/
+/** Typedefs *************************************************************************************/
+/** Variables ************************************************************************************/
+/** The core 1 entry point takes no argument */
+static AppCore_t *AppCoreInstance = NULL;
+
+/** Prototypes ***********************************************************************************/
+static void _app_core_main(void);
+static void _app_core_encode(AppCore_t *app);
+static void _app_core_commands(AppCore_t *app);
+static int32_t _app_core_temperature_centi_c(uint32_t value, uint8_t extraBits);
+
+/** Functions ************************************************************************************/
+
+int app_core_init(AppCore_t *app, const AdcSamplerConfig_t *samplerConfig, int netTaskId)
+{
+    if (app == NULL || samplerConfig == NULL)
+    {
+        return -1;
+    }
+
+    memset(app, 0, sizeof(AppCore_t));
+    app->netTaskId = netTaskId;
+    app->formats[MQTT_TOPIC_TEMP] = MQTT_TEMPERATURE_FORMAT;
+
+    /** The other topics have no samples yet, their policy reports every value */
+    const ReportPolicyConfig_t everyValue = {
+        .absDeadband = -1,
+    };
+    const ReportPolicyConfig_t temperature = {
+        .absDeadband = MQTT_TEMPERATURE_DEADBAND,
+        .relDeadbandPermille = MQTT_TEMPERATURE_DEADBAND_PERMILLE,
+        .maxSilenceMs = MQTT_TEMPERATURE_MAX_SILENCE_MS,
+        .delta = MQTT_TEMPERATURE_DELTA,
+    };
+    for (int i = 0; i < MQTT_TOPIC_MAX; i++)
+    {
+        if (report_policy_init(&app->policies[i], i == MQTT_TOPIC_TEMP ? &temperature : &everyValue) != 0)
+        {
+            return -1;
+        }
+    }
+
+    if (msg_queue_init(&app->samples, app->samplesStorage, sizeof(app->samplesStorage)) != 0 ||
+        msg_queue_init(&app->commands, app->commandsStorage, sizeof(app->commandsStorage)) != 0)
+    {
+        return -1;
+    }
+
+    /** Core 1 polls the sampler itself, there is no task to notify */
+    AdcSamplerConfig_t config = *samplerConfig;
+    config.notifyTaskId = SCHEDULER_INVALID_TASK;
+
+    return adc_sampler_init(&app->sampler, &config);
+}
+
+int app_core_launch(AppCore_t *app)
+{
+    if (app == NULL || AppCoreInstance != NULL)
+    {
+        return -1;
+    }
+
+    AppCoreInstance = app;
+    multicore_launch_core1(_app_core_main);
+
+    return 0;
+}
+
+int app_core_read_sample(AppCore_t *app, MqttTopic_t *topic, MqttPayloadFormat_t *format, char *payload)
+{
+    if (app == NULL || topic == NULL || format == NULL || payload == NULL)
+    {
+        return -1;
+    }
+
+    uint8_t body[1 + APP_CORE_SAMPLE_LEN];
+    MsgQueueHeader_t header;
+    int rc = msg_queue_pop(&app->samples, &header, body, sizeof(body));
+    if (rc <= 0)
+    {
+        return rc;
+    }
+
+    if (header.type != APP_CORE_MSG_SAMPLE || header.len < 2 || header.arg >= MQTT_TOPIC_MAX || body[0] >= MQTT_FORMAT_MAX)
+    {
+        return -1;
+    }
+
+    *topic = (MqttTopic_t)header.arg;
+    *format = (MqttPayloadFormat_t)body[0];
+    memcpy(payload, &body[1], header.len - 1);
+
+    return header.len - 1;
+}
+
+void app_core_get_report_stats(const AppCore_t *app, ReportPolicyStats_t *stats)
+{
+    if (app == NULL || stats == NULL)
+    {
+        return;
+    }
+
+    memset(stats, 0, sizeof(ReportPolicyStats_t));
+    for (int i = 0; i < MQTT_TOPIC_MAX; i++)
+    {
+        const ReportPolicyStats_t *topic = &app->policies[i].stats;
+        stats->sent += topic->sent;
+        stats->suppressed += topic->suppressed;
+        stats->heartbeats += topic->heartbeats;
+        stats->deltas += topic->deltas;
+    }
+}
+
+int app_core_send_command(AppCore_t *app, AppCoreMsg_t msg, MqttTopic_t topic, const uint8_t *payload, uint32_t len)
+{
+    if (app == NULL || topic >= MQTT_TOPIC_MAX || len > APP_CORE_COMMAND_LEN)
+    {
+        return -1;
+    }
+
+    if (msg_queue_push(&app->commands, (uint8_t)msg, (uint8_t)topic, payload, (uint16_t)len) != 0)
+    {
+        return -1;
+    }
+
+    /** Core 1 waits for an event between two sampler polls */
+    __sev();
+
+    return 0;
+}
+
+/**
+ * @brief Core 1 entry point, polls the sampler and handles the commands forever
+ */
+static void _app_core_main(void)
+{
+    AppCore_t *app = AppCoreInstance;
+
+    /** Let core 0 park this core while it programs the flash store */
+    flash_safe_execute_core_init();
+
+    uint64_t nextPollUs = time_us_64();
+    while (true)
+    {
+        uint64_t nowUs = time_us_64();
+        if (nowUs >= nextPollUs)
+        {
+            adc_sampler_poll(&app->sampler);
+            _app_core_encode(app);
+
+            nextPollUs += (uint64_t)ADC_SAMPLER_POLL_MS * 1000u;
+            if (nextPollUs <= nowUs)
+            {
+                /** Fell behind, the sampler counts the overrun, don't try to catch up */
+                nextPollUs = nowUs + (uint64_t)ADC_SAMPLER_POLL_MS * 1000u;
+            }
+        }
+
+        _app_core_commands(app);
+
+        /** Sleep until the next poll, a command from core 0 sends an event and wakes us earlier */
+        best_effort_wfe_or_timeout(from_us_since_boot(nextPollUs));
+    }
+}
+
+/**
+ * @brief Encode the finished samples the report policy lets through and queue them for core 0
+ * @param app The application
+ */
+static void _app_core_encode(AppCore_t *app)
+{
+    bool queued = false;
+
+    AdcSample_t sample;
+    while (adc_sampler_read(&app->sampler, &sample))
+    {
+        int32_t centiC = _app_core_temperature_centi_c(sample.value, app->sampler.config.extraBits);
+        ReportPolicy_t *policy = &app->policies[MQTT_TOPIC_TEMP];
+
+        /** The sample time rather than the clock, a late poll does not shift the heartbeat */
+        uint32_t sampleMs = sample.sequence * app->sampler.config.outputPeriodMs;
+        ReportPolicyReport_t report;
+        if (!report_policy_check(policy, centiC, sampleMs, &report))
+        {
+            continue;
+        }
+
+        /** The format goes in front of the payload so core 0 can frame the batch */
+        MqttPayloadFormat_t format = app->formats[MQTT_TOPIC_TEMP];
+        uint8_t body[1 + APP_CORE_SAMPLE_LEN];
+        body[0] = (uint8_t)format;
+        int len = report_policy_encode(&report, format, "t", 2, &body[1], APP_CORE_SAMPLE_LEN);
+        if (len < 0)
+        {
+            printf("Sample does not fit in %d bytes\n", APP_CORE_SAMPLE_LEN);
+            continue;
+        }
+
+        app->stats.samples++;
+        /** A sample core 0 has no room for is not the reference of the next ones */
+        if (msg_queue_push(&app->samples, APP_CORE_MSG_SAMPLE, MQTT_TOPIC_TEMP, body, (uint16_t)(1 + len)) == 0)
+        {
+            report_policy_sent(policy, &report, centiC, sampleMs);
+            queued = true;
+        }
+    }
+
+    if (queued)
+    {
+        scheduler_wake(app->netTaskId);
+    }
+}
+
+/**
+ * @brief Handle the commands forwarded by core 0
+ * @param app The application
+ */
+static void _app_core_commands(AppCore_t *app)
+{
+    /** Room for the terminator */
+    char payload[APP_CORE_COMMAND_LEN + 1];
+    MsgQueueHeader_t header;
+    int rc;
+
+    while ((rc = msg_queue_pop(&app->commands, &header, payload, APP_CORE_COMMAND_LEN)) != 0)
+    {
+        if (rc < 0)
+        {
+            continue;
+        }
+        payload[header.len] = '\0';
+        app->stats.commands++;
+
+        switch (header.type)
+        {
+        case APP_CORE_MSG_LED:
+            printf("LED command: %s\n", payload);
+            break;
+
+        case APP_CORE_MSG_FORMAT:
+            if (strcmp(payload, "json") == 0)
+            {
+                app->formats[header.arg] = MQTT_FORMAT_JSON;
+            }
+            else if (strcmp(payload, "cbor") == 0)
+            {
+                app->formats[header.arg] = MQTT_FORMAT_CBOR;
+            }
+            else
+            {
+                printf("Unknown payload format %s\n", payload);
+            }
+            break;
+
+        default:
+            break;
+        }
+    }
+}
+
+/* References for this implementation:
+ * raspberry-pi-pico-c-sdk.pdf, Section '4.1.1. hardware_adc'
+ * pico-examples/adc/adc_console/adc_console.c
+ * T = 27 - (V - 0.706) / 0.001721, done in microvolts and centi-degrees to stay in integers */
+static int32_t _app_core_temperature_centi_c(uint32_t value, uint8_t extraBits)
+{
+    /* 12-bit conversion plus the oversampled fraction bits, assume max value == ADC_VREF == 3.3 V */
+    int64_t microVolts = ((int64_t)value * 3300000) >> (12 + extraBits);
+
+    /* Round to the nearest centi-degree, the numerator can be either sign */
+    int64_t numerator = (microVolts - 706000) * 100;
+    int64_t offset = numerator >= 0 ? 1721 / 2 : -(1721 / 2);
+
+    return 2700 - (int32_t)((numerator + offset) / 1721);
+}
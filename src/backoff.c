@@ -0,0 +1,113 @@
+/** Includes *************************************************************************************/
+#include "backoff.h"
+
+#include <stddef.h>
+
+/** Defines **************************************************************************************/
+/** Typedefs *************************************************************************************/
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+static uint32_t _backoff_random(Backoff_t *backoff);
+
+/** Functions ************************************************************************************/
+
+int backoff_init(Backoff_t *backoff, const BackoffConfig_t *config, uint32_t seed)
+{
+    if (backoff == NULL || config == NULL || config->baseMs == 0 || config->capMs < config->baseMs)
+    {
+        return -1;
+    }
+
+    backoff->config = *config;
+    backoff->rng = seed != 0 ? seed : 0x9E3779B9u;
+    backoff->delayMs = 0;
+    backoff->retryMs = 0;
+    backoff->waiting = false;
+    backoff->connected = false;
+    backoff->connectedMs = 0;
+    backoff->failures = 0;
+    backoff->retries = 0;
+
+    return 0;
+}
+
+uint32_t backoff_failed(Backoff_t *backoff, uint32_t nowMs)
+{
+    if (backoff == NULL)
+    {
+        return 0;
+    }
+
+    /** A connection that held long enough was a success, start over from the base */
+    if (backoff->connected && nowMs - backoff->connectedMs >= backoff->config.stableMs)
+    {
+        backoff->delayMs = 0;
+        backoff->failures = 0;
+    }
+    backoff->connected = false;
+
+    /** sleep = min(cap, random_between(base, sleep * 3)), the first sleep is the base */
+    uint64_t previousMs = backoff->delayMs != 0 ? backoff->delayMs : backoff->config.baseMs;
+    uint64_t upperMs = previousMs * 3;
+    if (upperMs > backoff->config.capMs)
+    {
+        upperMs = backoff->config.capMs;
+    }
+
+    uint32_t spanMs = (uint32_t)(upperMs - backoff->config.baseMs);
+    uint32_t delayMs = backoff->config.baseMs + (spanMs != 0 ? _backoff_random(backoff) % (spanMs + 1) : 0);
+
+    backoff->delayMs = delayMs;
+    backoff->retryMs = nowMs + delayMs;
+    backoff->waiting = true;
+    backoff->failures++;
+    backoff->retries++;
+
+    return delayMs;
+}
+
+void backoff_connected(Backoff_t *backoff, uint32_t nowMs)
+{
+    if (backoff == NULL)
+    {
+        return;
+    }
+
+    backoff->connected = true;
+    backoff->connectedMs = nowMs;
+    backoff->waiting = false;
+}
+
+uint32_t backoff_remaining(Backoff_t *backoff, uint32_t nowMs)
+{
+    if (backoff == NULL || !backoff->waiting)
+    {
+        return 0;
+    }
+
+    /** The signed difference handles the roll-over */
+    int32_t remainingMs = (int32_t)(backoff->retryMs - nowMs);
+    if (remainingMs <= 0)
+    {
+        backoff->waiting = false;
+        return 0;
+    }
+
+    return (uint32_t)remainingMs;
+}
+
+/**
+ * @brief Next pseudo random number, xorshift32
+ * @param backoff The policy holding the state
+ * @return uint32_t The number
+ */
+static uint32_t _backoff_random(Backoff_t *backoff)
+{
+    uint32_t x = backoff->rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    backoff->rng = x;
+
+    return x;
+}
@@ -0,0 +1,324 @@
+/** Includes *************************************************************************************/
+#include "cbor_reader.h"
+#include "cbor_writer.h"
+
+#include <stddef.h>
+#include <string.h>
+
+/** Defines **************************************************************************************/
+#define CBOR_BREAK 0xFF
+
+#define CBOR_INFO_INDEFINITE 31
+
+#define CBOR_SIMPLE_FALSE 20
+#define CBOR_SIMPLE_TRUE 21
+#define CBOR_SIMPLE_NULL 22
+
+/** Largest number of decimals json_writer_fixed() writes */
+#define CBOR_READER_MAX_DECIMALS 9
+
+/** Typedefs *************************************************************************************/
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+static int _cbor_reader_value(CborReader_t *reader, JsonWriter_t *json, uint8_t depth);
+static int _cbor_reader_int(CborReader_t *reader, int32_t *value);
+static bool _cbor_reader_end(CborReader_t *reader, const CborItem_t *item, uint64_t index);
+static int _cbor_reader_text(const CborItem_t *item, char *text);
+
+/** Functions ************************************************************************************/
+
+void cbor_reader_init(CborReader_t *reader, const uint8_t *data, uint32_t len)
+{
+    reader->data = data;
+    reader->len = len;
+    reader->pos = 0;
+}
+
+int cbor_reader_next(CborReader_t *reader, CborItem_t *item)
+{
+    if (reader->pos >= reader->len)
+    {
+        return 0;
+    }
+
+    memset(item, 0, sizeof(CborItem_t));
+    uint8_t initial = reader->data[reader->pos++];
+    uint8_t major = initial >> 5;
+    uint8_t info = initial & 0x1F;
+
+    if (initial == CBOR_BREAK)
+    {
+        item->type = CBOR_ITEM_BREAK;
+        return 1;
+    }
+
+    /** The argument follows the initial byte in 1, 2, 4 or 8 bytes, big endian */
+    if (info < 24)
+    {
+        item->value = info;
+    }
+    else if (info <= 27)
+    {
+        uint32_t bytes = 1u << (info - 24);
+        if (bytes > reader->len - reader->pos)
+        {
+            return -1;
+        }
+        for (uint32_t i = 0; i < bytes; i++)
+        {
+            item->value = item->value << 8 | reader->data[reader->pos++];
+        }
+    }
+    else if (info == CBOR_INFO_INDEFINITE && (major == 4 || major == 5))
+    {
+        item->indefinite = true;
+    }
+    else
+    {
+        /** Reserved values and indefinite strings */
+        return -1;
+    }
+
+    switch (major)
+    {
+    case 0:
+        item->type = CBOR_ITEM_UINT;
+        break;
+    case 1:
+        item->type = CBOR_ITEM_NINT;
+        break;
+    case 2:
+    case 3:
+        item->type = major == 2 ? CBOR_ITEM_BYTES : CBOR_ITEM_TEXT;
+        if (item->value > reader->len - reader->pos)
+        {
+            return -1;
+        }
+        item->data = &reader->data[reader->pos];
+        reader->pos += (uint32_t)item->value;
+        break;
+    case 4:
+        item->type = CBOR_ITEM_ARRAY;
+        break;
+    case 5:
+        item->type = CBOR_ITEM_MAP;
+        break;
+    case 6:
+        item->type = CBOR_ITEM_TAG;
+        break;
+    default:
+        item->type = info >= 25 ? CBOR_ITEM_FLOAT : CBOR_ITEM_SIMPLE;
+        break;
+    }
+
+    return 1;
+}
+
+int cbor_reader_to_json(const uint8_t *data, uint32_t len, JsonWriter_t *json)
+{
+    if (data == NULL || json == NULL)
+    {
+        return -1;
+    }
+
+    CborReader_t reader;
+    cbor_reader_init(&reader, data, len);
+
+    /** Exactly one item, nothing after it */
+    if (_cbor_reader_value(&reader, json, 0) != 0 || reader.pos != reader.len)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Convert the next item, and everything it contains, to JSON
+ * @param reader The reader
+ * @param json The JSON writer
+ * @param depth Nesting of the item
+ * @return int 0 on success, -1 on malformed or unsupported data
+ */
+static int _cbor_reader_value(CborReader_t *reader, JsonWriter_t *json, uint8_t depth)
+{
+    CborItem_t item;
+    if (cbor_reader_next(reader, &item) != 1)
+    {
+        return -1;
+    }
+
+    char text[CBOR_READER_MAX_TEXT + 1];
+
+    switch (item.type)
+    {
+    case CBOR_ITEM_UINT:
+        if (item.value > INT32_MAX)
+        {
+            return -1;
+        }
+        json_writer_int(json, (int32_t)item.value);
+        return 0;
+
+    case CBOR_ITEM_NINT:
+        if (item.value > INT32_MAX)
+        {
+            return -1;
+        }
+        json_writer_int(json, -1 - (int32_t)item.value);
+        return 0;
+
+    case CBOR_ITEM_TEXT:
+        if (_cbor_reader_text(&item, text) != 0)
+        {
+            return -1;
+        }
+        json_writer_string(json, text);
+        return 0;
+
+    case CBOR_ITEM_ARRAY:
+    case CBOR_ITEM_MAP:
+        if (depth >= CBOR_READER_MAX_DEPTH)
+        {
+            return -1;
+        }
+
+        if (item.type == CBOR_ITEM_ARRAY)
+        {
+            json_writer_begin_array(json);
+        }
+        else
+        {
+            json_writer_begin_object(json);
+        }
+
+        for (uint64_t index = 0; !_cbor_reader_end(reader, &item, index); index++)
+        {
+            if (item.type == CBOR_ITEM_MAP)
+            {
+                /** JSON keys are strings, so the CBOR keys must be too */
+                CborItem_t key;
+                if (cbor_reader_next(reader, &key) != 1 || key.type != CBOR_ITEM_TEXT || _cbor_reader_text(&key, text) != 0)
+                {
+                    return -1;
+                }
+                json_writer_key(json, text);
+            }
+
+            if (_cbor_reader_value(reader, json, depth + 1) != 0)
+            {
+                return -1;
+            }
+        }
+
+        if (item.type == CBOR_ITEM_ARRAY)
+        {
+            json_writer_end_array(json);
+        }
+        else
+        {
+            json_writer_end_object(json);
+        }
+        return 0;
+
+    case CBOR_ITEM_TAG:
+        if (item.value == CBOR_TAG_DECIMAL_FRACTION)
+        {
+            /** [exponent, mantissa] with a negative exponent maps onto a fixed-point number */
+            CborItem_t pair;
+            int32_t exponent;
+            int32_t mantissa;
+            if (cbor_reader_next(reader, &pair) != 1 || pair.type != CBOR_ITEM_ARRAY || pair.indefinite || pair.value != 2 ||
+                _cbor_reader_int(reader, &exponent) != 0 || _cbor_reader_int(reader, &mantissa) != 0 ||
+                exponent > 0 || exponent < -CBOR_READER_MAX_DECIMALS)
+            {
+                return -1;
+            }
+            json_writer_fixed(json, mantissa, (uint8_t)-exponent);
+            return 0;
+        }
+
+        /** Any other tag, e.g. self-describe, doesn't change the JSON */
+        return _cbor_reader_value(reader, json, depth);
+
+    case CBOR_ITEM_SIMPLE:
+        if (item.value == CBOR_SIMPLE_FALSE || item.value == CBOR_SIMPLE_TRUE)
+        {
+            json_writer_bool(json, item.value == CBOR_SIMPLE_TRUE);
+            return 0;
+        }
+        if (item.value == CBOR_SIMPLE_NULL)
+        {
+            json_writer_null(json);
+            return 0;
+        }
+        return -1;
+
+    default:
+        return -1;
+    }
+}
+
+/**
+ * @brief Decode an integer that fits in 32 bits
+ */
+static int _cbor_reader_int(CborReader_t *reader, int32_t *value)
+{
+    CborItem_t item;
+    if (cbor_reader_next(reader, &item) != 1 || item.value > INT32_MAX)
+    {
+        return -1;
+    }
+
+    if (item.type == CBOR_ITEM_UINT)
+    {
+        *value = (int32_t)item.value;
+        return 0;
+    }
+    if (item.type == CBOR_ITEM_NINT)
+    {
+        *value = -1 - (int32_t)item.value;
+        return 0;
+    }
+
+    return -1;
+}
+
+/**
+ * @brief Check for the end of an array or map, consumes the break of an indefinite one
+ * @param reader The reader
+ * @param item The array or map
+ * @param index Number of items or pairs read so far
+ * @return bool True at the end
+ */
+static bool _cbor_reader_end(CborReader_t *reader, const CborItem_t *item, uint64_t index)
+{
+    if (!item->indefinite)
+    {
+        return index >= item->value;
+    }
+
+    if (reader->pos < reader->len && reader->data[reader->pos] == CBOR_BREAK)
+    {
+        reader->pos++;
+        return true;
+    }
+
+    /** A missing break runs into the end of the data and fails the next read */
+    return false;
+}
+
+/**
+ * @brief Copy a text string into a null terminated buffer of CBOR_READER_MAX_TEXT + 1 bytes
+ */
+static int _cbor_reader_text(const CborItem_t *item, char *text)
+{
+    if (item->value > CBOR_READER_MAX_TEXT)
+    {
+        return -1;
+    }
+
+    memcpy(text, item->data, (size_t)item->value);
+    text[item->value] = '\0';
+    return 0;
+}
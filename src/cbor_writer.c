@@ -0,0 +1,159 @@
+/** Includes *************************************************************************************/
+#include "cbor_writer.h"
+
+#include <stddef.h>
+#include <string.h>
+
+/** Defines **************************************************************************************/
+/** Major types */
+#define CBOR_MAJOR_UINT 0
+#define CBOR_MAJOR_NINT 1
+#define CBOR_MAJOR_TEXT 3
+#define CBOR_MAJOR_ARRAY 4
+#define CBOR_MAJOR_MAP 5
+#define CBOR_MAJOR_TAG 6
+#define CBOR_MAJOR_SIMPLE 7
+
+#define CBOR_SIMPLE_FALSE 20
+#define CBOR_SIMPLE_TRUE 21
+
+/** Typedefs *************************************************************************************/
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+static void _cbor_writer_put(CborWriter_t *writer, const uint8_t *data, uint16_t len);
+static void _cbor_writer_head(CborWriter_t *writer, uint8_t major, uint32_t value);
+
+/** Functions ************************************************************************************/
+
+void cbor_writer_init(CborWriter_t *writer, uint8_t *buffer, uint16_t size)
+{
+    memset(writer, 0, sizeof(CborWriter_t));
+    writer->buffer = buffer;
+    writer->size = size;
+    writer->failed = buffer == NULL;
+}
+
+void cbor_writer_uint(CborWriter_t *writer, uint32_t value)
+{
+    _cbor_writer_head(writer, CBOR_MAJOR_UINT, value);
+}
+
+void cbor_writer_int(CborWriter_t *writer, int32_t value)
+{
+    if (value >= 0)
+    {
+        _cbor_writer_head(writer, CBOR_MAJOR_UINT, (uint32_t)value);
+    }
+    else
+    {
+        /** Negative integers are encoded as -1 - value, this can't overflow */
+        _cbor_writer_head(writer, CBOR_MAJOR_NINT, (uint32_t)(-1 - value));
+    }
+}
+
+void cbor_writer_decimal(CborWriter_t *writer, int32_t value, uint8_t decimals)
+{
+    if (decimals == 0)
+    {
+        cbor_writer_int(writer, value);
+        return;
+    }
+
+    /** Tag 4, [exponent, mantissa] */
+    cbor_writer_tag(writer, CBOR_TAG_DECIMAL_FRACTION);
+    cbor_writer_array(writer, 2);
+    cbor_writer_int(writer, -(int32_t)decimals);
+    cbor_writer_int(writer, value);
+}
+
+void cbor_writer_bool(CborWriter_t *writer, bool value)
+{
+    _cbor_writer_head(writer, CBOR_MAJOR_SIMPLE, value ? CBOR_SIMPLE_TRUE : CBOR_SIMPLE_FALSE);
+}
+
+void cbor_writer_text(CborWriter_t *writer, const char *text)
+{
+    size_t len = strlen(text);
+    if (len > UINT16_MAX)
+    {
+        writer->failed = true;
+        return;
+    }
+
+    _cbor_writer_head(writer, CBOR_MAJOR_TEXT, (uint32_t)len);
+    _cbor_writer_put(writer, (const uint8_t *)text, (uint16_t)len);
+}
+
+void cbor_writer_array(CborWriter_t *writer, uint32_t count)
+{
+    _cbor_writer_head(writer, CBOR_MAJOR_ARRAY, count);
+}
+
+void cbor_writer_map(CborWriter_t *writer, uint32_t count)
+{
+    _cbor_writer_head(writer, CBOR_MAJOR_MAP, count);
+}
+
+void cbor_writer_tag(CborWriter_t *writer, uint32_t tag)
+{
+    _cbor_writer_head(writer, CBOR_MAJOR_TAG, tag);
+}
+
+int cbor_writer_finish(const CborWriter_t *writer)
+{
+    return writer->failed ? -1 : writer->len;
+}
+
+/**
+ * @brief Append raw bytes, marks the writer failed instead of writing past the end
+ */
+static void _cbor_writer_put(CborWriter_t *writer, const uint8_t *data, uint16_t len)
+{
+    if (writer->failed || len > writer->size - writer->len)
+    {
+        writer->failed = true;
+        return;
+    }
+
+    memcpy(&writer->buffer[writer->len], data, len);
+    writer->len += len;
+}
+
+/**
+ * @brief Write the initial byte of an item and its argument in the shortest form, big endian
+ */
+static void _cbor_writer_head(CborWriter_t *writer, uint8_t major, uint32_t value)
+{
+    uint8_t head[5];
+    uint16_t len;
+
+    if (value < 24)
+    {
+        head[0] = (uint8_t)(major << 5 | value);
+        len = 1;
+    }
+    else if (value <= UINT8_MAX)
+    {
+        head[0] = (uint8_t)(major << 5 | 24);
+        head[1] = (uint8_t)value;
+        len = 2;
+    }
+    else if (value <= UINT16_MAX)
+    {
+        head[0] = (uint8_t)(major << 5 | 25);
+        head[1] = (uint8_t)(value >> 8);
+        head[2] = (uint8_t)value;
+        len = 3;
+    }
+    else
+    {
+        head[0] = (uint8_t)(major << 5 | 26);
+        head[1] = (uint8_t)(value >> 24);
+        head[2] = (uint8_t)(value >> 16);
+        head[3] = (uint8_t)(value >> 8);
+        head[4] = (uint8_t)value;
+        len = 5;
+    }
+
+    _cbor_writer_put(writer, head, len);
+}
@@ -1,9 +1,11 @@
 /** Includes *************************************************************************************/
 #include "client.h"
+#include "scheduler.h"
+
+#include "pico/rand.h"
 /** Defines **************************************************************************************/
 #define SERVER_PORT 4242
 #define CLIENT_POLL_TIME_S 10
-#define CLIENT_TASK_TIMEOUT_MS 100
 #define CLIENT_CONNECT_TIMEOUT_MS 4000
 
 #ifndef MQTT_TOPIC_LENGTH
@@ -21,6 +23,9 @@ static err_t _client_sent(void *arg, struct tcp_pcb *tpcb, u16_t len);
 static err_t _client_recv(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err);
 static void _client_err(void *arg, err_t err);
 static err_t _client_connected(void *arg, struct tcp_pcb *tpcb, err_t err);
+static uint16_t _client_ring_write(void *arg, const uint8_t *data, uint16_t len);
+static void _client_backoff(client_t *client);
+static err_t _client_tx_pump(client_t *client);
 
 /** Function Definitions *************************************************************************/
 int client_init(client_t *client, const char *ip_address)
@@ -39,63 +44,214 @@ int client_init(client_t *client, const char *ip_address)
     client->mqtt_client_info.keep_alive = 60;   // Keep alive time in seconds
     client->mqtt_client_info.will_topic = NULL; // No will topic
 
+    /** Received data goes into the ring until the application sets its own callback */
+    ring_buffer_init(&client->rx_ring, client->rx_ring_storage, sizeof(client->rx_ring_storage));
+    client->recv_cb = _client_ring_write;
+    client->recv_arg = client;
+    client->task_id = SCHEDULER_INVALID_TASK;
+
+    /** Data to send is queued in the ring and written to TCP as the window allows */
+    ring_buffer_init(&client->tx_ring, client->tx_ring_storage, sizeof(client->tx_ring_storage));
+    client->tx_policy = CLIENT_TX_BULK;
+    client->writer_task_id = SCHEDULER_INVALID_TASK;
+
     /** Initialise client with the server ip address */
     _client_ip_string_to_ip_addr(ip_address, &client->remote_addr);
 
     /** Initialise the client state */
     client->state = CLIENT_DISCONNECTED;
 
+    const BackoffConfig_t backoffConfig = {
+        .baseMs = CLIENT_BACKOFF_BASE_MS,
+        .capMs = CLIENT_BACKOFF_CAP_MS,
+        .stableMs = BACKOFF_STABLE_MS,
+    };
+    backoff_init(&client->backoff, &backoffConfig, get_rand_32());
+
     return 0;
 }
 
-int client_task(client_t *client)
+int client_set_tasks(client_t *client, int task_id, int writer_task_id)
 {
     if (client == NULL)
     {
         return -1;
     }
-    /** Check if it is time to run the client task */
-    static uint32_t timeLastRunMs = 0;
-    uint32_t currentTimeMs = to_ms_since_boot(get_absolute_time());
-    /** time passed */
 
-    // clang-format off
-    uint32_t timePassedMs = currentTimeMs < timeLastRunMs
-                                ? UINT32_MAX - timeLastRunMs + currentTimeMs
-                                : currentTimeMs - timeLastRunMs;
-    // clang-format on
+    client->task_id = task_id;
+    client->writer_task_id = writer_task_id;
+
+    return 0;
+}
 
-    if (timePassedMs < CLIENT_TASK_TIMEOUT_MS)
+int client_set_recv_callback(client_t *client, PbufStreamConsumeFn_t recv_cb, void *arg)
+{
+    if (client == NULL)
+    {
+        return -1;
+    }
+
+    client->recv_cb = recv_cb != NULL ? recv_cb : _client_ring_write;
+    client->recv_arg = recv_cb != NULL ? arg : client;
+    client->rx.consume = client->recv_cb;
+    client->rx.arg = client->recv_arg;
+
+    return 0;
+}
+
+uint32_t client_read(client_t *client, uint8_t *data, uint32_t len)
+{
+    if (client == NULL || data == NULL)
     {
         return 0;
     }
 
-    /** Update the last run time and catch the roll-over */
-    timeLastRunMs = currentTimeMs;
+    uint32_t read = ring_buffer_read(&client->rx_ring, data, len);
+
+    /** Data is waiting in the pbufs for space in the ring, let the task move it over */
+    if (read > 0 && client->rx.pending > 0)
+    {
+        scheduler_wake(client->task_id);
+    }
+
+    return read;
+}
+
+uint32_t client_write(client_t *client, const uint8_t *data, uint32_t len, uint8_t flags)
+{
+    if (client == NULL || data == NULL || client->state != CLIENT_CONNECTED)
+    {
+        return 0;
+    }
+
+    uint32_t written = ring_buffer_write(&client->tx_ring, data, len);
+    if (written < len)
+    {
+        client->tx_blocked = true;
+        client->tx_stats.refused++;
+    }
+    if (written == 0)
+    {
+        return 0;
+    }
+
+    if (flags & CLIENT_WRITE_PUSH)
+    {
+        /** The producer owns the head, the ring position is where the pushed data ends */
+        client->tx_push_mark = client->tx_ring.head;
+    }
+    client->tx_stats.bytes_queued += written;
+
+    /** lwIP is only called from the task and the callbacks, the task writes the data out */
+    scheduler_wake(client->task_id);
+
+    return written;
+}
+
+int client_send_frame(client_t *client, const uint8_t *frame, uint16_t len, uint8_t flags)
+{
+    if (client == NULL || (frame == NULL && len != 0) || client->state != CLIENT_CONNECTED)
+    {
+        return -1;
+    }
+
+    /** Whole frames only, a partial one would put the stream out of step */
+    if (ring_buffer_free(&client->tx_ring) < (uint32_t)FRAME_HEADER_LEN + len)
+    {
+        client->tx_blocked = true;
+        client->tx_stats.refused++;
+        return -1;
+    }
+
+    uint8_t header[FRAME_HEADER_LEN];
+    frame_encode_header(header, len);
+    ring_buffer_write(&client->tx_ring, header, sizeof(header));
+    if (len > 0)
+    {
+        ring_buffer_write(&client->tx_ring, frame, len);
+    }
+
+    if (flags & CLIENT_WRITE_PUSH)
+    {
+        client->tx_push_mark = client->tx_ring.head;
+    }
+    client->tx_stats.bytes_queued += FRAME_HEADER_LEN + len;
+    scheduler_wake(client->task_id);
+
+    return 0;
+}
+
+int client_set_tx_policy(client_t *client, client_tx_policy_t policy)
+{
+    if (client == NULL || (policy != CLIENT_TX_BULK && policy != CLIENT_TX_LATENCY))
+    {
+        return -1;
+    }
+
+    /** Applied by the next pump */
+    client->tx_policy = policy;
+    scheduler_wake(client->task_id);
+
+    return 0;
+}
+
+int client_task(client_t *client)
+{
+    if (client == NULL)
+    {
+        return -1;
+    }
+    /** The task is dispatched by the scheduler every CLIENT_TASK_TIMEOUT_MS */
 
     /** poll the cwy43 arch to process any incoming data */
-    // cyw43_arch_poll(); already ran in wifi_task
+    // cyw43_arch_poll(); already ran in the main loop
 
     /** Run the state machine */
     switch (client->state)
     {
     case CLIENT_DISCONNECTED:
-        static int timeoutMs = 0;
-
-        if (timeoutMs > 0)
+    {
+        /** Wait out the delay after a failed connect or a drop */
+        uint32_t nowMs = to_ms_since_boot(get_absolute_time());
+        uint32_t remainingMs = backoff_remaining(&client->backoff, nowMs);
+        if (remainingMs > 0)
         {
-            timeoutMs -= CLIENT_TASK_TIMEOUT_MS;
+            scheduler_delay(scheduler_current_task(), remainingMs);
             return 0;
         }
-        else if (timeoutMs <= 0)
+
+        if (_client_open(client) != ERR_OK)
         {
-            _client_open(client) != ERR_OK;
-            timeoutMs = CLIENT_CONNECT_TIMEOUT_MS;
+            _client_backoff(client);
+            break;
         }
+        client->connect_deadline_ms = nowMs + CLIENT_CONNECT_TIMEOUT_MS;
+        client->state = CLIENT_CONNECTING;
+        break;
+    }
+    case CLIENT_CONNECTING:
+        /** The signed difference handles the roll-over */
+        if ((int32_t)(to_ms_since_boot(get_absolute_time()) - client->connect_deadline_ms) >= 0)
+        {
+            printf("Connection timeout\n");
 
+            /** Nothing was sent yet, closing frees the pcb without calling the error callback */
+            cyw43_arch_lwip_begin();
+            if (client->tcp_pcb != NULL && tcp_close(client->tcp_pcb) == ERR_OK)
+            {
+                client->tcp_pcb = NULL;
+            }
+            cyw43_arch_lwip_end();
+
+            _client_backoff(client);
+        }
         break;
     case CLIENT_CONNECTED:
-        /** If the client is connected, do nothing */
+        /** Offer any data the callback could not take earlier and write out what was queued */
+        cyw43_arch_lwip_begin();
+        pbuf_stream_process(&client->rx);
+        _client_tx_pump(client);
+        cyw43_arch_lwip_end();
         break;
     default:
         /** Huston we have a problem */
@@ -116,6 +272,15 @@ int client_task(client_t *client)
 static int _client_open(client_t *client)
 {
     /** Check if the client tcp control block is NULL */
+    /** Drop anything left over from the previous connection */
+    pbuf_stream_reset(&client->rx);
+    ring_buffer_reset(&client->rx_ring);
+
+    /** Unsent data was for the old connection, a frame cut short there can't be finished on the new one */
+    ring_buffer_reset(&client->tx_ring);
+    client->tx_push_mark = 0;
+    client->tx_acked = 0;
+
     if (client->tcp_pcb != NULL)
     {
         /** Abort the existing connection */
@@ -147,6 +312,9 @@ static int _client_open(client_t *client)
     tcp_recv(client->tcp_pcb, _client_recv);
     tcp_err(client->tcp_pcb, _client_err);
 
+    /** Received data is handed to the callback straight from the pbufs */
+    pbuf_stream_init(&client->rx, client->tcp_pcb, client->recv_cb, client->recv_arg);
+
     printf("Connecting to %s:%d\n", ipaddr_ntoa(&client->remote_addr), SERVER_PORT);
 
     /**
@@ -167,9 +335,20 @@ static int _client_open(client_t *client)
  * @param arg Pointer to the client structure.
  * @param tpcb Pointer to the TCP protocol control block.
  * @return err_t Error code.
- * @note This function is called periodically to check the status of the connection.
+ * @note This function is called periodically to check the status of the connection. It retries
+ *       a write that failed for lack of pbufs while nothing was in flight to call _client_sent.
  */
-static err_t _client_poll(void *arg, struct tcp_pcb *tpcb) { return 0; }
+static err_t _client_poll(void *arg, struct tcp_pcb *tpcb)
+{
+    (void)tpcb;
+    client_t *client = (client_t *)arg;
+    if (client == NULL || client->state != CLIENT_CONNECTED)
+    {
+        return ERR_OK;
+    }
+
+    return _client_tx_pump(client);
+}
 
 /**
  * @brief Callback function for when data is sent to the server.
@@ -177,9 +356,23 @@ static err_t _client_poll(void *arg, struct tcp_pcb *tpcb) { return 0; }
  * @param tpcb Pointer to the TCP protocol control block.
  * @param len Length of the data sent.
  * @return err_t Error code.
- * @note This function is called when data is sent to the server.
+ * @note This function is called when the server acknowledged len bytes, the space they took
+ *       in the send buffer is free again and the transmit ring is drained into it.
  */
-static err_t _client_sent(void *arg, struct tcp_pcb *tpcb, u16_t len) { return 0; }
+static err_t _client_sent(void *arg, struct tcp_pcb *tpcb, u16_t len)
+{
+    (void)tpcb;
+    client_t *client = (client_t *)arg;
+    if (client == NULL)
+    {
+        return ERR_OK;
+    }
+
+    client->tx_acked += len;
+    client->tx_stats.bytes_acked += len;
+
+    return _client_tx_pump(client);
+}
 
 /**
  * @brief Callback function for when data is received from the server.
@@ -196,49 +389,40 @@ static err_t _client_recv(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t
     if (err != ERR_OK)
     {
         printf("Error receiving data\n");
+        if (p != NULL)
+        {
+            pbuf_free(p);
+        }
         return err;
     }
 
     if (p == NULL)
     {
         printf("Connection closed\n");
-        tcp_close(tpcb);
-        client->state = CLIENT_DISCONNECTED;
-        return ERR_ABRT;
+        pbuf_stream_reset(&client->rx);
+        client->tcp_pcb = NULL;
+        _client_backoff(client);
+
+        /** The pcb is ours to close, lwIP only frees it here if the close went through */
+        if (tcp_close(tpcb) != ERR_OK)
+        {
+            tcp_abort(tpcb);
+            return ERR_ABRT;
+        }
+        return ERR_OK;
     }
 
     /**
-     * Print the incoming data to the console.
-     * @note: This is a simple example and should be replaced with your own code to handle the incoming data.
-     *        The payload is a pointer to the data in the pbuf, and the length of the data is in p->len.
-     *        The payload is not null terminated, so you need to handle it accordingly.
-     *
-     * @warning: This will only work well for null terminated strings.
-     *
+     * Hand the whole pbuf chain to the stream reader, it walks every pbuf in the chain and
+     * passes the payloads to the receive callback in place. The pbufs are freed and the TCP
+     * window is opened as the callback consumes the data.
      */
-    void *payload = p->payload;
-    uint16_t len = p->len;
-    uint8_t *buffer = client->buffer;     /** Use the client's buffer to store the data. */
-    uint16_t offset = client->buffer_len; /** Offset to write to in the buffer. */
-    if (len > BUF_SIZE - 1)
-    {
-        /** we are full */
-        len = BUF_SIZE - 1; // Ensure we don't overflow the buffer
-    }
-    else if (len > 0)
-    {
-        /** Copy the data to the buffer */
-        memcpy(buffer + offset, payload, len);
-        client->buffer_len += len;
-    }
-
-    buffer[client->buffer_len] = '\0'; // Null terminate the string
-
-    /** Free the pbuf */
-    pbuf_free(p);
+    pbuf_stream_push(&client->rx, p);
+    pbuf_stream_process(&client->rx);
 
     return ERR_OK;
 }
+
 /**
  * @brief Error callback for the client.
  * @param arg Pointer to the client structure.
@@ -250,9 +434,11 @@ static void _client_err(void *arg, err_t err)
 {
     client_t *client = (client_t *)arg;
     printf("Error: %d\n", err);
-    // tcp_abort(client->tcp_pcb); /** Abort kept giving recurring err_call with -13 */
-    tcp_close(client->tcp_pcb); /** close the connection */
-    client->state = CLIENT_DISCONNECTED;
+
+    /** lwIP has freed the pcb before calling this, closing or aborting it again corrupts its lists */
+    client->tcp_pcb = NULL;
+    pbuf_stream_reset(&client->rx);
+    _client_backoff(client);
 }
 
 /**
@@ -265,6 +451,10 @@ static void _client_err(void *arg, err_t err)
  */
 static err_t _client_connected(void *arg, struct tcp_pcb *tpcb, err_t err)
 {
+    /** The pcb is client->tcp_pcb, and lwIP always passes ERR_OK, failures go to _client_err */
+    (void)tpcb;
+    (void)err;
+
     /** NULL check */
     if (arg == NULL)
     {
@@ -279,7 +469,138 @@ static err_t _client_connected(void *arg, struct tcp_pcb *tpcb, err_t err)
     }
 
     client->state = CLIENT_CONNECTED;
+    backoff_connected(&client->backoff, to_ms_since_boot(get_absolute_time()));
     printf("Client connected\n");
+
+    /** Writes were refused while connecting */
+    if (client->tx_blocked)
+    {
+        client->tx_blocked = false;
+        scheduler_wake(client->writer_task_id);
+    }
+
+    return ERR_OK;
+}
+
+/**
+ * @brief Default receive callback, copies the incoming data into the receive ring.
+ * @param arg Pointer to the client structure.
+ * @param data Pointer to the received data.
+ * @param len Length of the data.
+ * @return uint16_t Number of bytes consumed. Less than len when the ring is full, the rest
+ *         stays in the pbufs and the TCP window stays closed until client_read() makes room.
+ */
+static uint16_t _client_ring_write(void *arg, const uint8_t *data, uint16_t len)
+{
+    client_t *client = (client_t *)arg;
+    uint16_t written = (uint16_t)ring_buffer_write(&client->rx_ring, data, len);
+
+    /** Let the reader know there is data, unless it is the task moving it over */
+    if (written > 0 && scheduler_current_task() != client->task_id)
+    {
+        scheduler_wake(client->task_id);
+    }
+
+    return written;
+}
+
+/**
+ * @brief Drop to disconnected and hold off the next connect by the reconnect delay.
+ * @param client Pointer to the client structure.
+ */
+static void _client_backoff(client_t *client)
+{
+    client->state = CLIENT_DISCONNECTED;
+    uint32_t delayMs = backoff_failed(&client->backoff, to_ms_since_boot(get_absolute_time()));
+    printf("Reconnecting in %lu ms\n", (unsigned long)delayMs);
+}
+
+/**
+ * @brief Write the transmit ring into the TCP send buffer, called from the lwIP context.
+ * @param client Pointer to the client structure.
+ * @return err_t ERR_OK, also when the window or lwIP's pbufs ran out, the rest is written from the sent callback.
+ * @note Only as much as tcp_sndbuf() and the free segment slots allow is written, so tcp_write()
+ *       does not fail for lack of room. Every write but the last one of a pump is flagged
+ *       TCP_WRITE_FLAG_MORE, lwIP fills its segments up and only pushes the last one.
+ */
+static err_t _client_tx_pump(client_t *client)
+{
+    struct tcp_pcb *pcb = client->tcp_pcb;
+    if (pcb == NULL)
+    {
+        return ERR_OK;
+    }
+
+    bool written = false;
+    uint32_t queued;
+    while ((queued = ring_buffer_used(&client->tx_ring)) > 0)
+    {
+        u16_t room = tcp_sndbuf(pcb);
+        u16_t slots = tcp_sndqueuelen(pcb) < TCP_SND_QUEUELEN ? (u16_t)(TCP_SND_QUEUELEN - tcp_sndqueuelen(pcb)) : 0;
+        if (room == 0 || slots == 0)
+        {
+            client->tx_stats.window_full++;
+            break;
+        }
+
+        /** Contiguous up to the end of the ring, the rest goes in the next round */
+        const uint8_t *data;
+        uint32_t len = ring_buffer_peek(&client->tx_ring, &data);
+        if (len > room)
+        {
+            len = room;
+        }
+        if (len > (uint32_t)slots * tcp_mss(pcb))
+        {
+            len = (uint32_t)slots * tcp_mss(pcb);
+        }
+
+        u8_t flags = TCP_WRITE_FLAG_COPY;
+        if (len < queued)
+        {
+            flags |= TCP_WRITE_FLAG_MORE;
+        }
+
+        err_t err = tcp_write(pcb, data, (u16_t)len, flags);
+        if (err == ERR_MEM)
+        {
+            client->tx_stats.mem_errors++;
+            break;
+        }
+        if (err != ERR_OK)
+        {
+            return err;
+        }
+
+        ring_buffer_consume(&client->tx_ring, len);
+        client->tx_stats.bytes_written += len;
+        client->tx_stats.writes++;
+        written = true;
+    }
+
+    /** Pushed data skips Nagle until the server acknowledged it, then the policy applies again */
+    bool push = client->tx_policy == CLIENT_TX_LATENCY || (int32_t)(client->tx_push_mark - client->tx_acked) > 0;
+    if (push)
+    {
+        tcp_nagle_disable(pcb);
+    }
+    else
+    {
+        tcp_nagle_enable(pcb);
+    }
+    if (written)
+    {
+        tcp_output(pcb);
+    }
+
+    /** The writer was refused, let it fill the ring again once half of it is free */
+    if (client->tx_blocked && ring_buffer_free(&client->tx_ring) >= CLIENT_TX_RING_SIZE / 2)
+    {
+        client->tx_blocked = false;
+        scheduler_wake(client->writer_task_id);
+    }
+
+    return ERR_OK;
 }
 
 /**
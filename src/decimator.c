@@ -0,0 +1,47 @@
+/** Includes *************************************************************************************/
+#include "decimator.h"
+
+#include <stddef.h>
+#include <string.h>
+
+/** Defines **************************************************************************************/
+/** Typedefs *************************************************************************************/
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+/** Functions ************************************************************************************/
+
+int decimator_init(Decimator_t *decimator, uint32_t factor, uint8_t extraBits)
+{
+    if (decimator == NULL || factor == 0 || factor > DECIMATOR_MAX_FACTOR || extraBits > 16)
+    {
+        return -1;
+    }
+
+    memset(decimator, 0, sizeof(Decimator_t));
+    decimator->factor = factor;
+    decimator->extraBits = extraBits;
+
+    return 0;
+}
+
+void decimator_reset(Decimator_t *decimator)
+{
+    decimator->count = 0;
+    decimator->sum = 0;
+}
+
+bool decimator_push(Decimator_t *decimator, uint16_t sample, uint32_t *out)
+{
+    decimator->sum += sample;
+    if (++decimator->count < decimator->factor)
+    {
+        return false;
+    }
+
+    /** Scale before dividing so the fraction bits survive, 64 bits as the scaled sum can overflow */
+    uint64_t scaled = (uint64_t)decimator->sum << decimator->extraBits;
+    *out = (uint32_t)((scaled + decimator->factor / 2) / decimator->factor);
+
+    decimator_reset(decimator);
+    return true;
+}
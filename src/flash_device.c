@@ -0,0 +1,128 @@
+/** Includes *************************************************************************************/
+#include "flash_device.h"
+
+#include <string.h>
+
+#include "pico/stdlib.h"
+#include "pico/flash.h"
+#include "hardware/flash.h"
+
+/** Defines **************************************************************************************/
+/** Time allowed for the other core to be locked out around a flash operation */
+#define FLASH_DEVICE_SAFE_TIMEOUT_MS 100
+
+/** Start of the store, relative to the start of the flash */
+#define FLASH_DEVICE_STORE_OFFSET (PICO_FLASH_SIZE_BYTES - FLASH_DEVICE_STORE_SIZE)
+
+/** Start of the settings, relative to the start of the flash */
+#define FLASH_DEVICE_SETTINGS_OFFSET (FLASH_DEVICE_STORE_OFFSET - FLASH_DEVICE_SETTINGS_SIZE)
+
+/** Typedefs *************************************************************************************/
+
+/** Parameters of a flash operation run through flash_safe_execute() */
+typedef struct
+{
+    uint32_t offset;
+    const void *data;
+    uint32_t len;
+} FlashDeviceOp_t;
+
+/** Variables ************************************************************************************/
+/** End of the program image, provided by the linker script */
+extern char __flash_binary_end;
+
+/** Prototypes ***********************************************************************************/
+static int _flash_device_region_init(FlashDevice_t *device, uint32_t offset, uint32_t size);
+static int _flash_device_read(void *arg, uint32_t offset, void *buffer, uint32_t len);
+static int _flash_device_program(void *arg, uint32_t offset, const void *data, uint32_t len);
+static int _flash_device_erase(void *arg, uint32_t offset);
+static void _flash_device_program_op(void *param);
+static void _flash_device_erase_op(void *param);
+
+/** Functions ************************************************************************************/
+
+int flash_device_pico_init(FlashDevice_t *device)
+{
+    return _flash_device_region_init(device, FLASH_DEVICE_STORE_OFFSET, FLASH_DEVICE_STORE_SIZE);
+}
+
+int flash_device_pico_settings_init(FlashDevice_t *device)
+{
+    return _flash_device_region_init(device, FLASH_DEVICE_SETTINGS_OFFSET, FLASH_DEVICE_SETTINGS_SIZE);
+}
+
+/**
+ * @brief Set up a device for a region of the on-board flash, the arg of the device is the start of the region
+ * @param device The device to set up
+ * @param offset Start of the region, relative to the start of the flash
+ * @param size Size of the region
+ * @return int 0 on success, -1 if the region overlaps the program image
+ */
+static int _flash_device_region_init(FlashDevice_t *device, uint32_t offset, uint32_t size)
+{
+    if (device == NULL)
+    {
+        return -1;
+    }
+
+    /** The region must not overlap the program */
+    if ((uintptr_t)&__flash_binary_end - XIP_BASE > offset)
+    {
+        printf("Flash region at 0x%lx overlaps the program image\n", (unsigned long)offset);
+        return -1;
+    }
+
+    memset(device, 0, sizeof(FlashDevice_t));
+    device->size = size;
+    device->sectorSize = FLASH_SECTOR_SIZE;
+    device->read = _flash_device_read;
+    device->program = _flash_device_program;
+    device->erase = _flash_device_erase;
+    device->arg = (void *)(uintptr_t)offset;
+
+    return 0;
+}
+
+/**
+ * @brief Read through the XIP window, the SDK flushes the cache after every program and erase
+ */
+static int _flash_device_read(void *arg, uint32_t offset, void *buffer, uint32_t len)
+{
+    memcpy(buffer, (const void *)(uintptr_t)(XIP_BASE + (uintptr_t)arg + offset), len);
+
+    return 0;
+}
+
+static int _flash_device_program(void *arg, uint32_t offset, const void *data, uint32_t len)
+{
+    FlashDeviceOp_t op = {
+        .offset = (uintptr_t)arg + offset,
+        .data = data,
+        .len = len,
+    };
+
+    /** XIP is unavailable while programming, so interrupts and the other core are held off */
+    return flash_safe_execute(_flash_device_program_op, &op, FLASH_DEVICE_SAFE_TIMEOUT_MS) == PICO_OK ? 0 : -1;
+}
+
+static int _flash_device_erase(void *arg, uint32_t offset)
+{
+    FlashDeviceOp_t op = {
+        .offset = (uintptr_t)arg + offset,
+        .len = FLASH_SECTOR_SIZE,
+    };
+
+    return flash_safe_execute(_flash_device_erase_op, &op, FLASH_DEVICE_SAFE_TIMEOUT_MS) == PICO_OK ? 0 : -1;
+}
+
+static void _flash_device_program_op(void *param)
+{
+    const FlashDeviceOp_t *op = (const FlashDeviceOp_t *)param;
+    flash_range_program(op->offset, (const uint8_t *)op->data, op->len);
+}
+
+static void _flash_device_erase_op(void *param)
+{
+    const FlashDeviceOp_t *op = (const FlashDeviceOp_t *)param;
+    flash_range_erase(op->offset, op->len);
+}
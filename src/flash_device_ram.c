@@ -0,0 +1,74 @@
+/** Includes *************************************************************************************/
+#include "flash_device.h"
+
+#include <stddef.h>
+#include <string.h>
+
+/** Defines **************************************************************************************/
+/** Typedefs *************************************************************************************/
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+static int _flash_device_ram_read(void *arg, uint32_t offset, void *buffer, uint32_t len);
+static int _flash_device_ram_program(void *arg, uint32_t offset, const void *data, uint32_t len);
+static int _flash_device_ram_erase(void *arg, uint32_t offset);
+
+/** Functions ************************************************************************************/
+
+int flash_device_ram_init(FlashDevice_t *device, uint8_t *buffer, uint32_t size)
+{
+    if (device == NULL || buffer == NULL || size == 0 || size % FLASH_DEVICE_SECTOR_SIZE != 0)
+    {
+        return -1;
+    }
+
+    memset(buffer, 0xFF, size);
+
+    memset(device, 0, sizeof(FlashDevice_t));
+    device->size = size;
+    device->sectorSize = FLASH_DEVICE_SECTOR_SIZE;
+    device->read = _flash_device_ram_read;
+    device->program = _flash_device_ram_program;
+    device->erase = _flash_device_ram_erase;
+    device->arg = buffer;
+
+    return 0;
+}
+
+static int _flash_device_ram_read(void *arg, uint32_t offset, void *buffer, uint32_t len)
+{
+    memcpy(buffer, (const uint8_t *)arg + offset, len);
+
+    return 0;
+}
+
+/**
+ * @brief Program like NOR flash does, bits can only be cleared
+ */
+static int _flash_device_ram_program(void *arg, uint32_t offset, const void *data, uint32_t len)
+{
+    if (offset % FLASH_DEVICE_PAGE_SIZE != 0 || len % FLASH_DEVICE_PAGE_SIZE != 0)
+    {
+        return -1;
+    }
+
+    uint8_t *dst = (uint8_t *)arg + offset;
+    const uint8_t *src = (const uint8_t *)data;
+    for (uint32_t i = 0; i < len; i++)
+    {
+        dst[i] &= src[i];
+    }
+
+    return 0;
+}
+
+static int _flash_device_ram_erase(void *arg, uint32_t offset)
+{
+    if (offset % FLASH_DEVICE_SECTOR_SIZE != 0)
+    {
+        return -1;
+    }
+
+    memset((uint8_t *)arg + offset, 0xFF, FLASH_DEVICE_SECTOR_SIZE);
+
+    return 0;
+}
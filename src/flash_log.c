@@ -0,0 +1,591 @@
+/** Includes *************************************************************************************/
+#include "flash_log.h"
+#include "crc32.h"
+
+#include <stddef.h>
+#include <string.h>
+
+/** Defines **************************************************************************************/
+#define FLASH_LOG_SECTOR_MAGIC 0x474F4C46u /** "FLOG" */
+
+/** Record flag values, anything but FLASH_LOG_RECORD_LIVE reads as consumed */
+#define FLASH_LOG_RECORD_LIVE 0xFF
+#define FLASH_LOG_RECORD_CONSUMED 0x00
+
+#define FLASH_LOG_ERASED_LEN 0xFFFF
+
+/** Records start on a word boundary */
+#define FLASH_LOG_ALIGN(x) (((x) + 3u) & ~3u)
+
+/** Typedefs *************************************************************************************/
+
+/** Header at the start of every sector in use */
+typedef struct
+{
+    uint32_t magic;
+    uint32_t sequence; /** Increases by one for every sector opened, orders the ring */
+    uint32_t crc;
+    uint32_t reserved;
+} FlashLogSectorHeader_t;
+
+/** Header of a record, followed by the payload */
+typedef struct
+{
+    uint16_t len;
+    uint8_t topic;
+    uint8_t flag;    /** Cleared in place once the record is consumed, not covered by the CRC */
+    uint32_t timeMs;
+    uint32_t crc;    /** Over len, topic, timeMs and the payload */
+} FlashLogRecordHeader_t;
+
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+static uint32_t _flash_log_record_crc(const FlashLogRecordHeader_t *header);
+static uint32_t _flash_log_sector_start(const FlashLog_t *log, uint32_t offset);
+static uint32_t _flash_log_next_sector(const FlashLog_t *log, uint32_t offset);
+static bool _flash_log_read_sector(FlashLog_t *log, uint32_t sector, uint32_t *sequence);
+static int _flash_log_check(FlashLog_t *log, uint32_t offset, FlashLogRecordHeader_t *header);
+static uint32_t _flash_log_next(FlashLog_t *log, uint32_t offset, bool skipConsumed);
+static int _flash_log_open_sector(FlashLog_t *log, uint32_t offset);
+static int _flash_log_program(FlashLog_t *log, uint32_t offset, const FlashLogRecordHeader_t *header, const uint8_t *payload);
+
+/** Functions ************************************************************************************/
+
+int flash_log_init(FlashLog_t *log, const FlashDevice_t *device)
+{
+    if (log == NULL || device == NULL || device->sectorSize == 0 || device->sectorSize % FLASH_DEVICE_PAGE_SIZE != 0 ||
+        device->size % device->sectorSize != 0 || device->size / device->sectorSize < 2)
+    {
+        return -1;
+    }
+
+    memset(log, 0, sizeof(FlashLog_t));
+    log->device = device;
+    log->sectorCount = device->size / device->sectorSize;
+
+    /** The head is the sector with the highest sequence number */
+    uint32_t head = 0;
+    uint32_t headSequence = 0;
+    bool found = false;
+    for (uint32_t sector = 0; sector < log->sectorCount; sector++)
+    {
+        uint32_t sequence;
+        if (_flash_log_read_sector(log, sector, &sequence) && (!found || (int32_t)(sequence - headSequence) > 0))
+        {
+            head = sector;
+            headSequence = sequence;
+            found = true;
+        }
+    }
+
+    if (!found)
+    {
+        /** Blank log, the first append opens sector 0 */
+        log->nextSequence = 1;
+        return 0;
+    }
+    log->nextSequence = headSequence + 1;
+
+    /** Walk back along the consecutive sequence numbers to the oldest sector */
+    uint32_t tail = head;
+    for (uint32_t i = 1; i < log->sectorCount; i++)
+    {
+        uint32_t prev = (tail + log->sectorCount - 1) % log->sectorCount;
+        uint32_t sequence;
+        if (!_flash_log_read_sector(log, prev, &sequence) || sequence != headSequence - i)
+        {
+            break;
+        }
+        tail = prev;
+    }
+
+    /** Count the live records and find the end of the head sector */
+    bool tailFound = false;
+    for (uint32_t sector = tail;; sector = (sector + 1) % log->sectorCount)
+    {
+        uint32_t start = sector * device->sectorSize;
+        uint32_t offset = start + sizeof(FlashLogSectorHeader_t);
+        bool closed = false;
+
+        while (offset < start + device->sectorSize)
+        {
+            FlashLogRecordHeader_t header;
+            int rc = _flash_log_check(log, offset, &header);
+            if (rc < 0)
+            {
+                /** A write cut by a reset, nothing after it in this sector can be trusted */
+                log->stats.corrupt++;
+                closed = true;
+                break;
+            }
+            if (rc == 0)
+            {
+                break;
+            }
+
+            if (header.flag == FLASH_LOG_RECORD_LIVE)
+            {
+                if (!tailFound)
+                {
+                    log->tailOffset = offset;
+                    tailFound = true;
+                }
+                log->pending++;
+            }
+            offset += FLASH_LOG_ALIGN(sizeof(FlashLogRecordHeader_t) + header.len);
+        }
+
+        if (sector == head)
+        {
+            /** A sector boundary means the next append opens a new sector */
+            log->writeOffset = (closed ? start + device->sectorSize : offset) % device->size;
+            break;
+        }
+    }
+
+    if (!tailFound)
+    {
+        log->tailOffset = log->writeOffset;
+    }
+    log->readOffset = log->tailOffset;
+
+    return 0;
+}
+
+int flash_log_append(FlashLog_t *log, uint8_t topic, const void *payload, uint16_t len, uint32_t timeMs)
+{
+    if (log == NULL || log->device == NULL || (payload == NULL && len > 0) || len > FLASH_LOG_MAX_PAYLOAD)
+    {
+        return -1;
+    }
+
+    uint32_t size = FLASH_LOG_ALIGN(sizeof(FlashLogRecordHeader_t) + len);
+    uint32_t sectorSize = log->device->sectorSize;
+    if (size > sectorSize - sizeof(FlashLogSectorHeader_t))
+    {
+        return -1;
+    }
+
+    /** Records never span two sectors */
+    if (log->writeOffset % sectorSize == 0)
+    {
+        if (_flash_log_open_sector(log, log->writeOffset) != 0)
+        {
+            return -1;
+        }
+    }
+    else if (log->writeOffset + size > _flash_log_sector_start(log, log->writeOffset) + sectorSize)
+    {
+        if (_flash_log_open_sector(log, _flash_log_next_sector(log, log->writeOffset)) != 0)
+        {
+            return -1;
+        }
+    }
+
+    FlashLogRecordHeader_t header = {
+        .len = len,
+        .topic = topic,
+        .flag = FLASH_LOG_RECORD_LIVE,
+        .timeMs = timeMs,
+    };
+    header.crc = crc32_update(_flash_log_record_crc(&header), payload, len);
+
+    bool empty = log->tailOffset == log->writeOffset;
+    bool readAtEnd = log->readOffset == log->writeOffset;
+    uint32_t offset = log->writeOffset;
+
+    /** Move the write offset first, so a failed program leaves a corrupt record behind and not a hole */
+    log->writeOffset = (offset + size) % log->device->size;
+    if (_flash_log_program(log, offset, &header, (const uint8_t *)payload) != 0)
+    {
+        log->stats.errors++;
+        log->writeOffset = _flash_log_next_sector(log, offset);
+        return -1;
+    }
+
+    if (empty)
+    {
+        log->tailOffset = offset;
+    }
+    if (readAtEnd)
+    {
+        log->readOffset = offset;
+    }
+    log->pending++;
+    log->stats.appends++;
+    log->stats.appendBytes += len;
+
+    return 0;
+}
+
+int flash_log_peek(FlashLog_t *log, FlashLogRecord_t *record, void *payload, uint16_t size)
+{
+    if (log == NULL || log->device == NULL || record == NULL)
+    {
+        return -1;
+    }
+
+    log->readOffset = _flash_log_next(log, log->readOffset, true);
+    if (log->readOffset == log->writeOffset)
+    {
+        return 0;
+    }
+
+    FlashLogRecordHeader_t header;
+    uint32_t sequence;
+    if (_flash_log_check(log, log->readOffset, &header) != 1 ||
+        !_flash_log_read_sector(log, log->readOffset / log->device->sectorSize, &sequence))
+    {
+        return -1;
+    }
+
+    record->offset = log->readOffset;
+    record->sequence = sequence;
+    record->topic = header.topic;
+    record->len = header.len;
+    record->timeMs = header.timeMs;
+
+    if (header.len > size)
+    {
+        /** The caller can never take it, don't hand it out again */
+        log->stats.errors++;
+        flash_log_advance(log, record);
+        return -1;
+    }
+
+    return log->device->read(log->device->arg, log->readOffset + sizeof(FlashLogRecordHeader_t), payload, header.len) == 0 ? 1 : -1;
+}
+
+void flash_log_advance(FlashLog_t *log, const FlashLogRecord_t *record)
+{
+    if (log == NULL || record == NULL || record->offset != log->readOffset)
+    {
+        return;
+    }
+
+    log->readOffset = (record->offset + FLASH_LOG_ALIGN(sizeof(FlashLogRecordHeader_t) + record->len)) % log->device->size;
+}
+
+int flash_log_consume(FlashLog_t *log, uint32_t offset, uint32_t sequence)
+{
+    if (log == NULL || log->device == NULL || offset >= log->device->size)
+    {
+        return -1;
+    }
+
+    /** The sector was erased and opened again since the record was read, it is gone */
+    uint32_t current;
+    if (!_flash_log_read_sector(log, offset / log->device->sectorSize, &current) || current != sequence)
+    {
+        log->stats.stale++;
+        return -1;
+    }
+
+    FlashLogRecordHeader_t header;
+    if (_flash_log_check(log, offset, &header) != 1)
+    {
+        return -1;
+    }
+
+    if (header.flag == FLASH_LOG_RECORD_LIVE)
+    {
+        /** Clear the flag byte in place, the rest of the page is programmed with 0xFF and stays as it is */
+        uint32_t flagOffset = offset + offsetof(FlashLogRecordHeader_t, flag);
+        uint32_t pageOffset = flagOffset - flagOffset % FLASH_DEVICE_PAGE_SIZE;
+        memset(log->page, 0xFF, sizeof(log->page));
+        log->page[flagOffset - pageOffset] = FLASH_LOG_RECORD_CONSUMED;
+
+        if (log->device->program(log->device->arg, pageOffset, log->page, FLASH_DEVICE_PAGE_SIZE) != 0)
+        {
+            log->stats.errors++;
+            return -1;
+        }
+
+        log->pending--;
+        log->stats.consumed++;
+    }
+
+    if (offset == log->tailOffset)
+    {
+        bool readAtTail = log->readOffset == log->tailOffset;
+        log->tailOffset = _flash_log_next(log, log->tailOffset, true);
+        if (readAtTail)
+        {
+            log->readOffset = log->tailOffset;
+        }
+    }
+
+    return 0;
+}
+
+void flash_log_rewind(FlashLog_t *log)
+{
+    if (log == NULL)
+    {
+        return;
+    }
+
+    log->readOffset = log->tailOffset;
+}
+
+uint32_t flash_log_pending(const FlashLog_t *log)
+{
+    return log == NULL ? 0 : log->pending;
+}
+
+/**
+ * @brief CRC of the header fields covered by the record CRC
+ * @param header The record header
+ * @return uint32_t The CRC, to be continued over the payload
+ */
+static uint32_t _flash_log_record_crc(const FlashLogRecordHeader_t *header)
+{
+    uint32_t crc = crc32_update(0, &header->len, sizeof(header->len));
+    crc = crc32_update(crc, &header->topic, sizeof(header->topic));
+    return crc32_update(crc, &header->timeMs, sizeof(header->timeMs));
+}
+
+static uint32_t _flash_log_sector_start(const FlashLog_t *log, uint32_t offset)
+{
+    return offset - offset % log->device->sectorSize;
+}
+
+static uint32_t _flash_log_next_sector(const FlashLog_t *log, uint32_t offset)
+{
+    return (_flash_log_sector_start(log, offset) + log->device->sectorSize) % log->device->size;
+}
+
+/**
+ * @brief Read and check a sector header
+ * @param log The log
+ * @param sector The sector index
+ * @param sequence The sequence number of the sector
+ * @return bool True if the sector is in use
+ */
+static bool _flash_log_read_sector(FlashLog_t *log, uint32_t sector, uint32_t *sequence)
+{
+    FlashLogSectorHeader_t header;
+    if (log->device->read(log->device->arg, sector * log->device->sectorSize, &header, sizeof(header)) != 0)
+    {
+        log->stats.errors++;
+        return false;
+    }
+
+    if (header.magic != FLASH_LOG_SECTOR_MAGIC || header.crc != crc32_update(0, &header, offsetof(FlashLogSectorHeader_t, crc)))
+    {
+        return false;
+    }
+
+    *sequence = header.sequence;
+    return true;
+}
+
+/**
+ * @brief Read and check the record at an offset
+ * @param log The log
+ * @param offset Offset of the record
+ * @param header The record header
+ * @return int 1 if the record is valid, 0 if the sector has no more records, -1 if the record is corrupt
+ */
+static int _flash_log_check(FlashLog_t *log, uint32_t offset, FlashLogRecordHeader_t *header)
+{
+    uint32_t sectorEnd = _flash_log_sector_start(log, offset) + log->device->sectorSize;
+    if (offset + sizeof(FlashLogRecordHeader_t) > sectorEnd)
+    {
+        return 0;
+    }
+
+    if (log->device->read(log->device->arg, offset, header, sizeof(FlashLogRecordHeader_t)) != 0)
+    {
+        log->stats.errors++;
+        return -1;
+    }
+
+    if (header->len == FLASH_LOG_ERASED_LEN)
+    {
+        return 0;
+    }
+
+    if (header->len > FLASH_LOG_MAX_PAYLOAD || offset + FLASH_LOG_ALIGN(sizeof(FlashLogRecordHeader_t) + header->len) > sectorEnd)
+    {
+        return -1;
+    }
+
+    /** CRC the payload a page at a time */
+    uint32_t crc = _flash_log_record_crc(header);
+    uint32_t payloadOffset = offset + sizeof(FlashLogRecordHeader_t);
+    for (uint32_t done = 0; done < header->len;)
+    {
+        uint32_t chunk = header->len - done;
+        if (chunk > sizeof(log->page))
+        {
+            chunk = sizeof(log->page);
+        }
+        if (log->device->read(log->device->arg, payloadOffset + done, log->page, chunk) != 0)
+        {
+            log->stats.errors++;
+            return -1;
+        }
+        crc = crc32_update(crc, log->page, chunk);
+        done += chunk;
+    }
+
+    return crc == header->crc ? 1 : -1;
+}
+
+/**
+ * @brief Find the next valid record at or after an offset
+ * @param log The log
+ * @param offset Where to start
+ * @param skipConsumed Also skip the records already consumed
+ * @return uint32_t Offset of the record, writeOffset if there is none
+ */
+static uint32_t _flash_log_next(FlashLog_t *log, uint32_t offset, bool skipConsumed)
+{
+    /** Every sector is visited at most once */
+    for (uint32_t sectors = 0; offset != log->writeOffset && sectors <= log->sectorCount;)
+    {
+        if (offset % log->device->sectorSize == 0)
+        {
+            offset += sizeof(FlashLogSectorHeader_t);
+            continue;
+        }
+
+        FlashLogRecordHeader_t header;
+        int rc = _flash_log_check(log, offset, &header);
+        if (rc == 1 && !(skipConsumed && header.flag != FLASH_LOG_RECORD_LIVE))
+        {
+            return offset;
+        }
+
+        if (rc == 1)
+        {
+            offset = (offset + FLASH_LOG_ALIGN(sizeof(FlashLogRecordHeader_t) + header.len)) % log->device->size;
+        }
+        else
+        {
+            /** End of the sector or a corrupt record, carry on in the next sector */
+            offset = _flash_log_next_sector(log, offset);
+            sectors++;
+        }
+    }
+
+    return log->writeOffset;
+}
+
+/**
+ * @brief Erase a sector and make it the head, dropping the undelivered records it still held
+ * @param log The log
+ * @param offset Start of the sector
+ * @return int 0 on success, -1 on failure
+ */
+static int _flash_log_open_sector(FlashLog_t *log, uint32_t offset)
+{
+    bool empty = log->tailOffset == log->writeOffset;
+    bool readAtEnd = log->readOffset == log->writeOffset;
+    bool tailInSector = !empty && _flash_log_sector_start(log, log->tailOffset) == offset;
+    bool readInSector = !readAtEnd && _flash_log_sector_start(log, log->readOffset) == offset;
+
+    /** The ring wrapped onto the oldest records, count what is lost */
+    if (tailInSector)
+    {
+        for (uint32_t record = log->tailOffset; _flash_log_sector_start(log, record) == offset;)
+        {
+            FlashLogRecordHeader_t header;
+            if (_flash_log_check(log, record, &header) != 1)
+            {
+                break;
+            }
+            if (header.flag == FLASH_LOG_RECORD_LIVE)
+            {
+                log->pending--;
+                log->stats.dropped++;
+            }
+            record += FLASH_LOG_ALIGN(sizeof(FlashLogRecordHeader_t) + header.len);
+        }
+    }
+
+    /** Nothing is written to this sector until it has a valid header, a reset in between leaves it blank */
+    log->writeOffset = offset;
+    if (log->device->erase(log->device->arg, offset) != 0)
+    {
+        log->stats.errors++;
+        return -1;
+    }
+    log->stats.erases++;
+
+    FlashLogSectorHeader_t header = {
+        .magic = FLASH_LOG_SECTOR_MAGIC,
+        .sequence = log->nextSequence,
+        .reserved = 0xFFFFFFFFu,
+    };
+    header.crc = crc32_update(0, &header, offsetof(FlashLogSectorHeader_t, crc));
+
+    memset(log->page, 0xFF, sizeof(log->page));
+    memcpy(log->page, &header, sizeof(header));
+    if (log->device->program(log->device->arg, offset, log->page, FLASH_DEVICE_PAGE_SIZE) != 0)
+    {
+        log->stats.errors++;
+        return -1;
+    }
+    log->nextSequence++;
+    log->writeOffset = offset + sizeof(FlashLogSectorHeader_t);
+
+    if (empty)
+    {
+        log->tailOffset = log->writeOffset;
+    }
+    else if (tailInSector)
+    {
+        log->tailOffset = _flash_log_next(log, _flash_log_next_sector(log, offset), true);
+    }
+
+    if (readAtEnd)
+    {
+        log->readOffset = log->writeOffset;
+    }
+    else if (readInSector)
+    {
+        log->readOffset = log->tailOffset;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Program a record page by page, the bytes outside the record are programmed with 0xFF
+ * @param log The log
+ * @param offset Offset of the record
+ * @param header The record header
+ * @param payload The payload
+ * @return int 0 on success, -1 on failure
+ */
+static int _flash_log_program(FlashLog_t *log, uint32_t offset, const FlashLogRecordHeader_t *header, const uint8_t *payload)
+{
+    uint32_t end = offset + sizeof(FlashLogRecordHeader_t) + header->len;
+
+    for (uint32_t pageOffset = offset - offset % FLASH_DEVICE_PAGE_SIZE; pageOffset < end; pageOffset += FLASH_DEVICE_PAGE_SIZE)
+    {
+        memset(log->page, 0xFF, sizeof(log->page));
+
+        for (uint32_t i = 0; i < FLASH_DEVICE_PAGE_SIZE; i++)
+        {
+            uint32_t position = pageOffset + i;
+            if (position < offset || position >= end)
+            {
+                continue;
+            }
+
+            uint32_t index = position - offset;
+            log->page[i] = index < sizeof(FlashLogRecordHeader_t) ? ((const uint8_t *)header)[index]
+                                                                   : payload[index - sizeof(FlashLogRecordHeader_t)];
+        }
+
+        if (log->device->program(log->device->arg, pageOffset, log->page, FLASH_DEVICE_PAGE_SIZE) != 0)
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,132 @@
+/** Includes *************************************************************************************/
+#include "frame_codec.h"
+
+#include <stddef.h>
+#include <string.h>
+
+/** Defines **************************************************************************************/
+/** Typedefs *************************************************************************************/
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+static void _frame_decoder_next(FrameDecoder_t *decoder);
+
+/** Functions ************************************************************************************/
+
+void frame_encode_header(uint8_t *header, uint16_t len)
+{
+    header[0] = (uint8_t)(len >> 8);
+    header[1] = (uint8_t)len;
+}
+
+int frame_decoder_init(FrameDecoder_t *decoder, uint8_t *buffer, uint16_t size, FrameHandlerFn_t handler, void *arg)
+{
+    if (decoder == NULL || buffer == NULL || handler == NULL)
+    {
+        return -1;
+    }
+
+    memset(decoder, 0, sizeof(FrameDecoder_t));
+    decoder->buffer = buffer;
+    decoder->size = size;
+    decoder->handler = handler;
+    decoder->arg = arg;
+
+    return 0;
+}
+
+void frame_decoder_reset(FrameDecoder_t *decoder)
+{
+    if (decoder != NULL)
+    {
+        _frame_decoder_next(decoder);
+    }
+}
+
+uint16_t frame_decoder_consume(void *arg, const uint8_t *data, uint16_t len)
+{
+    FrameDecoder_t *decoder = (FrameDecoder_t *)arg;
+    if (decoder == NULL || data == NULL)
+    {
+        return 0;
+    }
+
+    uint16_t used = 0;
+    while (true)
+    {
+        /** A complete frame in the buffer goes first, it may have been held back on the last call */
+        if (decoder->headerLen == FRAME_HEADER_LEN && decoder->received == decoder->frameLen)
+        {
+            if (decoder->frameLen <= decoder->size)
+            {
+                if (!decoder->handler(decoder->arg, decoder->buffer, decoder->frameLen))
+                {
+                    return used;
+                }
+                decoder->stats.frames++;
+                decoder->stats.copied++;
+            }
+            _frame_decoder_next(decoder);
+        }
+
+        if (used == len)
+        {
+            return used;
+        }
+
+        if (decoder->headerLen < FRAME_HEADER_LEN)
+        {
+            /** Nothing buffered and the whole frame is in the span, hand it over in place */
+            uint16_t left = len - used;
+            if (decoder->headerLen == 0 && left >= FRAME_HEADER_LEN)
+            {
+                uint16_t frameLen = (uint16_t)(((uint16_t)data[used] << 8) | data[used + 1]);
+                if (left - FRAME_HEADER_LEN >= frameLen)
+                {
+                    if (!decoder->handler(decoder->arg, &data[used + FRAME_HEADER_LEN], frameLen))
+                    {
+                        return used;
+                    }
+                    decoder->stats.frames++;
+                    used += FRAME_HEADER_LEN + frameLen;
+                    continue;
+                }
+            }
+
+            decoder->header[decoder->headerLen++] = data[used++];
+            if (decoder->headerLen == FRAME_HEADER_LEN)
+            {
+                decoder->frameLen = (uint16_t)(((uint16_t)decoder->header[0] << 8) | decoder->header[1]);
+                decoder->received = 0;
+                if (decoder->frameLen > decoder->size)
+                {
+                    /** Read past it, the stream stays in step */
+                    decoder->stats.oversized++;
+                }
+            }
+            continue;
+        }
+
+        uint16_t take = decoder->frameLen - decoder->received;
+        if (take > len - used)
+        {
+            take = len - used;
+        }
+        if (decoder->frameLen <= decoder->size)
+        {
+            memcpy(&decoder->buffer[decoder->received], &data[used], take);
+        }
+        decoder->received += take;
+        used += take;
+    }
+}
+
+/**
+ * @brief Start over with the header of the next frame
+ * @param decoder The decoder
+ */
+static void _frame_decoder_next(FrameDecoder_t *decoder)
+{
+    decoder->headerLen = 0;
+    decoder->frameLen = 0;
+    decoder->received = 0;
+}
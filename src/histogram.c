@@ -0,0 +1,72 @@
+/** Includes *************************************************************************************/
+#include "histogram.h"
+
+#include <stddef.h>
+#include <string.h>
+
+/** Defines **************************************************************************************/
+/** Typedefs *************************************************************************************/
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+/** Functions ************************************************************************************/
+
+void histogram_reset(Histogram_t *histogram)
+{
+    if (histogram != NULL)
+    {
+        memset(histogram, 0, sizeof(Histogram_t));
+    }
+}
+
+void histogram_add(Histogram_t *histogram, uint32_t value)
+{
+    if (histogram == NULL)
+    {
+        return;
+    }
+
+    histogram->buckets[histogram_bucket(value)]++;
+    histogram->count++;
+    histogram->sum += value;
+    if (value > histogram->max)
+    {
+        histogram->max = value;
+    }
+}
+
+uint32_t histogram_percentile(const Histogram_t *histogram, uint8_t percent)
+{
+    if (histogram == NULL || histogram->count == 0)
+    {
+        return 0;
+    }
+
+    /** Rank of the value, rounded up so the 100th percentile is the last one */
+    uint64_t rank = ((uint64_t)histogram->count * (percent > 100 ? 100 : percent) + 99) / 100;
+    if (rank == 0)
+    {
+        rank = 1;
+    }
+
+    uint64_t seen = 0;
+    for (uint8_t i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        seen += histogram->buckets[i];
+        if (seen >= rank)
+        {
+            /** Upper bound of the bucket, the last one has none */
+            uint32_t bound = i == 0 ? 0 : (i < HISTOGRAM_BUCKETS - 1 ? (1u << i) - 1 : histogram->max);
+            return bound < histogram->max ? bound : histogram->max;
+        }
+    }
+
+    return histogram->max;
+}
+
+uint8_t histogram_bucket(uint32_t value)
+{
+    /** The bit length of the value */
+    uint8_t bucket = value == 0 ? 0 : (uint8_t)(32 - __builtin_clz(value));
+
+    return bucket < HISTOGRAM_BUCKETS ? bucket : HISTOGRAM_BUCKETS - 1;
+}
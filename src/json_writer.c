@@ -0,0 +1,249 @@
+/** Includes *************************************************************************************/
+#include "json_writer.h"
+
+#include <stddef.h>
+#include <string.h>
+
+/** Defines **************************************************************************************/
+/** Digits of the largest uint32_t */
+#define JSON_WRITER_MAX_DIGITS 10
+
+/** Typedefs *************************************************************************************/
+/** Variables ************************************************************************************/
+static const uint32_t JsonWriterPow10[] = {1u, 10u, 100u, 1000u, 10000u, 100000u, 1000000u, 10000000u, 100000000u, 1000000000u};
+
+/** Prototypes ***********************************************************************************/
+static void _json_writer_put(JsonWriter_t *writer, const char *data, uint16_t len);
+static void _json_writer_separator(JsonWriter_t *writer);
+static void _json_writer_begin(JsonWriter_t *writer, char open);
+static void _json_writer_end(JsonWriter_t *writer, char close);
+static void _json_writer_uint(JsonWriter_t *writer, uint32_t value, uint8_t minDigits);
+static void _json_writer_escaped(JsonWriter_t *writer, const char *text);
+
+/** Functions ************************************************************************************/
+
+void json_writer_init(JsonWriter_t *writer, char *buffer, uint16_t size)
+{
+    memset(writer, 0, sizeof(JsonWriter_t));
+    writer->buffer = buffer;
+    writer->size = size;
+    writer->failed = buffer == NULL;
+}
+
+void json_writer_begin_object(JsonWriter_t *writer)
+{
+    _json_writer_begin(writer, '{');
+}
+
+void json_writer_end_object(JsonWriter_t *writer)
+{
+    _json_writer_end(writer, '}');
+}
+
+void json_writer_begin_array(JsonWriter_t *writer)
+{
+    _json_writer_begin(writer, '[');
+}
+
+void json_writer_end_array(JsonWriter_t *writer)
+{
+    _json_writer_end(writer, ']');
+}
+
+void json_writer_key(JsonWriter_t *writer, const char *key)
+{
+    _json_writer_separator(writer);
+    _json_writer_escaped(writer, key);
+    _json_writer_put(writer, ":", 1);
+    writer->afterKey = true;
+}
+
+void json_writer_int(JsonWriter_t *writer, int32_t value)
+{
+    json_writer_fixed(writer, value, 0);
+}
+
+void json_writer_fixed(JsonWriter_t *writer, int32_t value, uint8_t decimals)
+{
+    if (decimals >= sizeof(JsonWriterPow10) / sizeof(JsonWriterPow10[0]))
+    {
+        writer->failed = true;
+        return;
+    }
+
+    _json_writer_separator(writer);
+
+    /** Work on the magnitude, INT32_MIN has no positive counterpart in 32 bits */
+    uint32_t magnitude = value < 0 ? 0u - (uint32_t)value : (uint32_t)value;
+    if (value < 0)
+    {
+        _json_writer_put(writer, "-", 1);
+    }
+
+    _json_writer_uint(writer, magnitude / JsonWriterPow10[decimals], 1);
+    if (decimals > 0)
+    {
+        _json_writer_put(writer, ".", 1);
+        _json_writer_uint(writer, magnitude % JsonWriterPow10[decimals], decimals);
+    }
+}
+
+void json_writer_bool(JsonWriter_t *writer, bool value)
+{
+    _json_writer_separator(writer);
+    if (value)
+    {
+        _json_writer_put(writer, "true", 4);
+    }
+    else
+    {
+        _json_writer_put(writer, "false", 5);
+    }
+}
+
+void json_writer_null(JsonWriter_t *writer)
+{
+    _json_writer_separator(writer);
+    _json_writer_put(writer, "null", 4);
+}
+
+void json_writer_string(JsonWriter_t *writer, const char *value)
+{
+    _json_writer_separator(writer);
+    _json_writer_escaped(writer, value);
+}
+
+int json_writer_finish(const JsonWriter_t *writer)
+{
+    if (writer->failed || writer->depth != 0 || writer->afterKey)
+    {
+        return -1;
+    }
+
+    return writer->len;
+}
+
+/**
+ * @brief Append raw characters, marks the writer failed instead of writing past the end
+ */
+static void _json_writer_put(JsonWriter_t *writer, const char *data, uint16_t len)
+{
+    if (writer->failed || len > writer->size - writer->len)
+    {
+        writer->failed = true;
+        return;
+    }
+
+    memcpy(&writer->buffer[writer->len], data, len);
+    writer->len += len;
+}
+
+/**
+ * @brief Write the comma before a value or key when the container already has an item
+ */
+static void _json_writer_separator(JsonWriter_t *writer)
+{
+    if (writer->afterKey)
+    {
+        writer->afterKey = false;
+        return;
+    }
+
+    uint32_t bit = 1u << writer->depth;
+    if (writer->hasItems & bit)
+    {
+        _json_writer_put(writer, ",", 1);
+    }
+    writer->hasItems |= bit;
+}
+
+static void _json_writer_begin(JsonWriter_t *writer, char open)
+{
+    _json_writer_separator(writer);
+    if (writer->depth >= JSON_WRITER_MAX_DEPTH)
+    {
+        writer->failed = true;
+        return;
+    }
+
+    _json_writer_put(writer, &open, 1);
+    writer->depth++;
+    writer->hasItems &= ~(1u << writer->depth);
+}
+
+static void _json_writer_end(JsonWriter_t *writer, char close)
+{
+    if (writer->depth == 0 || writer->afterKey)
+    {
+        writer->failed = true;
+        return;
+    }
+
+    writer->depth--;
+    _json_writer_put(writer, &close, 1);
+}
+
+/**
+ * @brief Write an unsigned integer
+ * @param writer The writer
+ * @param value The value
+ * @param minDigits Pad with leading zeros up to this many digits
+ */
+static void _json_writer_uint(JsonWriter_t *writer, uint32_t value, uint8_t minDigits)
+{
+    /** Digits come out backwards, fill the scratch buffer from its end */
+    char digits[JSON_WRITER_MAX_DIGITS];
+    uint8_t count = 0;
+
+    do
+    {
+        digits[JSON_WRITER_MAX_DIGITS - 1 - count] = (char)('0' + value % 10u);
+        value /= 10u;
+        count++;
+    } while (value != 0 || count < minDigits);
+
+    _json_writer_put(writer, &digits[JSON_WRITER_MAX_DIGITS - count], count);
+}
+
+/**
+ * @brief Write a quoted string, escaping quotes, backslashes and control characters
+ */
+static void _json_writer_escaped(JsonWriter_t *writer, const char *text)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    _json_writer_put(writer, "\"", 1);
+
+    /** Copy the runs that need no escaping in one go */
+    const char *run = text;
+    for (const char *c = text;; c++)
+    {
+        unsigned char ch = (unsigned char)*c;
+        if (ch != '\0' && ch != '"' && ch != '\\' && ch >= 0x20)
+        {
+            continue;
+        }
+
+        _json_writer_put(writer, run, (uint16_t)(c - run));
+        if (ch == '\0')
+        {
+            break;
+        }
+
+        char escape[6] = {'\\', (char)ch, 0, 0, 0, 0};
+        uint16_t escapeLen = 2;
+        if (ch < 0x20)
+        {
+            escape[1] = 'u';
+            escape[2] = '0';
+            escape[3] = '0';
+            escape[4] = hex[ch >> 4];
+            escape[5] = hex[ch & 0x0F];
+            escapeLen = 6;
+        }
+        _json_writer_put(writer, escape, escapeLen);
+        run = c + 1;
+    }
+
+    _json_writer_put(writer, "\"", 1);
+}
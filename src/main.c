@@ -2,11 +2,21 @@
 #include <stdio.h>
 #include "pico/stdlib.h"
 #include "pico/cyw43_arch.h"
-#include "hardware/adc.h"
 
+#include "app_core.h"
 #include "mqtt_client.h"
+#include "power.h"
+#include "scheduler.h"
 #include "wifi.h"
 
+#if MQTT_TLS
+#include "mqtt_tls_ca.h"
+#endif
+
+#if TCP_CLIENT
+#include "client.h"
+#endif
+
 #ifdef CYW43_WL_GPIO_LED_PIN
 #include "pico/cyw43_arch.h"
 #endif
@@ -16,6 +26,9 @@
 #define LED_DELAY_MS 250
 #endif
 
+/** Bytes echoed back to the TCP server per run of the TCP client task */
+#define TCP_CLIENT_ECHO_SIZE 512
+
 /** Typedefs *************************************************************************************/
 /** Variables ************************************************************************************/
 /** Prototypes ***********************************************************************************/
@@ -24,6 +37,13 @@ void pico_set_led(bool led_on);
 
 int led_task(void);
 
+static int _wifi_task(void *arg);
+static int _led_task(void *arg);
+static int _mqtt_task(void *arg);
+#if TCP_CLIENT
+static int _tcp_client_task(void *arg);
+#endif
+
 /** Functions ************************************************************************************/
 
 int main()
@@ -33,9 +53,6 @@ int main()
 
     /** Initial sleep to give the user time to plug in an connect to the COM port */
     sleep_ms(5000);
-    adc_init();
-    adc_set_temp_sensor_enabled(true);
-    adc_select_input(4);
 
     /** Initialise the LED */
     // TODO: CH - There is a bug in the driver that when running cyw43_arch_init() twice
@@ -56,76 +73,228 @@ int main()
 
     printf("Wi-Fi initialised\n");
 
-    /** Initialise the client with the server IP address */
-    /** Ensure that the client data is initialised to 0 */
+#if POWER_SAVE
+    /** The radio sleeps between beacons and listens once per cycle at most, see power.h */
+    wifi_set_power_management(cyw43_pm_value(CYW43_PM2_POWERSAVE_MODE, POWER_RADIO_SLEEP_RET_MS, 1,
+                                             power_listen_interval(MQTT_PUBLISH_CYCLE_MS), POWER_RADIO_MAX_LISTEN_INTERVAL));
+#endif
+
+    /** The offline store is at the end of the on-board flash, the client runs without it if it does not fit */
+    static FlashDevice_t storeDevice = {0};
+    const bool storeAvailable = flash_device_pico_init(&storeDevice) == 0;
+    if (!storeAvailable)
+    {
+        printf("No room for the flash store\n");
+    }
+
+    /** Initialise the client data and its publish queue */
     static MqttClientData_t client = {0};
-    // if (client_init(&client, SERVER_IP) != 0)
-    // {
-    //     printf("Failed to initialise client\n");
-    //     return -1;
-    // }
+    const MqttClientConfig_t clientConfig = {
+        .clientId = CLIENT_ID,
+        .serverIp = SERVER_IP,
+        .port = MQTT_PORT,
+        .store = storeAvailable ? &storeDevice : NULL,
+#if MQTT_TLS
+        .caCert = (const uint8_t *)mqttTlsCaCert,
+        .caCertLen = sizeof(mqttTlsCaCert),
+        .serverName = MQTT_TLS_SERVER_NAME,
+#endif
+    };
+    if (mqtt_client_init(&client, &clientConfig) != 0)
+    {
+        printf("Failed to initialise client\n");
+        return -1;
+    }
 
     printf("Client initialised\n");
 
+    /** Register the tasks, they all run once straight away and then on their own deadlines */
+    if (scheduler_init() != 0)
+    {
+        printf("Failed to initialise scheduler\n");
+        return -1;
+    }
+
+    scheduler_add_task(_wifi_task, NULL, WIFI_TASK_INTERVAL_MS);
+    scheduler_add_task(_led_task, NULL, LED_DELAY_MS);
+    client.taskId = scheduler_add_task(_mqtt_task, &client, MQTT_CLIENT_TASK_TIMEOUT_ms);
+
+#if TCP_CLIENT
+    /** The raw TCP client echoes what the server sends, one task runs it, reads and writes */
+    static client_t tcpClient = {0};
+    if (client_init(&tcpClient, SERVER_IP) != 0)
+    {
+        printf("Failed to initialise TCP client\n");
+        return -1;
+    }
+    int tcpTaskId = scheduler_add_task(_tcp_client_task, &tcpClient, CLIENT_TASK_TIMEOUT_MS);
+    client_set_tasks(&tcpClient, tcpTaskId, tcpTaskId);
+#endif
+
+    /**
+     * Start the acquisition and hand it to core 1 with the encoding and the commands, this core
+     * keeps Wi-Fi, lwIP and MQTT. Core 1 wakes the client when samples are ready.
+     */
+    static AppCore_t app = {0};
+    const AdcSamplerConfig_t samplerConfig = {
+        .input = ADC_SAMPLER_TEMP_INPUT,
+        .outputPeriodMs = MQTT_SAMPLE_INTERVAL_MS,
+        .extraBits = MQTT_SAMPLE_EXTRA_BITS,
+    };
+    if (app_core_init(&app, &samplerConfig, client.taskId) != 0)
+    {
+        printf("Failed to initialise application\n");
+        return -1;
+    }
+    client.app = &app;
+    if (app_core_launch(&app) != 0)
+    {
+        printf("Failed to start core 1\n");
+        return -1;
+    }
+
+    /** The awake time per publish cycle goes out with the client stats */
+    static Power_t power = {0};
+    const PowerConfig_t powerConfig = {
+        .cycleMs = MQTT_PUBLISH_CYCLE_MS,
+        .slackMs = POWER_TIMER_SLACK_MS,
+    };
+    power_init(&power, &powerConfig, time_us_64());
+    client.power = &power;
+
     while (true)
     {
-        /** Run the wifi task to check if we are connected */
-        wifi_task();
+        /** Process any new info on the lower driver, this runs the lwIP callbacks */
+        cyw43_arch_poll();
 
-        /**
-         * Check if the wifi task state is connected.
-         * LED should be on if connected and blinking if not connected.
-         */
-        if (wifi_get_state() == WIFI_TASK_CONNECTED)
-        {
-            /** Set the LED on if connected */
-            pico_set_led(true);
-
-            /** Run the client task to check if we are connected */
-            if (mqtt_client_task(&client) != 0)
-            {
-                printf("Failed to run client task\n");
-            }
-
-            /** Check if we have data */
-            // if (client.buffer_len > 0)
-            // {
-            //     printf("Received data: %s\n", client.buffer);
-            //     memset(client.buffer, 0, sizeof(client.buffer)); // Clear the buffer
-            //     client.buffer_len = 0;                           // Reset the buffer length after processing
-            // }
-        }
-        else
-        {
-            /** Set the client task to disconnected */
-            client.taskState = MQTT_CLIENT_DISCONNECTED;
-            /** Blink the LED if not connected */
-            led_task();
-        }
+        /** Run the tasks that are due or were woken by the callbacks */
+        uint64_t nextDeadlineUs = scheduler_run();
 
-        /** Sleep for 10ms */
-        sleep_ms(10);
+        /** Sleep on the timer until the next deadline, or until the driver or a callback has work for us */
+        uint64_t wakeUs = power_sleep(&power, time_us_64(), nextDeadlineUs);
+        bool slept = scheduler_wait_until(wakeUs);
+        power_wake(&power, time_us_64(), slept);
     }
 }
 
 /**
- * @brief A simple LED task to blink the LED on and off every LED_DELAY_MS milliseconds.
+ * @brief Scheduler wrapper for the wifi task.
+ * @param arg Unused.
  * @return int 0 on success, -1 on failure.
  */
-int led_task(void)
+static int _wifi_task(void *arg)
 {
-    static bool led_on = false;
-    static uint32_t timeLastRunMs = 0;
-    uint32_t currentTimeMs = to_ms_since_boot(get_absolute_time());
+    (void)arg;
+    return wifi_task();
+}
 
-    if (currentTimeMs - timeLastRunMs < LED_DELAY_MS)
+/**
+ * @brief Scheduler wrapper for the LED task.
+ * @param arg Unused.
+ * @return int 0 on success, -1 on failure.
+ */
+static int _led_task(void *arg)
+{
+    (void)arg;
+    return led_task();
+}
+
+/**
+ * @brief Scheduler wrapper for the mqtt client task.
+ * Only runs the client while the wifi is connected, samples are stored while it is not.
+ * @param arg Pointer to the MqttClientData_t.
+ * @return int 0 on success, -1 on failure.
+ */
+static int _mqtt_task(void *arg)
+{
+    MqttClientData_t *client = (MqttClientData_t *)arg;
+
+    /** Check if the wifi task state is connected */
+    if (wifi_get_state() != WIFI_TASK_CONNECTED)
+    {
+        /** Set the client task to disconnected and keep recording the samples */
+        client->taskState = MQTT_CLIENT_DISCONNECTED;
+        return mqtt_client_offline_task(client);
+    }
+
+    /** Run the client task to check if we are connected */
+    if (mqtt_client_task(client) != 0)
+    {
+        printf("Failed to run client task\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+#if TCP_CLIENT
+/**
+ * @brief Scheduler wrapper for the raw TCP client task.
+ * Runs the connection and echoes the received data back, what the transmit ring does not take
+ * is kept and written on the next run, the client wakes the task once there is room.
+ * @param arg Pointer to the client_t.
+ * @return int 0 on success, -1 on failure.
+ */
+static int _tcp_client_task(void *arg)
+{
+    client_t *client = (client_t *)arg;
+    static uint8_t echo[TCP_CLIENT_ECHO_SIZE];
+    static uint32_t echoLen = 0;
+    static uint32_t echoSent = 0;
+
+    if (wifi_get_state() != WIFI_TASK_CONNECTED)
     {
         return 0;
     }
-    timeLastRunMs = currentTimeMs;
 
-    led_on = !led_on;
-    pico_set_led(led_on);
+    if (client_task(client) != 0)
+    {
+        return -1;
+    }
+
+    if (echoSent == echoLen)
+    {
+        echoLen = client_read(client, echo, sizeof(echo));
+        echoSent = 0;
+    }
+    if (echoSent < echoLen)
+    {
+        echoSent += client_write(client, &echo[echoSent], echoLen - echoSent, CLIENT_WRITE_PUSH);
+    }
+
+    return 0;
+}
+#endif
+
+/**
+ * @brief A simple LED task.
+ * LED should be on if the wifi is connected and blinking every LED_DELAY_MS milliseconds if not.
+ * The task is dispatched by the scheduler every LED_DELAY_MS milliseconds.
+ * In POWER_SAVE the LED is off while connected and only checked once per publish cycle, setting
+ * it is a transfer to the radio chip.
+ * @return int 0 on success, -1 on failure.
+ */
+int led_task(void)
+{
+    static bool led_on = false;
+
+    if (wifi_get_state() == WIFI_TASK_CONNECTED)
+    {
+        const bool connectedLed = !POWER_SAVE;
+        if (led_on != connectedLed)
+        {
+            led_on = connectedLed;
+            pico_set_led(led_on);
+        }
+#if POWER_SAVE
+        scheduler_delay(scheduler_current_task(), MQTT_PUBLISH_CYCLE_MS);
+#endif
+    }
+    else
+    {
+        led_on = !led_on;
+        pico_set_led(led_on);
+    }
 
     return 0;
 }
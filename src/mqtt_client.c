@@ -1,12 +1,44 @@
 /** Includes *************************************************************************************/
 #include "mqtt_client.h"
+#include "json_writer.h"
+#include "pool_stats.h"
+#include "scheduler.h"
+
+#include "lwip/init.h"
+#include "pico/rand.h"
 
-#include "hardware/adc.h"
 /** Defines **************************************************************************************/
+/** MQTT 3.1.1 packet bytes used to ask for and detect a persistent session */
+#define MQTT_CONNECT_PACKET 0x10
+#define MQTT_CONNACK_PACKET 0x20
+#define MQTT_CONNECT_NAME_LEVEL_LEN 7 /** Length prefixed "MQTT" and the protocol level */
+#define MQTT_CONNECT_FLAG_CLEAN 0x02
+#define MQTT_CONNACK_FLAG_SESSION_PRESENT 0x01
+
+/**
+ * request_persistent_session() and mqtt_connection_cb() use the output ring and the receive
+ * buffer of the mqtt_client_t in mqtt_priv.h, as lwIP 2.1 and 2.2 lay them out. Check them
+ * against mqtt.c before allowing another version here.
+ */
+#if LWIP_VERSION_MAJOR != 2 || LWIP_VERSION_MINOR < 1 || LWIP_VERSION_MINOR > 2
+#error "request_persistent_session() and the session present check are not verified for this lwIP version"
+#endif
+_Static_assert(sizeof(((mqtt_client_t *)0)->rx_buffer) == MQTT_VAR_HEADER_BUFFER_LEN && MQTT_VAR_HEADER_BUFFER_LEN >= 4,
+               "The CONNACK is read from the receive buffer of the client");
+_Static_assert(sizeof(((mqtt_client_t *)0)->output.buf) == MQTT_OUTPUT_RINGBUF_SIZE,
+               "The CONNECT is patched in the output ring of the client");
+
 /** Typedefs *************************************************************************************/
-#define MQTT_TEMPERATURE_TOPIC CLIENT_ID "/temperature"
 #define MQTT_LED_TOPIC CLIENT_ID "/led"
 /** Variables ************************************************************************************/
+/** Topic levels below the client id indexed by MqttTopic_t */
+static const char *MqttTopicLevels[MQTT_TOPIC_MAX] = {
+    [MQTT_TOPIC_BOOT] = MQTT_BOOT_LEVEL,
+    [MQTT_TOPIC_TEMP] = MQTT_TEMPERATURE_LEVEL,
+    [MQTT_TOPIC_HUMIDITY] = MQTT_HUMIDITY_LEVEL,
+    [MQTT_TOPIC_PRESSURE] = MQTT_PRESSURE_LEVEL,
+};
+
 /** Prototypes ***********************************************************************************/
 /** Functions ************************************************************************************/
 
@@ -43,38 +75,502 @@
 #define ERROR_printf printf
 #endif
 
-/* References for this implementation:
- * raspberry-pi-pico-c-sdk.pdf, Section '4.1.1. hardware_adc'
- * pico-examples/adc/adc_console/adc_console.c */
- static float read_onboard_temperature_c(const char unit) {
+/**
+ * @brief Count the outcome of a QoS 1 publish and time its PUBACK
+ * @param state The client data structure
+ * @param sentUs When the publish was handed to lwIP
+ * @param err The result passed to the request callback
+ */
+static void record_puback(MqttClientData_t *state, uint64_t sentUs, err_t err)
+{
+    if (err == ERR_OK)
+    {
+        state->stats.pubacks++;
+        histogram_add(&state->stats.pubackUs, (uint32_t)(time_us_64() - sentUs));
+    }
+    else if (err == ERR_TIMEOUT)
+    {
+        state->stats.pubTimeouts++;
+    }
+    else
+    {
+        state->stats.pubErrors++;
+    }
+}
+
+/**
+ * @brief Find the tracking of a QoS 1 publish
+ * @param state The client data structure
+ * @param id The handle
+ * @return MqttPublishHandle_t* The tracking, NULL if the handle is unknown or was reused
+ */
+static MqttPublishHandle_t *get_handle(MqttClientData_t *state, uint32_t id)
+{
+    MqttPublishHandle_t *handle = &state->handles[id % MQTT_PUBLISH_HANDLES];
+    return id != 0 && handle->id == id ? handle : NULL;
+}
+
+/**
+ * @brief Record the outcome of a QoS 1 publish and deliver the completions that are now in order
+ * @param state The client data structure
+ * @param id The handle
+ * @param result The outcome
+ */
+static void complete_publish(MqttClientData_t *state, uint32_t id, MqttPublishResult_t result)
+{
+    MqttPublishHandle_t *handle = get_handle(state, id);
+    if (handle == NULL || handle->result != MQTT_PUBLISH_PENDING)
+    {
+        return;
+    }
+    handle->result = result;
+    handle->doneUs = time_us_64();
 
-    /* 12-bit conversion, assume max value == ADC_VREF == 3.3 V */
-    const float conversionFactor = 3.3f / (1 << 12);
+    /** Up to the oldest publish still pending, the done function may publish again */
+    while (state->doneHandle != state->nextHandle)
+    {
+        handle = &state->handles[state->doneHandle % MQTT_PUBLISH_HANDLES];
+        if (handle->result == MQTT_PUBLISH_PENDING)
+        {
+            break;
+        }
+        state->doneHandle++;
+        if (state->publishDone != NULL)
+        {
+            state->publishDone(state->publishDoneArg, handle);
+        }
+    }
+}
 
-    float adc = (float)adc_read() * conversionFactor;
-    float tempC = 27.0f - (adc - 0.706f) / 0.001721f;
+/**
+ * @brief Give up on a live publish once it was sent MQTT_PUBLISH_MAX_ATTEMPTS times
+ * @param state The client data structure
+ * @param slot The slot of the publish
+ * @return bool True if the publish expired and the slot was freed
+ */
+static bool expire_inflight(MqttClientData_t *state, MqttInflightSlot_t *slot)
+{
+#if MQTT_PUBLISH_MAX_ATTEMPTS > 0
+    const MqttPublishHandle_t *handle = get_handle(state, slot->id);
+    if (handle == NULL || handle->attempts < MQTT_PUBLISH_MAX_ATTEMPTS)
+    {
+        return false;
+    }
 
-    return tempC;
+    ERROR_printf("Giving up on publish %lu to %s\n", (unsigned long)slot->id, slot->topic);
+    state->stats.pubExpired++;
+    slot->used = false;
+    complete_publish(state, slot->id, MQTT_PUBLISH_EXPIRED);
+    return true;
+#else
+    /** Retried until acknowledged */
+    (void)state;
+    (void)slot;
+    return false;
+#endif
 }
 
-static void pub_request_cb(__unused void *arg, err_t err)
+/**
+ * @brief Request callback of a live publish, the slot is freed once the broker acknowledged it
+ * @param arg The MqttInflightSlot_t the publish was sent from
+ * @param err ERR_OK on PUBACK, an error on timeout
+ */
+static void pub_request_cb(void *arg, err_t err)
 {
-    if (err != 0)
+    MqttInflightSlot_t *slot = (MqttInflightSlot_t *)arg;
+    MqttClientData_t *state = slot->client;
+    record_puback(state, slot->sentUs, err);
+
+    if (err == ERR_OK)
+    {
+        slot->used = false;
+        complete_publish(state, slot->id, MQTT_PUBLISH_ACKED);
+        if (outbox_pending(&state->outbox) != 0)
+        {
+            /** The outbox waits for a free slot */
+            scheduler_wake(state->taskId);
+        }
+        return;
+    }
+
+    ERROR_printf("pub_request_cb failed %d\n", err);
+    if (!expire_inflight(state, slot))
     {
-        ERROR_printf("pub_request_cb failed %d", err);
+        /** Send it again, QoS 1 allows the duplicate */
+        slot->sent = false;
     }
+    scheduler_wake(state->taskId);
 }
 
-static void sub_request_cb(void *arg, err_t err)
+/**
+ * @brief Hand a live publish to lwIP, a retransmission keeps the packet id of the first attempt
+ * @param state The client data structure
+ * @param slot The slot of the publish
+ * @return err_t ERR_OK once queued in lwIP, ERR_MEM if its output buffer or request queue is full
+ */
+static err_t publish_inflight(MqttClientData_t *state, MqttInflightSlot_t *slot)
+{
+    mqtt_client_t *client = state->mqttClientInst;
+    MqttPublishHandle_t *handle = get_handle(state, slot->id);
+
+    /**
+     * lwIP numbers the publish with the packet id after pkt_id_seq, see mqtt_priv.h. It writes
+     * and sends the fixed header in the same call, so the DUP flag of a retransmission stays 0.
+     */
+    uint16_t packetIdSeq = client->pkt_id_seq;
+    bool retransmit = handle != NULL && handle->attempts > 0;
+    if (retransmit)
+    {
+        client->pkt_id_seq = handle->packetId - 1;
+    }
+
+    slot->sentUs = time_us_64();
+    err_t err = mqtt_publish(client, slot->topic, slot->payload, slot->len, 1, MQTT_PUBLISH_RETAIN, pub_request_cb, slot);
+    if (retransmit)
+    {
+        client->pkt_id_seq = packetIdSeq;
+    }
+    if (err != ERR_OK)
+    {
+        state->stats.pubRefused++;
+        return err;
+    }
+    state->stats.published++;
+    slot->sent = true;
+
+    if (handle != NULL)
+    {
+        if (!retransmit)
+        {
+            handle->packetId = client->pkt_id_seq;
+            handle->firstSentUs = slot->sentUs;
+        }
+        if (handle->attempts < UINT8_MAX)
+        {
+            handle->attempts++;
+        }
+    }
+
+    return ERR_OK;
+}
+
+/**
+ * @brief Check whether the client has a connection to publish on
+ * @param state The client data structure
+ * @return bool True once connected, until the connection drops
+ */
+static bool is_online(const MqttClientData_t *state)
+{
+    return (state->taskState == MQTT_CLIENT_CONNECTED || state->taskState == MQTT_CLIENT_SUBSCRIBED) && state->mqttClientInst != NULL;
+}
+
+/**
+ * @brief Queue a publish in the outbox without waking the task, for the callers running in it
+ * @param state The client data structure
+ * @param priority The queue
+ * @param topic The topic, must outlive the publish
+ * @param payload The payload
+ * @param len Length of the payload
+ * @param qos 0 or 1
+ * @param handle Set to the handle of a QoS 1 publish that was taken, 0 otherwise, may be NULL
+ * @return OutboxStatus_t Whether the publish was taken
+ */
+static OutboxStatus_t queue_publish(MqttClientData_t *state, OutboxPriority_t priority, const char *topic,
+                                    const void *payload, uint16_t len, uint8_t qos, uint32_t *handle)
+{
+    if (handle != NULL)
+    {
+        *handle = 0;
+    }
+
+    /** A QoS 1 publish has to fit in an in-flight slot once it is sent */
+    if (qos > 1 || (qos == 1 && len > sizeof(state->inflight[0].payload)))
+    {
+        return OUTBOX_REJECTED;
+    }
+
+    uint32_t id = 0;
+    if (qos == 1)
+    {
+        if (state->nextHandle - state->doneHandle >= MQTT_PUBLISH_HANDLES)
+        {
+            /** Every handle waits for an older publish to complete */
+            return OUTBOX_BLOCKED;
+        }
+        id = state->nextHandle;
+    }
+
+    uint32_t nowMs = to_ms_since_boot(get_absolute_time());
+    OutboxStatus_t status = outbox_publish(&state->outbox, priority, topic, payload, len, qos, id, nowMs);
+    if (status != OUTBOX_QUEUED || id == 0)
+    {
+        return status;
+    }
+
+    state->handles[id % MQTT_PUBLISH_HANDLES] = (MqttPublishHandle_t){
+        .id = id,
+        .topic = topic,
+        .result = MQTT_PUBLISH_PENDING,
+        .queuedMs = nowMs,
+    };
+    state->nextHandle++;
+    if (handle != NULL)
+    {
+        *handle = id;
+    }
+
+    return status;
+}
+
+/**
+ * @brief Send function of the outbox, hands an entry to lwIP
+ * @param arg Pointer to the MqttClientData_t
+ * @param entry The entry
+ * @return int 0 when sent, -1 if lwIP or the in-flight window has no room, the entry stays queued
+ */
+static int outbox_send_cb(void *arg, const OutboxEntry_t *entry)
 {
     MqttClientData_t *state = (MqttClientData_t *)arg;
-    if (err != 0)
+
+    if (entry->qos == 0)
+    {
+        /** lwIP copies the payload and forgets about it */
+        err_t err = mqtt_publish(state->mqttClientInst, entry->topic, entry->payload, entry->len, 0, MQTT_PUBLISH_RETAIN, NULL, NULL);
+        if (err != ERR_OK)
+        {
+            state->stats.pubRefused++;
+            return -1;
+        }
+        return 0;
+    }
+
+    /** The publish is kept until its PUBACK so a reconnect does not lose it */
+    MqttInflightSlot_t *slot = NULL;
+    for (int i = 0; i < MQTT_INFLIGHT_WINDOW && slot == NULL; i++)
+    {
+        if (!state->inflight[i].used)
+        {
+            slot = &state->inflight[i];
+        }
+    }
+    if (slot == NULL)
+    {
+        return -1;
+    }
+
+    INFO_printf("Sending %d bytes to topic: %s\n", entry->len, entry->topic);
+    slot->client = state;
+    slot->id = entry->tag;
+    slot->topic = entry->topic;
+    slot->len = entry->len;
+    memcpy(slot->payload, entry->payload, entry->len);
+    if (publish_inflight(state, slot) != ERR_OK)
+    {
+        return -1;
+    }
+    slot->used = true;
+
+    return 0;
+}
+
+/**
+ * @brief Drop function of the outbox, completes the QoS 1 publishes that made room for newer ones
+ * @param arg Pointer to the MqttClientData_t
+ * @param entry The entry
+ */
+static void outbox_drop_cb(void *arg, const OutboxEntry_t *entry)
+{
+    complete_publish((MqttClientData_t *)arg, entry->tag, MQTT_PUBLISH_DROPPED);
+}
+
+/**
+ * @brief Publish a batch handed over by the publish queue
+ * @param arg Pointer to the MqttClientData_t
+ * @param topic The topic of the batch
+ * @param payload The payload
+ * @param len The length of the payload
+ * @return int 0 on success, -1 if the batch could not be queued and should be retried
+ */
+static int publish_queue_flush_cb(void *arg, MqttTopic_t topic, const char *payload, uint16_t len)
+{
+    MqttClientData_t *state = (MqttClientData_t *)arg;
+
+    if (is_online(state))
+    {
+        OutboxStatus_t status = queue_publish(state, OUTBOX_PRIORITY_NORMAL, state->topicNames[topic], payload, len, MQTT_PUBLISH_QOS, NULL);
+        if (status == OUTBOX_QUEUED)
+        {
+            return 0;
+        }
+        if (status == OUTBOX_BLOCKED)
+        {
+            /** The publish queue keeps the batch and tries again */
+            return -1;
+        }
+        /** Held back past MQTT_OUTBOX_BLOCK_MS, the link is too slow for the telemetry */
+    }
+
+    /** Offline or the outbox is overloaded, keep QoS >= 1 messages in flash until they can be replayed */
+    if (MQTT_PUBLISH_QOS == 0 || !state->storeReady)
+    {
+        return -1;
+    }
+    return flash_log_append(&state->store, (uint8_t)topic, payload, len, to_ms_since_boot(get_absolute_time()));
+}
+
+/**
+ * @brief Publish again the live publishes the previous connection dropped or that timed out
+ * @param state The client data structure
+ * @return uint32_t Milliseconds until the next try, UINT32_MAX if everything was sent
+ */
+static uint32_t resend_inflight(MqttClientData_t *state)
+{
+    for (int i = 0; i < MQTT_INFLIGHT_WINDOW; i++)
+    {
+        MqttInflightSlot_t *slot = &state->inflight[i];
+        if (!slot->used || slot->sent || expire_inflight(state, slot))
+        {
+            continue;
+        }
+
+        if (publish_inflight(state, slot) != ERR_OK)
+        {
+            /** ERR_MEM, the lwIP output buffer or request queue is full */
+            return MQTT_STORE_DRAIN_INTERVAL_MS;
+        }
+    }
+
+    return UINT32_MAX;
+}
+
+/**
+ * @brief Request callback of a replayed publish, the record is consumed once the broker acknowledged it
+ * @param arg The MqttStoreSlot_t the record was sent from
+ * @param err ERR_OK on PUBACK, an error on timeout
+ */
+static void store_pub_request_cb(void *arg, err_t err)
+{
+    MqttStoreSlot_t *slot = (MqttStoreSlot_t *)arg;
+    MqttClientData_t *state = slot->client;
+    record_puback(state, slot->sentUs, err);
+
+    if (err == ERR_OK)
     {
-        panic("subscribe request failed %d", err);
+        flash_log_consume(&state->store, slot->offset, slot->sequence);
     }
+    else
+    {
+        /** Send everything not acknowledged again, QoS 1 allows the duplicates */
+        ERROR_printf("Replayed publish failed %d\n", err);
+        flash_log_rewind(&state->store);
+    }
+    slot->used = false;
 
-    INFO_printf("Subscribed to topic\n");
-    state->subscribe_count++;
+    /** A slot is free, send the next record */
+    scheduler_wake(state->taskId);
+}
+
+/**
+ * @brief Replay the records of the flash store, at most MQTT_STORE_DRAIN_WINDOW unacknowledged at a time
+ * @param state The client data structure
+ * @return uint32_t Milliseconds until the store should be drained again, UINT32_MAX if it is empty
+ */
+static uint32_t drain_store(MqttClientData_t *state)
+{
+    if (!state->storeReady || flash_log_pending(&state->store) == 0)
+    {
+        return UINT32_MAX;
+    }
+
+    for (int i = 0; i < MQTT_STORE_DRAIN_WINDOW; i++)
+    {
+        MqttStoreSlot_t *slot = &state->storeSlots[i];
+        if (slot->used)
+        {
+            continue;
+        }
+
+        FlashLogRecord_t record;
+        int rc = flash_log_peek(&state->store, &record, state->storePayload, sizeof(state->storePayload));
+        if (rc <= 0)
+        {
+            break;
+        }
+        if (record.topic >= MQTT_TOPIC_MAX)
+        {
+            ERROR_printf("Dropping stored record with unknown topic %d\n", record.topic);
+            flash_log_advance(&state->store, &record);
+            flash_log_consume(&state->store, record.offset, record.sequence);
+            continue;
+        }
+
+        slot->client = state;
+        slot->offset = record.offset;
+        slot->sequence = record.sequence;
+        slot->sentUs = time_us_64();
+        err_t err = mqtt_publish(state->mqttClientInst, state->topicNames[record.topic], state->storePayload, record.len, MQTT_PUBLISH_QOS, MQTT_PUBLISH_RETAIN, store_pub_request_cb, slot);
+        if (err != ERR_OK)
+        {
+            /** ERR_MEM means the lwIP output buffer or request queue is full, retry on the next drain */
+            state->stats.pubRefused++;
+            break;
+        }
+        state->stats.published++;
+
+        slot->used = true;
+        flash_log_advance(&state->store, &record);
+    }
+
+    return MQTT_STORE_DRAIN_INTERVAL_MS;
+}
+
+/**
+ * @brief Queue the samples encoded by the application core and publish the batches that are due
+ * @param state The client data structure
+ * @param currentTimeMs The current time
+ * @return uint32_t Milliseconds until the next batch deadline, the application core wakes the task for new samples
+ */
+static uint32_t sample_and_queue(MqttClientData_t *state, uint32_t currentTimeMs)
+{
+    /** The samples are timed by the ADC and encoded on core 1, the task only batches and sends them */
+    char payload[APP_CORE_SAMPLE_LEN];
+    MqttTopic_t topic;
+    MqttPayloadFormat_t format;
+    int len;
+    while (state->app != NULL)
+    {
+        /** While the outbox or the completions hold the telemetry back the samples wait in the queue of core 1 */
+        bool handlesFull = MQTT_PUBLISH_QOS != 0 && state->nextHandle - state->doneHandle >= MQTT_PUBLISH_HANDLES;
+        if (is_online(state) && (handlesFull || outbox_check(&state->outbox, OUTBOX_PRIORITY_NORMAL, currentTimeMs) == OUTBOX_BLOCKED))
+        {
+            uint32_t nextMs = publish_queue_poll(&state->publishQueue, currentTimeMs);
+            return nextMs < MQTT_STORE_DRAIN_INTERVAL_MS ? nextMs : MQTT_STORE_DRAIN_INTERVAL_MS;
+        }
+
+        len = app_core_read_sample(state->app, &topic, &format, payload);
+        if (len == 0)
+        {
+            break;
+        }
+        if (len < 0)
+        {
+            continue;
+        }
+
+        /** A batch can't mix formats, the first sample in the new format closes it */
+        if (publish_queue_get_format(&state->publishQueue, topic) != format &&
+            publish_queue_set_format(&state->publishQueue, topic, format) != 0)
+        {
+            ERROR_printf("Dropped the pending batch of %s\n", state->topicNames[topic]);
+        }
+        if (publish_queue_add(&state->publishQueue, topic, payload, (uint16_t)len, currentTimeMs) != 0)
+        {
+            /** Too large for a batch, or behind one that could neither be sent nor stored */
+            state->stats.samplesLost++;
+        }
+    }
+
+    return publish_queue_poll(&state->publishQueue, currentTimeMs);
 }
 
 static void unsub_request_cb(void *arg, err_t err)
@@ -94,42 +590,122 @@ static void unsub_request_cb(void *arg, err_t err)
     }
 }
 
-static void sub_unsub_topics(MqttClientData_t *state, bool sub)
+/**
+ * @brief Unsubscribe from every filter, the client disconnects once they are all acknowledged if stop_client is set
+ * @note Subscribing is done by the subscription manager, see mqtt_client_task
+ */
+static __unused void unsub_topics(MqttClientData_t *state)
 {
-    // Subscribe to topics
-    INFO_printf("Subscribing to topics\n");
-    mqtt_request_cb_t cb = sub ? sub_request_cb : unsub_request_cb;
+    INFO_printf("Unsubscribing from topics\n");
+    const TopicRouter_t *router = &state->inbound.router;
 
-    /** TODO: Need to connect one at a time and then verify connected. */
-    if( ERR_OK != mqtt_sub_unsub(state->mqttClientInst, "led", MQTT_SUBSCRIBE_QOS, cb, state, sub)) {
-        ERROR_printf("Failed to subscribe to topic\n");
-    }
-    else {
-        INFO_printf("Subscribed to topic led\n");
+    for (int route = 0; route < topic_router_count(router); route++)
+    {
+        const TopicRoute_t *entry = topic_router_get(router, route);
+        if (ERR_OK != mqtt_unsubscribe(state->mqttClientInst, entry->filter, unsub_request_cb, state))
+        {
+            ERROR_printf("Failed to unsubscribe from topic %s\n", entry->filter);
+        }
     }
 }
 
 static void mqtt_incoming_data_cb(void *arg, const u8_t *data, u16_t len, u8_t flags)
 {
     MqttClientData_t *state = (MqttClientData_t *)arg;
-    /** Need to handle NULL */
-    if (data == NULL || len == 0)
+
+    /** Fragments are reassembled or streamed to the handler of the topic */
+    mqtt_inbound_data(&state->inbound, data, len, (flags & MQTT_DATA_FLAG_LAST) != 0);
+}
+
+static void mqtt_incoming_publish_cb(void *arg, const char *topic, u32_t tot_len)
+{
+    MqttClientData_t *state = (MqttClientData_t *)arg;
+    INFO_printf("Incoming publish topic: %s, length: %d\n", topic, tot_len);
+
+    mqtt_inbound_publish(&state->inbound, topic, tot_len);
+}
+
+/**
+ * @brief Handler for the led topic, the command is run on the application core
+ * @param arg Pointer to the MqttClientData_t
+ * @param topic The topic
+ * @param payload The null terminated payload
+ * @param len Length of the payload
+ */
+static void led_topic_handler(void *arg, const char *topic, const uint8_t *payload, uint32_t len)
+{
+    MqttClientData_t *state = (MqttClientData_t *)arg;
+
+    if (state->app == NULL || app_core_send_command(state->app, APP_CORE_MSG_LED, APP_CORE_NO_TOPIC, payload, len) != 0)
+    {
+        ERROR_printf("Dropped command on %s\n", topic);
+    }
+}
+
+/**
+ * @brief Handler for the format config topic, forwards the format of the topic named by the last level
+ * @param arg Pointer to the MqttClientData_t
+ * @param topic The topic, "<client id>/config/format/<topic>"
+ * @param payload The null terminated payload, "json" or "cbor"
+ * @param len Length of the payload
+ */
+static void format_topic_handler(void *arg, const char *topic, const uint8_t *payload, uint32_t len)
+{
+    MqttClientData_t *state = (MqttClientData_t *)arg;
+
+    const char *name = strrchr(topic, '/');
+    if (name == NULL)
     {
         return;
     }
+    name++;
 
-    const char *basic_topic = state->topic;
-    strncpy(state->data, (const char *)data, len);
-    state->len = len;
-    state->data[len] = '\0';
+    /** The topic levels all start with "/" */
+    for (MqttTopic_t i = 0; i < MQTT_TOPIC_MAX; i++)
+    {
+        if (strcmp(MqttTopicLevels[i] + 1, name) == 0)
+        {
+            /** The encoder is on the application core, the publish queue follows the format of the samples */
+            INFO_printf("Publishing %s as %s\n", state->topicNames[i], (const char *)payload);
+            if (state->app == NULL || app_core_send_command(state->app, APP_CORE_MSG_FORMAT, i, payload, len) != 0)
+            {
+                ERROR_printf("Dropped command on %s\n", topic);
+            }
+            return;
+        }
+    }
 
-    INFO_printf("Topic: %s, Message: %s\n", state->topic, state->data);
+    ERROR_printf("Unknown topic %s in format config\n", name);
 }
 
-static void mqtt_incoming_publish_cb(void *arg, const char *topic, u32_t tot_len)
+/**
+ * @brief Ask for a persistent session in the CONNECT packet lwIP has queued
+ *
+ * The lwIP client always sets the clean session flag and has no option for it. The CONNECT
+ * packet waits at the start of the output ring of the new client until the TCP connection is
+ * up, so the flag is cleared there. Relies on the layout in mqtt_priv.h, see the lwIP version
+ * check at the top of the file.
+ *
+ * @param client A client that was just connected with mqtt_client_connect()
+ */
+static void request_persistent_session(mqtt_client_t *client)
 {
-    MqttClientData_t *state = (MqttClientData_t *)arg;
-    INFO_printf("Incoming publish topic: %s, length: %d\n", topic, tot_len);
+    const uint8_t *buf = client->output.buf;
+    if (client->output.get != 0 || buf[0] != MQTT_CONNECT_PACKET)
+    {
+        ERROR_printf("No CONNECT to patch, the session will be clean\n");
+        return;
+    }
+
+    /** Fixed header, 1 to 4 bytes of remaining length, protocol name and level, then the flags */
+    uint16_t idx = 1;
+    while (buf[idx] & 0x80)
+    {
+        idx++;
+    }
+    idx += 1 + MQTT_CONNECT_NAME_LEVEL_LEN;
+
+    client->output.buf[idx] &= (uint8_t)~MQTT_CONNECT_FLAG_CLEAN;
 }
 
 static void mqtt_connection_cb(mqtt_client_t *client, void *arg, mqtt_connection_status_t status)
@@ -138,119 +714,578 @@ static void mqtt_connection_cb(mqtt_client_t *client, void *arg, mqtt_connection
 
      if (status == MQTT_CONNECT_ACCEPTED)
      {
-        INFO_printf("Connected to mqtt server\n");
+        /**
+         * lwIP does not pass the session present flag on, the CONNACK is still in its receive
+         * buffer while this callback runs: fixed header, then the acknowledge flags.
+         */
+        state->sessionPresent = !MQTT_CLEAN_SESSION && client->rx_buffer[0] == MQTT_CONNACK_PACKET &&
+                                (client->rx_buffer[2] & MQTT_CONNACK_FLAG_SESSION_PRESENT) != 0;
+        INFO_printf("Connected to mqtt server, session %s\n", state->sessionPresent ? "resumed" : "new");
         state->connect_done = true;
-        sub_unsub_topics(state, true); // subscribe;
+        state->stats.connects++;
+        state->stats.lastConnectUs = (uint32_t)(time_us_64() - state->connectStartUs);
+        histogram_add(&state->stats.connectUs, state->stats.lastConnectUs);
+#if MQTT_TLS
+        bool resumed = mqtt_tls_connected(&state->tls, client->conn, state->stats.lastConnectUs);
+        INFO_printf("TLS session %s\n", resumed ? "resumed" : "negotiated");
+#endif
+        backoff_connected(&state->backoff, to_ms_since_boot(get_absolute_time()));
+        /** Let the task move on to connected and start subscribing without waiting for its next deadline */
+        scheduler_wake(state->taskId);
+    }
+    else
+    {
+        if (status == MQTT_CONNECT_DISCONNECTED)
+        {
+            INFO_printf("Disconnected from mqtt server\n");
+        }
+        else
+        {
+            INFO_printf("mqtt_connection_cb error %d\n", status);
+        }
+
+        /** Connect again after the delay, the in-flight publishes are kept and sent once the session is back */
+        if (state->taskState != MQTT_CLIENT_DISCONNECTED)
+        {
+            if (state->connect_done)
+            {
+                state->stats.disconnects++;
+            }
+            else
+            {
+                state->stats.connectFailures++;
+            }
+            state->taskState = MQTT_CLIENT_DISCONNECTED;
+            uint32_t delayMs = backoff_failed(&state->backoff, to_ms_since_boot(get_absolute_time()));
+            INFO_printf("Reconnecting to mqtt server in %lu ms\n", (unsigned long)delayMs);
+            scheduler_wake(state->taskId);
+        }
     }
-    else if (status == MQTT_CONNECT_DISCONNECTED)
+}
+
+/**
+ * @brief Write a histogram as {"n":count,"p50":..,"p90":..,"p99":..,"max":..,"h":[buckets]}
+ * @param writer The writer
+ * @param key The key of the histogram
+ * @param histogram The histogram
+ */
+static void write_histogram(JsonWriter_t *writer, const char *key, const Histogram_t *histogram)
+{
+    json_writer_key(writer, key);
+    json_writer_begin_object(writer);
+    json_writer_key(writer, "n");
+    json_writer_int(writer, (int32_t)histogram->count);
+    json_writer_key(writer, "p50");
+    json_writer_int(writer, (int32_t)histogram_percentile(histogram, 50));
+    json_writer_key(writer, "p90");
+    json_writer_int(writer, (int32_t)histogram_percentile(histogram, 90));
+    json_writer_key(writer, "p99");
+    json_writer_int(writer, (int32_t)histogram_percentile(histogram, 99));
+    json_writer_key(writer, "max");
+    json_writer_int(writer, (int32_t)histogram->max);
+
+    /** The empty buckets at the top are left out, bucket i counts [2^(i-1), 2^i) us */
+    int used = HISTOGRAM_BUCKETS;
+    while (used > 0 && histogram->buckets[used - 1] == 0)
     {
-        INFO_printf("Disconnected from mqtt server\n");
+        used--;
     }
-    else
+    json_writer_key(writer, "h");
+    json_writer_begin_array(writer);
+    for (int i = 0; i < used; i++)
     {
-        INFO_printf("mqtt_connection_cb error %d\n", status);
-        
+        json_writer_int(writer, (int32_t)histogram->buckets[i]);
     }
+    json_writer_end_array(writer);
+    json_writer_end_object(writer);
 }
 
-static void start_client(MqttClientData_t *state)
+/**
+ * @brief Write the outbox counters as {"depth":[high,normal,low],"max":[..],"drop":[..],"rej":[..],"to":[..]}
+ * @param writer The writer
+ * @param outbox The outbox
+ */
+static void write_outbox(JsonWriter_t *writer, const Outbox_t *outbox)
 {
-    INFO_printf("Starting mqtt client\n");
-    const int port = MQTT_PORT;
-    INFO_printf("Warning: Not using TLS\n");
-    /** TODO: CH - Before cleaning out the memory ensure that the mqttClientInst is free */
-    if (state->mqttClientInst != NULL)
+    OutboxQueueStats_t queues[OUTBOX_PRIORITY_MAX];
+    for (int i = 0; i < OUTBOX_PRIORITY_MAX; i++)
     {
-        mqtt_client_free(state->mqttClientInst);
-        state->mqttClientInst = NULL;
+        outbox_get_stats(outbox, (OutboxPriority_t)i, &queues[i]);
     }
 
-    /** Ensure that the client structure is cleaned out */
-    memset(state, 0, sizeof(MqttClientData_t));
+    /** One array per counter, indexed by OutboxPriority_t */
+    static const char *keys[] = {"depth", "max", "drop", "rej", "to"};
+    json_writer_key(writer, "outbox");
+    json_writer_begin_object(writer);
+    for (size_t key = 0; key < sizeof(keys) / sizeof(keys[0]); key++)
+    {
+        json_writer_key(writer, keys[key]);
+        json_writer_begin_array(writer);
+        for (int i = 0; i < OUTBOX_PRIORITY_MAX; i++)
+        {
+            const uint32_t values[] = {queues[i].depth, queues[i].maxDepth, queues[i].droppedOldest, queues[i].rejected, queues[i].timeouts};
+            json_writer_int(writer, (int32_t)values[key]);
+        }
+        json_writer_end_array(writer);
+    }
+    json_writer_end_object(writer);
+}
+
+#if MQTT_TLS
+/**
+ * @brief Write the handshakes as {"full":[count,p50,p90],"res":[count,p50,p90]}, CONNECT to CONNACK in us
+ * @param writer The writer
+ * @param stats The TLS counters
+ */
+static void write_tls(JsonWriter_t *writer, const MqttTlsStats_t *stats)
+{
+    static const char *keys[] = {"full", "res"};
+    const Histogram_t *histograms[] = {&stats->fullUs, &stats->resumedUs};
+    json_writer_key(writer, "tls");
+    json_writer_begin_object(writer);
+    for (size_t i = 0; i < sizeof(keys) / sizeof(keys[0]); i++)
+    {
+        json_writer_key(writer, keys[i]);
+        json_writer_begin_array(writer);
+        json_writer_int(writer, (int32_t)histograms[i]->count);
+        json_writer_int(writer, (int32_t)histogram_percentile(histograms[i], 50));
+        json_writer_int(writer, (int32_t)histogram_percentile(histograms[i], 90));
+        json_writer_end_array(writer);
+    }
+    json_writer_end_object(writer);
+}
+#endif
+
+/**
+ * @brief Publish the lwIP pool usage as {"total":bytes,"peak":bytes,"<pool>":[used,max,avail,err],...}
+ *
+ * Best effort, a snapshot that does not fit waits for the next interval.
+ *
+ * @param state The client data structure
+ */
+static void publish_pool_stats(MqttClientData_t *state)
+{
+    uint32_t totalBytes;
+    uint32_t peakBytes;
+    pool_stats_totals(&totalBytes, &peakBytes);
+
+    JsonWriter_t writer;
+    json_writer_init(&writer, state->statsPayload, sizeof(state->statsPayload));
+    json_writer_begin_object(&writer);
+    json_writer_key(&writer, "total");
+    json_writer_int(&writer, (int32_t)totalBytes);
+    json_writer_key(&writer, "peak");
+    json_writer_int(&writer, (int32_t)peakBytes);
+
+    PoolStats_t pool;
+    for (int i = 0; i < pool_stats_count(); i++)
+    {
+        if (pool_stats_get(i, &pool) != 0)
+        {
+            continue;
+        }
+        json_writer_key(&writer, pool.name);
+        json_writer_begin_array(&writer);
+        json_writer_int(&writer, pool.used);
+        json_writer_int(&writer, pool.max);
+        json_writer_int(&writer, pool.avail);
+        json_writer_int(&writer, (int32_t)pool.err);
+        json_writer_end_array(&writer);
+    }
+    json_writer_end_object(&writer);
+
+    int len = json_writer_finish(&writer);
+    if (len < 0)
+    {
+        ERROR_printf("Pool stats do not fit in %d bytes\n", MQTT_STATS_LEN);
+        return;
+    }
+
+    queue_publish(state, OUTBOX_PRIORITY_LOW, state->poolStatsTopic, state->statsPayload, (uint16_t)len, 0, NULL);
+}
+
+/**
+ * @brief Publish a snapshot of the counters on the stats topic when it is due
+ * @param state The client data structure
+ * @param currentTimeMs The current time
+ * @return uint32_t Milliseconds until the next snapshot, UINT32_MAX if they are disabled
+ */
+static uint32_t publish_stats(MqttClientData_t *state, uint32_t currentTimeMs)
+{
+    if (MQTT_STATS_INTERVAL_MS == 0)
+    {
+        return UINT32_MAX;
+    }
+
+    /** The signed difference handles the roll-over */
+    int32_t remainingMs = (int32_t)(state->statsDueMs - currentTimeMs);
+    if (remainingMs > 0)
+    {
+        return (uint32_t)remainingMs;
+    }
+
+    /** Counters since boot, a lost snapshot loses nothing and the fleet side takes the differences */
+    const MqttClientStats_t *stats = &state->stats;
+    JsonWriter_t writer;
+    json_writer_init(&writer, state->statsPayload, sizeof(state->statsPayload));
+    json_writer_begin_object(&writer);
+    json_writer_key(&writer, "up");
+    json_writer_int(&writer, (int32_t)(currentTimeMs / 1000));
+    json_writer_key(&writer, "pub");
+    json_writer_int(&writer, (int32_t)stats->published);
+    json_writer_key(&writer, "ack");
+    json_writer_int(&writer, (int32_t)stats->pubacks);
+    json_writer_key(&writer, "to");
+    json_writer_int(&writer, (int32_t)stats->pubTimeouts);
+    json_writer_key(&writer, "err");
+    json_writer_int(&writer, (int32_t)stats->pubErrors);
+    json_writer_key(&writer, "exp");
+    json_writer_int(&writer, (int32_t)stats->pubExpired);
+    json_writer_key(&writer, "full");
+    json_writer_int(&writer, (int32_t)stats->pubRefused);
+    json_writer_key(&writer, "lost");
+    json_writer_int(&writer, (int32_t)stats->samplesLost);
+    json_writer_key(&writer, "con");
+    json_writer_int(&writer, (int32_t)stats->connects);
+    json_writer_key(&writer, "conFail");
+    json_writer_int(&writer, (int32_t)stats->connectFailures);
+    json_writer_key(&writer, "drop");
+    json_writer_int(&writer, (int32_t)stats->disconnects);
+    json_writer_key(&writer, "conLast");
+    json_writer_int(&writer, (int32_t)stats->lastConnectUs);
+    write_histogram(&writer, "ackUs", &stats->pubackUs);
+    write_histogram(&writer, "conUs", &stats->connectUs);
+    if (state->power != NULL)
+    {
+        /** Awake time of the main loop per publish cycle, the duty cycle in per mille */
+        PowerStats_t power;
+        power_get_stats(state->power, &power);
+        json_writer_key(&writer, "awake");
+        json_writer_begin_object(&writer);
+        json_writer_key(&writer, "ms");
+        json_writer_int(&writer, (int32_t)power.lastAwakeMs);
+        json_writer_key(&writer, "max");
+        json_writer_int(&writer, (int32_t)power.maxAwakeMs);
+        json_writer_key(&writer, "wake");
+        json_writer_int(&writer, (int32_t)power.lastWakeups);
+        json_writer_key(&writer, "duty");
+        json_writer_int(&writer, power.elapsedUs != 0 ? (int32_t)(power.awakeUs * 1000u / power.elapsedUs) : 0);
+        json_writer_end_object(&writer);
+    }
+    if (state->app != NULL)
+    {
+        /** Samples published and held back by the report policies, see MQTT_TEMPERATURE_DEADBAND */
+        ReportPolicyStats_t report;
+        app_core_get_report_stats(state->app, &report);
+        json_writer_key(&writer, "report");
+        json_writer_begin_object(&writer);
+        json_writer_key(&writer, "sent");
+        json_writer_int(&writer, (int32_t)report.sent);
+        json_writer_key(&writer, "supp");
+        json_writer_int(&writer, (int32_t)report.suppressed);
+        json_writer_key(&writer, "hb");
+        json_writer_int(&writer, (int32_t)report.heartbeats);
+        json_writer_key(&writer, "delta");
+        json_writer_int(&writer, (int32_t)report.deltas);
+        json_writer_end_object(&writer);
+    }
+    write_outbox(&writer, &state->outbox);
+#if MQTT_TLS
+    write_tls(&writer, &state->tls.stats);
+#endif
+    json_writer_end_object(&writer);
+
+    int len = json_writer_finish(&writer);
+    if (len < 0)
+    {
+        ERROR_printf("Stats do not fit in %d bytes\n", MQTT_STATS_LEN);
+        state->statsDueMs = currentTimeMs + MQTT_STATS_INTERVAL_MS;
+        return MQTT_STATS_INTERVAL_MS;
+    }
+
+    /**
+     * QoS 0, the snapshot does not take a request slot or show up in its own latencies. At low
+     * priority a newer snapshot replaces one that is still waiting, the counters are since boot.
+     */
+    queue_publish(state, OUTBOX_PRIORITY_LOW, state->statsTopic, state->statsPayload, (uint16_t)len, 0, NULL);
+
+    /** The outbox copied the snapshot, the buffer is free for the pools */
+    publish_pool_stats(state);
+
+    state->statsDueMs = currentTimeMs + MQTT_STATS_INTERVAL_MS;
+    return MQTT_STATS_INTERVAL_MS;
+}
+
+/**
+ * @brief Start a new connection to the broker
+ * @param state The client
+ * @return int 0 once the connect is under way, -1 if it could not be sent
+ */
+static int start_client(MqttClientData_t *state)
+{
+    INFO_printf("Starting mqtt client %s\n", state->clientId);
+#if !MQTT_TLS
+    INFO_printf("Warning: Not using TLS\n");
+#endif
+    /**
+     * The lwIP client lives in the client structure and is reused, nothing is allocated per
+     * connect. A connection that is still half open is closed first, without its callback.
+     * The connect starts the packet ids over, they carry on instead so that the live publishes
+     * sent again with their own packet id don't collide with the new requests.
+     */
+    uint16_t packetIdSeq = state->mqttClient.pkt_id_seq;
+    mqtt_disconnect(&state->mqttClient);
+    state->mqttClientInst = &state->mqttClient;
+
+    /**
+     * Ensure that the connection state is cleaned out.
+     * The scheduler task id, the publish queue and the topic handlers are kept across reconnects.
+     */
+    memset(&state->mqttClientInfo, 0, sizeof(state->mqttClientInfo));
+    state->connect_done = false;
+    state->subscribe_count = 0;
+    state->stop_client = false;
+
+    /** The old client dropped its requests, replay the stored records that were not acknowledged */
+    memset(state->storeSlots, 0, sizeof(state->storeSlots));
+    flash_log_rewind(&state->store);
+
+    /** Same for the live publishes, they are sent again once connected */
+    for (int i = 0; i < MQTT_INFLIGHT_WINDOW; i++)
+    {
+        state->inflight[i].sent = false;
+    }
+    state->sessionPresent = false;
 
-    state->mqttClientInfo.client_id = CLIENT_ID;          /** See CMakeLists.txt */
-    state->mqttClientInfo.keep_alive = 60; // Keep alive in sec
+    state->mqttClientInfo.client_id = state->clientId;
+    state->mqttClientInfo.keep_alive = power_keep_alive_s(MQTT_PUBLISH_CYCLE_MS, MQTT_KEEP_ALIVE_S);
     state->mqttClientInfo.will_topic = "boot";
     state->mqttClientInfo.will_msg = "booted";
     state->mqttClientInfo.will_qos = MQTT_PUBLISH_QOS;
     state->mqttClientInfo.will_retain = MQTT_PUBLISH_RETAIN;
+#if MQTT_TLS
+    state->mqttClientInfo.tls_config = state->tls.config;
+#endif
 
+    INFO_printf("IP address of this device %s\n", ipaddr_ntoa(&(netif_list->ip_addr)));
+    INFO_printf("Connecting to mqtt server at %s\n", ipaddr_ntoa(&state->mqtt_server_address));
 
-    /** Convert the string IP address to an ip4 address  */
-    if(!ipaddr_aton(SERVER_IP, &state->mqtt_server_address)) {
-        panic("Failed to convert IP address %s", SERVER_IP);
+    state->connectStartUs = time_us_64();
+    err_t err = mqtt_client_connect(state->mqttClientInst, &state->mqtt_server_address, state->port, mqtt_connection_cb, state, &state->mqttClientInfo);
+    if (err != ERR_OK)
+    {
+        /** No route or no memory yet, it is retried after the delay like a refused connect */
+        state->stats.connectFailures++;
+        uint32_t delayMs = backoff_failed(&state->backoff, to_ms_since_boot(get_absolute_time()));
+        ERROR_printf("MQTT broker connection error %d, retrying in %lu ms\n", err, (unsigned long)delayMs);
+        return -1;
     }
 
-    state->mqttClientInst = mqtt_client_new();
-    if (!state->mqttClientInst)
+    state->mqttClientInst->pkt_id_seq = packetIdSeq;
+
+#if MQTT_TLS
+    /** The TCP connection is not up yet, the cached session goes into the first ClientHello */
+    if (mqtt_tls_start(&state->tls, state->mqttClientInst->conn) != 0)
     {
-        panic("MQTT client instance creation error");
+        ERROR_printf("Failed to prepare the TLS handshake\n");
     }
-    INFO_printf("IP address of this device %s\n", ipaddr_ntoa(&(netif_list->ip_addr)));
-    INFO_printf("Connecting to mqtt server at %s\n", ipaddr_ntoa(&state->mqtt_server_address));
+#endif
 
-    if (mqtt_client_connect(state->mqttClientInst, &state->mqtt_server_address, MQTT_PORT, mqtt_connection_cb, state, &state->mqttClientInfo) != ERR_OK)
+    if (!MQTT_CLEAN_SESSION)
     {
-        panic("MQTT broker connection error");
+        request_persistent_session(state->mqttClientInst);
     }
     
     INFO_printf("MQTT set callbacks\n");
     mqtt_set_inpub_callback(state->mqttClientInst, mqtt_incoming_publish_cb, mqtt_incoming_data_cb, state);
+
+    return 0;
 }
 
-int mqtt_client_task(MqttClientData_t *client)
+int mqtt_client_init(MqttClientData_t *client, const MqttClientConfig_t *config)
 {
+    if (client == NULL || config == NULL || config->clientId == NULL || config->serverIp == NULL)
+    {
+        return -1;
+    }
 
-    /** Implement state machine with timeout and rollover protection */
-    static uint32_t timeLastRunMs = 0;
-    uint32_t currentTimeMs = to_ms_since_boot(get_absolute_time());
+    memset(client, 0, sizeof(MqttClientData_t));
+    client->taskState = MQTT_CLIENT_DISCONNECTED;
 
-    // clang-format off
-    uint32_t timePassedMs = currentTimeMs < timeLastRunMs
-                          ? UINT32_MAX - timeLastRunMs + currentTimeMs
-                          : currentTimeMs - timeLastRunMs;
-    // clang-format on
+    /** The topics are built once, they have to outlive the requests lwIP keeps on them */
+    size_t idLen = strlen(config->clientId);
+    if (idLen == 0 || idLen >= sizeof(client->clientId) || idLen + sizeof(MQTT_FORMAT_CONFIG_LEVEL) > MQTT_TOPIC_LEN)
+    {
+        return -1;
+    }
+    memcpy(client->clientId, config->clientId, idLen + 1);
+    for (MqttTopic_t i = 0; i < MQTT_TOPIC_MAX; i++)
+    {
+        snprintf(client->topicNames[i], MQTT_TOPIC_LEN, "%s%s", client->clientId, MqttTopicLevels[i]);
+    }
+    snprintf(client->statsTopic, MQTT_TOPIC_LEN, "%s%s", client->clientId, MQTT_STATS_LEVEL);
+    snprintf(client->poolStatsTopic, MQTT_TOPIC_LEN, "%s%s", client->clientId, MQTT_POOL_STATS_LEVEL);
+    snprintf(client->formatConfigFilter, MQTT_TOPIC_LEN, "%s%s", client->clientId, MQTT_FORMAT_CONFIG_LEVEL);
 
-    if (timePassedMs < MQTT_CLIENT_TASK_TIMEOUT_ms)
+    if (!ipaddr_aton(config->serverIp, &client->mqtt_server_address))
     {
-        return 0;
+        ERROR_printf("Failed to convert IP address %s\n", config->serverIp);
+        return -1;
     }
+    client->port = config->port;
+#if MQTT_TLS
+    if (mqtt_tls_init(&client->tls, config->caCert, config->caCertLen, config->serverName) != 0)
+    {
+        ERROR_printf("Failed to set up TLS for %s\n", config->serverIp);
+        return -1;
+    }
+#endif
+
+    const BackoffConfig_t backoffConfig = {
+        .baseMs = MQTT_BACKOFF_BASE_MS,
+        .capMs = MQTT_BACKOFF_CAP_MS,
+        .stableMs = BACKOFF_STABLE_MS,
+    };
+    if (backoff_init(&client->backoff, &backoffConfig, get_rand_32()) != 0)
+    {
+        return -1;
+    }
+
+    mqtt_inbound_init(&client->inbound);
+    if (mqtt_inbound_register_message(&client->inbound, "led", MQTT_SUBSCRIBE_QOS, led_topic_handler, client) != 0 ||
+        mqtt_inbound_register_message(&client->inbound, client->formatConfigFilter, MQTT_SUBSCRIBE_QOS, format_topic_handler, client) != 0)
+    {
+        return -1;
+    }
+
+    /** The store is optional, without it offline samples are lost */
+    if (config->store != NULL)
+    {
+        client->storeDevice = *config->store;
+        if (flash_log_init(&client->store, &client->storeDevice) == 0)
+        {
+            client->storeReady = true;
+            INFO_printf("Flash store mounted, %lu records to replay\n", (unsigned long)flash_log_pending(&client->store));
+        }
+        else
+        {
+            ERROR_printf("Failed to mount the flash store\n");
+        }
+    }
+    else
+    {
+        INFO_printf("No flash store for %s\n", client->clientId);
+    }
+
+    const OutboxQueueConfig_t outboxConfigs[OUTBOX_PRIORITY_MAX] = {
+        [OUTBOX_PRIORITY_HIGH] = {.policy = OUTBOX_DROP_NEWEST, .depth = MQTT_OUTBOX_HIGH_DEPTH},
+        [OUTBOX_PRIORITY_NORMAL] = {.policy = OUTBOX_BLOCK, .depth = MQTT_OUTBOX_NORMAL_DEPTH, .blockMs = MQTT_OUTBOX_BLOCK_MS},
+        [OUTBOX_PRIORITY_LOW] = {.policy = OUTBOX_DROP_OLDEST, .depth = MQTT_OUTBOX_LOW_DEPTH},
+    };
+    if (outbox_init(&client->outbox, outboxConfigs, client->outboxEntries, MQTT_OUTBOX_DEPTH, outbox_send_cb, outbox_drop_cb, client) != 0)
+    {
+        return -1;
+    }
+    client->nextHandle = 1;
+    client->doneHandle = 1;
 
-    /** Update the last run time and catch the roll-over */
-    timeLastRunMs = currentTimeMs;
+    const PublishQueueConfig_t queueConfig = {
+        .maxBytes = MQTT_BATCH_MAX_BYTES,
+        .maxAgeMs = MQTT_BATCH_MAX_AGE_MS,
+    };
+
+    return publish_queue_init(&client->publishQueue, &queueConfig, publish_queue_flush_cb, client);
+}
+
+int mqtt_client_task(MqttClientData_t *client)
+{
+    /** The task is dispatched by the scheduler, see MQTT_CLIENT_TASK_TIMEOUT_ms */
+    uint32_t currentTimeMs = to_ms_since_boot(get_absolute_time());
+
+    /** Samples are queued in every state, they go to the flash store until the client is connected */
+    uint32_t remainingMs = sample_and_queue(client, currentTimeMs);
 
     switch (client->taskState)
     {
     case MQTT_CLIENT_DISCONNECTED:
-        start_client(client);
-        client->taskState = MQTT_CLIENT_CONNECTING;
+    {
+        /** Wait out the delay after a refused connect or a drop, the samples keep going to the store */
+        uint32_t backoffRemainingMs = backoff_remaining(&client->backoff, currentTimeMs);
+        if (backoffRemainingMs == 0 && start_client(client) == 0)
+        {
+            client->taskState = MQTT_CLIENT_CONNECTING;
+            break;
+        }
+
+        backoffRemainingMs = backoff_remaining(&client->backoff, currentTimeMs);
+        scheduler_delay(client->taskId, backoffRemainingMs < remainingMs ? backoffRemainingMs : remainingMs);
         break;
+    }
     case MQTT_CLIENT_CONNECTING:
         if (client->connect_done)
         {
             /** We are connected yay */
-            client->taskState = MQTT_CLIENT_CONNECTED;
-            INFO_printf("MQTT client connected\n");
+            if (client->sessionPresent && client->sessionSubscribed)
+            {
+                /** The broker kept our subscriptions, they were made by this firmware since boot */
+                client->taskState = MQTT_CLIENT_SUBSCRIBED;
+                INFO_printf("MQTT session resumed, skipping %d subscriptions\n", topic_router_count(&client->inbound.router));
+            }
+            else
+            {
+                client->taskState = MQTT_CLIENT_CONNECTED;
+                INFO_printf("MQTT client connected, subscribing to %d topics\n", topic_router_count(&client->inbound.router));
+                subscription_manager_start(&client->subscriptions, client->mqttClientInst, &client->inbound.router, client->taskId, currentTimeMs);
+            }
+            scheduler_wake(client->taskId);
         }
         break;
 
     case MQTT_CLIENT_CONNECTED:
-        /** Send ON message to the led topic every 5 seconds */
-        static int32_t timeout = 5000;
-        if (timeout > 0)
+    case MQTT_CLIENT_SUBSCRIBED:
+        /** Keep the SUBSCRIBE pipeline full until every filter is acknowledged */
+        if (client->taskState == MQTT_CLIENT_CONNECTED)
         {
-            timeout -= MQTT_CLIENT_TASK_TIMEOUT_ms;
+            uint32_t retryRemainingMs = subscription_manager_poll(&client->subscriptions, currentTimeMs);
+            if (subscription_manager_done(&client->subscriptions))
+            {
+                client->taskState = MQTT_CLIENT_SUBSCRIBED;
+                client->sessionSubscribed = !MQTT_CLEAN_SESSION;
+                client->subscribe_count = client->subscriptions.done;
+                INFO_printf("MQTT client subscribed to %d topics in %lu ms\n", client->subscribe_count,
+                            (unsigned long)(currentTimeMs - client->subscriptions.startMs));
+            }
+            else if (retryRemainingMs < remainingMs)
+            {
+                remainingMs = retryRemainingMs;
+            }
         }
-        else
+
+        /** Publishes the last connection dropped go first, then what was stored while offline */
+        uint32_t resendRemainingMs = resend_inflight(client);
+        if (resendRemainingMs < remainingMs)
+        {
+            remainingMs = resendRemainingMs;
+        }
+        uint32_t drainRemainingMs = drain_store(client);
+        if (drainRemainingMs < remainingMs)
+        {
+            remainingMs = drainRemainingMs;
+        }
+        uint32_t statsRemainingMs = publish_stats(client, currentTimeMs);
+        if (statsRemainingMs < remainingMs)
+        {
+            remainingMs = statsRemainingMs;
+        }
+
+        /** Then the outbox, highest priority first, a freed in-flight slot wakes the task earlier */
+        if (outbox_pump(&client->outbox) != 0 && MQTT_STORE_DRAIN_INTERVAL_MS < remainingMs)
         {
-            timeout = 5000;
-            float temp = read_onboard_temperature_c('C');
-            char buffer[20] = {0};
-            sprintf(buffer,"{ \"t\": %.2f }", temp);
-            INFO_printf("Sending temperature to topic: %s\n", MQTT_TEMPERATURE_TOPIC);
-            mqtt_publish(client->mqttClientInst, MQTT_TEMPERATURE_TOPIC, buffer, strlen(buffer), MQTT_PUBLISH_QOS, MQTT_PUBLISH_RETAIN, pub_request_cb, client);
+            remainingMs = MQTT_STORE_DRAIN_INTERVAL_MS;
         }
 
+        /** Sleep until the next sample, batch, retry or drain deadline, lwIP callbacks wake the task earlier if needed */
+        scheduler_delay(client->taskId, remainingMs);
         break;
 
     default:
@@ -258,4 +1293,72 @@ int mqtt_client_task(MqttClientData_t *client)
     }
 
     return 0;
-}
\ No newline at end of file
+}
+
+int mqtt_client_offline_task(MqttClientData_t *client)
+{
+    uint32_t currentTimeMs = to_ms_since_boot(get_absolute_time());
+
+    /** Keep sampling, the publish queue hands the batches to the flash store */
+    uint32_t remainingMs = sample_and_queue(client, currentTimeMs);
+    if (remainingMs > MQTT_CLIENT_TASK_TIMEOUT_ms)
+    {
+        /** Still check for the link coming back at the default period */
+        remainingMs = MQTT_CLIENT_TASK_TIMEOUT_ms;
+    }
+    scheduler_delay(client->taskId, remainingMs);
+
+    return 0;
+}
+
+OutboxStatus_t mqtt_client_publish(MqttClientData_t *client, OutboxPriority_t priority, const char *topic,
+                                   const void *payload, uint16_t len, uint8_t qos, uint32_t *handle)
+{
+    if (client == NULL)
+    {
+        return OUTBOX_REJECTED;
+    }
+
+    OutboxStatus_t status = queue_publish(client, priority, topic, payload, len, qos, handle);
+    if (status == OUTBOX_QUEUED)
+    {
+        /** Sent on the next run of the task */
+        scheduler_wake(client->taskId);
+    }
+
+    return status;
+}
+
+void mqtt_client_set_publish_done(MqttClientData_t *client, MqttPublishDoneFn_t done, void *arg)
+{
+    if (client != NULL)
+    {
+        client->publishDone = done;
+        client->publishDoneArg = arg;
+    }
+}
+
+int mqtt_client_get_publish(const MqttClientData_t *client, uint32_t handle, MqttPublishHandle_t *status)
+{
+    if (client == NULL || status == NULL)
+    {
+        return -1;
+    }
+
+    const MqttPublishHandle_t *entry = &client->handles[handle % MQTT_PUBLISH_HANDLES];
+    if (handle == 0 || entry->id != handle)
+    {
+        return -1;
+    }
+
+    *status = *entry;
+    return 0;
+}
+
+void mqtt_client_get_stats(const MqttClientData_t *client, MqttClientStats_t *stats)
+{
+    if (client != NULL && stats != NULL)
+    {
+        *stats = client->stats;
+    }
+}
@@ -0,0 +1,192 @@
+/** Includes *************************************************************************************/
+#include "mqtt_inbound.h"
+
+#include <stddef.h>
+#include <string.h>
+
+/** Defines **************************************************************************************/
+/** Typedefs *************************************************************************************/
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+static int _mqtt_inbound_register(MqttInbound_t *inbound, const char *filter, uint8_t qos, const MqttInboundHandler_t *handler);
+static uint8_t *_mqtt_inbound_arena_alloc(MqttInbound_t *inbound, uint32_t len);
+static void _mqtt_inbound_arena_release(MqttInbound_t *inbound);
+
+/** Functions ************************************************************************************/
+
+void mqtt_inbound_init(MqttInbound_t *inbound)
+{
+    memset(inbound, 0, sizeof(MqttInbound_t));
+    topic_router_init(&inbound->router);
+}
+
+int mqtt_inbound_register_stream(MqttInbound_t *inbound, const char *filter, uint8_t qos, MqttInboundStreamFn_t fn, void *arg)
+{
+    if (fn == NULL)
+    {
+        return -1;
+    }
+
+    const MqttInboundHandler_t handler = {
+        .mode = MQTT_INBOUND_MODE_STREAM,
+        .streamFn = fn,
+        .arg = arg,
+    };
+
+    return _mqtt_inbound_register(inbound, filter, qos, &handler);
+}
+
+int mqtt_inbound_register_message(MqttInbound_t *inbound, const char *filter, uint8_t qos, MqttInboundMessageFn_t fn, void *arg)
+{
+    if (fn == NULL)
+    {
+        return -1;
+    }
+
+    const MqttInboundHandler_t handler = {
+        .mode = MQTT_INBOUND_MODE_BUFFERED,
+        .messageFn = fn,
+        .arg = arg,
+    };
+
+    return _mqtt_inbound_register(inbound, filter, qos, &handler);
+}
+
+void mqtt_inbound_publish(MqttInbound_t *inbound, const char *topic, uint32_t totLen)
+{
+    /** A new publish always ends the previous one, even if its last fragment never came */
+    _mqtt_inbound_arena_release(inbound);
+    inbound->current = NULL;
+    inbound->totLen = totLen;
+    inbound->received = 0;
+
+    size_t topicLen = strlen(topic);
+    if (topicLen >= sizeof(inbound->topic))
+    {
+        /** Can't match any handler */
+        inbound->topic[0] = '\0';
+        inbound->stats.unhandled++;
+        return;
+    }
+    memcpy(inbound->topic, topic, topicLen + 1);
+
+    int route = topic_router_match(&inbound->router, inbound->topic);
+    if (route == TOPIC_ROUTER_NO_ROUTE)
+    {
+        inbound->stats.unhandled++;
+        return;
+    }
+    const MqttInboundHandler_t *handler = &inbound->handlers[route];
+
+    if (handler->mode == MQTT_INBOUND_MODE_BUFFERED)
+    {
+        /** One slab for the whole payload plus a terminator */
+        inbound->slab = _mqtt_inbound_arena_alloc(inbound, totLen + 1);
+        if (inbound->slab == NULL)
+        {
+            inbound->stats.tooLarge++;
+            return;
+        }
+    }
+
+    inbound->current = handler;
+}
+
+void mqtt_inbound_data(MqttInbound_t *inbound, const uint8_t *data, uint16_t len, bool last)
+{
+    inbound->stats.fragments++;
+    inbound->stats.bytes += len;
+
+    const MqttInboundHandler_t *handler = inbound->current;
+    if (handler == NULL)
+    {
+        /** Discarding this message */
+        return;
+    }
+
+    /** Never write past what the publish header announced */
+    uint32_t offset = inbound->received;
+    if (len > inbound->totLen - offset)
+    {
+        len = (uint16_t)(inbound->totLen - offset);
+    }
+    inbound->received += len;
+
+    if (handler->mode == MQTT_INBOUND_MODE_STREAM)
+    {
+        handler->streamFn(handler->arg, inbound->topic, data, len, offset, inbound->totLen, last);
+    }
+    else if (len > 0)
+    {
+        memcpy(&inbound->slab[offset], data, len);
+    }
+
+    if (!last)
+    {
+        return;
+    }
+
+    if (handler->mode == MQTT_INBOUND_MODE_BUFFERED)
+    {
+        inbound->slab[inbound->received] = '\0';
+        handler->messageFn(handler->arg, inbound->topic, inbound->slab, inbound->received);
+        _mqtt_inbound_arena_release(inbound);
+    }
+
+    inbound->stats.messages++;
+    inbound->current = NULL;
+}
+
+/**
+ * @brief Add a topic filter to the router and store its handler
+ * @param inbound The reassembly state
+ * @param filter The topic filter
+ * @param qos The QoS to subscribe with
+ * @param handler The handler to copy in
+ * @return int 0 on success, -1 on failure
+ */
+static int _mqtt_inbound_register(MqttInbound_t *inbound, const char *filter, uint8_t qos, const MqttInboundHandler_t *handler)
+{
+    if (inbound == NULL)
+    {
+        return -1;
+    }
+
+    int route = topic_router_add(&inbound->router, filter, qos);
+    if (route == TOPIC_ROUTER_NO_ROUTE)
+    {
+        return -1;
+    }
+    inbound->handlers[route] = *handler;
+
+    return 0;
+}
+
+/**
+ * @brief Allocate a slab from the arena
+ * @param inbound The reassembly state
+ * @param len Size of the slab
+ * @return uint8_t* The slab, NULL if the arena is too small
+ */
+static uint8_t *_mqtt_inbound_arena_alloc(MqttInbound_t *inbound, uint32_t len)
+{
+    if (len > sizeof(inbound->arena) - inbound->arenaUsed)
+    {
+        return NULL;
+    }
+
+    uint8_t *slab = &inbound->arena[inbound->arenaUsed];
+    inbound->arenaUsed += len;
+
+    return slab;
+}
+
+/**
+ * @brief Release every slab of the arena
+ * @param inbound The reassembly state
+ */
+static void _mqtt_inbound_arena_release(MqttInbound_t *inbound)
+{
+    inbound->arenaUsed = 0;
+    inbound->slab = NULL;
+}
@@ -0,0 +1,104 @@
+/** Includes *************************************************************************************/
+#include "mqtt_tls.h"
+
+#include <string.h>
+
+/** Defines **************************************************************************************/
+/** Typedefs *************************************************************************************/
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+static int _mqtt_tls_verify(void *arg, mbedtls_x509_crt *crt, int depth, uint32_t *flags);
+
+/** Functions ************************************************************************************/
+
+int mqtt_tls_init(MqttTls_t *tls, const uint8_t *caCert, size_t caCertLen, const char *serverName)
+{
+    if (tls == NULL || caCert == NULL || serverName == NULL)
+    {
+        return -1;
+    }
+
+    memset(tls, 0, sizeof(MqttTls_t));
+    mbedtls_ssl_session_init(&tls->session);
+    tls->serverName = serverName;
+
+    /** The CA is parsed once, the DRBG behind the config is seeded from the TRNG, see mbedtls_config.h */
+    tls->config = altcp_tls_create_config_client(caCert, caCertLen);
+
+    return tls->config != NULL ? 0 : -1;
+}
+
+int mqtt_tls_start(MqttTls_t *tls, struct altcp_pcb *conn)
+{
+    mbedtls_ssl_context *ssl = (mbedtls_ssl_context *)altcp_tls_context(conn);
+    if (tls == NULL || ssl == NULL)
+    {
+        return -1;
+    }
+
+    tls->verified = false;
+    if (mbedtls_ssl_set_hostname(ssl, tls->serverName) != 0)
+    {
+        return -1;
+    }
+
+    /** Only called on a full handshake, the flags mbedTLS computed are left as they are */
+    mbedtls_ssl_set_verify(ssl, _mqtt_tls_verify, tls);
+
+    if (tls->sessionValid && mbedtls_ssl_set_session(ssl, &tls->session) != 0)
+    {
+        /** Not fatal, the broker gets a full handshake */
+        mqtt_tls_forget(tls);
+    }
+
+    return 0;
+}
+
+bool mqtt_tls_connected(MqttTls_t *tls, struct altcp_pcb *conn, uint32_t connectUs)
+{
+    mbedtls_ssl_context *ssl = (mbedtls_ssl_context *)altcp_tls_context(conn);
+    if (tls == NULL || ssl == NULL)
+    {
+        return false;
+    }
+
+    bool resumed = !tls->verified;
+    histogram_add(resumed ? &tls->stats.resumedUs : &tls->stats.fullUs, connectUs);
+    tls->stats.lastResumed = resumed;
+
+    /** The broker may have issued a new ticket, the session is taken again on every connect */
+    mqtt_tls_forget(tls);
+    tls->sessionValid = mbedtls_ssl_get_session(ssl, &tls->session) == 0;
+
+    return resumed;
+}
+
+void mqtt_tls_forget(MqttTls_t *tls)
+{
+    if (tls != NULL)
+    {
+        mbedtls_ssl_session_free(&tls->session);
+        mbedtls_ssl_session_init(&tls->session);
+        tls->sessionValid = false;
+    }
+}
+
+/**
+ * @brief Certificate verification callback of mbedTLS, marks the handshake as a full one
+ * @param arg The MqttTls_t
+ * @param crt The certificate being verified
+ * @param depth Its depth in the chain
+ * @param flags The verification result so far, left unchanged
+ * @return int 0, the result is up to mbedTLS
+ */
+static int _mqtt_tls_verify(void *arg, mbedtls_x509_crt *crt, int depth, uint32_t *flags)
+{
+    (void)crt;
+    (void)depth;
+    (void)flags;
+
+    MqttTls_t *tls = (MqttTls_t *)arg;
+    tls->verified = true;
+
+    return 0;
+}
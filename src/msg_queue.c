@@ -0,0 +1,85 @@
+/** Includes *************************************************************************************/
+#include "msg_queue.h"
+
+#include <stddef.h>
+
+/** Defines **************************************************************************************/
+/** Typedefs *************************************************************************************/
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+/** Functions ************************************************************************************/
+
+int msg_queue_init(MsgQueue_t *queue, uint8_t *storage, uint32_t size)
+{
+    if (queue == NULL || ring_buffer_init(&queue->ring, storage, size) != 0)
+    {
+        return -1;
+    }
+
+    queue->hasPending = false;
+    queue->dropped = 0;
+
+    return 0;
+}
+
+int msg_queue_push(MsgQueue_t *queue, uint8_t type, uint8_t arg, const void *data, uint16_t len)
+{
+    if (queue == NULL || (data == NULL && len > 0))
+    {
+        return -1;
+    }
+
+    /** Only the producer adds to the ring, so the space can only grow after this check */
+    if (ring_buffer_free(&queue->ring) < sizeof(MsgQueueHeader_t) + len)
+    {
+        queue->dropped++;
+        return -1;
+    }
+
+    const MsgQueueHeader_t header = {
+        .len = len,
+        .type = type,
+        .arg = arg,
+    };
+    ring_buffer_write(&queue->ring, (const uint8_t *)&header, sizeof(header));
+    ring_buffer_write(&queue->ring, (const uint8_t *)data, len);
+
+    return 0;
+}
+
+int msg_queue_pop(MsgQueue_t *queue, MsgQueueHeader_t *header, void *data, uint16_t size)
+{
+    if (queue == NULL || header == NULL)
+    {
+        return -1;
+    }
+
+    /** The header and the body are published separately, the body may not be there yet */
+    if (!queue->hasPending)
+    {
+        if (ring_buffer_used(&queue->ring) < sizeof(MsgQueueHeader_t))
+        {
+            return 0;
+        }
+        ring_buffer_read(&queue->ring, (uint8_t *)&queue->pending, sizeof(MsgQueueHeader_t));
+        queue->hasPending = true;
+    }
+
+    if (ring_buffer_used(&queue->ring) < queue->pending.len)
+    {
+        return 0;
+    }
+
+    *header = queue->pending;
+    queue->hasPending = false;
+
+    if (header->len > size || (data == NULL && header->len > 0))
+    {
+        ring_buffer_consume(&queue->ring, header->len);
+        return -1;
+    }
+
+    ring_buffer_read(&queue->ring, (uint8_t *)data, header->len);
+
+    return 1;
+}
@@ -0,0 +1,213 @@
+/** Includes *************************************************************************************/
+#include "outbox.h"
+
+#include <stddef.h>
+#include <string.h>
+
+/** Defines **************************************************************************************/
+/** Typedefs *************************************************************************************/
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+static OutboxStatus_t _outbox_admit(OutboxQueue_t *queue, uint32_t nowMs);
+static void _outbox_pop(OutboxQueue_t *queue);
+
+/** Functions ************************************************************************************/
+
+int outbox_init(Outbox_t *outbox, const OutboxQueueConfig_t *configs, OutboxEntry_t *entries, uint16_t count,
+                OutboxSendFn_t send, OutboxDropFn_t drop, void *arg)
+{
+    if (outbox == NULL || configs == NULL || send == NULL)
+    {
+        return -1;
+    }
+
+    memset(outbox, 0, sizeof(Outbox_t));
+    outbox->send = send;
+    outbox->drop = drop;
+    outbox->sendArg = arg;
+
+    uint16_t used = 0;
+    for (int i = 0; i < OUTBOX_PRIORITY_MAX; i++)
+    {
+        if (configs[i].depth > count - used || (configs[i].depth > 0 && entries == NULL))
+        {
+            return -1;
+        }
+        outbox->queues[i].config = configs[i];
+        outbox->queues[i].entries = configs[i].depth > 0 ? &entries[used] : NULL;
+        used += configs[i].depth;
+    }
+
+    return 0;
+}
+
+OutboxStatus_t outbox_publish(Outbox_t *outbox, OutboxPriority_t priority, const char *topic, const void *payload,
+                              uint16_t len, uint8_t qos, uint32_t tag, uint32_t nowMs)
+{
+    if (outbox == NULL || priority >= OUTBOX_PRIORITY_MAX || topic == NULL || (payload == NULL && len > 0))
+    {
+        return OUTBOX_REJECTED;
+    }
+
+    OutboxQueue_t *queue = &outbox->queues[priority];
+    if (len > OUTBOX_PAYLOAD_LEN || queue->config.depth == 0)
+    {
+        queue->stats.rejected++;
+        return OUTBOX_REJECTED;
+    }
+
+    OutboxStatus_t status = _outbox_admit(queue, nowMs);
+    if (status == OUTBOX_BLOCKED)
+    {
+        queue->stats.blocked++;
+        return status;
+    }
+    if (status == OUTBOX_REJECTED)
+    {
+        if (queue->config.policy == OUTBOX_BLOCK)
+        {
+            queue->stats.timeouts++;
+        }
+        else
+        {
+            queue->stats.rejected++;
+        }
+        return status;
+    }
+
+    if (queue->count == queue->config.depth)
+    {
+        /** OUTBOX_DROP_OLDEST, the newest data is worth more than what is waiting */
+        if (outbox->drop != NULL)
+        {
+            outbox->drop(outbox->sendArg, &queue->entries[queue->head]);
+        }
+        _outbox_pop(queue);
+        queue->stats.droppedOldest++;
+    }
+
+    OutboxEntry_t *entry = &queue->entries[(queue->head + queue->count) % queue->config.depth];
+    entry->topic = topic;
+    entry->qos = qos;
+    entry->len = len;
+    entry->tag = tag;
+    if (len > 0)
+    {
+        memcpy(entry->payload, payload, len);
+    }
+    queue->count++;
+
+    queue->stats.queued++;
+    queue->stats.depth = queue->count;
+    if (queue->count > queue->stats.maxDepth)
+    {
+        queue->stats.maxDepth = queue->count;
+    }
+
+    return OUTBOX_QUEUED;
+}
+
+OutboxStatus_t outbox_check(Outbox_t *outbox, OutboxPriority_t priority, uint32_t nowMs)
+{
+    if (outbox == NULL || priority >= OUTBOX_PRIORITY_MAX || outbox->queues[priority].config.depth == 0)
+    {
+        return OUTBOX_REJECTED;
+    }
+
+    return _outbox_admit(&outbox->queues[priority], nowMs);
+}
+
+uint16_t outbox_pump(Outbox_t *outbox)
+{
+    if (outbox == NULL)
+    {
+        return 0;
+    }
+
+    uint16_t pending = 0;
+    for (int i = 0; i < OUTBOX_PRIORITY_MAX; i++)
+    {
+        OutboxQueue_t *queue = &outbox->queues[i];
+        while (queue->count > 0)
+        {
+            if (outbox->send(outbox->sendArg, &queue->entries[queue->head]) != 0)
+            {
+                /**
+                 * No room for this one, the lower priorities are still tried, a QoS 0 entry may
+                 * fit where a QoS 1 one waits for an acknowledgement
+                 */
+                queue->stats.retries++;
+                break;
+            }
+            _outbox_pop(queue);
+            queue->stats.sent++;
+        }
+        pending += queue->count;
+    }
+
+    return pending;
+}
+
+uint16_t outbox_pending(const Outbox_t *outbox)
+{
+    uint16_t pending = 0;
+    for (int i = 0; outbox != NULL && i < OUTBOX_PRIORITY_MAX; i++)
+    {
+        pending += outbox->queues[i].count;
+    }
+
+    return pending;
+}
+
+void outbox_get_stats(const Outbox_t *outbox, OutboxPriority_t priority, OutboxQueueStats_t *stats)
+{
+    if (outbox != NULL && priority < OUTBOX_PRIORITY_MAX && stats != NULL)
+    {
+        *stats = outbox->queues[priority].stats;
+    }
+}
+
+/**
+ * @brief Decide whether a queue takes one more entry, starting the block deadline when it is full
+ * @param queue The queue
+ * @param nowMs The current time in milliseconds
+ * @return OutboxStatus_t OUTBOX_QUEUED if there is room or the oldest entry can make some
+ */
+static OutboxStatus_t _outbox_admit(OutboxQueue_t *queue, uint32_t nowMs)
+{
+    if (queue->count < queue->config.depth)
+    {
+        return OUTBOX_QUEUED;
+    }
+
+    switch (queue->config.policy)
+    {
+    case OUTBOX_DROP_OLDEST:
+        return OUTBOX_QUEUED;
+
+    case OUTBOX_BLOCK:
+        /** The deadline runs from the first producer held back, not from each retry */
+        if (!queue->blocking)
+        {
+            queue->blocking = true;
+            queue->blockedSinceMs = nowMs;
+        }
+        return nowMs - queue->blockedSinceMs < queue->config.blockMs ? OUTBOX_BLOCKED : OUTBOX_REJECTED;
+
+    case OUTBOX_DROP_NEWEST:
+    default:
+        return OUTBOX_REJECTED;
+    }
+}
+
+/**
+ * @brief Remove the oldest entry of a queue, the producers held back get the room
+ * @param queue The queue, not empty
+ */
+static void _outbox_pop(OutboxQueue_t *queue)
+{
+    queue->head = (uint8_t)((queue->head + 1) % queue->config.depth);
+    queue->count--;
+    queue->stats.depth = queue->count;
+    queue->blocking = false;
+}
@@ -0,0 +1,152 @@
+/** Includes *************************************************************************************/
+#include "pbuf_stream.h"
+
+#include <string.h>
+
+/** Defines **************************************************************************************/
+/** Typedefs *************************************************************************************/
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+/** Functions ************************************************************************************/
+
+void pbuf_stream_init(PbufStream_t *stream, struct tcp_pcb *pcb, PbufStreamConsumeFn_t consume, void *arg)
+{
+    memset(stream, 0, sizeof(PbufStream_t));
+    stream->pcb = pcb;
+    stream->consume = consume;
+    stream->arg = arg;
+}
+
+void pbuf_stream_push(PbufStream_t *stream, struct pbuf *p)
+{
+    if (p == NULL)
+    {
+        return;
+    }
+
+    stream->pending += p->tot_len;
+    stream->stats.bytesReceived += p->tot_len;
+    stream->stats.pbufsReceived++;
+
+    /**
+     * The unconsumed data is bounded by the TCP window because it is only opened again
+     * on release, so the tot_len of the joined chain cannot overflow.
+     */
+    if (stream->head == NULL)
+    {
+        stream->head = p;
+        stream->offset = 0;
+    }
+    else
+    {
+        pbuf_cat(stream->head, p);
+    }
+}
+
+uint32_t pbuf_stream_process(PbufStream_t *stream)
+{
+    uint32_t consumed = 0;
+
+    if (stream->consume == NULL)
+    {
+        return 0;
+    }
+
+    const uint8_t *data = NULL;
+    uint16_t len = 0;
+    while ((len = pbuf_stream_peek(stream, &data)) > 0)
+    {
+        uint16_t used = stream->consume(stream->arg, data, len);
+        if (used > len)
+        {
+            used = len;
+        }
+
+        pbuf_stream_release(stream, used);
+        consumed += used;
+
+        if (used < len)
+        {
+            /** The consumer is full, the rest stays in the stream */
+            break;
+        }
+    }
+
+    return consumed;
+}
+
+uint16_t pbuf_stream_peek(PbufStream_t *stream, const uint8_t **data)
+{
+    /** Free a fully consumed or empty head so the span starts in a pbuf with data */
+    if (stream->head != NULL && stream->offset >= stream->head->len)
+    {
+        pbuf_stream_release(stream, 0);
+    }
+
+    if (stream->head == NULL)
+    {
+        *data = NULL;
+        return 0;
+    }
+
+    *data = (const uint8_t *)stream->head->payload + stream->offset;
+    return stream->head->len - stream->offset;
+}
+
+void pbuf_stream_release(PbufStream_t *stream, uint32_t len)
+{
+    if (len > stream->pending)
+    {
+        len = stream->pending;
+    }
+
+    stream->pending -= len;
+    stream->stats.bytesConsumed += len;
+
+    /** Walk the chain, freeing every pbuf that has been consumed completely */
+    uint32_t remaining = len;
+    while (stream->head != NULL)
+    {
+        uint16_t available = stream->head->len - stream->offset;
+        if (remaining < available)
+        {
+            stream->offset += remaining;
+            break;
+        }
+        remaining -= available;
+
+        /**
+         * Drop the head pbuf. The extra reference on next keeps the rest of the chain
+         * alive when pbuf_free() walks down from the head.
+         */
+        struct pbuf *next = stream->head->next;
+        if (next != NULL)
+        {
+            pbuf_ref(next);
+        }
+        pbuf_free(stream->head);
+        stream->head = next;
+        stream->offset = 0;
+    }
+
+    /** Open the window by what the consumer released, tcp_recved takes a u16_t */
+    while (stream->pcb != NULL && len > 0)
+    {
+        uint16_t chunk = len > 0xFFFF ? 0xFFFF : (uint16_t)len;
+        tcp_recved(stream->pcb, chunk);
+        len -= chunk;
+    }
+}
+
+void pbuf_stream_reset(PbufStream_t *stream)
+{
+    if (stream->head != NULL)
+    {
+        pbuf_free(stream->head);
+    }
+
+    stream->head = NULL;
+    stream->offset = 0;
+    stream->pending = 0;
+    stream->pcb = NULL;
+}
@@ -0,0 +1,80 @@
+/** Includes *************************************************************************************/
+#include "pool_stats.h"
+
+#include <stddef.h>
+
+#include "lwip/memp.h"
+#include "lwip/priv/memp_priv.h"
+#include "lwip/stats.h"
+
+/** Defines **************************************************************************************/
+/** Typedefs *************************************************************************************/
+/** Variables ************************************************************************************/
+#if MEMP_STATS
+/** Pool names indexed by memp_t, lwIP only keeps its own with LWIP_DEBUG */
+static const char *const PoolStatsNames[MEMP_MAX] = {
+#define LWIP_MEMPOOL(name, num, size, desc) #name,
+#include "lwip/priv/memp_std.h"
+};
+#endif
+
+/** Prototypes ***********************************************************************************/
+/** Functions ************************************************************************************/
+
+int pool_stats_count(void)
+{
+#if MEMP_STATS
+    return MEMP_MAX;
+#else
+    return 0;
+#endif
+}
+
+int pool_stats_get(int index, PoolStats_t *stats)
+{
+#if MEMP_STATS
+    if (index < 0 || index >= MEMP_MAX || stats == NULL)
+    {
+        return -1;
+    }
+
+    const struct memp_desc *pool = memp_pools[index];
+    stats->name = PoolStatsNames[index];
+    stats->size = pool->size;
+    stats->avail = (uint16_t)pool->stats->avail;
+    stats->used = (uint16_t)pool->stats->used;
+    stats->max = (uint16_t)pool->stats->max;
+    stats->err = pool->stats->err;
+
+    return 0;
+#else
+    (void)index;
+    (void)stats;
+    return -1;
+#endif
+}
+
+void pool_stats_totals(uint32_t *totalBytes, uint32_t *peakBytes)
+{
+    uint32_t total = 0;
+    uint32_t peak = 0;
+
+    PoolStats_t stats;
+    for (int i = 0; i < pool_stats_count(); i++)
+    {
+        if (pool_stats_get(i, &stats) == 0)
+        {
+            total += (uint32_t)stats.size * stats.avail;
+            peak += (uint32_t)stats.size * stats.max;
+        }
+    }
+
+    if (totalBytes != NULL)
+    {
+        *totalBytes = total;
+    }
+    if (peakBytes != NULL)
+    {
+        *peakBytes = peak;
+    }
+}
@@ -0,0 +1,148 @@
+/** Includes *************************************************************************************/
+#include "power.h"
+
+#include <stddef.h>
+#include <string.h>
+
+/** Defines **************************************************************************************/
+/** Typedefs *************************************************************************************/
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+static void _power_account(Power_t *power, uint64_t nowUs);
+
+/** Functions ************************************************************************************/
+
+int power_init(Power_t *power, const PowerConfig_t *config, uint64_t nowUs)
+{
+    if (power == NULL || config == NULL || config->cycleMs == 0)
+    {
+        return -1;
+    }
+
+    memset(power, 0, sizeof(Power_t));
+    power->config = *config;
+    power->awake = true;
+    power->startUs = nowUs;
+    power->awakeSinceUs = nowUs;
+    power->sleepSinceUs = nowUs;
+    power->cycleStartUs = nowUs;
+
+    return 0;
+}
+
+uint64_t power_sleep(Power_t *power, uint64_t nowUs, uint64_t deadlineUs)
+{
+    if (power == NULL)
+    {
+        return deadlineUs;
+    }
+
+    if (power->awake)
+    {
+        power->cycleAwakeUs += nowUs - power->awakeSinceUs;
+        power->stats.awakeUs += nowUs - power->awakeSinceUs;
+        power->awake = false;
+    }
+    power->sleepSinceUs = nowUs;
+    _power_account(power, nowUs);
+
+    /** Round up on a fixed grid, deadlines close to each other end up on the same wake-up */
+    uint64_t slackUs = (uint64_t)power->config.slackMs * 1000u;
+    if (slackUs == 0 || deadlineUs <= nowUs)
+    {
+        return deadlineUs;
+    }
+
+    return (deadlineUs + slackUs - 1) / slackUs * slackUs;
+}
+
+void power_wake(Power_t *power, uint64_t nowUs, bool slept)
+{
+    if (power == NULL || power->awake)
+    {
+        return;
+    }
+
+    power->awake = true;
+    if (!slept)
+    {
+        /** The time since power_sleep() was spent awake */
+        power->awakeSinceUs = power->sleepSinceUs;
+        return;
+    }
+
+    power->awakeSinceUs = nowUs;
+    power->cycleWakeups++;
+    power->stats.wakeups++;
+}
+
+void power_get_stats(const Power_t *power, PowerStats_t *stats)
+{
+    if (power != NULL && stats != NULL)
+    {
+        *stats = power->stats;
+    }
+}
+
+uint16_t power_keep_alive_s(uint32_t cycleMs, uint16_t minKeepAliveS)
+{
+    /** 64 bits, two cycles of a day or more and their rounding don't fit in 32 */
+    uint64_t keepAliveMs = 2 * (uint64_t)cycleMs;
+    if (keepAliveMs < (uint64_t)minKeepAliveS * 1000u)
+    {
+        keepAliveMs = (uint64_t)minKeepAliveS * 1000u;
+    }
+
+    /** Round up to a whole number of cycles */
+    if (cycleMs != 0)
+    {
+        keepAliveMs = (keepAliveMs + cycleMs - 1) / cycleMs * cycleMs;
+    }
+
+    uint64_t keepAliveS = (keepAliveMs + 999u) / 1000u;
+    return keepAliveS > UINT16_MAX ? UINT16_MAX : (uint16_t)keepAliveS;
+}
+
+uint8_t power_listen_interval(uint32_t cycleMs)
+{
+    uint64_t beacons = (uint64_t)cycleMs * 1000u / POWER_BEACON_INTERVAL_US;
+    if (beacons < 1)
+    {
+        return 1;
+    }
+
+    return beacons > POWER_RADIO_MAX_LISTEN_INTERVAL ? POWER_RADIO_MAX_LISTEN_INTERVAL : (uint8_t)beacons;
+}
+
+/**
+ * @brief Close the cycles that ended before now
+ * @param power The accounting, asleep
+ * @param nowUs The current time in microseconds
+ * @note The awake time is counted in the cycle the loop goes to sleep in.
+ */
+static void _power_account(Power_t *power, uint64_t nowUs)
+{
+    uint64_t cycleUs = (uint64_t)power->config.cycleMs * 1000u;
+    power->stats.elapsedUs = nowUs - power->startUs;
+
+    if (nowUs - power->cycleStartUs < cycleUs)
+    {
+        return;
+    }
+
+    /** A long sleep may have spanned whole cycles, they count as cycles spent asleep */
+    uint64_t endedCycles = (nowUs - power->cycleStartUs) / cycleUs;
+    uint32_t awakeMs = (uint32_t)(power->cycleAwakeUs / 1000u);
+    power->stats.cycles += (uint32_t)endedCycles;
+    power->stats.lastAwakeMs = awakeMs;
+    power->stats.lastWakeups = power->cycleWakeups;
+    if (awakeMs > power->stats.maxAwakeMs)
+    {
+        power->stats.maxAwakeMs = awakeMs;
+    }
+    histogram_add(&power->stats.cycleAwakeUs, (uint32_t)power->cycleAwakeUs);
+
+    power->cycleStartUs += endedCycles * cycleUs;
+    power->cycleAwakeUs = 0;
+    power->cycleWakeups = 0;
+}
@@ -0,0 +1,274 @@
+/** Includes *************************************************************************************/
+#include "publish_queue.h"
+
+#include <string.h>
+
+/** Defines **************************************************************************************/
+/** Time to wait before retrying a batch the flush function failed to send */
+#define PUBLISH_QUEUE_RETRY_MS 1000
+
+/** Typedefs *************************************************************************************/
+
+/** How the samples of a format are put together into a payload */
+typedef struct
+{
+    const char *prefix; /** Before a single sample */
+    uint8_t prefixLen;
+    const char *open;   /** Before the first sample of a batch */
+    uint8_t openLen;
+    const char *separator; /** Between two samples of a batch */
+    uint8_t separatorLen;
+    char close;         /** After the last sample of a batch */
+} PublishQueueFraming_t;
+
+/** Variables ************************************************************************************/
+/** Indexed by MqttPayloadFormat_t, 0xD9D9F7 is the CBOR self-describe tag and 0x9F an indefinite array */
+static const PublishQueueFraming_t PublishQueueFraming[MQTT_FORMAT_MAX] = {
+    [MQTT_FORMAT_JSON] = {.prefix = "", .prefixLen = 0, .open = "[", .openLen = 1, .separator = ",", .separatorLen = 1, .close = ']'},
+    [MQTT_FORMAT_CBOR] = {.prefix = "\xD9\xD9\xF7", .prefixLen = 3, .open = "\xD9\xD9\xF7\x9F", .openLen = 4, .separator = "", .separatorLen = 0, .close = '\xFF'},
+};
+
+/** Prototypes ***********************************************************************************/
+/** Functions ************************************************************************************/
+
+int publish_queue_init(PublishQueue_t *queue, const PublishQueueConfig_t *config, PublishQueueFlushFn_t flush, void *arg)
+{
+    if (queue == NULL || config == NULL || flush == NULL)
+    {
+        return -1;
+    }
+
+    memset(queue, 0, sizeof(PublishQueue_t));
+    queue->config = *config;
+    queue->flush = flush;
+    queue->flushArg = arg;
+
+    if (queue->config.maxBytes > PUBLISH_QUEUE_BATCH_SIZE)
+    {
+        queue->config.maxBytes = PUBLISH_QUEUE_BATCH_SIZE;
+    }
+
+    return 0;
+}
+
+int publish_queue_set_format(PublishQueue_t *queue, MqttTopic_t topic, MqttPayloadFormat_t format)
+{
+    if (queue == NULL || topic >= MQTT_TOPIC_MAX || format >= MQTT_FORMAT_MAX)
+    {
+        return -1;
+    }
+
+    PublishBatch_t *batch = &queue->batches[topic];
+    if (batch->format == format)
+    {
+        return 0;
+    }
+
+    /** A batch can't mix formats */
+    int rc = 0;
+    if (publish_queue_flush(queue, topic) != 0)
+    {
+        queue->stats.dropped += batch->count;
+        batch->len = 0;
+        batch->count = 0;
+        batch->whole = false;
+        rc = -1;
+    }
+    batch->format = format;
+
+    return rc;
+}
+
+MqttPayloadFormat_t publish_queue_get_format(const PublishQueue_t *queue, MqttTopic_t topic)
+{
+    if (queue == NULL || topic >= MQTT_TOPIC_MAX)
+    {
+        return MQTT_FORMAT_JSON;
+    }
+
+    return queue->batches[topic].format;
+}
+
+int publish_queue_add(PublishQueue_t *queue, MqttTopic_t topic, const char *sample, uint16_t len, uint32_t nowMs)
+{
+    if (queue == NULL || sample == NULL || topic >= MQTT_TOPIC_MAX)
+    {
+        return -1;
+    }
+
+    queue->stats.samples++;
+
+    PublishBatch_t *batch = &queue->batches[topic];
+    const PublishQueueFraming_t *framing = &PublishQueueFraming[batch->format];
+
+    /** Batching disabled, send the sample as it is */
+    if (queue->config.maxBytes == 0)
+    {
+        /** A sample that could not be sent goes first, this one can't wait behind it */
+        if (batch->count > 0 && publish_queue_flush(queue, topic) != 0)
+        {
+            queue->stats.dropped++;
+            return -1;
+        }
+        if ((uint32_t)framing->prefixLen + len > PUBLISH_QUEUE_BATCH_SIZE)
+        {
+            queue->stats.dropped++;
+            return -1;
+        }
+
+        const char *payload = sample;
+        uint16_t payloadLen = len;
+        if (framing->prefixLen > 0)
+        {
+            /** The batch buffer is unused without batching, prefix the sample in it */
+            memcpy(batch->payload, framing->prefix, framing->prefixLen);
+            memcpy(&batch->payload[framing->prefixLen], sample, len);
+            payload = batch->payload;
+            payloadLen += framing->prefixLen;
+        }
+
+        queue->stats.flushes++;
+        if (queue->flush(queue->flushArg, topic, payload, payloadLen) == 0)
+        {
+            queue->stats.payloadBytes += payloadLen;
+            return 0;
+        }
+
+        /** Keep the sample in the batch buffer, publish_queue_poll() sends it again */
+        queue->stats.flushErrors++;
+        if (payload != batch->payload)
+        {
+            memcpy(batch->payload, sample, len);
+        }
+        batch->len = payloadLen;
+        batch->count = 1;
+        batch->firstSampleMs = nowMs;
+        batch->whole = true;
+        return 0;
+    }
+
+    /** Room for the separator, or the opening of the batch, and the closing */
+    uint32_t needed = (uint32_t)len + framing->separatorLen + 1;
+
+    if (batch->count > 0 && batch->len + needed > PUBLISH_QUEUE_BATCH_SIZE)
+    {
+        publish_queue_flush(queue, topic);
+    }
+
+    if (batch->count == 0)
+    {
+        needed = (uint32_t)len + framing->openLen + 1;
+    }
+
+    if (batch->len + needed > PUBLISH_QUEUE_BATCH_SIZE)
+    {
+        /** Either the sample is larger than a batch or the flush above failed */
+        queue->stats.dropped++;
+        return -1;
+    }
+
+    if (batch->count == 0)
+    {
+        memcpy(batch->payload, framing->open, framing->openLen);
+        batch->len = framing->openLen;
+        batch->firstSampleMs = nowMs;
+    }
+    else
+    {
+        memcpy(&batch->payload[batch->len], framing->separator, framing->separatorLen);
+        batch->len += framing->separatorLen;
+    }
+
+    memcpy(&batch->payload[batch->len], sample, len);
+    batch->len += len;
+    batch->count++;
+
+    /** The closing counts towards the size threshold */
+    if (batch->len + 1 >= queue->config.maxBytes)
+    {
+        publish_queue_flush(queue, topic);
+    }
+
+    return 0;
+}
+
+uint32_t publish_queue_poll(PublishQueue_t *queue, uint32_t nowMs)
+{
+    uint32_t nextMs = UINT32_MAX;
+
+    if (queue == NULL)
+    {
+        return nextMs;
+    }
+
+    for (int topic = 0; topic < MQTT_TOPIC_MAX; topic++)
+    {
+        PublishBatch_t *batch = &queue->batches[topic];
+        if (batch->count == 0)
+        {
+            continue;
+        }
+
+        uint32_t ageMs = nowMs - batch->firstSampleMs;
+        uint32_t remainingMs = 0;
+
+        if (batch->whole || ageMs >= queue->config.maxAgeMs)
+        {
+            if (publish_queue_flush(queue, (MqttTopic_t)topic) != 0)
+            {
+                remainingMs = PUBLISH_QUEUE_RETRY_MS;
+            }
+            else
+            {
+                continue;
+            }
+        }
+        else
+        {
+            remainingMs = queue->config.maxAgeMs - ageMs;
+        }
+
+        if (remainingMs < nextMs)
+        {
+            nextMs = remainingMs;
+        }
+    }
+
+    return nextMs;
+}
+
+int publish_queue_flush(PublishQueue_t *queue, MqttTopic_t topic)
+{
+    if (queue == NULL || topic >= MQTT_TOPIC_MAX)
+    {
+        return -1;
+    }
+
+    PublishBatch_t *batch = &queue->batches[topic];
+    if (batch->count == 0)
+    {
+        return 0;
+    }
+
+    /** Space for the closing was reserved when the last sample was added */
+    uint16_t len = batch->len;
+    if (!batch->whole)
+    {
+        batch->payload[len++] = PublishQueueFraming[batch->format].close;
+    }
+
+    queue->stats.flushes++;
+    if (queue->flush(queue->flushArg, topic, batch->payload, len) != 0)
+    {
+        /** Keep the batch, it is retried on the next flush */
+        queue->stats.flushErrors++;
+        return -1;
+    }
+
+    queue->stats.payloadBytes += len;
+    batch->len = 0;
+    batch->count = 0;
+    batch->whole = false;
+
+    return 0;
+}
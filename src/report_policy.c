@@ -0,0 +1,140 @@
+/** Includes *************************************************************************************/
+#include "report_policy.h"
+#include "cbor_writer.h"
+#include "json_writer.h"
+
+#include <stddef.h>
+#include <string.h>
+
+/** Defines **************************************************************************************/
+/** Key of a delta report */
+#define REPORT_POLICY_DELTA_KEY "d"
+
+/** Typedefs *************************************************************************************/
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+/** Functions ************************************************************************************/
+
+int report_policy_init(ReportPolicy_t *policy, const ReportPolicyConfig_t *config)
+{
+    if (policy == NULL || config == NULL)
+    {
+        return -1;
+    }
+
+    memset(policy, 0, sizeof(ReportPolicy_t));
+    policy->config = *config;
+
+    return 0;
+}
+
+bool report_policy_check(ReportPolicy_t *policy, int32_t value, uint32_t nowMs, ReportPolicyReport_t *report)
+{
+    if (policy == NULL || report == NULL)
+    {
+        return false;
+    }
+
+    /** In 64 bits, the change of two large values doesn't fit in 32 */
+    int64_t change = (int64_t)value - policy->lastValue;
+
+    if (!policy->reported)
+    {
+        report->reason = REPORT_FIRST;
+    }
+    else
+    {
+        int64_t magnitude = change < 0 ? -change : change;
+
+        if (magnitude > report_policy_band(policy))
+        {
+            report->reason = REPORT_CHANGE;
+        }
+        else if (policy->config.maxSilenceMs != 0 && nowMs - policy->lastMs >= policy->config.maxSilenceMs)
+        {
+            report->reason = REPORT_HEARTBEAT;
+        }
+        else
+        {
+            policy->stats.suppressed++;
+            return false;
+        }
+    }
+
+    /** The first report, the heartbeats and a change past 32 bits carry the full value, a receiver resyncs on them */
+    report->delta = policy->config.delta && report->reason == REPORT_CHANGE && change >= INT32_MIN && change <= INT32_MAX;
+    report->value = report->delta ? (int32_t)change : value;
+
+    return true;
+}
+
+int64_t report_policy_band(const ReportPolicy_t *policy)
+{
+    if (policy == NULL)
+    {
+        return -1;
+    }
+
+    /** In 64 bits, the relative band of a large value doesn't fit in 32 */
+    int64_t last = policy->lastValue < 0 ? -(int64_t)policy->lastValue : policy->lastValue;
+    int64_t band = policy->config.absDeadband;
+    int64_t relativeBand = last * policy->config.relDeadbandPermille / 1000;
+    if (band >= 0 && relativeBand > band)
+    {
+        band = relativeBand;
+    }
+
+    return band;
+}
+
+void report_policy_sent(ReportPolicy_t *policy, const ReportPolicyReport_t *report, int32_t value, uint32_t nowMs)
+{
+    if (policy == NULL || report == NULL)
+    {
+        return;
+    }
+
+    policy->reported = true;
+    policy->lastValue = value;
+    policy->lastMs = nowMs;
+
+    policy->stats.sent++;
+    if (report->reason == REPORT_HEARTBEAT)
+    {
+        policy->stats.heartbeats++;
+    }
+    if (report->delta)
+    {
+        policy->stats.deltas++;
+    }
+}
+
+int report_policy_encode(const ReportPolicyReport_t *report, MqttPayloadFormat_t format, const char *key, uint8_t decimals,
+                         uint8_t *buffer, uint16_t size)
+{
+    if (report == NULL || key == NULL || buffer == NULL)
+    {
+        return -1;
+    }
+
+    const char *reportKey = report->delta ? REPORT_POLICY_DELTA_KEY : key;
+
+    if (format == MQTT_FORMAT_CBOR)
+    {
+        /** {"t": 4([-2, 2345])} */
+        CborWriter_t writer;
+        cbor_writer_init(&writer, buffer, size);
+        cbor_writer_map(&writer, 1);
+        cbor_writer_text(&writer, reportKey);
+        cbor_writer_decimal(&writer, report->value, decimals);
+        return cbor_writer_finish(&writer);
+    }
+
+    JsonWriter_t writer;
+    json_writer_init(&writer, (char *)buffer, size);
+    json_writer_begin_object(&writer);
+    json_writer_key(&writer, reportKey);
+    json_writer_fixed(&writer, report->value, decimals);
+    json_writer_end_object(&writer);
+    return json_writer_finish(&writer);
+}
@@ -0,0 +1,121 @@
+/** Includes *************************************************************************************/
+#include "ring_buffer.h"
+
+#include <stddef.h>
+#include <string.h>
+
+/** Defines **************************************************************************************/
+/**
+ * Index accessors. The acquire load of the other side's index orders the data accesses after
+ * it, the release store of our own index publishes the data accesses before it.
+ */
+#define RING_LOAD(x) __atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define RING_STORE(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELEASE)
+
+/** Typedefs *************************************************************************************/
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+/** Functions ************************************************************************************/
+
+int ring_buffer_init(RingBuffer_t *ring, uint8_t *storage, uint32_t size)
+{
+    if (ring == NULL || storage == NULL || size == 0 || (size & (size - 1)) != 0)
+    {
+        return -1;
+    }
+
+    ring->buffer = storage;
+    ring->size = size;
+    ring->mask = size - 1;
+    ring->head = 0;
+    ring->tail = 0;
+
+    return 0;
+}
+
+void ring_buffer_reset(RingBuffer_t *ring)
+{
+    ring->head = 0;
+    ring->tail = 0;
+}
+
+uint32_t ring_buffer_used(const RingBuffer_t *ring)
+{
+    return RING_LOAD(ring->head) - RING_LOAD(ring->tail);
+}
+
+uint32_t ring_buffer_free(const RingBuffer_t *ring)
+{
+    return ring->size - ring_buffer_used(ring);
+}
+
+uint32_t ring_buffer_write(RingBuffer_t *ring, const uint8_t *data, uint32_t len)
+{
+    uint32_t head = ring->head;
+    uint32_t space = ring->size - (head - RING_LOAD(ring->tail));
+    if (len > space)
+    {
+        len = space;
+    }
+
+    /** Copy in up to two pieces, the second one when the write wraps around */
+    uint32_t offset = head & ring->mask;
+    uint32_t first = ring->size - offset;
+    if (first > len)
+    {
+        first = len;
+    }
+    memcpy(&ring->buffer[offset], data, first);
+    memcpy(&ring->buffer[0], data + first, len - first);
+
+    RING_STORE(ring->head, head + len);
+
+    return len;
+}
+
+uint32_t ring_buffer_read(RingBuffer_t *ring, uint8_t *data, uint32_t len)
+{
+    uint32_t tail = ring->tail;
+    uint32_t available = RING_LOAD(ring->head) - tail;
+    if (len > available)
+    {
+        len = available;
+    }
+
+    uint32_t offset = tail & ring->mask;
+    uint32_t first = ring->size - offset;
+    if (first > len)
+    {
+        first = len;
+    }
+    memcpy(data, &ring->buffer[offset], first);
+    memcpy(data + first, &ring->buffer[0], len - first);
+
+    RING_STORE(ring->tail, tail + len);
+
+    return len;
+}
+
+uint32_t ring_buffer_peek(const RingBuffer_t *ring, const uint8_t **data)
+{
+    uint32_t tail = ring->tail;
+    uint32_t available = RING_LOAD(ring->head) - tail;
+    uint32_t offset = tail & ring->mask;
+    uint32_t first = ring->size - offset;
+
+    *data = &ring->buffer[offset];
+
+    return available < first ? available : first;
+}
+
+void ring_buffer_consume(RingBuffer_t *ring, uint32_t len)
+{
+    uint32_t tail = ring->tail;
+    uint32_t available = RING_LOAD(ring->head) - tail;
+    if (len > available)
+    {
+        len = available;
+    }
+
+    RING_STORE(ring->tail, tail + len);
+}
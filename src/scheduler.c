@@ -0,0 +1,279 @@
+/** Includes *************************************************************************************/
+#include "scheduler.h"
+
+#include <string.h>
+#include "pico/stdlib.h"
+#include "pico/cyw43_arch.h"
+
+/** Defines **************************************************************************************/
+/** Words of the wake mask, one bit per task */
+#define SCHEDULER_WAKE_WORDS ((SCHEDULER_MAX_TASKS + 31) / 32)
+
+/** Typedefs *************************************************************************************/
+typedef struct
+{
+    SchedulerTaskFn_t fn;
+    void *arg;
+    uint32_t periodMs;
+    uint64_t deadlineUs;
+    uint64_t wokenAtUs; /** Time scheduler_wake() was called, 0 if not woken */
+} SchedulerTask_t;
+
+typedef struct
+{
+    SchedulerTask_t tasks[SCHEDULER_MAX_TASKS];
+    uint16_t queue[SCHEDULER_MAX_TASKS]; /** Task ids ordered by deadline, earliest first */
+    uint16_t taskCount;
+    volatile uint32_t wakeMask[SCHEDULER_WAKE_WORDS]; /** One bit per task that has been woken */
+    int currentTask;
+    async_when_pending_worker_t wakeWorker;
+    SchedulerStats_t stats;
+} Scheduler_t;
+
+/** Variables ************************************************************************************/
+static Scheduler_t Scheduler = {
+    .taskCount = 0,
+    .currentTask = SCHEDULER_INVALID_TASK,
+};
+
+/** Prototypes ***********************************************************************************/
+static void _scheduler_queue_remove(uint16_t taskId);
+static void _scheduler_queue_insert(uint16_t taskId);
+static void _scheduler_wake_worker(async_context_t *context, async_when_pending_worker_t *worker);
+
+/** Functions ************************************************************************************/
+
+int scheduler_init(void)
+{
+    memset(&Scheduler, 0, sizeof(Scheduler));
+    Scheduler.currentTask = SCHEDULER_INVALID_TASK;
+
+    /**
+     * The worker has nothing to do, marking it pending is only used to release the
+     * async context semaphore so cyw43_arch_wait_for_work_until() returns early.
+     */
+    Scheduler.wakeWorker.do_work = _scheduler_wake_worker;
+    if (!async_context_add_when_pending_worker(cyw43_arch_async_context(), &Scheduler.wakeWorker))
+    {
+        printf("Failed to add scheduler wake worker\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+int scheduler_add_task(SchedulerTaskFn_t fn, void *arg, uint32_t periodMs)
+{
+    if (fn == NULL || Scheduler.taskCount >= SCHEDULER_MAX_TASKS)
+    {
+        return SCHEDULER_INVALID_TASK;
+    }
+
+    uint16_t taskId = Scheduler.taskCount;
+    SchedulerTask_t *task = &Scheduler.tasks[taskId];
+    task->fn = fn;
+    task->arg = arg;
+    task->periodMs = periodMs;
+    task->deadlineUs = time_us_64();
+    task->wokenAtUs = 0;
+
+    /** The queue only holds registered tasks so the new task goes in after the last one */
+    Scheduler.taskCount++;
+    Scheduler.queue[taskId] = taskId;
+    _scheduler_queue_remove(taskId);
+    _scheduler_queue_insert(taskId);
+
+    return taskId;
+}
+
+int scheduler_wake(int taskId)
+{
+    if (taskId < 0 || taskId >= Scheduler.taskCount)
+    {
+        return -1;
+    }
+
+    /** Only the first wake stamps the time so latency is measured from the earliest request */
+    volatile uint32_t *word = &Scheduler.wakeMask[taskId / 32];
+    uint32_t bit = 1u << (taskId % 32);
+    if ((*word & bit) == 0)
+    {
+        Scheduler.tasks[taskId].wokenAtUs = time_us_64();
+    }
+    __atomic_fetch_or(word, bit, __ATOMIC_SEQ_CST);
+
+    async_context_set_work_pending(cyw43_arch_async_context(), &Scheduler.wakeWorker);
+
+    return 0;
+}
+
+int scheduler_delay(int taskId, uint32_t delayMs)
+{
+    if (taskId < 0 || taskId >= Scheduler.taskCount)
+    {
+        return -1;
+    }
+
+    Scheduler.tasks[taskId].deadlineUs = time_us_64() + (uint64_t)delayMs * 1000u;
+    _scheduler_queue_remove(taskId);
+    _scheduler_queue_insert(taskId);
+
+    return 0;
+}
+
+int scheduler_current_task(void)
+{
+    return Scheduler.currentTask;
+}
+
+uint64_t scheduler_run(void)
+{
+    uint64_t nowUs = time_us_64();
+
+    /** Move every woken task to the front of the queue */
+    for (uint16_t w = 0; w < SCHEDULER_WAKE_WORDS; w++)
+    {
+        uint32_t woken = __atomic_exchange_n(&Scheduler.wakeMask[w], 0, __ATOMIC_SEQ_CST);
+        while (woken != 0)
+        {
+            uint16_t taskId = (uint16_t)(w * 32 + __builtin_ctz(woken));
+            woken &= woken - 1;
+            Scheduler.tasks[taskId].deadlineUs = nowUs;
+            _scheduler_queue_remove(taskId);
+            _scheduler_queue_insert(taskId);
+        }
+    }
+
+    /**
+     * Dispatch the due tasks in deadline order. Each task runs at most once per call so
+     * a task that keeps rescheduling itself with no delay cannot starve the loop. Such a task
+     * goes in behind every other due task, so once it is at the front again they have all run.
+     */
+    uint32_t dispatched[SCHEDULER_WAKE_WORDS] = {0};
+    for (uint16_t i = 0; i < Scheduler.taskCount; i++)
+    {
+        uint16_t taskId = Scheduler.queue[0];
+        SchedulerTask_t *task = &Scheduler.tasks[taskId];
+        uint32_t bit = 1u << (taskId % 32);
+        if (task->deadlineUs > nowUs || (dispatched[taskId / 32] & bit) != 0)
+        {
+            break;
+        }
+        dispatched[taskId / 32] |= bit;
+
+        _scheduler_queue_remove(taskId);
+        task->deadlineUs = nowUs + (uint64_t)task->periodMs * 1000u;
+
+        if (task->wokenAtUs != 0)
+        {
+            uint64_t latencyUs = time_us_64() - task->wokenAtUs;
+            task->wokenAtUs = 0;
+            Scheduler.stats.wakeCount++;
+            Scheduler.stats.wakeLatencyLastUs = latencyUs;
+            Scheduler.stats.wakeLatencyTotalUs += latencyUs;
+            if (latencyUs > Scheduler.stats.wakeLatencyMaxUs)
+            {
+                Scheduler.stats.wakeLatencyMaxUs = latencyUs;
+            }
+        }
+
+        Scheduler.currentTask = taskId;
+        task->fn(task->arg);
+        Scheduler.currentTask = SCHEDULER_INVALID_TASK;
+        Scheduler.stats.dispatchCount++;
+
+        /** The task may have rescheduled others while it ran, so find it again */
+        _scheduler_queue_remove(taskId);
+        _scheduler_queue_insert(taskId);
+    }
+
+    if (Scheduler.taskCount == 0)
+    {
+        return nowUs + (uint64_t)SCHEDULER_MAX_IDLE_MS * 1000u;
+    }
+
+    uint64_t nextDeadlineUs = Scheduler.tasks[Scheduler.queue[0]].deadlineUs;
+    uint64_t maxDeadlineUs = nowUs + (uint64_t)SCHEDULER_MAX_IDLE_MS * 1000u;
+
+    return nextDeadlineUs < maxDeadlineUs ? nextDeadlineUs : maxDeadlineUs;
+}
+
+bool scheduler_wait_until(uint64_t deadlineUs)
+{
+    /** Don't sleep if a task was woken while the others were running */
+    for (uint16_t w = 0; w < SCHEDULER_WAKE_WORDS; w++)
+    {
+        if (Scheduler.wakeMask[w] != 0)
+        {
+            return false;
+        }
+    }
+    if (time_us_64() >= deadlineUs)
+    {
+        return false;
+    }
+
+    Scheduler.stats.sleepCount++;
+    cyw43_arch_wait_for_work_until(from_us_since_boot(deadlineUs));
+
+    return true;
+}
+
+void scheduler_get_stats(SchedulerStats_t *stats)
+{
+    if (stats != NULL)
+    {
+        *stats = Scheduler.stats;
+    }
+}
+
+/**
+ * @brief Remove a task from the deadline queue
+ * @param taskId The task to remove
+ * @note The removed id is parked in the last slot of the queue until the matching
+ *       _scheduler_queue_insert() call.
+ */
+static void _scheduler_queue_remove(uint16_t taskId)
+{
+    for (uint16_t i = 0; i < Scheduler.taskCount; i++)
+    {
+        if (Scheduler.queue[i] == taskId)
+        {
+            memmove(&Scheduler.queue[i], &Scheduler.queue[i + 1], (Scheduler.taskCount - i - 1) * sizeof(Scheduler.queue[0]));
+            Scheduler.queue[Scheduler.taskCount - 1] = taskId;
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Insert a task into the deadline queue
+ * @param taskId The task to insert, must have just been removed
+ * @note Tasks with equal deadlines keep their insertion order so they run round robin.
+ */
+static void _scheduler_queue_insert(uint16_t taskId)
+{
+    uint64_t deadlineUs = Scheduler.tasks[taskId].deadlineUs;
+    uint16_t last = Scheduler.taskCount - 1;
+    uint16_t pos = 0;
+
+    while (pos < last && Scheduler.tasks[Scheduler.queue[pos]].deadlineUs <= deadlineUs)
+    {
+        pos++;
+    }
+
+    memmove(&Scheduler.queue[pos + 1], &Scheduler.queue[pos], (last - pos) * sizeof(Scheduler.queue[0]));
+    Scheduler.queue[pos] = taskId;
+}
+
+/**
+ * @brief Async context worker used to wake the loop
+ * @param context The cyw43 async context
+ * @param worker The scheduler wake worker
+ * @note Nothing to do here, the woken tasks are dispatched by scheduler_run().
+ */
+static void _scheduler_wake_worker(async_context_t *context, async_when_pending_worker_t *worker)
+{
+    (void)context;
+    (void)worker;
+}
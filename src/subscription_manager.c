@@ -0,0 +1,139 @@
+/** Includes *************************************************************************************/
+#include "subscription_manager.h"
+#include "scheduler.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/** Defines **************************************************************************************/
+/** Typedefs *************************************************************************************/
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+static void _subscription_request_cb(void *arg, err_t err);
+
+/** Functions ************************************************************************************/
+
+void subscription_manager_start(SubscriptionManager_t *manager, mqtt_client_t *mqttClient, const TopicRouter_t *router, int taskId, uint32_t nowMs)
+{
+    /** The counters live across reconnects, everything else starts over */
+    SubscriptionStats_t stats = manager->stats;
+    memset(manager, 0, sizeof(SubscriptionManager_t));
+    manager->stats = stats;
+
+    manager->mqttClient = mqttClient;
+    manager->router = router;
+    manager->taskId = taskId;
+    manager->nowMs = nowMs;
+    manager->startMs = nowMs;
+
+    for (int route = 0; route < TOPIC_ROUTER_MAX_ROUTES; route++)
+    {
+        manager->entries[route].manager = manager;
+        manager->entries[route].state = SUBSCRIPTION_PENDING;
+    }
+}
+
+uint32_t subscription_manager_poll(SubscriptionManager_t *manager, uint32_t nowMs)
+{
+    uint32_t nextRetryMs = UINT32_MAX;
+    manager->nowMs = nowMs;
+
+    if (manager->mqttClient == NULL || manager->router == NULL)
+    {
+        return nextRetryMs;
+    }
+
+    for (int route = 0; route < topic_router_count(manager->router); route++)
+    {
+        SubscriptionEntry_t *entry = &manager->entries[route];
+
+        if (entry->state == SUBSCRIPTION_RETRY)
+        {
+            int32_t remainingMs = (int32_t)(entry->retryAtMs - nowMs);
+            if (remainingMs > 0)
+            {
+                if ((uint32_t)remainingMs < nextRetryMs)
+                {
+                    nextRetryMs = (uint32_t)remainingMs;
+                }
+                continue;
+            }
+            entry->state = SUBSCRIPTION_PENDING;
+        }
+
+        if (entry->state != SUBSCRIPTION_PENDING || manager->inFlight >= SUBSCRIPTION_MAX_IN_FLIGHT)
+        {
+            continue;
+        }
+
+        const TopicRoute_t *topicRoute = topic_router_get(manager->router, route);
+        err_t err = mqtt_subscribe(manager->mqttClient, topicRoute->filter, topicRoute->qos, _subscription_request_cb, entry);
+        if (err == ERR_MEM)
+        {
+            /** lwIP has no free request slot, try again when the next SUBACK frees one */
+            break;
+        }
+        else if (err != ERR_OK)
+        {
+            printf("Failed to subscribe to topic %s, err %d\n", topicRoute->filter, err);
+            _subscription_request_cb(entry, err);
+            continue;
+        }
+
+        entry->state = SUBSCRIPTION_IN_FLIGHT;
+        manager->inFlight++;
+        manager->stats.requests++;
+    }
+
+    return nextRetryMs;
+}
+
+bool subscription_manager_done(const SubscriptionManager_t *manager)
+{
+    return manager->router != NULL && manager->done >= topic_router_count(manager->router);
+}
+
+/**
+ * @brief lwIP request callback, called with the SUBACK result or on timeout
+ * @param arg The SubscriptionEntry_t of the filter
+ * @param err ERR_OK if the broker accepted the subscription
+ */
+static void _subscription_request_cb(void *arg, err_t err)
+{
+    SubscriptionEntry_t *entry = (SubscriptionEntry_t *)arg;
+    SubscriptionManager_t *manager = entry->manager;
+
+    if (entry->state == SUBSCRIPTION_IN_FLIGHT)
+    {
+        manager->inFlight--;
+    }
+
+    if (err == ERR_OK)
+    {
+        entry->state = SUBSCRIPTION_DONE;
+        entry->failures = 0;
+        manager->stats.acks++;
+        manager->done++;
+    }
+    else
+    {
+        /** Back off exponentially instead of giving up */
+        uint32_t backoffMs = SUBSCRIPTION_RETRY_BASE_MS << (entry->failures < 16 ? entry->failures : 16);
+        if (backoffMs > SUBSCRIPTION_RETRY_MAX_MS)
+        {
+            backoffMs = SUBSCRIPTION_RETRY_MAX_MS;
+        }
+
+        entry->state = SUBSCRIPTION_RETRY;
+        entry->retryAtMs = manager->nowMs + backoffMs;
+        if (entry->failures < UINT8_MAX)
+        {
+            entry->failures++;
+        }
+        manager->stats.failures++;
+        printf("Subscribe request failed %d, retrying in %lu ms\n", err, (unsigned long)backoffMs);
+    }
+
+    /** A request slot is free, let the task send the next one or move on to subscribed */
+    scheduler_wake(manager->taskId);
+}
@@ -0,0 +1,430 @@
+/** Includes *************************************************************************************/
+#include "topic_router.h"
+
+#include <stddef.h>
+#include <string.h>
+
+/** Defines **************************************************************************************/
+#define TOPIC_ROUTER_ROOT 0
+
+/** Typedefs *************************************************************************************/
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+static uint16_t _topic_router_hash(const char *level, size_t len);
+static const char *_topic_router_level_end(const char *level);
+static bool _topic_router_level_equal(const TopicRouter_t *router, const TopicRouterNode_t *node, const char *level, size_t len, uint16_t hash);
+static int _topic_router_insert(TopicRouter_t *router, uint8_t route, const char *filter, bool dryRun);
+static uint8_t _topic_router_new_node(TopicRouter_t *router, uint8_t route, const char *filter, const char *level, size_t len);
+static int _topic_router_match(const TopicRouter_t *router, uint8_t nodeIdx, const char *level, bool firstLevel);
+static int _topic_router_match_child(const TopicRouter_t *router, uint8_t childIdx, const char *end);
+static uint8_t _topic_router_lower_bound(const TopicRouter_t *router, const TopicRouterNode_t *node, uint16_t hash);
+static uint8_t _topic_router_find_child(const TopicRouter_t *router, const TopicRouterNode_t *node, const char *level, size_t len);
+static void _topic_router_add_child(TopicRouter_t *router, uint8_t nodeIdx, uint8_t childIdx);
+
+/** Functions ************************************************************************************/
+
+void topic_router_init(TopicRouter_t *router)
+{
+    memset(router, 0, sizeof(TopicRouter_t));
+
+    router->nodeCount = 1;
+    router->nodes[TOPIC_ROUTER_ROOT].route = TOPIC_ROUTER_NO_ROUTE;
+    router->nodes[TOPIC_ROUTER_ROOT].hashRoute = TOPIC_ROUTER_NO_ROUTE;
+}
+
+int topic_router_add(TopicRouter_t *router, const char *filter, uint8_t qos)
+{
+    if (router == NULL || filter == NULL || filter[0] == '\0')
+    {
+        return TOPIC_ROUTER_NO_ROUTE;
+    }
+
+    size_t filterLen = strlen(filter);
+    if (filterLen >= TOPIC_ROUTER_FILTER_LEN || router->routeCount >= TOPIC_ROUTER_MAX_ROUTES)
+    {
+        return TOPIC_ROUTER_NO_ROUTE;
+    }
+
+    /** Validate the wildcards before touching the trie */
+    for (const char *level = filter;; level = _topic_router_level_end(level) + 1)
+    {
+        const char *end = _topic_router_level_end(level);
+        size_t len = (size_t)(end - level);
+        bool wildcard = memchr(level, '+', len) != NULL || memchr(level, '#', len) != NULL;
+
+        if (wildcard && len != 1)
+        {
+            /** A wildcard must take up the whole level */
+            return TOPIC_ROUTER_NO_ROUTE;
+        }
+        if (level[0] == '#' && *end != '\0')
+        {
+            /** '#' must be the last level */
+            return TOPIC_ROUTER_NO_ROUTE;
+        }
+        if (*end == '\0')
+        {
+            break;
+        }
+    }
+
+    /** Check the filter is new and fits before touching the trie, so a failure leaves it as it was */
+    uint8_t route = router->routeCount;
+    if (_topic_router_insert(router, route, filter, true) != 0)
+    {
+        return TOPIC_ROUTER_NO_ROUTE;
+    }
+
+    /** The route is stored first so the new nodes can point into its filter */
+    TopicRoute_t *entry = &router->routes[route];
+    memcpy(entry->filter, filter, filterLen + 1);
+    entry->qos = qos;
+    _topic_router_insert(router, route, entry->filter, false);
+    router->routeCount++;
+
+    return route;
+}
+
+int topic_router_match(const TopicRouter_t *router, const char *topic)
+{
+    if (router == NULL || topic == NULL)
+    {
+        return TOPIC_ROUTER_NO_ROUTE;
+    }
+
+    return _topic_router_match(router, TOPIC_ROUTER_ROOT, topic, true);
+}
+
+int topic_router_count(const TopicRouter_t *router)
+{
+    return router->routeCount;
+}
+
+const TopicRoute_t *topic_router_get(const TopicRouter_t *router, int route)
+{
+    if (route < 0 || route >= router->routeCount)
+    {
+        return NULL;
+    }
+
+    return &router->routes[route];
+}
+
+/**
+ * @brief FNV-1a hash of a topic level folded to 16 bits
+ * @param level The level text
+ * @param len Length of the level
+ * @return uint16_t The hash
+ */
+static uint16_t _topic_router_hash(const char *level, size_t len)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++)
+    {
+        hash ^= (uint8_t)level[i];
+        hash *= 16777619u;
+    }
+
+    return (uint16_t)(hash ^ (hash >> 16));
+}
+
+/**
+ * @brief Find the end of a topic level
+ * @param level Start of the level
+ * @return const char* Pointer to the '/' or the terminator ending the level
+ */
+static const char *_topic_router_level_end(const char *level)
+{
+    while (*level != '\0' && *level != '/')
+    {
+        level++;
+    }
+
+    return level;
+}
+
+/**
+ * @brief Compare the level of a node with a topic level
+ * @return bool True if they are equal
+ */
+static bool _topic_router_level_equal(const TopicRouter_t *router, const TopicRouterNode_t *node, const char *level, size_t len, uint16_t hash)
+{
+    if (node->hash != hash || node->levelLen != len)
+    {
+        return false;
+    }
+
+    const char *text = &router->routes[node->levelRoute].filter[node->levelOffset];
+    return memcmp(text, level, len) == 0;
+}
+
+/**
+ * @brief Walk the trie along a filter, adding the missing nodes
+ * @param router The router
+ * @param route The route id to store at the end of the filter
+ * @param filter The filter, must stay valid while the nodes exist unless dryRun is set
+ * @param dryRun Only check that the filter is new and that there are enough free nodes
+ * @return int 0 on success, -1 if the filter is already registered or the node pool is too small
+ */
+static int _topic_router_insert(TopicRouter_t *router, uint8_t route, const char *filter, bool dryRun)
+{
+    uint8_t nodeIdx = TOPIC_ROUTER_ROOT;
+    uint8_t missing = 0;
+
+    for (const char *level = filter;; level = _topic_router_level_end(level) + 1)
+    {
+        const char *end = _topic_router_level_end(level);
+        size_t len = (size_t)(end - level);
+        TopicRouterNode_t *node = &router->nodes[nodeIdx];
+
+        if (level[0] == '#')
+        {
+            if (missing == 0 && node->hashRoute != TOPIC_ROUTER_NO_ROUTE)
+            {
+                return -1;
+            }
+            if (!dryRun)
+            {
+                node->hashRoute = (int8_t)route;
+            }
+            break;
+        }
+
+        uint8_t childIdx = 0;
+        if (missing == 0)
+        {
+            if (len == 1 && level[0] == '+')
+            {
+                childIdx = node->plusChild;
+            }
+            else
+            {
+                childIdx = _topic_router_find_child(router, node, level, len);
+            }
+        }
+
+        if (childIdx == 0)
+        {
+            missing++;
+        }
+
+        if (childIdx == 0 && !dryRun)
+        {
+            childIdx = _topic_router_new_node(router, route, filter, level, len);
+            if (len == 1 && level[0] == '+')
+            {
+                router->nodes[nodeIdx].plusChild = childIdx;
+            }
+            else
+            {
+                _topic_router_add_child(router, nodeIdx, childIdx);
+            }
+        }
+
+        if (!dryRun || missing == 0)
+        {
+            nodeIdx = childIdx;
+        }
+
+        if (*end == '\0')
+        {
+            if (missing == 0 && router->nodes[nodeIdx].route != TOPIC_ROUTER_NO_ROUTE)
+            {
+                return -1;
+            }
+            if (!dryRun)
+            {
+                router->nodes[nodeIdx].route = (int8_t)route;
+            }
+            break;
+        }
+    }
+
+    if (dryRun && router->nodeCount + missing > TOPIC_ROUTER_MAX_NODES)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Allocate a node for a filter level
+ * @return uint8_t The node index
+ * @warning The caller must have checked that the node pool has room.
+ */
+static uint8_t _topic_router_new_node(TopicRouter_t *router, uint8_t route, const char *filter, const char *level, size_t len)
+{
+    uint8_t nodeIdx = router->nodeCount++;
+    TopicRouterNode_t *node = &router->nodes[nodeIdx];
+    memset(node, 0, sizeof(TopicRouterNode_t));
+    node->hash = _topic_router_hash(level, len);
+    node->levelRoute = route;
+    node->levelOffset = (uint8_t)(level - filter);
+    node->levelLen = (uint8_t)len;
+    node->route = TOPIC_ROUTER_NO_ROUTE;
+    node->hashRoute = TOPIC_ROUTER_NO_ROUTE;
+
+    return nodeIdx;
+}
+
+/**
+ * @brief Match the remaining levels of a topic below a node
+ * @param router The router
+ * @param nodeIdx The node matched so far
+ * @param level Start of the next topic level
+ * @param firstLevel True for the first level of the topic
+ * @return int The route id, TOPIC_ROUTER_NO_ROUTE if nothing matches
+ */
+static int _topic_router_match(const TopicRouter_t *router, uint8_t nodeIdx, const char *level, bool firstLevel)
+{
+    const TopicRouterNode_t *node = &router->nodes[nodeIdx];
+    const char *end = _topic_router_level_end(level);
+    size_t len = (size_t)(end - level);
+    int route = TOPIC_ROUTER_NO_ROUTE;
+
+    /** Literal level first, it is the most specific */
+    uint8_t childIdx = _topic_router_find_child(router, node, level, len);
+    if (childIdx != 0)
+    {
+        route = _topic_router_match_child(router, childIdx, end);
+    }
+
+    /** Wildcards don't match the first level of system topics such as $SYS */
+    if (route != TOPIC_ROUTER_NO_ROUTE || (firstLevel && level[0] == '$'))
+    {
+        return route;
+    }
+
+    if (node->plusChild != 0)
+    {
+        route = _topic_router_match_child(router, node->plusChild, end);
+    }
+
+    if (route == TOPIC_ROUTER_NO_ROUTE)
+    {
+        route = node->hashRoute;
+    }
+
+    return route;
+}
+
+/**
+ * @brief Continue matching in a child whose level matched
+ * @param router The router
+ * @param childIdx The child
+ * @param end End of the level the child matched
+ * @return int The route id, TOPIC_ROUTER_NO_ROUTE if nothing matches
+ */
+static int _topic_router_match_child(const TopicRouter_t *router, uint8_t childIdx, const char *end)
+{
+    const TopicRouterNode_t *child = &router->nodes[childIdx];
+
+    if (*end != '\0')
+    {
+        return _topic_router_match(router, childIdx, end + 1, false);
+    }
+
+    /** Last level, "a/#" also matches "a" */
+    return child->route != TOPIC_ROUTER_NO_ROUTE ? child->route : child->hashRoute;
+}
+
+/**
+ * @brief Find where a hash goes among the literal children of a node
+ * @param router The router
+ * @param node The node
+ * @param hash The hash of the level
+ * @return uint8_t Index in router->children of the first child with a hash not below it
+ */
+static uint8_t _topic_router_lower_bound(const TopicRouter_t *router, const TopicRouterNode_t *node, uint16_t hash)
+{
+    uint8_t low = node->childStart;
+    uint8_t high = (uint8_t)(node->childStart + node->childCount);
+    while (low < high)
+    {
+        uint8_t mid = (uint8_t)(low + (high - low) / 2);
+        if (router->nodes[router->children[mid]].hash < hash)
+        {
+            low = (uint8_t)(mid + 1);
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+
+    return low;
+}
+
+/**
+ * @brief Find the literal child of a node for a level
+ * @param router The router
+ * @param node The node
+ * @param level The level text
+ * @param len Length of the level
+ * @return uint8_t The child, 0 if there is none
+ */
+static uint8_t _topic_router_find_child(const TopicRouter_t *router, const TopicRouterNode_t *node, const char *level, size_t len)
+{
+    if (node->childCount == 0)
+    {
+        return 0;
+    }
+
+    uint16_t hash = _topic_router_hash(level, len);
+    uint8_t end = (uint8_t)(node->childStart + node->childCount);
+
+    /** Levels that share a hash sit next to each other */
+    for (uint8_t i = _topic_router_lower_bound(router, node, hash); i < end; i++)
+    {
+        const TopicRouterNode_t *child = &router->nodes[router->children[i]];
+        if (child->hash != hash)
+        {
+            break;
+        }
+        if (_topic_router_level_equal(router, child, level, len, hash))
+        {
+            return router->children[i];
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Add a literal child to a node, keeping its run of children sorted
+ * @param router The router
+ * @param nodeIdx The node
+ * @param childIdx The new child
+ * @note The runs of the other nodes behind the insertion point move up by one. Filters are
+ *       added at start up, the lookups are what has to be fast.
+ */
+static void _topic_router_add_child(TopicRouter_t *router, uint8_t nodeIdx, uint8_t childIdx)
+{
+    TopicRouterNode_t *node = &router->nodes[nodeIdx];
+
+    /** The first child starts a new run at the end */
+    uint8_t pos = router->childTotal;
+    if (node->childCount == 0)
+    {
+        node->childStart = pos;
+    }
+    else
+    {
+        pos = _topic_router_lower_bound(router, node, router->nodes[childIdx].hash);
+    }
+
+    memmove(&router->children[pos + 1], &router->children[pos], (size_t)(router->childTotal - pos));
+    router->children[pos] = childIdx;
+    router->childTotal++;
+
+    for (uint8_t i = 0; i < router->nodeCount; i++)
+    {
+        TopicRouterNode_t *other = &router->nodes[i];
+        if (i != nodeIdx && other->childCount > 0 && other->childStart >= pos)
+        {
+            other->childStart++;
+        }
+    }
+    node->childCount++;
+}
@@ -1,29 +1,83 @@
 /** Includes *************************************************************************************/
 #include "wifi.h"
+#include "backoff.h"
+#include "crc32.h"
+#include "flash_device.h"
+#include "scheduler.h"
+
+#include <stddef.h>
+
+#include "pico/rand.h"
+
+#include "lwip/dhcp.h"
+#include "lwip/netif.h"
 /** Defines **************************************************************************************/
 #define WIFI_CONNECTION_TIMEOUT_MS 5000
-#define WIFI_TASK_INTERVAL_MS 100
+#ifndef WIFI_TASK_CONNECTED_INTERVAL_MS
+#define WIFI_TASK_CONNECTED_INTERVAL_MS 500
+#endif
 #define WIFI_SSID_MAX_LENGTH 32
 #define WIFI_PASSWORD_MAX_LENGTH 64
 
+#define WIFI_CACHE_MAGIC 0x48434657u /** "WFCH" */
+
 /** Typedefs *************************************************************************************/
+
+/** The last good link, enough to rejoin without a scan and to reuse the address */
+typedef struct
+{
+    uint32_t magic;
+    uint32_t ssidCrc; /** The cache only applies to the SSID it was taken on */
+    uint8_t bssid[6];
+    uint8_t reserved[2];
+    uint32_t channel; /** CYW43_CHANNEL_NONE if unknown */
+    uint32_t ip;
+    uint32_t netmask;
+    uint32_t gateway;
+    uint32_t crc; /** Over everything before it */
+} WifiCache_t;
+
 typedef struct
 {
     WifiTaskState_t state;
-    uint32_t last_run_ms;
+    uint32_t connect_deadline_ms;
     char ssid[WIFI_SSID_MAX_LENGTH];
     char pw[WIFI_PASSWORD_MAX_LENGTH];
+
+    WifiCache_t cache;
+    bool cacheValid;
+    bool fastPath;      /** The next or current attempt rejoins the cached access point */
+    bool staticAddress; /** The cached address was taken without DHCP */
+    FlashDevice_t settings;
+    bool settingsReady;
+
+    bool reconnecting;       /** A connect sequence is running, it ends once the address is usable */
+    uint32_t connectStartMs; /** First connect request of the sequence */
+    bool joined;             /** The access point was joined in the current attempt */
+    uint32_t joinedMs;
+    Backoff_t backoff; /** Delay before the next connect */
+    bool powerManagementSet;  /** Otherwise the radio keeps the cyw43 default */
+    uint32_t powerManagement; /** cyw43 power management value, applied on every connect */
+    WifiStats_t stats;
 } WifiTask_t;
 
 /** Variables ************************************************************************************/
 static WifiTask_t WifiTask = {
     .state = WIFI_TASK_DISCONNECTED,
-    .last_run_ms = 0,
+    .connect_deadline_ms = 0,
     .ssid = {0},
     .pw = {0},
 };
 
 /** Prototypes ***********************************************************************************/
+static void _wifi_reset(void);
+static void _wifi_backoff(uint32_t currentTimeMs);
+static uint32_t _wifi_get_channel(void);
+static void _wifi_cache_update(void);
+static void _wifi_cache_load(void);
+static void _wifi_cache_store(void);
+static void _wifi_static_fallback(void);
+
 /** Functions ************************************************************************************/
 
 int wifi_init(const char *ssid, const char *password)
@@ -52,39 +106,36 @@ int wifi_init(const char *ssid, const char *password)
     /** Enable wifi station */
     cyw43_arch_enable_sta_mode();
 
+    const BackoffConfig_t backoffConfig = {
+        .baseMs = WIFI_BACKOFF_BASE_MS,
+        .capMs = WIFI_BACKOFF_CAP_MS,
+        .stableMs = BACKOFF_STABLE_MS,
+    };
+    backoff_init(&WifiTask.backoff, &backoffConfig, get_rand_32());
+
+    /** The cached link lets the first connect skip the scan, it is optional */
+#if WIFI_CACHE_IN_FLASH
+    if (flash_device_pico_settings_init(&WifiTask.settings) == 0)
+    {
+        WifiTask.settingsReady = true;
+        _wifi_cache_load();
+    }
+#endif
+
     return 0;
 }
 
 int wifi_task(void)
 {
-
-    /** Check if the task should run */
-    static uint32_t timeLastRunMs = 0;
+    /**
+     * The task is dispatched by the scheduler every WIFI_TASK_INTERVAL_MS.
+     * cyw43_arch_poll() is run by the main loop before the tasks are dispatched.
+     */
     uint32_t currentTimeMs = to_ms_since_boot(get_absolute_time());
 
-    // clang-format off
-    uint32_t timePassedMs = currentTimeMs < timeLastRunMs
-                            ? UINT32_MAX - timeLastRunMs + currentTimeMs
-                            : currentTimeMs - timeLastRunMs;
-    // clang-format on
-
-    if (timePassedMs < WIFI_TASK_INTERVAL_MS)
-    {
-        return 0;
-    }
-
-    /** Time to run. Update last run */
-    timeLastRunMs = currentTimeMs;
-
-    /** Run poll to check if there is new info on the lower driver */
-    cyw43_arch_poll();
-
     /** Get the current wifi status */
     int currentWifiStatus = cyw43_tcpip_link_status(&cyw43_state, CYW43_ITF_STA);
 
-    /** Keep track of connection timeout */
-    static uint32_t connectionTimeoutMs = 0;
-
     switch (WifiTask.state)
     {
 
@@ -93,58 +144,128 @@ int wifi_task(void)
         char *ssid = WifiTask.ssid;
         char *pw = WifiTask.pw;
 
-        /** Enable station mode again */
+        /** Wait out the delay after a failure or a drop */
+        uint32_t backoffRemainingMs = backoff_remaining(&WifiTask.backoff, currentTimeMs);
+        if (backoffRemainingMs > 0)
+        {
+            scheduler_delay(scheduler_current_task(), backoffRemainingMs);
+            break;
+        }
+
+        /** Enable station mode again, does nothing if it was kept up for the fast path */
         cyw43_arch_enable_sta_mode();
 
         if (currentWifiStatus != CYW43_LINK_UP)
         {
-            /** Try to connect */
-            connectionTimeoutMs = WIFI_CONNECTION_TIMEOUT_MS;
-            cyw43_arch_wifi_connect_bssid_async(ssid, NULL, pw, CYW43_AUTH_WPA2_AES_PSK);
-            printf("Connecting to Wi-Fi\n");
+            /** The timings cover the whole sequence, including a failed fast path */
+            if (!WifiTask.reconnecting)
+            {
+                WifiTask.reconnecting = true;
+                WifiTask.connectStartMs = currentTimeMs;
+            }
+            WifiTask.joined = false;
+
+            if (WifiTask.fastPath)
+            {
+                /** Straight to the cached access point, no scan */
+                WifiTask.connect_deadline_ms = currentTimeMs + WIFI_FAST_CONNECT_TIMEOUT_MS;
+                cyw43_wifi_join(&cyw43_state, strlen(ssid), (const uint8_t *)ssid, strlen(pw), (const uint8_t *)pw, CYW43_AUTH_WPA2_AES_PSK,
+                                WifiTask.cache.bssid, WifiTask.cache.channel);
+                printf("Rejoining %02x:%02x:%02x:%02x:%02x:%02x on channel %lu\n", WifiTask.cache.bssid[0], WifiTask.cache.bssid[1],
+                       WifiTask.cache.bssid[2], WifiTask.cache.bssid[3], WifiTask.cache.bssid[4], WifiTask.cache.bssid[5],
+                       (unsigned long)WifiTask.cache.channel);
+            }
+            else
+            {
+                /** Try to connect */
+                WifiTask.connect_deadline_ms = currentTimeMs + WIFI_CONNECTION_TIMEOUT_MS;
+                cyw43_arch_wifi_connect_bssid_async(ssid, NULL, pw, CYW43_AUTH_WPA2_AES_PSK);
+                printf("Connecting to Wi-Fi\n");
+            }
             WifiTask.state = WIFI_TASK_CONNECTING;
         }
 
         break;
 
     case WIFI_TASK_CONNECTING:
+        /** The join and the address are timed separately */
+        if (!WifiTask.joined && cyw43_wifi_link_status(&cyw43_state, CYW43_ITF_STA) == CYW43_LINK_JOIN)
+        {
+            WifiTask.joined = true;
+            WifiTask.joinedMs = currentTimeMs;
+            WifiTask.stats.linkUpMs = currentTimeMs - WifiTask.connectStartMs;
+
+            /** The deadline covered the join, DHCP gets its own */
+            WifiTask.connect_deadline_ms = currentTimeMs + WIFI_CONNECTION_TIMEOUT_MS;
+        }
+
+#if WIFI_DHCP_FALLBACK_MS > 0
+        if (WifiTask.joined && currentWifiStatus == CYW43_LINK_NOIP && WifiTask.cacheValid &&
+            currentTimeMs - WifiTask.joinedMs >= WIFI_DHCP_FALLBACK_MS)
+        {
+            _wifi_static_fallback();
+            currentWifiStatus = cyw43_tcpip_link_status(&cyw43_state, CYW43_ITF_STA);
+        }
+#endif
+
         /** Check if connected */
         if (currentWifiStatus == CYW43_LINK_UP)
         {
             /** WiFi is connected */
-            uint8_t *ip_address = (uint8_t *)&(cyw43_state.netif[0].ip_addr.addr);
+            uint8_t *ip_address = (uint8_t *)&(cyw43_state.netif[CYW43_ITF_STA].ip_addr.addr);
             printf("Connected to Wi-Fi\n");
             printf("IP address %d.%d.%d.%d\n", ip_address[0], ip_address[1], ip_address[2], ip_address[3]);
             /** Set the state to connected */
             WifiTask.state = WIFI_TASK_CONNECTED;
+            WifiTask.stats.connects++;
+            if (WifiTask.fastPath)
+            {
+                WifiTask.stats.fastConnects++;
+            }
+            backoff_connected(&WifiTask.backoff, currentTimeMs);
+
+            /** The join brings the radio back to the default power management */
+            if (WifiTask.powerManagementSet)
+            {
+                cyw43_wifi_pm(&cyw43_state, WifiTask.powerManagement);
+            }
         }
         else if (currentWifiStatus == CYW43_LINK_FAIL)
         {
             // Failed to connect
             printf("Failed to connect to Wi-Fi\n");
-            cyw43_arch_disable_sta_mode();
-            WifiTask.state = WIFI_TASK_DISCONNECTED;
+            _wifi_reset();
         }
         else if (currentWifiStatus == CYW43_LINK_BADAUTH)
         {
             /** Bad authentication */
             printf("Bad auth\n");
-            cyw43_arch_disable_sta_mode();
-            WifiTask.state = WIFI_TASK_DISCONNECTED;
+            _wifi_reset();
         }
 
-        /** Reduce the timeout */
-        if (connectionTimeoutMs > 0)
-        {
-            connectionTimeoutMs -= WIFI_TASK_INTERVAL_MS;
-        }
-        else
+        /** Check the timeout, the signed difference handles the roll-over */
+        if (WifiTask.state == WIFI_TASK_CONNECTING && (int32_t)(currentTimeMs - WifiTask.connect_deadline_ms) >= 0)
         {
             /** Timeout reached */
             printf("Connection timeout\n");
             /** Reset station mode just incase it gets locked up */
-            cyw43_arch_disable_sta_mode();
-            WifiTask.state = WIFI_TASK_DISCONNECTED;
+            _wifi_reset();
+        }
+
+        if (WifiTask.state == WIFI_TASK_DISCONNECTED)
+        {
+            if (WifiTask.fastPath)
+            {
+                /** The cached access point is gone or moved, scan for it straight away and refresh the cache */
+                printf("Rejoin failed, falling back to a full scan\n");
+                WifiTask.stats.fastFailures++;
+                WifiTask.fastPath = false;
+                WifiTask.cacheValid = false;
+            }
+            else
+            {
+                _wifi_backoff(currentTimeMs);
+            }
         }
         break;
 
@@ -154,8 +275,34 @@ int wifi_task(void)
         {
             /** Disconnected */
             printf("Disconnected from Wi-Fi\n");
-            cyw43_arch_disable_sta_mode();
-            WifiTask.state = WIFI_TASK_DISCONNECTED;
+            _wifi_backoff(currentTimeMs);
+            if (WifiTask.cacheValid)
+            {
+                /** Keep the station and its netif up so the lease survives, the rejoin skips the scan */
+                WifiTask.fastPath = true;
+                WifiTask.state = WIFI_TASK_DISCONNECTED;
+            }
+            else
+            {
+                _wifi_reset();
+            }
+        }
+        else if (WifiTask.reconnecting)
+        {
+            /** The link is up, wait for DHCP to bind or confirm the address */
+            if (dhcp_supplied_address(&cyw43_state.netif[CYW43_ITF_STA]) || WifiTask.staticAddress)
+            {
+                WifiTask.reconnecting = false;
+                WifiTask.stats.ipMs = currentTimeMs - WifiTask.connectStartMs;
+                printf("Wi-Fi %s: link up in %lu ms, IP in %lu ms\n", WifiTask.fastPath ? "rejoined" : "connected",
+                       (unsigned long)WifiTask.stats.linkUpMs, (unsigned long)WifiTask.stats.ipMs);
+                _wifi_cache_update();
+            }
+        }
+        else
+        {
+            /** The link is up, there is no need to check it as often */
+            scheduler_delay(scheduler_current_task(), WIFI_TASK_CONNECTED_INTERVAL_MS);
         }
         break;
 
@@ -167,7 +314,155 @@ int wifi_task(void)
     return 0;
 }
 
+int wifi_set_power_management(uint32_t pm)
+{
+    WifiTask.powerManagement = pm;
+    WifiTask.powerManagementSet = true;
+
+    if (WifiTask.state == WIFI_TASK_CONNECTED)
+    {
+        return cyw43_wifi_pm(&cyw43_state, pm) == 0 ? 0 : -1;
+    }
+
+    return 0;
+}
+
 WifiTaskState_t wifi_get_state(void)
 {
     return WifiTask.state;
 }
+
+void wifi_get_stats(WifiStats_t *stats)
+{
+    if (stats != NULL)
+    {
+        *stats = WifiTask.stats;
+    }
+}
+
+/**
+ * @brief Take the station down, its netif and DHCP lease go with it, and start over
+ */
+static void _wifi_reset(void)
+{
+    cyw43_arch_disable_sta_mode();
+    WifiTask.staticAddress = false;
+    WifiTask.state = WIFI_TASK_DISCONNECTED;
+}
+
+/**
+ * @brief Hold off the next connect by the reconnect delay
+ * @param currentTimeMs The current time in milliseconds
+ */
+static void _wifi_backoff(uint32_t currentTimeMs)
+{
+    WifiTask.stats.backoffMs = backoff_failed(&WifiTask.backoff, currentTimeMs);
+    printf("Reconnecting to Wi-Fi in %lu ms\n", (unsigned long)WifiTask.stats.backoffMs);
+}
+
+/**
+ * @brief Get the channel of the current link
+ * @return uint32_t The channel, CYW43_CHANNEL_NONE if it is unknown
+ */
+static uint32_t _wifi_get_channel(void)
+{
+    /** The ioctl fills in a channel_info_t, its first word is the channel in use */
+    uint32_t info[3] = {0};
+    if (cyw43_ioctl(&cyw43_state, CYW43_IOCTL_GET_CHANNEL, sizeof(info), (uint8_t *)info, CYW43_ITF_STA) != 0 || info[0] == 0)
+    {
+        return CYW43_CHANNEL_NONE;
+    }
+
+    return info[0];
+}
+
+/**
+ * @brief Cache the current link, the flash copy is only rewritten when it changed
+ */
+static void _wifi_cache_update(void)
+{
+    const struct netif *netif = &cyw43_state.netif[CYW43_ITF_STA];
+
+    WifiCache_t cache;
+    memset(&cache, 0, sizeof(cache));
+    if (cyw43_wifi_get_bssid(&cyw43_state, cache.bssid) != 0)
+    {
+        return;
+    }
+    cache.magic = WIFI_CACHE_MAGIC;
+    cache.ssidCrc = crc32_update(0, WifiTask.ssid, strlen(WifiTask.ssid));
+    cache.channel = _wifi_get_channel();
+    cache.ip = ip4_addr_get_u32(netif_ip4_addr(netif));
+    cache.netmask = ip4_addr_get_u32(netif_ip4_netmask(netif));
+    cache.gateway = ip4_addr_get_u32(netif_ip4_gw(netif));
+    cache.crc = crc32_update(0, &cache, offsetof(WifiCache_t, crc));
+
+    bool changed = memcmp(&cache, &WifiTask.cache, sizeof(cache)) != 0;
+    WifiTask.cache = cache;
+    WifiTask.cacheValid = true;
+
+    if (changed && WifiTask.settingsReady)
+    {
+        _wifi_cache_store();
+    }
+}
+
+/**
+ * @brief Load the cached link from the settings flash, it is ignored if it was taken on another SSID
+ */
+static void _wifi_cache_load(void)
+{
+    WifiCache_t cache;
+    if (WifiTask.settings.read(WifiTask.settings.arg, 0, &cache, sizeof(cache)) != 0)
+    {
+        return;
+    }
+
+    if (cache.magic != WIFI_CACHE_MAGIC || cache.crc != crc32_update(0, &cache, offsetof(WifiCache_t, crc)) ||
+        cache.ssidCrc != crc32_update(0, WifiTask.ssid, strlen(WifiTask.ssid)))
+    {
+        return;
+    }
+
+    WifiTask.cache = cache;
+    WifiTask.cacheValid = true;
+    WifiTask.fastPath = true;
+}
+
+/**
+ * @brief Write the cached link to the settings flash
+ */
+static void _wifi_cache_store(void)
+{
+    uint8_t page[FLASH_DEVICE_PAGE_SIZE];
+    memset(page, 0xFF, sizeof(page));
+    memcpy(page, &WifiTask.cache, sizeof(WifiCache_t));
+
+    if (WifiTask.settings.erase(WifiTask.settings.arg, 0) != 0 || WifiTask.settings.program(WifiTask.settings.arg, 0, page, sizeof(page)) != 0)
+    {
+        printf("Failed to store the Wi-Fi cache\n");
+    }
+}
+
+/**
+ * @brief Stop DHCP and take the cached address
+ */
+static __unused void _wifi_static_fallback(void)
+{
+    struct netif *netif = &cyw43_state.netif[CYW43_ITF_STA];
+    ip4_addr_t ip;
+    ip4_addr_t netmask;
+    ip4_addr_t gateway;
+    ip4_addr_set_u32(&ip, WifiTask.cache.ip);
+    ip4_addr_set_u32(&netmask, WifiTask.cache.netmask);
+    ip4_addr_set_u32(&gateway, WifiTask.cache.gateway);
+
+    cyw43_arch_lwip_begin();
+    dhcp_stop(netif);
+    netif_set_addr(netif, &ip, &netmask, &gateway);
+    cyw43_arch_lwip_end();
+
+    WifiTask.staticAddress = true;
+    WifiTask.stats.staticFallbacks++;
+    printf("No DHCP answer, using the cached address %s\n", ip4addr_ntoa(&ip));
+}